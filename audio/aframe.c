@@ -438,11 +438,6 @@ void mp_aframe_skip_samples(struct mp_aframe *f, int samples)
 }
 
 // sanitize a floating point sample value
-#define sanitizef(f) do {       \
-    if (!isnormal(f))           \
-        (f) = 0;                \
-} while (0)
-
 void mp_aframe_sanitize_float(struct mp_aframe *mpa)
 {
     int format = af_fmt_from_planar(mp_aframe_get_format(mpa));
@@ -452,18 +447,12 @@ void mp_aframe_sanitize_float(struct mp_aframe *mpa)
     uint8_t **planes = mp_aframe_get_data_rw(mpa);
     if (!planes)
         return;
+    int total = mp_aframe_get_total_plane_samples(mpa);
     for (int p = 0; p < num_planes; p++) {
-        void *ptr = planes[p];
-        int total = mp_aframe_get_total_plane_samples(mpa);
-        switch (format) {
-        case AF_FORMAT_FLOAT:
-            for (int s = 0; s < total; s++)
-                sanitizef(((float *)ptr)[s]);
-            break;
-        case AF_FORMAT_DOUBLE:
-            for (int s = 0; s < total; s++)
-                sanitizef(((double *)ptr)[s]);
-            break;
+        if (format == AF_FORMAT_FLOAT) {
+            af_sanitize_float((float *)planes[p], total);
+        } else {
+            af_sanitize_double((double *)planes[p], total);
         }
     }
 }
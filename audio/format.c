@@ -17,9 +17,13 @@
  * License along with mpv.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <float.h>
 #include <limits.h>
+#include <math.h>
+#include <string.h>
 
 #include "common/common.h"
+#include "osdep/endian.h"
 #include "format.h"
 
 // number of bytes per sample, 0 if invalid/unknown
@@ -144,6 +148,93 @@ void af_fill_silence(void *dst, size_t bytes, int format)
     memset(dst, af_fmt_is_unsigned(format) ? 0x80 : 0, bytes);
 }
 
+// The loops below process fixed-size blocks, which compilers vectorize even
+// with their cheapest cost model (as used with -O2). The rest is done by
+// scalar code.
+#define BLOCK 16
+
+// Convert S32 samples to 24 bit samples (dropping the LSB), stored in 3 bytes
+// each if pad_msb is false, or in the lower 3 bytes of 4 bytes each (the MSB
+// set to 0). dst can be the same as src.
+void af_s32_to_s24(void *dst, const void *src, size_t samples, bool pad_msb)
+{
+    uint8_t *d = dst;
+    const uint8_t *sp = src;
+    size_t n = 0;
+
+    if (pad_msb) {
+        for (; n + BLOCK <= samples; n += BLOCK) {
+            uint32_t v[BLOCK];
+            memcpy(v, sp + n * 4, sizeof(v));
+            for (int i = 0; i < BLOCK; i++)
+                v[i] = MP_SELECT_LE_BE(v[i] >> 8, v[i] & ~(uint32_t)0xFF);
+            memcpy(d + n * 4, v, sizeof(v));
+        }
+        for (; n < samples; n++) {
+            uint32_t v;
+            memcpy(&v, sp + n * 4, 4);
+            v = MP_SELECT_LE_BE(v >> 8, v & ~(uint32_t)0xFF);
+            memcpy(d + n * 4, &v, 4);
+        }
+        return;
+    }
+
+#if BYTE_ORDER == LITTLE_ENDIAN
+    // 4 samples at a time, packed into 3 words. Each group is read completely
+    // before it's written, and the output is behind the input, so this works
+    // in-place.
+    for (; n + 4 <= samples; n += 4) {
+        uint32_t a, b, c, e;
+        memcpy(&a, sp + n * 4 + 0, 4);
+        memcpy(&b, sp + n * 4 + 4, 4);
+        memcpy(&c, sp + n * 4 + 8, 4);
+        memcpy(&e, sp + n * 4 + 12, 4);
+        uint32_t w0 = (a >> 8) | ((b & 0xFF00) << 16);
+        uint32_t w1 = (b >> 16) | ((c & 0xFFFF00) << 8);
+        uint32_t w2 = (c >> 24) | (e & 0xFFFFFF00);
+        memcpy(d + n * 3 + 0, &w0, 4);
+        memcpy(d + n * 3 + 4, &w1, 4);
+        memcpy(d + n * 3 + 8, &w2, 4);
+    }
+#endif
+    for (; n < samples; n++) {
+        uint32_t v;
+        memcpy(&v, sp + n * 4, 4);
+        uint8_t *p = d + n * 3;
+        p[0] = v >> MP_SELECT_LE_BE(8, 24);
+        p[1] = v >> 16;
+        p[2] = v >> MP_SELECT_LE_BE(24, 8);
+    }
+}
+
+// (Comparisons with NaN are false.)
+#define SANITIZE(x, fabs, min, max) ((x) = fabs(x) >= (min) && fabs(x) <= (max) ? (x) : 0)
+
+// Replace NaN, infinity and denormals with 0.
+void af_sanitize_float(float *data, size_t samples)
+{
+    size_t n = 0;
+    for (; n + BLOCK <= samples; n += BLOCK) {
+        float *b = data + n;
+        for (int i = 0; i < BLOCK; i++)
+            SANITIZE(b[i], fabsf, FLT_MIN, FLT_MAX);
+    }
+    for (; n < samples; n++)
+        SANITIZE(data[n], fabsf, FLT_MIN, FLT_MAX);
+}
+
+void af_sanitize_double(double *data, size_t samples)
+{
+    size_t n = 0;
+    for (; n + BLOCK <= samples; n += BLOCK) {
+        double *b = data + n;
+        for (int i = 0; i < BLOCK; i++)
+            SANITIZE(b[i], fabs, DBL_MIN, DBL_MAX);
+    }
+    for (; n < samples; n++)
+        SANITIZE(data[n], fabs, DBL_MIN, DBL_MAX);
+}
+
 // Returns a "score" that serves as heuristic how lossy or hard a conversion is.
 // If the formats are equal, 1024 is returned. If they are gravely incompatible
 // (like s16<->ac3), INT_MIN is returned. If there is implied loss of precision
@@ -68,6 +68,10 @@ int af_fmt_from_planar(int format);
 
 void af_fill_silence(void *dst, size_t bytes, int format);
 
+void af_s32_to_s24(void *dst, const void *src, size_t samples, bool pad_msb);
+void af_sanitize_float(float *data, size_t samples);
+void af_sanitize_double(double *data, size_t samples);
+
 void af_get_best_sample_formats(int src_format, int *out_formats);
 int af_format_conversion_score(int dst_format, int src_format);
 int af_select_best_samplerate(int src_sampelrate, const int *available);
@@ -614,6 +614,14 @@ void ao_set_gain(struct ao *ao, float gain)
             ((((int64_t)((d)[n]) - (center)) * (gain) + 128) >> 8) + (center),  \
             (low), (high))
 
+// Same as MUL_GAIN_i, but with 32 bit intermediates (much faster if it gets
+// vectorized). Valid only if the product can't overflow.
+#define MUL_GAIN_i32(d, num_samples, gain, low, center, high)                   \
+    for (int n = 0; n < (num_samples); n++)                                     \
+        (d)[n] = MPCLAMP(                                                       \
+            ((((int32_t)((d)[n]) - (center)) * (gain) + 128) >> 8) + (center),  \
+            (low), (high))
+
 #define MUL_GAIN_f(d, num_samples, gain)                                        \
     for (int n = 0; n < (num_samples); n++)                                     \
         (d)[n] = (d)[n] * (gain)
@@ -624,12 +632,22 @@ static void process_plane(struct ao *ao, void *data, int num_samples)
     int gi = lrint(256.0 * gain);
     if (gi == 256)
         return;
+    // |sample| <= 2^15 for U8 and S16, so the product fits into int32_t.
+    bool small_gain = gi < (1 << 16);
     switch (af_fmt_from_planar(ao->format)) {
     case AF_FORMAT_U8:
-        MUL_GAIN_i((uint8_t *)data, num_samples, gi, 0, 128, 255);
+        if (small_gain) {
+            MUL_GAIN_i32((uint8_t *)data, num_samples, gi, 0, 128, 255);
+        } else {
+            MUL_GAIN_i((uint8_t *)data, num_samples, gi, 0, 128, 255);
+        }
         break;
     case AF_FORMAT_S16:
-        MUL_GAIN_i((int16_t *)data, num_samples, gi, INT16_MIN, 0, INT16_MAX);
+        if (small_gain) {
+            MUL_GAIN_i32((int16_t *)data, num_samples, gi, INT16_MIN, 0, INT16_MAX);
+        } else {
+            MUL_GAIN_i((int16_t *)data, num_samples, gi, INT16_MIN, 0, INT16_MAX);
+        }
         break;
     case AF_FORMAT_S32:
         MUL_GAIN_i((int32_t *)data, num_samples, gi, INT32_MIN, 0, INT32_MAX);
@@ -678,32 +696,20 @@ bool ao_need_conversion(struct ao_convert_fmt *fmt)
     return get_conv_type(fmt) != 0;
 }
 
-// The LSB is always ignored.
-#if BYTE_ORDER == BIG_ENDIAN
-#define SHIFT24(x) ((3-(x))*8)
-#else
-#define SHIFT24(x) (((x)+1)*8)
-#endif
-
-static void convert_plane(int type, void *data, int num_samples)
+static void convert_plane(int type, int bytes, void *dst, void *src,
+                          int num_samples)
 {
     switch (type) {
     case 0:
+        if (dst != src)
+            memcpy(dst, src, num_samples * bytes);
         break;
-    case 1: /* fall through */
-    case 2: {
-        int bytes = type == 1 ? 3 : 4;
-        for (int s = 0; s < num_samples; s++) {
-            uint32_t val = *((uint32_t *)data + s);
-            uint8_t *ptr = (uint8_t *)data + s * bytes;
-            ptr[0] = val >> SHIFT24(0);
-            ptr[1] = val >> SHIFT24(1);
-            ptr[2] = val >> SHIFT24(2);
-            if (type == 2)
-                ptr[3] = 0;
-        }
+    case 1:
+        af_s32_to_s24(dst, src, num_samples, false);
+        break;
+    case 2:
+        af_s32_to_s24(dst, src, num_samples, true);
         break;
-    }
     default:
         MP_ASSERT_UNREACHABLE();
     }
@@ -713,11 +719,20 @@ static void convert_plane(int type, void *data, int num_samples)
 // format implied by fmt->src_fmt. src_fmt also controls whether the data is
 // all in one plane, or if there is a plane per channel.
 void ao_convert_inplace(struct ao_convert_fmt *fmt, void **data, int num_samples)
+{
+    ao_convert(fmt, data, data, num_samples);
+}
+
+// Same as ao_convert_inplace(), but write the result to dst. The dst planes
+// must not overlap with the src planes, unless they are the same.
+void ao_convert(struct ao_convert_fmt *fmt, void **dst, void **src,
+                int num_samples)
 {
     int type = get_conv_type(fmt);
+    int bytes = af_fmt_to_bytes(fmt->src_fmt);
     bool planar = af_fmt_is_planar(fmt->src_fmt);
     int planes = planar ? fmt->channels : 1;
     int plane_samples = num_samples * (planar ? 1: fmt->channels);
     for (int n = 0; n < planes; n++)
-        convert_plane(type, data[n], plane_samples);
+        convert_plane(type, bytes, dst[n], src[n], plane_samples);
 }
@@ -248,7 +248,6 @@ int ao_read_data_converted(struct ao *ao, struct ao_convert_fmt *fmt,
     int planes = planar ? fmt->channels : 1;
     int plane_samples = samples * (planar ? 1: fmt->channels);
     int src_plane_size = plane_samples * af_fmt_to_bytes(fmt->src_fmt);
-    int dst_plane_size = plane_samples * fmt->dst_bits / 8;
 
     int needed = src_plane_size * planes;
     if (needed > talloc_get_size(p->convert_buffer) || !p->convert_buffer) {
@@ -261,9 +260,7 @@ int ao_read_data_converted(struct ao *ao, struct ao_convert_fmt *fmt,
 
     int res = ao_read_data(ao, ndata, samples, out_time_ns, NULL, true, true);
 
-    ao_convert_inplace(fmt, ndata, samples);
-    for (int n = 0; n < planes; n++)
-        memcpy(data[n], ndata[n], dst_plane_size);
+    ao_convert(fmt, data, ndata, samples);
 
     return res;
 }
@@ -228,6 +228,8 @@ struct ao_convert_fmt {
 bool ao_can_convert_inplace(struct ao_convert_fmt *fmt);
 bool ao_need_conversion(struct ao_convert_fmt *fmt);
 void ao_convert_inplace(struct ao_convert_fmt *fmt, void **data, int num_samples);
+void ao_convert(struct ao_convert_fmt *fmt, void **dst, void **src,
+                int num_samples);
 
 void ao_wakeup(struct ao *ao);
 
@@ -10,6 +10,7 @@ struct mpv_global {
     struct mp_client_api *client_api;
     char *configdir;
     struct stats_base *stats;
+    struct lavf_probe_cache *lavf_probe_cache; // created by demux_lavf.c
 };
 
 #endif
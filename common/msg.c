@@ -40,12 +40,14 @@
 #include "msg.h"
 #include "msg_control.h"
 
-// log buffer size (lines) logfile level
-#define FILE_BUF 100
-
 // lines to accumulate before any client requests the terminal loglevel
 #define EARLY_TERM_BUF 100
 
+// log file messages that can be queued before the log file thread processes
+// them; further messages are dropped (and the number of dropped messages is
+// logged). Must be a power of 2.
+#define LOG_RING_SIZE 8192
+
 // logfile lines to accumulate during init before we know the log file name.
 // thousands of logfile lines during init can happen (especially with many
 // scripts, big config, etc), so we set 5000. If it cycles and messages are
@@ -91,21 +93,53 @@ struct mp_log_root {
     mp_thread log_file_thread;
     // --- owner thread only, but frozen while log_file_thread is running
     FILE *log_file;
-    struct mp_log_buffer *log_file_buffer;
+    // --- created on first use by the owner thread, then immutable
+    struct log_ring *log_ring;
+    // --- must be accessed atomically
+    atomic_bool log_ring_active;    // log_file_thread is reading log_ring
+    atomic_bool log_file_sleeping;  // log_file_thread waits for a wakeup
     // --- protected by log_file_lock
     bool log_file_thread_active; // also termination signal for the thread
     int module_indent;
 };
 
+// A message queued for the log file. Allocated as a single block; prefix and
+// text point into it.
+struct log_ring_entry {
+    int64_t time;
+    int level;
+    char *prefix;
+    char *text;         // one or more lines, each terminated with \n
+};
+
+// Bounded multi-producer, single-consumer queue (the consumer is the log file
+// thread). Producers never block or take locks; if the queue is full, the
+// message is dropped and counted instead.
+struct log_ring {
+    struct log_ring_slot {
+        atomic_size_t seq;
+        struct log_ring_entry *entry;
+    } slots[LOG_RING_SIZE];
+    atomic_size_t head;         // next write position
+    size_t tail;                // next read position (consumer only)
+    atomic_uint_least64_t dropped;
+};
+
 struct mp_log {
     struct mp_log_root *root;
     const char *prefix;
     const char *verbose_prefix;
     int max_level;              // minimum log level for this instance
     int level;                  // minimum log level for any outputs
-    int terminal_level;         // minimum log level for terminal output
+    // Minimum log level for terminal output. Written under root->lock, but
+    // read without it by msg_va_log_file_only().
+    atomic_int terminal_level;
+    // Maximum level requested by log buffers, other than terminal level ones.
+    // Written under root->lock, but read without it by msg_va_log_file_only().
+    atomic_int buffer_level;
     atomic_ulong reload_counter;
-    bstr partial[MSGL_MAX + 1];
+    bstr partial[MSGL_MAX + 1];     // protected by root->lock
+    atomic_uint partial_levels;     // bit n set if partial[n] is not empty
 };
 
 struct mp_log_buffer {
@@ -147,14 +181,17 @@ static void update_loglevel(struct mp_log *log)
         if (match_mod(log->verbose_prefix, root->msg_levels[n * 2 + 0]))
             log->level = mp_msg_find_level(root->msg_levels[n * 2 + 1]);
     }
-    log->terminal_level = log->level;
+    atomic_store(&log->terminal_level, log->level);
+    int max_buffer_level = -1;
     for (int n = 0; n < log->root->num_buffers; n++) {
         int buffer_level = log->root->buffers[n]->level;
         if (buffer_level == MP_LOG_BUFFER_MSGL_LOGFILE)
             buffer_level = MSGL_DEBUG;
         if (buffer_level != MP_LOG_BUFFER_MSGL_TERM)
-            log->level = MPMAX(log->level, buffer_level);
+            max_buffer_level = MPMAX(max_buffer_level, buffer_level);
     }
+    atomic_store(&log->buffer_level, max_buffer_level);
+    log->level = MPMAX(log->level, max_buffer_level);
     if (log->root->log_file)
         log->level = MPMAX(log->level, MSGL_DEBUG);
     if (log->root->stats_file)
@@ -369,7 +406,7 @@ static void pretty_print_module(struct mp_log_root *root, bstr *text,
 
 static bool test_terminal_level(struct mp_log *log, int lev)
 {
-    return lev <= log->terminal_level && log->root->use_terminal &&
+    return lev <= atomic_load(&log->terminal_level) && log->root->use_terminal &&
            !(lev == MSGL_STATUS && terminal_in_background());
 }
 
@@ -430,6 +467,85 @@ static void append_terminal_line(struct mp_log *log, int lev,
     *line_w = root->isatty[term_msg_fileno(root, lev)] ? width : 0;
 }
 
+static struct log_ring *log_ring_create(void *talloc_ctx)
+{
+    struct log_ring *ring = talloc_zero(talloc_ctx, struct log_ring);
+    for (size_t n = 0; n < LOG_RING_SIZE; n++)
+        atomic_init(&ring->slots[n].seq, n);
+    return ring;
+}
+
+static bool log_ring_push(struct log_ring *ring, struct log_ring_entry *entry)
+{
+    size_t pos = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    struct log_ring_slot *slot;
+    while (1) {
+        slot = &ring->slots[pos & (LOG_RING_SIZE - 1)];
+        size_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&ring->head, &pos, pos + 1,
+                                                      memory_order_relaxed,
+                                                      memory_order_relaxed))
+                break;
+        } else if (diff < 0) {
+            atomic_fetch_add(&ring->dropped, 1);
+            return false;
+        } else {
+            pos = atomic_load_explicit(&ring->head, memory_order_relaxed);
+        }
+    }
+    slot->entry = entry;
+    // (seq_cst, pairs with log_file_sleeping in log_file_thread())
+    atomic_store(&slot->seq, pos + 1);
+    return true;
+}
+
+static struct log_ring_entry *log_ring_pop(struct log_ring *ring)
+{
+    struct log_ring_slot *slot = &ring->slots[ring->tail & (LOG_RING_SIZE - 1)];
+    if (atomic_load(&slot->seq) != ring->tail + 1)
+        return NULL;
+    struct log_ring_entry *entry = slot->entry;
+    atomic_store_explicit(&slot->seq, ring->tail + LOG_RING_SIZE,
+                          memory_order_release);
+    ring->tail += 1;
+    return entry;
+}
+
+static struct log_ring_entry *log_ring_entry_new(int64_t time, int lev,
+                                                 const char *prefix, bstr text)
+{
+    size_t prefix_len = strlen(prefix);
+    struct log_ring_entry *entry =
+        talloc_size(NULL, sizeof(*entry) + prefix_len + 1 + text.len + 1);
+    *entry = (struct log_ring_entry){
+        .time = time,
+        .level = lev,
+        .prefix = (char *)(entry + 1),
+    };
+    entry->text = entry->prefix + prefix_len + 1;
+    memcpy(entry->prefix, prefix, prefix_len + 1);
+    if (text.len)
+        memcpy(entry->text, text.start, text.len);
+    entry->text[text.len] = '\0';
+    return entry;
+}
+
+// Queue a message for the log file thread. Does not need any locks.
+static void log_file_queue(struct mp_log_root *root, struct log_ring_entry *entry)
+{
+    if (!log_ring_push(root->log_ring, entry)) {
+        talloc_free(entry);
+        return;
+    }
+    if (atomic_load(&root->log_file_sleeping)) {
+        mp_mutex_lock(&root->log_file_lock);
+        mp_cond_broadcast(&root->log_file_wakeup);
+        mp_mutex_unlock(&root->log_file_lock);
+    }
+}
+
 static struct mp_log_buffer_entry *log_buffer_read(struct mp_log_buffer *buffer)
 {
     assert(buffer->num_entries);
@@ -442,35 +558,17 @@ static struct mp_log_buffer_entry *log_buffer_read(struct mp_log_buffer *buffer)
 static void write_msg_to_buffers(struct mp_log *log, int lev, bstr text)
 {
     struct mp_log_root *root = log->root;
+    int terminal_level = atomic_load(&log->terminal_level);
     for (int n = 0; n < root->num_buffers; n++) {
         struct mp_log_buffer *buffer = root->buffers[n];
         bool wakeup = false;
         mp_mutex_lock(&buffer->lock);
         int buffer_level = buffer->level;
         if (buffer_level == MP_LOG_BUFFER_MSGL_TERM)
-            buffer_level = log->terminal_level;
+            buffer_level = terminal_level;
         if (buffer_level == MP_LOG_BUFFER_MSGL_LOGFILE)
-            buffer_level = MPMAX(log->terminal_level, MSGL_DEBUG);
+            buffer_level = MPMAX(terminal_level, MSGL_DEBUG);
         if (lev <= buffer_level && lev != MSGL_STATUS) {
-            if (buffer->level == MP_LOG_BUFFER_MSGL_LOGFILE) {
-                // If the buffer is full, block until we can write again,
-                // unless there's no write thread (died, or early filebuffer)
-                bool dead = false;
-                while (buffer->num_entries == buffer->capacity && !dead) {
-                    // Temporary unlock is OK; buffer->level is immutable, and
-                    // buffer can't go away because the global log lock is held.
-                    mp_mutex_unlock(&buffer->lock);
-                    mp_mutex_lock(&root->log_file_lock);
-                    if (root->log_file_thread_active) {
-                        mp_cond_wait(&root->log_file_wakeup,
-                                          &root->log_file_lock);
-                    } else {
-                        dead = true;
-                    }
-                    mp_mutex_unlock(&root->log_file_lock);
-                    mp_mutex_lock(&buffer->lock);
-                }
-            }
             if (buffer->num_entries == buffer->capacity) {
                 struct mp_log_buffer_entry *skip = log_buffer_read(buffer);
                 talloc_free(skip);
@@ -492,6 +590,57 @@ static void write_msg_to_buffers(struct mp_log *log, int lev, bstr text)
         if (wakeup)
             buffer->wakeup_cb(buffer->wakeup_cb_ctx);
     }
+
+    if (atomic_load(&root->log_ring_active) && lev != MSGL_STATUS &&
+        lev <= MPMAX(terminal_level, MSGL_DEBUG))
+    {
+        log_file_queue(root, log_ring_entry_new(mp_time_ns(), lev,
+                                                log->verbose_prefix, text));
+    }
+}
+
+// Messages which go to the log file only are formatted on the calling thread
+// and handed to the log file thread without taking the global lock. Messages
+// for log buffers always take the normal path, so that they are delivered in
+// the order they were logged.
+// Returns false if the message has to go through the normal path.
+static bool msg_va_log_file_only(struct mp_log *log, int lev,
+                                 const char *format, va_list va)
+{
+    struct mp_log_root *root = log->root;
+    int terminal_level = atomic_load(&log->terminal_level);
+    if (!atomic_load(&root->log_ring_active) || lev == MSGL_STATUS ||
+        lev > MSGL_DEBUG || lev <= terminal_level ||
+        lev <= atomic_load(&log->buffer_level))
+        return false;
+    // Partial lines need to be merged under the lock.
+    size_t format_len = strlen(format);
+    if (!format_len || format[format_len - 1] != '\n' ||
+        (atomic_load(&log->partial_levels) & (1u << lev)))
+        return false;
+
+    char buf[512];
+    va_list copy;
+    va_copy(copy, va);
+    int len = vsnprintf(buf, sizeof(buf), format, copy);
+    va_end(copy);
+    if (len < 0)
+        return false;
+
+    struct log_ring_entry *entry;
+    if (len < sizeof(buf)) {
+        entry = log_ring_entry_new(mp_time_ns(), lev, log->verbose_prefix,
+                                   (bstr){(unsigned char *)buf, len});
+    } else {
+        entry = log_ring_entry_new(mp_time_ns(), lev, log->verbose_prefix,
+                                   (bstr){NULL, 0});
+        entry = talloc_realloc_size(NULL, entry, talloc_get_size(entry) + len);
+        entry->prefix = (char *)(entry + 1);
+        entry->text = entry->prefix + strlen(entry->prefix) + 1;
+        vsnprintf(entry->text, len + 1, format, va);
+    }
+    log_file_queue(root, entry);
+    return true;
 }
 
 static void dump_stats(struct mp_log *log, int lev, bstr text)
@@ -547,6 +696,7 @@ static void write_term_msg(struct mp_log *log, int lev, bstr text, bstr *out)
                                   : (line_w + term_w - 1) / term_w;
     } else if (str.len) {
         bstr_xappend(NULL, &log->partial[lev], str);
+        atomic_fetch_or(&log->partial_levels, 1u << lev);
     }
 
     if (print_term && (root->term_msg_tmp.len || lev == MSGL_STATUS)) {
@@ -564,6 +714,9 @@ void mp_msg_va(struct mp_log *log, int lev, const char *format, va_list va)
     if (!mp_msg_test(log, lev))
         return; // do not display
 
+    if (msg_va_log_file_only(log, lev, format, va))
+        return;
+
     struct mp_log_root *root = log->root;
 
     mp_mutex_lock(&root->lock);
@@ -573,6 +726,7 @@ void mp_msg_va(struct mp_log *log, int lev, const char *format, va_list va)
     if (log->partial[lev].len)
         bstr_xappend(root, &root->buffer, log->partial[lev]);
     log->partial[lev].len = 0;
+    atomic_fetch_and(&log->partial_levels, ~(1u << lev));
 
     if (bstr_xappend_vasprintf(root, &root->buffer, format, va) < 0) {
         bstr_xappend(root, &root->buffer, bstr0("format error: "));
@@ -688,44 +842,70 @@ void mp_msg_init(struct mpv_global *global)
     global->log = log;
 }
 
+static void write_log_file_lines(struct mp_log_root *root,
+                                 struct log_ring_entry *e)
+{
+    bstr text = bstr0(e->text);
+    while (text.len) {
+        bstr line = bstr_getline(text, &text);
+        bstr_eatstart0(&line, TERM_MSG_0);
+        fprintf(root->log_file, "[%8.3f][%c][%s] %.*s",
+                e->time / 1e9, mp_log_levels[e->level][0], e->prefix,
+                BSTR_P(line));
+    }
+}
+
+// Maximum number of messages taken from the queue at once.
+#define LOG_FILE_BATCH 64
+
 static MP_THREAD_VOID log_file_thread(void *p)
 {
     struct mp_log_root *root = p;
+    struct log_ring *ring = root->log_ring;
 
     mp_thread_set_name("log");
 
-    mp_mutex_lock(&root->log_file_lock);
+    uint64_t reported_dropped = atomic_load(&ring->dropped);
 
-    while (root->log_file_thread_active) {
-        struct mp_log_buffer_entry *e =
-            mp_msg_log_buffer_read(root->log_file_buffer);
-        if (e) {
-            mp_mutex_unlock(&root->log_file_lock);
-            fprintf(root->log_file, "[%8.3f][%c][%s] %s",
-                    mp_time_sec(),
-                    mp_log_levels[e->level][0], e->prefix, e->text);
+    while (1) {
+        struct log_ring_entry *batch[LOG_FILE_BATCH];
+        int num = 0;
+        while (num < LOG_FILE_BATCH && (batch[num] = log_ring_pop(ring)))
+            num++;
+
+        if (!num) {
             fflush(root->log_file);
             mp_mutex_lock(&root->log_file_lock);
-            talloc_free(e);
-            // Multiple threads might be blocked if the log buffer was full.
-            mp_cond_broadcast(&root->log_file_wakeup);
-        } else {
-            mp_cond_wait(&root->log_file_wakeup, &root->log_file_lock);
+            bool active = root->log_file_thread_active;
+            atomic_store(&root->log_file_sleeping, true);
+            // Recheck after announcing the sleep (see log_file_queue()).
+            struct log_ring_slot *slot =
+                &ring->slots[ring->tail & (LOG_RING_SIZE - 1)];
+            if (active && atomic_load(&slot->seq) != ring->tail + 1)
+                mp_cond_wait(&root->log_file_wakeup, &root->log_file_lock);
+            atomic_store(&root->log_file_sleeping, false);
+            mp_mutex_unlock(&root->log_file_lock);
+            if (!active)
+                break;
+            continue;
         }
-    }
 
-    mp_mutex_unlock(&root->log_file_lock);
+        uint64_t dropped = atomic_load(&ring->dropped);
+        if (dropped != reported_dropped) {
+            fprintf(root->log_file, "[%8.3f][f][overflow] log message buffer "
+                    "overflow: %"PRIu64" messages skipped\n",
+                    batch[0]->time / 1e9, dropped - reported_dropped);
+            reported_dropped = dropped;
+        }
 
-    MP_THREAD_RETURN();
-}
+        for (int n = 0; n < num; n++)
+            write_log_file_lines(root, batch[n]);
 
-static void wakeup_log_file(void *p)
-{
-    struct mp_log_root *root = p;
+        for (int n = 0; n < num; n++)
+            talloc_free(batch[n]);
+    }
 
-    mp_mutex_lock(&root->log_file_lock);
-    mp_cond_broadcast(&root->log_file_wakeup);
-    mp_mutex_unlock(&root->log_file_lock);
+    MP_THREAD_RETURN();
 }
 
 // Only to be called from the main thread.
@@ -744,11 +924,22 @@ static void terminate_log_file_thread(struct mp_log_root *root)
     if (wait_terminate)
         mp_thread_join(root->log_file_thread);
 
-    mp_msg_log_buffer_destroy(root->log_file_buffer);
-    root->log_file_buffer = NULL;
+    atomic_store(&root->log_ring_active, false);
 
-    if (root->log_file)
+    // Messages queued after the thread exited (or with no thread at all).
+    if (root->log_ring) {
+        struct log_ring_entry *e;
+        while ((e = log_ring_pop(root->log_ring))) {
+            if (root->log_file)
+                write_log_file_lines(root, e);
+            talloc_free(e);
+        }
+    }
+
+    if (root->log_file) {
         fclose(root->log_file);
+        atomic_fetch_add(&root->reload_counter, 1);
+    }
     root->log_file = NULL;
 }
 
@@ -834,10 +1025,12 @@ void mp_msg_update_msglevels(struct mpv_global *global, struct MPOpts *opts)
                     mp_msg_log_buffer_destroy(earlybuf);  // + remove from root
                 }
 
-                root->log_file_buffer =
-                    mp_msg_log_buffer_new(global, FILE_BUF, MP_LOG_BUFFER_MSGL_LOGFILE,
-                                          wakeup_log_file, root);
+                if (!root->log_ring)
+                    root->log_ring = log_ring_create(root);
                 root->log_file_thread_active = true;
+                atomic_store(&root->log_ring_active, true);
+                // Make mp_log instances pick up the new log level.
+                atomic_fetch_add(&root->reload_counter, 1);
                 if (mp_thread_create(&root->log_file_thread, log_file_thread,
                                    root))
                 {
@@ -924,9 +1117,8 @@ void mp_msg_uninit(struct mpv_global *global)
 //   main cases where meaningful messages are accumulated before the filename
 //   is known are when log-file is set at mpv.conf, or from script/client init.
 //   once a file name is known, the early buffer is flushed and destroyed.
-//   unlike the "proper" log-file buffer, the early filebuffer is not backed by
-//   a write thread, and hence non-blocking (can overwrite old messages).
-//   it's also bigger than the actual file buffer (early: 5000, actual: 100).
+//   unlike the "proper" log-file queue, the early filebuffer is not backed by
+//   a write thread (can overwrite old messages).
 
 static void mp_msg_set_early_logging_raw(struct mpv_global *global, bool enable,
                                          struct mp_log_buffer **root_logbuf,
@@ -26,6 +26,8 @@
 #include "demux/demux.h"
 #include "demux/packet.h"
 #include "demux/stheader.h"
+#include "misc/path_utils.h"
+#include "osdep/threads.h"
 
 #include "recorder.h"
 
@@ -42,6 +44,12 @@ struct mp_recorder {
     struct mpv_global *global;
     struct mp_log *log;
 
+    struct mp_recorder_params params;
+    const AVOutputFormat *oformat;
+    char *target_file;
+    struct demux_attachment *attachments;
+    int num_attachments;
+
     struct mp_recorder_sink **streams;
     int num_streams;
 
@@ -57,17 +65,40 @@ struct mp_recorder {
     // of the first packet of the current segment written to the output.
     double rebase_ts;
 
+    // Packets are written to the file on a separate thread.
+    mp_thread writer;
+    bool writer_valid;
+    mp_mutex lock;
+    mp_cond wakeup;
+
+    // --- Protected by lock.
+    AVPacket **queue;
+    int num_queue;
+    int queue_head;         // index of the next packet to write
+    int64_t queue_bytes;
+    int64_t dropped_packets;
+    bool terminate;
+
+    // --- Owned by the writer thread (while it runs).
     AVFormatContext *mux;
+    bool header_written;
+    char *cur_file;
+    int file_index;
+    struct mp_recorder_sink *split_stream; // keyframes of it start new files
+    int64_t file_start;     // AV_TIME_BASE_Q timestamp where cur_file starts
 };
 
 struct mp_recorder_sink {
     struct mp_recorder *owner;
     struct sh_stream *sh;
-    AVStream *av_stream;
+    int index;              // AVStream.index in the output
+    AVCodecParameters *par;
+    AVRational time_base;   // of the packets passed to the writer thread
     AVPacket *avpkt;
     double max_out_pts;
     bool discont;
     bool proper_eof;
+    bool dropping;          // protected by mp_recorder.lock
     struct demux_packet **packets;
     int num_packets;
 };
@@ -75,30 +106,30 @@ struct mp_recorder_sink {
 static int add_stream(struct mp_recorder *priv, struct sh_stream *sh)
 {
     enum AVMediaType av_type = mp_to_av_stream_type(sh->type);
-    int ret = -1;
-    AVCodecParameters *avp = NULL;
     if (av_type == AVMEDIA_TYPE_UNKNOWN)
-        goto done;
+        return -1;
 
     struct mp_recorder_sink *rst = talloc(priv, struct mp_recorder_sink);
     *rst = (struct mp_recorder_sink) {
         .owner = priv,
         .sh = sh,
-        .av_stream = avformat_new_stream(priv->mux, NULL),
+        .index = priv->num_streams,
         .avpkt = av_packet_alloc(),
         .max_out_pts = MP_NOPTS_VALUE,
     };
+    MP_TARRAY_APPEND(priv, priv->streams, priv->num_streams, rst);
 
-    if (!rst->av_stream || !rst->avpkt)
-        goto done;
+    if (!rst->avpkt)
+        return -1;
 
-    avp = mp_codec_params_to_av(sh->codec);
+    AVCodecParameters *avp = mp_codec_params_to_av(sh->codec);
     if (!avp)
-        goto done;
+        return -1;
+    rst->par = avp;
 
     // Check if we get the same codec_id for the output format;
     // otherwise clear it to have a chance at muxing
-    if (av_codec_get_id(priv->mux->oformat->codec_tag,
+    if (av_codec_get_id(priv->oformat->codec_tag,
                         avp->codec_tag) != avp->codec_id)
         avp->codec_tag = 0;
 
@@ -110,20 +141,253 @@ static int add_stream(struct mp_recorder *priv, struct sh_stream *sh)
         avp->video_delay = 16;
 
     if (avp->codec_id == AV_CODEC_ID_NONE)
-        goto done;
+        return -1;
+
+    return 0;
+}
+
+// Not allocated under priv, because this runs on the writer thread, while the
+// demuxer thread can reallocate priv->queue.
+static char *get_file_name(struct mp_recorder *priv, int index)
+{
+    if (priv->params.segment_secs <= 0 && priv->params.segment_bytes <= 0)
+        return talloc_strdup(NULL, priv->target_file);
+
+    bstr root = bstr0(priv->target_file);
+    char *ext = mp_splitext(priv->target_file, &root);
+    return talloc_asprintf(NULL, "%.*s-%04d%s%s", BSTR_P(root), index,
+                           ext ? "." : "", ext ? ext : "");
+}
+
+// Create the mux context and write the file header.
+static bool open_output(struct mp_recorder *priv)
+{
+    char *filename = get_file_name(priv, priv->file_index);
+    talloc_free(priv->cur_file);
+    priv->cur_file = filename;
+
+    priv->mux = avformat_alloc_context();
+    if (!priv->mux)
+        return false;
 
-    if (avcodec_parameters_copy(rst->av_stream->codecpar, avp) < 0)
+    priv->mux->oformat = priv->oformat;
+
+    if (avio_open2(&priv->mux->pb, filename, AVIO_FLAG_WRITE, NULL, NULL) < 0) {
+        MP_ERR(priv, "Failed opening output file '%s'.\n", filename);
+        return false;
+    }
+
+    for (int n = 0; n < priv->num_streams; n++) {
+        struct mp_recorder_sink *rst = priv->streams[n];
+        AVStream *st = avformat_new_stream(priv->mux, NULL);
+        if (!st || avcodec_parameters_copy(st->codecpar, rst->par) < 0)
+            return false;
+        st->time_base = mp_get_codec_timebase(rst->sh->codec);
+    }
+
+    for (int i = 0; i < priv->num_attachments; ++i) {
+        AVStream *a_stream = avformat_new_stream(priv->mux, NULL);
+        if (!a_stream) {
+            MP_ERR(priv, "Can't mux one of the attachments.\n");
+            return false;
+        }
+        struct demux_attachment *attachment = &priv->attachments[i];
+
+        a_stream->codecpar->codec_type = AVMEDIA_TYPE_ATTACHMENT;
+
+        a_stream->codecpar->extradata  = av_mallocz(
+            attachment->data_size + AV_INPUT_BUFFER_PADDING_SIZE
+        );
+        if (!a_stream->codecpar->extradata) {
+            return false;
+        }
+        memcpy(a_stream->codecpar->extradata,
+            attachment->data, attachment->data_size);
+        a_stream->codecpar->extradata_size = attachment->data_size;
+
+        av_dict_set(&a_stream->metadata, "filename", attachment->name, 0);
+        av_dict_set(&a_stream->metadata, "mimetype", attachment->type, 0);
+    }
+
+    // Not sure how to write this in a "standard" way. It appears only mkv
+    // and mp4 support this directly.
+    char version[200];
+    snprintf(version, sizeof(version), "%s experimental stream recording "
+             "feature (can generate broken files - please report bugs)",
+             mpv_version);
+    av_dict_set(&priv->mux->metadata, "encoding_tool", version, 0);
+
+    if (avformat_write_header(priv->mux, NULL) < 0) {
+        MP_ERR(priv, "Writing header failed.\n");
+        return false;
+    }
+
+    priv->header_written = true;
+    return true;
+}
+
+// Finish and close the current output file (if any).
+static void close_output(struct mp_recorder *priv)
+{
+    if (!priv->mux)
+        return;
+
+    bool ok = priv->header_written;
+    if (priv->header_written && av_write_trailer(priv->mux) < 0) {
+        MP_ERR(priv, "Writing trailer failed.\n");
+        ok = false;
+    }
+
+    if (avio_closep(&priv->mux->pb) < 0) {
+        MP_ERR(priv, "Closing file failed\n");
+        ok = false;
+    }
+
+    avformat_free_context(priv->mux);
+    priv->mux = NULL;
+    priv->header_written = false;
+
+    if (ok && priv->opened && priv->params.segment_done)
+        priv->params.segment_done(priv->params.segment_done_ctx, priv->cur_file);
+}
+
+// Whether pkt should start a new output file.
+static bool check_split(struct mp_recorder *priv, struct mp_recorder_sink *rst,
+                        AVPacket *pkt)
+{
+    if (rst != priv->split_stream || !(pkt->flags & AV_PKT_FLAG_KEY) ||
+        pkt->pts == AV_NOPTS_VALUE)
+        return false;
+
+    int64_t ts = av_rescale_q(pkt->pts, rst->time_base, AV_TIME_BASE_Q);
+    if (priv->file_start == AV_NOPTS_VALUE)
+        priv->file_start = ts;
+
+    double secs = priv->params.segment_secs;
+    if (secs > 0 && ts - priv->file_start >= secs * AV_TIME_BASE)
+        goto split;
+
+    int64_t bytes = priv->params.segment_bytes;
+    if (bytes > 0 && priv->mux && avio_tell(priv->mux->pb) >= bytes)
+        goto split;
+
+    return false;
+
+split:
+    priv->file_start = ts;
+    return true;
+}
+
+static void write_packet(struct mp_recorder *priv, AVPacket *pkt)
+{
+    struct mp_recorder_sink *rst = priv->streams[pkt->stream_index];
+
+    if (check_split(priv, rst, pkt) && priv->header_written) {
+        close_output(priv);
+        priv->file_index += 1;
+        if (open_output(priv)) {
+            MP_VERBOSE(priv, "Started new file: %s\n", priv->cur_file);
+        } else {
+            MP_ERR(priv, "Stopping recording.\n");
+            close_output(priv);
+        }
+    }
+
+    if (!priv->header_written)
         goto done;
 
-    ret = 0;
-    rst->av_stream->time_base = mp_get_codec_timebase(sh->codec);
+    // Every new file starts at timestamp 0.
+    if (priv->file_index > 0) {
+        int64_t offset =
+            av_rescale_q(priv->file_start, AV_TIME_BASE_Q, rst->time_base);
+        if (pkt->pts != AV_NOPTS_VALUE)
+            pkt->pts -= offset;
+        if (pkt->dts != AV_NOPTS_VALUE)
+            pkt->dts -= offset;
+    }
+    av_packet_rescale_ts(pkt, rst->time_base,
+                         priv->mux->streams[rst->index]->time_base);
 
-    MP_TARRAY_APPEND(priv, priv->streams, priv->num_streams, rst);
+    if (av_interleaved_write_frame(priv->mux, pkt) < 0)
+        MP_ERR(priv, "Failed writing packet.\n");
 
 done:
-    if (avp)
-        avcodec_parameters_free(&avp);
-    return ret;
+    av_packet_free(&pkt);
+}
+
+static MP_THREAD_VOID writer_thread(void *ptr)
+{
+    struct mp_recorder *priv = ptr;
+
+    mp_thread_set_name("recorder");
+
+    mp_mutex_lock(&priv->lock);
+    while (priv->queue_head < priv->num_queue || !priv->terminate) {
+        if (priv->queue_head == priv->num_queue) {
+            mp_cond_wait(&priv->wakeup, &priv->lock);
+            continue;
+        }
+
+        AVPacket *pkt = priv->queue[priv->queue_head++];
+        if (priv->queue_head == priv->num_queue)
+            priv->queue_head = priv->num_queue = 0;
+        priv->queue_bytes -= pkt->size;
+        mp_cond_broadcast(&priv->wakeup);
+        mp_mutex_unlock(&priv->lock);
+
+        write_packet(priv, pkt);
+
+        mp_mutex_lock(&priv->lock);
+    }
+    mp_mutex_unlock(&priv->lock);
+
+    MP_THREAD_RETURN();
+}
+
+// Pass the packet to the writer thread. If the queue is full, wait, or drop
+// it (in which case the stream resumes at the next keyframe).
+static void queue_packet(struct mp_recorder *priv, struct mp_recorder_sink *rst,
+                         AVPacket *pkt)
+{
+    int64_t max_bytes = priv->params.queue_max_bytes;
+
+    mp_mutex_lock(&priv->lock);
+
+    if (rst->dropping && !(pkt->flags & AV_PKT_FLAG_KEY))
+        goto drop;
+
+    while (max_bytes > 0 && priv->queue_head < priv->num_queue &&
+           priv->queue_bytes + pkt->size > max_bytes)
+    {
+        if (priv->params.queue_drop) {
+            if (!rst->dropping) {
+                MP_WARN(priv, "Writing is too slow; dropping packets of stream "
+                        "%d until the next keyframe.\n", rst->index);
+            }
+            goto drop;
+        }
+        mp_cond_wait(&priv->wakeup, &priv->lock);
+    }
+
+    rst->dropping = false;
+    // Reclaim the slots of written packets if the queue never runs empty.
+    if (priv->queue_head > priv->num_queue / 2) {
+        priv->num_queue -= priv->queue_head;
+        memmove(priv->queue, priv->queue + priv->queue_head,
+                priv->num_queue * sizeof(priv->queue[0]));
+        priv->queue_head = 0;
+    }
+    MP_TARRAY_APPEND(priv, priv->queue, priv->num_queue, pkt);
+    priv->queue_bytes += pkt->size;
+    mp_cond_broadcast(&priv->wakeup);
+    mp_mutex_unlock(&priv->lock);
+    return;
+
+drop:
+    rst->dropping = true;
+    priv->dropped_packets += 1;
+    mp_mutex_unlock(&priv->lock);
+    av_packet_free(&pkt);
 }
 
 struct mp_recorder *mp_recorder_create(struct mpv_global *global,
@@ -131,33 +395,31 @@ struct mp_recorder *mp_recorder_create(struct mpv_global *global,
                                        struct sh_stream **streams,
                                        int num_streams,
                                        struct demux_attachment **attachments,
-                                       int num_attachments)
+                                       int num_attachments,
+                                       const struct mp_recorder_params *params)
 {
     struct mp_recorder *priv = talloc_zero(NULL, struct mp_recorder);
 
     priv->global = global;
     priv->log = mp_log_new(priv, global->log, "recorder");
+    if (params)
+        priv->params = *params;
+    priv->target_file = talloc_strdup(priv, target_file);
+    priv->file_start = AV_NOPTS_VALUE;
+    mp_mutex_init(&priv->lock);
+    mp_cond_init(&priv->wakeup);
 
     if (!num_streams) {
         MP_ERR(priv, "No streams.\n");
         goto error;
     }
 
-    priv->mux = avformat_alloc_context();
-    if (!priv->mux)
-        goto error;
-
-    priv->mux->oformat = av_guess_format(NULL, target_file, NULL);
-    if (!priv->mux->oformat) {
+    priv->oformat = av_guess_format(NULL, target_file, NULL);
+    if (!priv->oformat) {
         MP_ERR(priv, "Output format not found.\n");
         goto error;
     }
 
-    if (avio_open2(&priv->mux->pb, target_file, AVIO_FLAG_WRITE, NULL, NULL) < 0) {
-        MP_ERR(priv, "Failed opening output file.\n");
-        goto error;
-    }
-
     for (int n = 0; n < num_streams; n++) {
         if (add_stream(priv, streams[n]) < 0) {
             MP_ERR(priv, "Can't mux one of the input streams.\n");
@@ -165,48 +427,44 @@ struct mp_recorder *mp_recorder_create(struct mpv_global *global,
         }
     }
 
-    if (!strcmp(priv->mux->oformat->name, "matroska")) {
+    // New files start at keyframes of the video stream (if any).
+    for (int n = 0; n < priv->num_streams; n++) {
+        struct mp_recorder_sink *rst = priv->streams[n];
+        if (!priv->split_stream || (rst->sh->type == STREAM_VIDEO &&
+                                    priv->split_stream->sh->type != STREAM_VIDEO))
+            priv->split_stream = rst;
+    }
+
+    if (!strcmp(priv->oformat->name, "matroska")) {
         // Only attach attachments (fonts) to matroska - mp4, nut, mpegts don't
         // like them, and we find that out too late in the muxing process.
-        AVStream *a_stream = NULL;
-        for (int i = 0; i < num_attachments; ++i) {
-            a_stream = avformat_new_stream(priv->mux, NULL);
-            if (!a_stream) {
-                MP_ERR(priv, "Can't mux one of the attachments.\n");
-                goto error;
-            }
-            struct demux_attachment *attachment = attachments[i];
-
-            a_stream->codecpar->codec_type = AVMEDIA_TYPE_ATTACHMENT;
-
-            a_stream->codecpar->extradata  = av_mallocz(
-                attachment->data_size + AV_INPUT_BUFFER_PADDING_SIZE
-            );
-            if (!a_stream->codecpar->extradata) {
-                goto error;
-            }
-            memcpy(a_stream->codecpar->extradata,
-                attachment->data, attachment->data_size);
-            a_stream->codecpar->extradata_size = attachment->data_size;
-
-            av_dict_set(&a_stream->metadata, "filename", attachment->name, 0);
-            av_dict_set(&a_stream->metadata, "mimetype", attachment->type, 0);
+        // (Copied, because they're written again with each new file.)
+        priv->attachments =
+            talloc_array(priv, struct demux_attachment, num_attachments);
+        priv->num_attachments = num_attachments;
+        for (int i = 0; i < num_attachments; i++) {
+            struct demux_attachment *a = attachments[i];
+            priv->attachments[i] = (struct demux_attachment){
+                .name = talloc_strdup(priv->attachments, a->name),
+                .type = talloc_strdup(priv->attachments, a->type),
+                .data = talloc_memdup(priv->attachments, a->data, a->data_size),
+                .data_size = a->data_size,
+            };
         }
     }
 
-    // Not sure how to write this in a "standard" way. It appears only mkv
-    // and mp4 support this directly.
-    char version[200];
-    snprintf(version, sizeof(version), "%s experimental stream recording "
-             "feature (can generate broken files - please report bugs)",
-             mpv_version);
-    av_dict_set(&priv->mux->metadata, "encoding_tool", version, 0);
-
-    if (avformat_write_header(priv->mux, NULL) < 0) {
-        MP_ERR(priv, "Writing header failed.\n");
+    if (!open_output(priv))
         goto error;
+
+    for (int n = 0; n < priv->num_streams; n++) {
+        struct mp_recorder_sink *rst = priv->streams[n];
+        rst->time_base = priv->mux->streams[rst->index]->time_base;
     }
 
+    if (mp_thread_create(&priv->writer, writer_thread, priv))
+        goto error;
+    priv->writer_valid = true;
+
     priv->opened = true;
     priv->muxing_from_start = true;
 
@@ -246,9 +504,9 @@ static void mux_packet(struct mp_recorder_sink *rst,
 
     rst->max_out_pts = MP_PTS_MAX(rst->max_out_pts, pkt->pts);
 
-    mp_set_av_packet(rst->avpkt, &mpkt, &rst->av_stream->time_base);
+    mp_set_av_packet(rst->avpkt, &mpkt, &rst->time_base);
 
-    rst->avpkt->stream_index = rst->av_stream->index;
+    rst->avpkt->stream_index = rst->index;
 
     if (rst->avpkt->duration < 0 && rst->sh->type != STREAM_SUB)
         rst->avpkt->duration = 0;
@@ -259,10 +517,7 @@ static void mux_packet(struct mp_recorder_sink *rst,
         return;
     }
 
-    if (av_interleaved_write_frame(priv->mux, new_packet) < 0)
-        MP_ERR(priv, "Failed writing packet.\n");
-
-    av_packet_free(&new_packet);
+    queue_packet(priv, rst, new_packet);
 }
 
 // Write all packets available in the stream queue
@@ -326,24 +581,36 @@ static void check_restart(struct mp_recorder *priv)
 void mp_recorder_destroy(struct mp_recorder *priv)
 {
     if (priv->opened) {
-        for (int n = 0; n < priv->num_streams; n++) {
-            struct mp_recorder_sink *rst = priv->streams[n];
-            mux_packets(rst);
-            mp_free_av_packet(&rst->avpkt);
-        }
+        for (int n = 0; n < priv->num_streams; n++)
+            mux_packets(priv->streams[n]);
+    }
 
-        if (av_write_trailer(priv->mux) < 0)
-            MP_ERR(priv, "Writing trailer failed.\n");
+    // Wait until all queued packets were written.
+    if (priv->writer_valid) {
+        mp_mutex_lock(&priv->lock);
+        priv->terminate = true;
+        mp_cond_broadcast(&priv->wakeup);
+        mp_mutex_unlock(&priv->lock);
+        mp_thread_join(priv->writer);
     }
 
-    if (priv->mux) {
-        if (avio_closep(&priv->mux->pb) < 0)
-            MP_ERR(priv, "Closing file failed\n");
+    close_output(priv);
 
-        avformat_free_context(priv->mux);
+    if (priv->dropped_packets) {
+        MP_WARN(priv, "%"PRId64" packets were dropped, because writing was "
+                "too slow.\n", priv->dropped_packets);
+    }
+
+    for (int n = 0; n < priv->num_streams; n++) {
+        struct mp_recorder_sink *rst = priv->streams[n];
+        mp_free_av_packet(&rst->avpkt);
+        avcodec_parameters_free(&rst->par);
     }
 
     flush_packets(priv);
+    talloc_free(priv->cur_file);
+    mp_cond_destroy(&priv->wakeup);
+    mp_mutex_destroy(&priv->lock);
     talloc_free(priv);
 }
 
@@ -408,7 +675,7 @@ void mp_recorder_feed_packet(struct mp_recorder_sink *rst,
 
     if (rst->num_packets >= QUEUE_MAX_PACKETS) {
         MP_ERR(priv, "Stream %d has too many queued packets; dropping.\n",
-               rst->av_stream->index);
+               rst->index);
         return;
     }
 
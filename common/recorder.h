@@ -8,12 +8,35 @@ struct sh_stream;
 struct demux_attachment;
 struct mp_recorder_sink;
 
+#include <stdbool.h>
+#include <stdint.h>
+
+struct mp_recorder_params {
+    // Maximum size of packets waiting to be written (0: unlimited). If it's
+    // reached, mp_recorder_feed_packet() blocks, or drops packets if
+    // queue_drop is set.
+    int64_t queue_max_bytes;
+    bool queue_drop;
+    // If either is >0, start a new output file at the next keyframe once the
+    // current file has this duration or size. The files are named by
+    // appending "-0000", "-0001", ... to the target file name (before the
+    // extension).
+    double segment_secs;
+    int64_t segment_bytes;
+    // Called with the file name each time an output file was completed. This
+    // is called from the writer thread, or from mp_recorder_destroy().
+    void (*segment_done)(void *ctx, const char *filename);
+    void *segment_done_ctx;
+};
+
+// The output files are written on a separate thread. params can be NULL.
 struct mp_recorder *mp_recorder_create(struct mpv_global *global,
                                        const char *target_file,
                                        struct sh_stream **streams,
                                        int num_streams,
                                        struct demux_attachment **demux_attachments,
-                                       int num_attachments);
+                                       int num_attachments,
+                                       const struct mp_recorder_params *params);
 void mp_recorder_destroy(struct mp_recorder *r);
 void mp_recorder_mark_discontinuity(struct mp_recorder *r);
 
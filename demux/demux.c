@@ -106,8 +106,17 @@ const struct m_sub_options demux_conf = {
         {"index", OPT_CHOICE(index_mode, {"default", 1}, {"recreate", 0})},
         {"mf-fps", OPT_DOUBLE(mf_fps)},
         {"mf-type", OPT_STRING(mf_type)},
+        {"mf-readahead", OPT_INT(mf_readahead), M_RANGE(0, 64)},
         {"sub-create-cc-track", OPT_BOOL(create_ccs)},
         {"stream-record", OPT_STRING(record_file)},
+        {"stream-record-queue-max-bytes", OPT_BYTE_SIZE(record_queue_max_bytes),
+            M_RANGE(0, M_MAX_MEM_BYTES)},
+        {"stream-record-overflow", OPT_CHOICE(record_overflow,
+            {"wait", 0}, {"drop", 1})},
+        {"stream-record-segment-secs", OPT_DOUBLE(record_segment_secs),
+            M_RANGE(0, DBL_MAX)},
+        {"stream-record-segment-bytes", OPT_BYTE_SIZE(record_segment_bytes),
+            M_RANGE(0, M_MAX_MEM_BYTES)},
         {"video-backward-overlap", OPT_CHOICE(video_back_preroll, {"auto", -1}),
             M_RANGE(0, 1024)},
         {"audio-backward-overlap", OPT_CHOICE(audio_back_preroll, {"auto", -1}),
@@ -121,6 +130,10 @@ const struct m_sub_options demux_conf = {
         {"metadata-codepage", OPT_STRING(meta_cp)},
         {"autocreate-playlist", OPT_CHOICE(autocreate_playlist,
             {"no", 0}, {"filter", 1}, {"same", 2})},
+        {"demuxer-timeline-open-threads", OPT_INT(timeline_open_threads),
+            M_RANGE(1, 64)},
+        {"demuxer-timeline-lookahead-secs", OPT_DOUBLE(timeline_lookahead_secs),
+            M_RANGE(0, DBL_MAX)},
         {0}
     },
     .size = sizeof(struct demux_opts),
@@ -134,6 +147,7 @@ const struct m_sub_options demux_conf = {
         .seekable_cache = -1,
         .index_mode = 1,
         .mf_fps = 1.0,
+        .mf_readahead = 4,
         .access_references = true,
         .video_back_preroll = -1,
         .audio_back_preroll = -1,
@@ -143,6 +157,9 @@ const struct m_sub_options demux_conf = {
             [STREAM_AUDIO] = 10,
         },
         .meta_cp = "auto",
+        .timeline_open_threads = 4,
+        .timeline_lookahead_secs = 2.0,
+        .record_queue_max_bytes = 64 * 1024 * 1024,
     },
     .get_sub_options = get_demux_sub_opts,
 };
@@ -267,8 +284,20 @@ struct demux_internal {
     struct mp_recorder *dumper;
     int dumper_status;
 
+    bool recording_stopped;     // demux_stop_recording() was called
+
     bool owns_stream;
 
+    // Files completed by the recorder; protected by recorded_lock (and not
+    // by lock, because the recorder may report them while lock is held).
+    // recorded_files is a separate talloc context (not a child of in), because
+    // the writer thread must not change the children of in.
+    mp_mutex recorded_lock;
+    char **recorded_files;
+    int num_recorded_files;
+    void (*recorded_wakeup_cb)(void *ctx); // copy of wakeup_cb
+    void *recorded_wakeup_cb_ctx;
+
     // -- Access from demuxer thread only
     bool enable_recording;
     struct mp_recorder *recorder;
@@ -1103,6 +1132,8 @@ static void demux_dealloc(struct demux_internal *in)
     for (int n = 0; n < in->num_streams; n++)
         talloc_free(in->streams[n]);
     mp_mutex_destroy(&in->lock);
+    mp_mutex_destroy(&in->recorded_lock);
+    talloc_free(in->recorded_files);
     mp_cond_destroy(&in->wakeup);
     talloc_free(in->d_user);
 }
@@ -1221,6 +1252,10 @@ void demux_set_wakeup_cb(struct demuxer *demuxer, void (*cb)(void *ctx), void *c
     mp_mutex_lock(&in->lock);
     in->wakeup_cb = cb;
     in->wakeup_cb_ctx = ctx;
+    mp_mutex_lock(&in->recorded_lock);
+    in->recorded_wakeup_cb = cb;
+    in->recorded_wakeup_cb_ctx = ctx;
+    mp_mutex_unlock(&in->recorded_lock);
     mp_mutex_unlock(&in->lock);
 }
 
@@ -1919,8 +1954,28 @@ static void adjust_seek_range_on_packet(struct demux_stream *ds,
     }
 }
 
+// Called by the recorder's writer thread.
+static void recorded_file_done(void *ctx, const char *filename)
+{
+    struct demux_internal *in = ctx;
+    mp_mutex_lock(&in->recorded_lock);
+    char *name = talloc_strdup(NULL, filename);
+    MP_TARRAY_APPEND(NULL, in->recorded_files, in->num_recorded_files, name);
+    talloc_steal(in->recorded_files, name);
+    void (*cb)(void *ctx) = in->recorded_wakeup_cb;
+    void *cb_ctx = in->recorded_wakeup_cb_ctx;
+    mp_mutex_unlock(&in->recorded_lock);
+
+    // Let the player pick it up now.
+    if (cb)
+        cb(cb_ctx);
+}
+
+// params==NULL for the cache dumper, which doesn't use the --stream-record-*
+// options.
 static struct mp_recorder *recorder_create(struct demux_internal *in,
-                                           const char *dst)
+                                           const char *dst,
+                                           struct mp_recorder_params *params)
 {
     struct sh_stream **streams = NULL;
     int num_streams = 0;
@@ -1938,7 +1993,8 @@ static struct mp_recorder *recorder_create(struct demux_internal *in,
 
     struct mp_recorder *res = mp_recorder_create(in->d_thread->global, dst,
                                                  streams, num_streams,
-                                                 attachments, demuxer->num_attachments);
+                                                 attachments, demuxer->num_attachments,
+                                                 params);
     talloc_free(streams);
     talloc_free(attachments);
     return res;
@@ -1962,14 +2018,23 @@ static void write_dump_packet(struct demux_internal *in, struct demux_packet *dp
 static void record_packet(struct demux_internal *in, struct demux_packet *dp)
 {
     // (should preferably be outside of the lock)
-    if (in->enable_recording && !in->recorder &&
+    if (in->enable_recording && !in->recorder && !in->recording_stopped &&
         in->d_user->opts->record_file && in->d_user->opts->record_file[0])
     {
         // Later failures shouldn't make it retry and overwrite the previously
         // recorded file.
         in->enable_recording = false;
 
-        in->recorder = recorder_create(in, in->d_user->opts->record_file);
+        struct demux_opts *opts = in->d_user->opts;
+        struct mp_recorder_params params = {
+            .queue_max_bytes = opts->record_queue_max_bytes,
+            .queue_drop = opts->record_overflow == 1,
+            .segment_secs = opts->record_segment_secs,
+            .segment_bytes = opts->record_segment_bytes,
+            .segment_done = recorded_file_done,
+            .segment_done_ctx = in,
+        };
+        in->recorder = recorder_create(in, opts->record_file, &params);
         if (!in->recorder)
             MP_ERR(in, "Disabling recording.\n");
     }
@@ -3310,6 +3375,7 @@ static struct demuxer *open_given_type(struct mpv_global *global,
         .owns_stream = !params->external_stream,
     };
     mp_mutex_init(&in->lock);
+    mp_mutex_init(&in->recorded_lock);
     mp_cond_init(&in->wakeup);
 
     *in->d_thread = *demuxer;
@@ -4356,7 +4422,7 @@ bool demux_cache_dump_set(struct demuxer *demuxer, double start, double end,
     if (file && file[0] && start != MP_NOPTS_VALUE) {
         res = true;
 
-        in->dumper = recorder_create(in, file);
+        in->dumper = recorder_create(in, file, NULL);
 
         // This is not asynchronous and will freeze the shit for a while if the
         // user is unlucky. It could be moved to a thread with some effort.
@@ -4382,6 +4448,42 @@ int demux_cache_dump_get_status(struct demuxer *demuxer)
     return status;
 }
 
+// Stop --stream-record for the rest of the demuxer's lifetime. This finishes
+// the current output file, which demux_get_recorded_files() returns next.
+// Call it before destroying the demuxer, or the last file is not reported.
+void demux_stop_recording(struct demuxer *demuxer)
+{
+    struct demux_internal *in = demuxer->in;
+    assert(demuxer == in->d_user);
+
+    // (The demuxer thread uses the recorder only while holding the lock.)
+    mp_mutex_lock(&in->lock);
+    in->recording_stopped = true;
+    if (in->recorder) {
+        mp_recorder_destroy(in->recorder);
+        in->recorder = NULL;
+    }
+    mp_mutex_unlock(&in->lock);
+}
+
+// Return the names of the files --stream-record finished writing since the
+// last call (allocated with ta_parent), and remove them from the list. With
+// --stream-record-segment-secs/bytes, this includes each completed segment.
+// The last file is completed only when recording stops (see
+// demux_stop_recording()).
+char **demux_get_recorded_files(struct demuxer *demuxer, void *ta_parent,
+                                int *num_files)
+{
+    struct demux_internal *in = demuxer->in;
+    mp_mutex_lock(&in->recorded_lock);
+    char **res = talloc_steal(ta_parent, in->recorded_files);
+    *num_files = in->num_recorded_files;
+    in->recorded_files = NULL;
+    in->num_recorded_files = 0;
+    mp_mutex_unlock(&in->recorded_lock);
+    return res;
+}
+
 // Return what range demux_cache_dump_set() would (probably) yield. This is a
 // conservative amount (in addition to internal consistency of this code, it
 // depends on what a player will do with the resulting file).
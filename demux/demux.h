@@ -78,6 +78,7 @@ struct demux_opts {
     int index_mode;
     double mf_fps;
     char *mf_type;
+    int mf_readahead;
     bool create_ccs;
     char *record_file;
     int video_back_preroll;
@@ -87,6 +88,12 @@ struct demux_opts {
     char *meta_cp;
     bool force_retry_eof;
     int autocreate_playlist;
+    int timeline_open_threads;
+    double timeline_lookahead_secs;
+    int64_t record_queue_max_bytes;
+    int record_overflow;
+    double record_segment_secs;
+    int64_t record_segment_bytes;
 };
 
 #define SEEK_FACTOR   (1 << 1)      // argument is in range [0,1]
@@ -347,6 +354,11 @@ bool demux_cache_dump_set(struct demuxer *demuxer, double start, double end,
                           char *file);
 int demux_cache_dump_get_status(struct demuxer *demuxer);
 
+void demux_stop_recording(struct demuxer *demuxer);
+void demux_lavf_uninit_probe_cache(struct mpv_global *global);
+char **demux_get_recorded_files(struct demuxer *demuxer, void *ta_parent,
+                                int *num_files);
+
 double demux_probe_cache_dump_target(struct demuxer *demuxer, double pts,
                                      bool for_end);
 
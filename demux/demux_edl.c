@@ -33,6 +33,8 @@
 #include "misc/bstr.h"
 #include "common/common.h"
 #include "common/tags.h"
+#include "misc/thread_pool.h"
+#include "options/m_config.h"
 #include "stream/stream.h"
 
 #define HEADER "# mpv EDL v0\n"
@@ -286,20 +288,109 @@ error:
     return NULL;
 }
 
+// A source opened ahead by open_sources_concurrently().
+struct preopen {
+    struct timeline *root;
+    struct demuxer_params params;
+    char *filename;
+    bool taken;
+    struct demuxer *d;
+};
+
+static void preopen_fn(void *ctx)
+{
+    struct preopen *po = ctx;
+    po->d = demux_open_url(po->filename, &po->params, po->root->cancel,
+                           po->root->global);
+}
+
+// Opening sources one by one can take a long time with many network sources,
+// so open all distinct sources on a thread pool first. This returns when all
+// are opened (or failed).
+static struct preopen *open_sources_concurrently(struct timeline *root,
+                                                 struct timeline_par *tl,
+                                                 struct tl_parts *parts,
+                                                 int *num_out)
+{
+    *num_out = 0;
+
+    struct demux_opts *opts = mp_get_config_group(NULL, root->global, &demux_conf);
+    int threads = opts->timeline_open_threads;
+    talloc_free(opts);
+
+    struct preopen *po = NULL;
+    int num_po = 0;
+    for (int n = 0; n < parts->num_parts; n++) {
+        char *filename = parts->parts[n].filename;
+        bool dup = false;
+        for (int i = 0; i < num_po; i++)
+            dup |= strcmp(po[i].filename, filename) == 0;
+        if (dup)
+            continue;
+        struct preopen entry = {
+            .root = root,
+            .params = {
+                .init_fragment = tl->init_fragment,
+                .stream_flags = root->stream_origin,
+            },
+            .filename = filename,
+        };
+        MP_TARRAY_APPEND(NULL, po, num_po, entry);
+    }
+
+    threads = MPMIN(threads, num_po);
+    struct mp_thread_pool *pool = NULL;
+    if (threads > 1)
+        pool = mp_thread_pool_create(NULL, threads, threads, threads);
+    if (!pool) {
+        talloc_free(po);
+        return NULL;
+    }
+
+    MP_VERBOSE(root, "Opening %d sources with %d threads...\n", num_po, threads);
+    for (int n = 0; n < num_po; n++)
+        mp_thread_pool_queue(pool, preopen_fn, &po[n]);
+    talloc_free(pool); // waits until all work items are done
+
+    *num_out = num_po;
+    return po;
+}
+
+static void free_preopened(struct preopen *po, int num_po)
+{
+    for (int n = 0; n < num_po; n++) {
+        if (po[n].d)
+            demux_free(po[n].d);
+    }
+    talloc_free(po);
+}
+
 static struct demuxer *open_source(struct timeline *root,
-                                   struct timeline_par *tl, char *filename)
+                                   struct timeline_par *tl, char *filename,
+                                   struct preopen *po, int num_po)
 {
     for (int n = 0; n < tl->num_parts; n++) {
         struct demuxer *d = tl->parts[n].source;
         if (d && d->filename && strcmp(d->filename, filename) == 0)
             return d;
     }
-    struct demuxer_params params = {
-        .init_fragment = tl->init_fragment,
-        .stream_flags = root->stream_origin,
-    };
-    struct demuxer *d = demux_open_url(filename, &params, root->cancel,
-                                       root->global);
+    struct demuxer *d = NULL;
+    bool opened = false;
+    for (int n = 0; n < num_po; n++) {
+        if (!po[n].taken && strcmp(po[n].filename, filename) == 0) {
+            d = po[n].d;
+            po[n].d = NULL;
+            po[n].taken = opened = true;
+            break;
+        }
+    }
+    if (!opened) {
+        struct demuxer_params params = {
+            .init_fragment = tl->init_fragment,
+            .stream_flags = root->stream_origin,
+        };
+        d = demux_open_url(filename, &params, root->cancel, root->global);
+    }
     if (d) {
         MP_TARRAY_APPEND(root, root->sources, root->num_sources, d);
     } else {
@@ -357,6 +448,9 @@ static struct timeline_par *build_timeline(struct timeline *root,
     struct timeline_par *tl = talloc_zero(root, struct timeline_par);
     MP_TARRAY_APPEND(root, root->pars, root->num_pars, tl);
 
+    struct preopen *po = NULL;
+    int num_po = 0;
+
     tl->track_layout = NULL;
     tl->dash = parts->dash;
     tl->no_clip = parts->no_clip;
@@ -390,6 +484,9 @@ static struct timeline_par *build_timeline(struct timeline *root,
         MP_TARRAY_APPEND(root, root->sources, root->num_sources, tl->track_layout);
     }
 
+    if (!tl->dash && !tl->delay_open)
+        po = open_sources_concurrently(root, tl, parts, &num_po);
+
     tl->parts = talloc_array_ptrtype(tl, tl->parts, parts->num_parts);
     double starttime = 0;
     for (int n = 0; n < parts->num_parts; n++) {
@@ -404,7 +501,7 @@ static struct timeline_par *build_timeline(struct timeline *root,
                 MP_WARN(root, "Offsets are ignored.\n");
 
             if (!tl->track_layout)
-                tl->track_layout = open_source(root, tl, part->filename);
+                tl->track_layout = open_source(root, tl, part->filename, NULL, 0);
         } else if (tl->delay_open) {
             if (n == 0 && !part->offset_set) {
                 part->offset = starttime;
@@ -417,7 +514,7 @@ static struct timeline_par *build_timeline(struct timeline *root,
         } else {
             MP_VERBOSE(root, "Opening segment %d...\n", n);
 
-            source = open_source(root, tl, part->filename);
+            source = open_source(root, tl, part->filename, po, num_po);
             if (!source)
                 goto error;
 
@@ -477,6 +574,10 @@ static struct timeline_par *build_timeline(struct timeline *root,
         tl->num_parts++;
     }
 
+    free_preopened(po, num_po);
+    po = NULL;
+    num_po = 0;
+
     if (tl->no_clip && tl->num_parts > 1)
         MP_WARN(root, "Multiple parts with no_clip. Undefined behavior ahead.\n");
 
@@ -506,6 +607,7 @@ static struct timeline_par *build_timeline(struct timeline *root,
     return tl;
 
 error:
+    free_preopened(po, num_po);
     root->num_pars = 0;
     return NULL;
 }
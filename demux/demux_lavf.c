@@ -34,6 +34,7 @@
 #include <libavutil/display.h>
 #include <libavutil/dovi_meta.h>
 #include <libavutil/mathematics.h>
+#include <libavutil/md5.h>
 #include <libavutil/opt.h>
 #include <libavutil/pixdesc.h>
 #include <libavutil/replaygain.h>
@@ -41,12 +42,16 @@
 #include "audio/chmap_avchannel.h"
 
 #include "common/common.h"
+#include "common/global.h"
 #include "common/msg.h"
 #include "common/tags.h"
 #include "common/av_common.h"
 #include "misc/bstr.h"
 #include "misc/charset_conv.h"
+#include "misc/kv_log.h"
+#include "misc/path_utils.h"
 #include "misc/thread_tools.h"
+#include "osdep/io.h"
 
 #include "stream/stream.h"
 #include "demux.h"
@@ -78,6 +83,7 @@ struct demux_lavf_opts {
     int rtsp_transport;
     int linearize_ts;
     bool propagate_opts;
+    bool probe_cache;
 };
 
 const struct m_sub_options demux_lavf_conf = {
@@ -105,6 +111,7 @@ const struct m_sub_options demux_lavf_conf = {
         {"demuxer-lavf-linearize-timestamps", OPT_CHOICE(linearize_ts,
             {"no", 0}, {"auto", -1}, {"yes", 1})},
         {"demuxer-lavf-propagate-opts", OPT_BOOL(propagate_opts)},
+        {"demuxer-lavf-probe-cache", OPT_BOOL(probe_cache)},
         {0}
     },
     .size = sizeof(struct demux_lavf_opts),
@@ -237,6 +244,9 @@ typedef struct lavf_priv {
 
     struct demux_lavf_opts *opts;
 
+    // Only set while opening.
+    struct probe_cache *probe_cache;
+
     bool pcm_seek_hack_disabled;
     AVStream *pcm_seek_hack;
     int pcm_seek_hack_packet_size;
@@ -410,6 +420,398 @@ static char *remove_prefix(char *s, const char *const *prefixes)
 static const char *const prefixes[] =
     {"ffmpeg://", "lavf://", "avdevice://", "av://", NULL};
 
+// Persistent cache of the probing results (--demuxer-lavf-probe-cache). Maps
+// the file path to the detected format and the codec parameters of all streams,
+// so that reopening an unchanged file can skip avformat_find_stream_info().
+
+#define PROBE_CACHE_FILE "lavf-probe-cache"
+
+// Don't store files with huge extradata (such as fonts in attachment streams).
+#define PROBE_CACHE_MAX_EXTRADATA (256 * 1024)
+
+#define PROBE_CACHE_PAR_FIELDS(X) \
+    X(codec_type) X(codec_id) X(codec_tag) X(format) X(bit_rate)            \
+    X(bits_per_coded_sample) X(bits_per_raw_sample) X(profile) X(level)     \
+    X(width) X(height) X(field_order) X(color_range) X(color_primaries)     \
+    X(color_trc) X(color_space) X(chroma_location) X(video_delay)           \
+    X(sample_rate) X(block_align) X(frame_size) X(initial_padding)          \
+    X(trailing_padding) X(seek_preroll)
+
+struct probe_cache_stream {
+    int64_t id;
+    AVRational time_base, avg_frame_rate, r_frame_rate, sar;
+    int64_t start_time, duration;
+    AVCodecParameters *par;
+};
+
+struct probe_cache {
+    struct mp_kv_log *kv;
+    char *key;
+    int64_t size, mtime;
+
+    // Entry loaded from the file; format==NULL if none or if outdated.
+    // num_streams==0 if only the format is cached.
+    char *format;
+    int64_t size_entry, check;
+    int64_t start_time, duration, bit_rate;
+    struct probe_cache_stream *streams;
+    int num_streams;
+};
+
+static void probe_cache_destroy(void *p)
+{
+    struct probe_cache *c = p;
+    for (int n = 0; n < c->num_streams; n++)
+        avcodec_parameters_free(&c->streams[n].par);
+}
+
+static bool parse_rational(bstr val, AVRational *out)
+{
+    bstr num, den;
+    if (!bstr_split_tok(val, "/", &num, &den))
+        return false;
+    out->num = bstrtoll(num, NULL, 10);
+    out->den = bstrtoll(den, NULL, 10);
+    return true;
+}
+
+static bool parse_stream_line(struct probe_cache_stream *st, bstr line)
+{
+    AVCodecParameters *par = st->par;
+    while (line.len) {
+        bstr val, name = bstr_split(line, " ", &line);
+        if (!name.len)
+            continue;
+        if (!bstr_split_tok(name, "=", &name, &val))
+            return false;
+        int64_t v = bstrtoll(val, NULL, 10);
+#define PARSE_FIELD(f) \
+        if (bstr_equals0(name, #f)) { par->f = v; continue; }
+        PROBE_CACHE_PAR_FIELDS(PARSE_FIELD)
+#undef PARSE_FIELD
+        if (bstr_equals0(name, "id")) {
+            st->id = v;
+        } else if (bstr_equals0(name, "start_time")) {
+            st->start_time = v;
+        } else if (bstr_equals0(name, "duration")) {
+            st->duration = v;
+        } else if (bstr_equals0(name, "time_base")) {
+            if (!parse_rational(val, &st->time_base))
+                return false;
+        } else if (bstr_equals0(name, "avg_frame_rate")) {
+            if (!parse_rational(val, &st->avg_frame_rate))
+                return false;
+        } else if (bstr_equals0(name, "r_frame_rate")) {
+            if (!parse_rational(val, &st->r_frame_rate))
+                return false;
+        } else if (bstr_equals0(name, "sar")) {
+            if (!parse_rational(val, &st->sar))
+                return false;
+        } else if (bstr_equals0(name, "ch_order")) {
+            par->ch_layout.order = v;
+        } else if (bstr_equals0(name, "ch_count")) {
+            par->ch_layout.nb_channels = v;
+        } else if (bstr_equals0(name, "ch_mask")) {
+            par->ch_layout.u.mask = bstrtoll(val, NULL, 16);
+        } else if (bstr_equals0(name, "extradata")) {
+            bstr data;
+            if (!bstr_decode_hex(NULL, val, &data))
+                return false;
+            par->extradata = av_mallocz(data.len + AV_INPUT_BUFFER_PADDING_SIZE);
+            if (par->extradata) {
+                memcpy(par->extradata, data.start, data.len);
+                par->extradata_size = data.len;
+            }
+            talloc_free(data.start);
+            if (!par->extradata)
+                return false;
+        }
+        // Ignore unknown fields.
+    }
+    return true;
+}
+
+static bool parse_probe_cache_entry(struct probe_cache *c, bstr data)
+{
+    while (data.len) {
+        bstr line = bstr_getline(data, &data);
+        line = bstr_strip_linebreaks(line);
+        bstr name = bstr_split(line, " ", &line);
+        line = bstr_strip(line);
+        int64_t v = bstrtoll(line, NULL, 10);
+        if (bstr_equals0(name, "format")) {
+            c->format = bstrto0(c, line);
+        } else if (bstr_equals0(name, "size")) {
+            c->size_entry = v;
+        } else if (bstr_equals0(name, "check")) {
+            c->check = v;
+        } else if (bstr_equals0(name, "start_time")) {
+            c->start_time = v;
+        } else if (bstr_equals0(name, "duration")) {
+            c->duration = v;
+        } else if (bstr_equals0(name, "bit_rate")) {
+            c->bit_rate = v;
+        } else if (bstr_equals0(name, "stream")) {
+            struct probe_cache_stream st = {.par = avcodec_parameters_alloc()};
+            if (!st.par)
+                return false;
+            MP_TARRAY_APPEND(c, c->streams, c->num_streams, st);
+            if (!parse_stream_line(&c->streams[c->num_streams - 1], line))
+                return false;
+        }
+    }
+    return c->format;
+}
+
+// The index is built once per mpv instance, and shared by all of its demuxer
+// instances. It's freed by demux_lavf_uninit_probe_cache().
+// Normally there is only a single path, unless the config directory changes.
+struct lavf_probe_cache {
+    mp_mutex lock;
+    struct mp_log *log;
+    struct probe_cache_kv {
+        char *path;
+        struct mp_kv_log *kv;
+    } *kvs;
+    int num_kvs;
+};
+
+// Protects creating mpv_global.lavf_probe_cache.
+static mp_static_mutex probe_cache_init_lock = MP_STATIC_MUTEX_INITIALIZER;
+
+static void destroy_lavf_probe_cache(void *p)
+{
+    struct lavf_probe_cache *pc = p;
+    // (Also joins the compaction threads.)
+    for (int n = 0; n < pc->num_kvs; n++)
+        talloc_free(pc->kvs[n].kv);
+    mp_mutex_destroy(&pc->lock);
+}
+
+static struct mp_kv_log *get_probe_cache_kv(struct mpv_global *global,
+                                            const char *path)
+{
+    mp_mutex_lock(&probe_cache_init_lock);
+    struct lavf_probe_cache *pc = global->lavf_probe_cache;
+    if (!pc) {
+        pc = talloc_zero(NULL, struct lavf_probe_cache);
+        talloc_set_destructor(pc, destroy_lavf_probe_cache);
+        mp_mutex_init(&pc->lock);
+        pc->log = mp_log_new(pc, global->log, "lavf-probe-cache");
+        global->lavf_probe_cache = pc;
+    }
+    mp_mutex_unlock(&probe_cache_init_lock);
+
+    struct mp_kv_log *kv = NULL;
+    mp_mutex_lock(&pc->lock);
+    for (int n = 0; n < pc->num_kvs; n++) {
+        if (strcmp(pc->kvs[n].path, path) == 0)
+            kv = pc->kvs[n].kv;
+    }
+    if (!kv) {
+        kv = mp_kv_log_open(NULL, pc->log, path);
+        MP_TARRAY_APPEND(pc, pc->kvs, pc->num_kvs,
+                         (struct probe_cache_kv){talloc_strdup(kv, path), kv});
+    }
+    mp_mutex_unlock(&pc->lock);
+    // Only indexes what other processes appended since the last call.
+    mp_kv_log_refresh(kv);
+    return kv;
+}
+
+// Close the probe cache. No demuxers may be using it anymore.
+void demux_lavf_uninit_probe_cache(struct mpv_global *global)
+{
+    TA_FREEP(&global->lavf_probe_cache);
+}
+
+// Returns NULL if the option is disabled, or the stream is not a regular file.
+static struct probe_cache *open_probe_cache(struct demuxer *demuxer)
+{
+    lavf_priv_t *priv = demuxer->priv;
+    struct stream *s = priv->stream;
+    if (!priv->opts->probe_cache || !s->is_local_fs || !s->path)
+        return NULL;
+
+    struct stat st;
+    if (stat(s->path, &st) || !S_ISREG(st.st_mode))
+        return NULL;
+
+    char *dir = mp_find_user_file(NULL, demuxer->global, "cache", "");
+    if (!dir || !dir[0]) {
+        talloc_free(dir);
+        return NULL;
+    }
+    mp_mkdirp(dir);
+    char *path = mp_path_join(NULL, dir, PROBE_CACHE_FILE);
+    talloc_free(dir);
+
+    struct probe_cache *c = talloc_zero(priv, struct probe_cache);
+    talloc_set_destructor(c, probe_cache_destroy);
+    c->kv = get_probe_cache_kv(demuxer->global, path);
+    talloc_free(path);
+    c->size = st.st_size;
+    c->mtime = st.st_mtime;
+
+    uint8_t md5[16];
+    av_md5_sum(md5, s->path, strlen(s->path));
+    c->key = talloc_strdup(c, "");
+    for (int i = 0; i < 16; i++)
+        c->key = talloc_asprintf_append(c->key, "%02X", md5[i]);
+
+    bstr data = {0};
+    int64_t mtime = -1;
+    if (mp_kv_log_get(c->kv, c, c->key, &data, &mtime) && mtime == c->mtime) {
+        if (!parse_probe_cache_entry(c, data)) {
+            MP_WARN(demuxer, "Ignoring invalid probe cache entry.\n");
+            c->format = NULL;
+        }
+        // The file was modified.
+        if (c->size_entry != c->size)
+            c->format = NULL;
+    }
+    talloc_free(data.start);
+
+    if (c->format)
+        MP_VERBOSE(demuxer, "Found probe cache entry.\n");
+    return c;
+}
+
+// Returns the cached format name, if it was found with the same check level.
+static const char *probe_cache_get_format(struct probe_cache *c,
+                                          enum demux_check check)
+{
+    return c && c->format && c->check == check ? c->format : NULL;
+}
+
+// Initialize the streams from the cache entry instead of probing them. Returns
+// false if the streams libavformat created don't match the cached ones.
+static bool probe_cache_apply(struct demuxer *demuxer)
+{
+    lavf_priv_t *priv = demuxer->priv;
+    struct probe_cache *c = priv->probe_cache;
+    AVFormatContext *avfc = priv->avfc;
+
+    if (!c->format || !c->num_streams ||
+        strcmp(c->format, priv->avif->name) != 0 ||
+        avfc->nb_streams != c->num_streams)
+        return false;
+
+    for (int n = 0; n < c->num_streams; n++) {
+        AVStream *st = avfc->streams[n];
+        struct probe_cache_stream *cst = &c->streams[n];
+        if (st->id != cst->id ||
+            (st->codecpar->codec_type != AVMEDIA_TYPE_UNKNOWN &&
+             st->codecpar->codec_type != cst->par->codec_type) ||
+            (st->codecpar->codec_id != AV_CODEC_ID_NONE &&
+             st->codecpar->codec_id != cst->par->codec_id))
+            return false;
+    }
+
+    for (int n = 0; n < c->num_streams; n++) {
+        AVStream *st = avfc->streams[n];
+        struct probe_cache_stream *cst = &c->streams[n];
+        AVCodecParameters *par = st->codecpar;
+        // Only the fields that are stored; coded_side_data (set when reading
+        // the header) must be kept.
+#define COPY_FIELD(f) par->f = cst->par->f;
+        PROBE_CACHE_PAR_FIELDS(COPY_FIELD)
+#undef COPY_FIELD
+        av_channel_layout_uninit(&par->ch_layout);
+        if (av_channel_layout_copy(&par->ch_layout, &cst->par->ch_layout) < 0)
+            return false;
+        av_freep(&par->extradata);
+        par->extradata_size = 0;
+        if (cst->par->extradata_size) {
+            par->extradata = av_mallocz(cst->par->extradata_size +
+                                        AV_INPUT_BUFFER_PADDING_SIZE);
+            if (!par->extradata)
+                return false;
+            memcpy(par->extradata, cst->par->extradata,
+                   cst->par->extradata_size);
+            par->extradata_size = cst->par->extradata_size;
+        }
+        st->time_base = cst->time_base;
+        st->avg_frame_rate = cst->avg_frame_rate;
+        st->r_frame_rate = cst->r_frame_rate;
+        st->sample_aspect_ratio = cst->sar;
+        st->start_time = cst->start_time;
+        st->duration = cst->duration;
+    }
+    avfc->start_time = c->start_time;
+    avfc->duration = c->duration;
+    avfc->bit_rate = c->bit_rate;
+    return true;
+}
+
+static void append_rational(bstr *s, const char *name, AVRational r)
+{
+    bstr_xappend_asprintf(NULL, s, " %s=%d/%d", name, r.num, r.den);
+}
+
+// header_streams is the number of streams before avformat_find_stream_info().
+static void probe_cache_store(struct demuxer *demuxer, enum demux_check check,
+                              int header_streams)
+{
+    lavf_priv_t *priv = demuxer->priv;
+    struct probe_cache *c = priv->probe_cache;
+    AVFormatContext *avfc = priv->avfc;
+
+    // Streams that are created only when reading packets (like with MPEG-PS)
+    // can't be restored from the cache. Then only the format is cached.
+    bool with_streams = avfc->nb_streams && avfc->nb_streams == header_streams;
+    if (!with_streams && c->format && !c->num_streams && c->check == check &&
+        strcmp(c->format, priv->avif->name) == 0)
+        return; // already stored
+
+    bstr s = {0};
+    bstr_xappend_asprintf(NULL, &s, "format %s\n", priv->avif->name);
+    bstr_xappend_asprintf(NULL, &s, "size %"PRId64"\n", c->size);
+    bstr_xappend_asprintf(NULL, &s, "check %d\n", (int)check);
+    bstr_xappend_asprintf(NULL, &s, "start_time %"PRId64"\n", avfc->start_time);
+    bstr_xappend_asprintf(NULL, &s, "duration %"PRId64"\n", avfc->duration);
+    bstr_xappend_asprintf(NULL, &s, "bit_rate %"PRId64"\n", avfc->bit_rate);
+
+    bool ok = true;
+    int64_t extradata_size = 0;
+    for (int n = 0; with_streams && n < avfc->nb_streams; n++) {
+        AVStream *st = avfc->streams[n];
+        AVCodecParameters *par = st->codecpar;
+        // Channel maps are not stored.
+        if (par->ch_layout.order == AV_CHANNEL_ORDER_CUSTOM)
+            ok = false;
+        extradata_size += par->extradata_size;
+
+        bstr_xappend_asprintf(NULL, &s, "stream id=%d", st->id);
+        append_rational(&s, "time_base", st->time_base);
+        append_rational(&s, "avg_frame_rate", st->avg_frame_rate);
+        append_rational(&s, "r_frame_rate", st->r_frame_rate);
+        append_rational(&s, "sar", st->sample_aspect_ratio);
+        bstr_xappend_asprintf(NULL, &s, " start_time=%"PRId64" duration=%"PRId64,
+                              st->start_time, st->duration);
+#define WRITE_FIELD(f) \
+        bstr_xappend_asprintf(NULL, &s, " " #f "=%"PRId64, (int64_t)par->f);
+        PROBE_CACHE_PAR_FIELDS(WRITE_FIELD)
+#undef WRITE_FIELD
+        bstr_xappend_asprintf(NULL, &s, " ch_order=%d ch_count=%d ch_mask=%"PRIx64,
+                              (int)par->ch_layout.order,
+                              par->ch_layout.nb_channels,
+                              (uint64_t)par->ch_layout.u.mask);
+        if (par->extradata_size) {
+            bstr_xappend0(NULL, &s, " extradata=");
+            for (int i = 0; i < par->extradata_size; i++)
+                bstr_xappend_asprintf(NULL, &s, "%02x", par->extradata[i]);
+        }
+        bstr_xappend0(NULL, &s, "\n");
+    }
+
+    if (ok && extradata_size <= PROBE_CACHE_MAX_EXTRADATA) {
+        if (!mp_kv_log_set(c->kv, c->key, s, c->mtime))
+            MP_WARN(demuxer, "Could not write probe cache entry.\n");
+    }
+    talloc_free(s.start);
+}
+
 static int lavf_check_file(demuxer_t *demuxer, enum demux_check check)
 {
     lavf_priv_t *priv = demuxer->priv;
@@ -453,6 +855,12 @@ static int lavf_check_file(demuxer_t *demuxer, enum demux_check check)
         }
     }
 
+    // Trust the previous probing result for unchanged files.
+    const AVInputFormat *cached_format = NULL;
+    const char *cached_name = probe_cache_get_format(priv->probe_cache, check);
+    if (!forced_format && cached_name)
+        cached_format = av_find_input_format(cached_name);
+
     // HLS streams seems to be not well tagged, so matching mime type is not
     // enough. Strip URL parameters and match extension.
     bstr ext = bstr_get_ext(bstr_split(bstr0(priv->filename), "?#", NULL));
@@ -471,8 +879,8 @@ static int lavf_check_file(demuxer_t *demuxer, enum demux_check check)
     do {
         int score = 0;
 
-        if (forced_format) {
-            priv->avif = forced_format;
+        if (forced_format || cached_format) {
+            priv->avif = forced_format ? forced_format : cached_format;
             score = AVPROBE_SCORE_MAX;
         } else {
             int nsize = av_clip(avpd.buf_size * 2, INITIAL_PROBE_SIZE,
@@ -488,7 +896,8 @@ static int lavf_check_file(demuxer_t *demuxer, enum demux_check check)
         if (priv->avif) {
             MP_VERBOSE(demuxer, "Found '%s' at score=%d size=%d%s.\n",
                        priv->avif->name, score, avpd.buf_size,
-                       forced_format ? " (forced)" : "");
+                       forced_format ? " (forced)" :
+                       cached_format ? " (cached)" : "");
 
             for (int n = 0; lavfdopts->hacks && format_hacks[n].ff_name; n++) {
                 const struct format_hack *entry = &format_hacks[n];
@@ -971,6 +1380,8 @@ static int demux_open_lavf(demuxer_t *demuxer, enum demux_check check)
     priv->opts = mp_get_config_group(priv, demuxer->global, &demux_lavf_conf);
     struct demux_lavf_opts *lavfdopts = priv->opts;
 
+    priv->probe_cache = open_probe_cache(demuxer);
+
     if (lavf_check_file(demuxer, check) < 0)
         goto fail;
 
@@ -1088,6 +1499,15 @@ static int demux_open_lavf(demuxer_t *demuxer, enum demux_check check)
     }
     if (demuxer->params && demuxer->params->skip_lavf_probing)
         probeinfo = false;
+    int header_streams = avfc->nb_streams;
+    if (probeinfo && priv->probe_cache) {
+        if (probe_cache_apply(demuxer)) {
+            MP_VERBOSE(demuxer, "Using cached stream info.\n");
+            probeinfo = false;
+        } else if (priv->probe_cache->num_streams) {
+            MP_VERBOSE(demuxer, "Cached stream info does not match.\n");
+        }
+    }
     if (probeinfo) {
         if (avformat_find_stream_info(avfc, NULL) < 0) {
             MP_ERR(demuxer, "av_find_stream_info() failed\n");
@@ -1096,7 +1516,11 @@ static int demux_open_lavf(demuxer_t *demuxer, enum demux_check check)
 
         MP_VERBOSE(demuxer, "avformat_find_stream_info() finished after %"PRId64
                    " bytes.\n", stream_tell(priv->stream));
+
+        if (priv->probe_cache)
+            probe_cache_store(demuxer, check, header_streams);
     }
+    TA_FREEP(&priv->probe_cache);
 
     for (int i = 0; i < avfc->nb_chapters; i++) {
         AVChapter *c = avfc->chapters[i];
@@ -1176,6 +1600,7 @@ fail:
     if (!priv->avfc)
         avformat_free_context(avfc);
     av_dict_free(&dopts);
+    TA_FREEP(&priv->probe_cache);
 
     return -1;
 }
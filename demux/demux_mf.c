@@ -15,6 +15,8 @@
  * License along with mpv.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <dirent.h>
+#include <limits.h>
 #include <math.h>
 #include <stdbool.h>
 #include <stdio.h>
@@ -30,6 +32,9 @@
 #include "options/m_config.h"
 #include "options/path.h"
 #include "misc/ctype.h"
+#include "misc/thread_pool.h"
+#include "misc/thread_tools.h"
+#include "osdep/threads.h"
 
 #include "stream/stream.h"
 #include "demux.h"
@@ -38,6 +43,22 @@
 
 #define MF_MAX_FILE_SIZE (1024 * 1024 * 256)
 
+// A frame file read on a worker thread. Owned by the demuxer, unless it was
+// abandoned while the read was still in progress; then the worker frees it.
+struct mf_job {
+    struct mpv_global *global;
+    struct mp_cancel *cancel;
+    int stream_origin;
+    char *filename;
+    int frame;
+    // Protected by mf_t.lock.
+    bool done;
+    bool abandoned;
+    struct demux_packet *pkt;
+    mp_mutex *lock;
+    mp_cond *wakeup;
+};
+
 typedef struct mf {
     struct mp_log *log;
     struct sh_stream *sh;
@@ -46,6 +67,14 @@ typedef struct mf {
     char **names;
     // optional
     struct stream **streams;
+
+    // Readahead of the frames following curr_frame (--mf-readahead).
+    struct mp_thread_pool *pool;
+    int readahead;
+    mp_mutex lock;
+    mp_cond wakeup;
+    struct mf_job **jobs; // consecutive frames, in order
+    int num_jobs;
 } mf_t;
 
 
@@ -55,6 +84,91 @@ static void mf_add(mf_t *mf, const char *fname)
     MP_TARRAY_APPEND(mf, mf->names, mf->nr_of_files, entry);
 }
 
+static int cmp_int(const void *a, const void *b)
+{
+    int ia = *(const int *)a, ib = *(const int *)b;
+    return ia < ib ? -1 : ia > ib;
+}
+
+// List the files matching the printf pattern from a single scan of the
+// directory, instead of probing each possible file name. fname is a buffer
+// for formatting file names. Returns false if the directory can't be listed
+// this way, or if nothing matched, and the caller has to probe the names.
+// Names are compared byte by byte, so on case-insensitive or normalizing
+// filesystems the probing can find files the scan misses.
+static bool scan_mf_pattern(mf_t *mf, const char *filename, char *fname,
+                            size_t fname_avail)
+{
+    const char *base = mp_basename(filename);
+    for (const char *c = filename; c < base; c++) {
+        if (*c == '%')
+            return false;
+    }
+
+    void *tmp = talloc_new(NULL);
+    char *dir = bstrdup0(tmp, mp_dirname(filename));
+    DIR *dp = opendir(dir);
+    if (!dp) {
+        talloc_free(tmp);
+        return false;
+    }
+
+    // Literal part of the pattern before the number.
+    bstr prefix = {0};
+    for (const char *c = base; *c; c++) {
+        if (c[0] == '%' && c[1] != '%')
+            break;
+        c += c[0] == '%';
+        bstr_xappend(tmp, &prefix, (bstr){(char *)c, 1});
+    }
+
+    int *nums = NULL;
+    int num_nums = 0;
+    struct dirent *ep;
+    while ((ep = readdir(dp))) {
+        bstr name = bstr0(ep->d_name);
+        if (!bstr_eatstart(&name, prefix))
+            continue;
+        // Try each length of the leading digits, because the pattern may
+        // continue with digits. The formatted name must match exactly, which
+        // also takes care of field widths.
+        int64_t num = 0;
+        for (int len = 0; len <= name.len; len++) {
+            if (len > 0) {
+                if (!mp_isdigit(name.start[len - 1]))
+                    break;
+                num = num * 10 + name.start[len - 1] - '0';
+                if (num > INT_MAX)
+                    break;
+            }
+            int r = snprintf(fname, fname_avail, filename, (int)num);
+            if (r >= 0 && r < fname_avail &&
+                strcmp(mp_basename(fname), ep->d_name) == 0)
+            {
+                MP_TARRAY_APPEND(tmp, nums, num_nums, num);
+                break;
+            }
+        }
+    }
+    closedir(dp);
+
+    // Same result as probing from 0 and giving up after 5 missing files.
+    // (Each number can match only one name, so there are no duplicates.)
+    if (num_nums)
+        qsort(nums, num_nums, sizeof(nums[0]), cmp_int);
+    int added = 0;
+    for (int n = 0; n < num_nums; n++) {
+        if (nums[n] - n >= 5)
+            break;
+        snprintf(fname, fname_avail, filename, nums[n]);
+        mf_add(mf, fname);
+        added++;
+    }
+
+    talloc_free(tmp);
+    return added > 0;
+}
+
 static mf_t *open_mf_pattern(void *talloc_ctx, struct demuxer *d, char *filename)
 {
     struct mp_log *log = d->log;
@@ -197,6 +311,9 @@ static mf_t *open_mf_pattern(void *talloc_ctx, struct demuxer *d, char *filename
 
     mp_info(log, "search expr: %s\n", filename);
 
+    if (scan_mf_pattern(mf, filename, fname, fname_avail))
+        goto exit_mf;
+
     while (error_count < 5) {
         if (snprintf(fname, fname_avail, filename, count++) >= fname_avail) {
             mp_err(log, "format result too long: '%s'\n", filename);
@@ -223,6 +340,130 @@ static mf_t *open_mf_single(void *talloc_ctx, struct mp_log *log, char *filename
     return mf;
 }
 
+// Read the whole file into a new packet. Returns NULL on failure.
+static struct demux_packet *read_frame(struct stream *stream)
+{
+    stream_seek(stream, 0);
+    int64_t size = stream_get_size(stream);
+    if (size > MF_MAX_FILE_SIZE)
+        return NULL;
+
+    if (size > 0) {
+        // Read directly into the packet if the size is known.
+        struct demux_packet *dp = new_demux_packet(size);
+        if (!dp)
+            return NULL;
+        int len = stream_read(stream, dp->buffer, size);
+        if (len <= 0) {
+            free_demux_packet(dp);
+            return NULL;
+        }
+        demux_packet_shorten(dp, len);
+        return dp;
+    }
+
+    struct demux_packet *dp = NULL;
+    bstr data = stream_read_complete(stream, NULL, MF_MAX_FILE_SIZE);
+    if (data.len)
+        dp = new_demux_packet_from(data.start, data.len);
+    talloc_free(data.start);
+    return dp;
+}
+
+static struct demux_packet *open_and_read_frame(struct mpv_global *global,
+                                                struct mp_cancel *cancel,
+                                                int stream_origin,
+                                                const char *filename)
+{
+    if (!filename)
+        return NULL;
+    struct stream *stream = stream_create(filename, stream_origin | STREAM_READ,
+                                          cancel, global);
+    if (!stream)
+        return NULL;
+    struct demux_packet *dp = read_frame(stream);
+    free_stream(stream);
+    return dp;
+}
+
+static void run_job(void *ctx)
+{
+    struct mf_job *job = ctx;
+
+    struct demux_packet *dp = open_and_read_frame(job->global, job->cancel,
+                                                  job->stream_origin,
+                                                  job->filename);
+
+    mp_mutex_lock(job->lock);
+    bool abandoned = job->abandoned;
+    job->pkt = dp;
+    job->done = true;
+    mp_cond_broadcast(job->wakeup);
+    mp_mutex_unlock(job->lock);
+
+    if (abandoned) {
+        free_demux_packet(dp);
+        talloc_free(job);
+    }
+}
+
+// Remove the job from the readahead window. Aborts it if it's still running.
+static void drop_job(mf_t *mf, int index)
+{
+    struct mf_job *job = mf->jobs[index];
+    MP_TARRAY_REMOVE_AT(mf->jobs, mf->num_jobs, index);
+
+    mp_mutex_lock(&mf->lock);
+    bool done = job->done;
+    if (!done) {
+        job->abandoned = true;
+        mp_cancel_trigger(job->cancel);
+    }
+    mp_mutex_unlock(&mf->lock);
+
+    if (done) {
+        free_demux_packet(job->pkt);
+        talloc_free(job);
+    }
+}
+
+// Make the readahead window start at curr_frame, and fill it.
+static void update_readahead(struct demuxer *demuxer)
+{
+    mf_t *mf = demuxer->priv;
+
+    if (mf->num_jobs && (mf->jobs[0]->frame > mf->curr_frame ||
+                         mf->jobs[mf->num_jobs - 1]->frame < mf->curr_frame))
+    {
+        while (mf->num_jobs)
+            drop_job(mf, mf->num_jobs - 1);
+    }
+    while (mf->num_jobs && mf->jobs[0]->frame < mf->curr_frame)
+        drop_job(mf, 0);
+
+    while (mf->num_jobs < mf->readahead) {
+        int frame = mf->curr_frame + mf->num_jobs;
+        if (frame >= mf->nr_of_files)
+            break;
+        struct mf_job *job = talloc_ptrtype(NULL, job);
+        *job = (struct mf_job){
+            .global = demuxer->global,
+            .cancel = mp_cancel_new(job),
+            .stream_origin = demuxer->stream_origin,
+            .filename = talloc_strdup(job, mf->names[frame]),
+            .frame = frame,
+            .lock = &mf->lock,
+            .wakeup = &mf->wakeup,
+        };
+        mp_cancel_set_parent(job->cancel, demuxer->cancel);
+        if (!mp_thread_pool_queue(mf->pool, run_job, job)) {
+            talloc_free(job);
+            break;
+        }
+        MP_TARRAY_APPEND(mf, mf->jobs, mf->num_jobs, job);
+    }
+}
+
 static void demux_seek_mf(demuxer_t *demuxer, double seek_pts, int flags)
 {
     mf_t *mf = demuxer->priv;
@@ -243,45 +484,51 @@ static bool demux_mf_read_packet(struct demuxer *demuxer,
     mf_t *mf = demuxer->priv;
     if (mf->curr_frame >= mf->nr_of_files)
         return false;
-    bool ok = false;
-
-    struct stream *entry_stream = NULL;
-    if (mf->streams)
-        entry_stream = mf->streams[mf->curr_frame];
-    struct stream *stream = entry_stream;
-    if (!stream) {
-        char *filename = mf->names[mf->curr_frame];
-        if (filename) {
-            stream = stream_create(filename, demuxer->stream_origin | STREAM_READ,
-                                   demuxer->cancel, demuxer->global);
+
+    struct demux_packet *dp = NULL;
+    bool done = false;
+
+    if (mf->pool) {
+        update_readahead(demuxer);
+        if (mf->num_jobs) {
+            struct mf_job *job = mf->jobs[0];
+            MP_TARRAY_REMOVE_AT(mf->jobs, mf->num_jobs, 0);
+            mp_mutex_lock(&mf->lock);
+            while (!job->done)
+                mp_cond_wait(&mf->wakeup, &mf->lock);
+            mp_mutex_unlock(&mf->lock);
+            dp = job->pkt;
+            talloc_free(job);
+            done = true;
         }
     }
 
-    if (stream) {
-        stream_seek(stream, 0);
-        bstr data = stream_read_complete(stream, NULL, MF_MAX_FILE_SIZE);
-        if (data.len) {
-            demux_packet_t *dp = new_demux_packet(data.len);
-            if (dp) {
-                memcpy(dp->buffer, data.start, data.len);
-                dp->pts = mf->curr_frame / mf->sh->codec->fps;
-                dp->keyframe = true;
-                dp->stream = mf->sh->index;
-                *pkt = dp;
-                ok = true;
-            }
+    if (!done) {
+        if (mf->streams && mf->streams[mf->curr_frame]) {
+            dp = read_frame(mf->streams[mf->curr_frame]);
+        } else {
+            dp = open_and_read_frame(demuxer->global, demuxer->cancel,
+                                     demuxer->stream_origin,
+                                     mf->names[mf->curr_frame]);
         }
-        talloc_free(data.start);
     }
 
-    if (stream && stream != entry_stream)
-        free_stream(stream);
+    if (dp) {
+        dp->pts = mf->curr_frame / mf->sh->codec->fps;
+        dp->keyframe = true;
+        dp->stream = mf->sh->index;
+        *pkt = dp;
+    }
 
     mf->curr_frame++;
 
-    if (!ok)
+    if (!dp)
         MP_ERR(demuxer, "error reading image file\n");
 
+    // Queue the next frame while the demuxer layer processes this one.
+    if (mf->pool)
+        update_readahead(demuxer);
+
     return true;
 }
 
@@ -414,6 +661,13 @@ static int demux_open_mf(demuxer_t *demuxer, enum demux_check check)
     demuxer->seekable = true;
     demuxer->duration = mf->nr_of_files / mf->sh->codec->fps;
 
+    mf->readahead = demuxer->opts->mf_readahead;
+    if (!mf->streams && mf->nr_of_files > 1 && mf->readahead > 0) {
+        mp_mutex_init(&mf->lock);
+        mp_cond_init(&mf->wakeup);
+        mf->pool = mp_thread_pool_create(mf, 0, 0, mf->readahead);
+    }
+
     return 0;
 
 error:
@@ -422,6 +676,16 @@ error:
 
 static void demux_close_mf(demuxer_t *demuxer)
 {
+    mf_t *mf = demuxer->priv;
+    if (!mf || !mf->pool)
+        return;
+
+    while (mf->num_jobs)
+        drop_job(mf, mf->num_jobs - 1);
+    // Waits until the abandoned jobs are done.
+    TA_FREEP(&mf->pool);
+    mp_cond_destroy(&mf->wakeup);
+    mp_mutex_destroy(&mf->lock);
 }
 
 const demuxer_desc_t demuxer_desc_mf = {
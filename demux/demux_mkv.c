@@ -2445,97 +2445,151 @@ static int demux_mkv_open(demuxer_t *demuxer, enum demux_check check)
     return 0;
 }
 
-// Read the laced block data at the current stream position (until endpos as
-// indicated by the block length field) into individual buffers.
-static int demux_mkv_read_block_lacing(struct block_info *block, int type,
-                                       struct stream *s, uint64_t endpos)
+// Parse the lacing header in [*p, end) into lace_size[]. payload is the number
+// of bytes from *p to the end of the block. Returns the number of laces, 0 if
+// the header continues past end, or -1 if it is broken.
+static int parse_lacing(int type, const uint8_t **p, const uint8_t *end,
+                        uint64_t payload, uint32_t lace_size[MAX_NUM_LACES])
 {
-    int laces;
-    uint32_t lace_size[MAX_NUM_LACES];
-
-
+    const uint8_t *start = *p;
     if (type == 0) {           /* no lacing */
-        laces = 1;
-        lace_size[0] = endpos - stream_tell(s);
-    } else {
-        laces = stream_read_char(s);
-        if (laces < 0 || stream_tell(s) > endpos)
-            goto error;
-        laces += 1;
-
-        switch (type) {
-        case 1: {              /* xiph lacing */
-            uint32_t total = 0;
-            for (int i = 0; i < laces - 1; i++) {
-                lace_size[i] = 0;
-                uint8_t t;
-                do {
-                    t = stream_read_char(s);
-                    if (s->eof || stream_tell(s) >= endpos)
-                        goto error;
-                    lace_size[i] += t;
-                } while (t == 0xFF);
-                total += lace_size[i];
-            }
-            uint32_t rest_length = endpos - stream_tell(s);
-            lace_size[laces - 1] = rest_length - total;
-            break;
-        }
+        lace_size[0] = payload;
+        return payload <= UINT32_MAX ? 1 : -1;
+    }
 
-        case 2: {              /* fixed-size lacing */
-            uint32_t full_length = endpos - stream_tell(s);
-            for (int i = 0; i < laces; i++)
-                lace_size[i] = full_length / laces;
-            break;
+    if (*p >= end)
+        return 0;
+    int laces = *(*p)++ + 1;
+    uint64_t total = 0;
+
+    switch (type) {
+    case 1: {                  /* xiph lacing */
+        for (int i = 0; i < laces - 1; i++) {
+            lace_size[i] = 0;
+            uint8_t t;
+            do {
+                if (*p >= end)
+                    return 0;
+                t = *(*p)++;
+                lace_size[i] += t;
+            } while (t == 0xFF);
+            total += lace_size[i];
         }
+        break;
+    }
 
-        case 3: {              /* EBML lacing */
-            uint64_t num = ebml_read_length(s);
-            if (num == EBML_UINT_INVALID || stream_tell(s) >= endpos)
-                goto error;
-
-            uint32_t total = lace_size[0] = num;
-            for (int i = 1; i < laces - 1; i++) {
-                int64_t snum = ebml_read_signed_length(s);
-                if (snum == EBML_INT_INVALID || stream_tell(s) >= endpos)
-                    goto error;
-                lace_size[i] = lace_size[i - 1] + snum;
-                total += lace_size[i];
-            }
-            uint32_t rest_length = endpos - stream_tell(s);
-            lace_size[laces - 1] = rest_length - total;
-            break;
+    case 2: {                  /* fixed-size lacing */
+        uint64_t full_length = payload - (*p - start);
+        if (full_length % laces)
+            return -1;
+        for (int i = 0; i < laces; i++)
+            lace_size[i] = full_length / laces;
+        return laces;
+    }
+
+    case 3: {                  /* EBML lacing */
+        const uint8_t *prev = *p;
+        uint64_t num = ebml_buf_read_length(p, end);
+        if (num == EBML_UINT_INVALID)
+            return end - prev < 8 ? 0 : -1;
+        total = lace_size[0] = num;
+        for (int i = 1; i < laces - 1; i++) {
+            prev = *p;
+            int64_t snum = ebml_buf_read_signed_length(p, end);
+            if (snum == EBML_INT_INVALID)
+                return end - prev < 8 ? 0 : -1;
+            lace_size[i] = lace_size[i - 1] + snum;
+            total += lace_size[i];
         }
+        break;
+    }
 
-        default:
-            goto error;
-        }
+    default:
+        return -1;
     }
 
-    for (int i = 0; i < laces; i++) {
-        uint32_t size = lace_size[i];
-        if (stream_tell(s) + size > endpos || size > (1 << 30))
-            goto error;
-        int pad = MPMAX(AV_INPUT_BUFFER_PADDING_SIZE, AV_LZO_INPUT_PADDING);
-        AVBufferRef *buf = av_buffer_alloc(size + pad);
-        if (!buf)
-            goto error;
-        buf->size = size;
-        if (stream_read(s, buf->data, buf->size) != buf->size) {
-            av_buffer_unref(&buf);
-            goto error;
-        }
-        memset(buf->data + buf->size, 0, pad);
-        block->laces[block->num_laces++] = buf;
+    uint64_t header = *p - start;
+    if (header > payload || total > payload - header)
+        return -1;
+    lace_size[laces - 1] = payload - header - total;
+    return laces;
+}
+
+// Read a Xiph lacing header directly from the stream, for headers too large
+// for parse_lacing(). Leaves the stream positioned after the header. Returns
+// the number of laces, or -1 on error.
+static int read_xiph_lacing(struct stream *s, uint64_t endpos,
+                            uint32_t lace_size[MAX_NUM_LACES])
+{
+    int laces = stream_read_char(s);
+    if (laces < 0 || stream_tell(s) > endpos)
+        return -1;
+    laces += 1;
+
+    uint64_t total = 0;
+    for (int i = 0; i < laces - 1; i++) {
+        lace_size[i] = 0;
+        uint8_t t;
+        do {
+            t = stream_read_char(s);
+            if (s->eof || stream_tell(s) >= endpos)
+                return -1;
+            lace_size[i] += t;
+        } while (t == 0xFF);
+        total += lace_size[i];
     }
 
-    if (stream_tell(s) != endpos)
-        goto error;
+    uint64_t rest = endpos - stream_tell(s);
+    if (total > rest)
+        return -1;
+    lace_size[laces - 1] = rest - total;
+    return laces;
+}
 
-    return 0;
+// Read the block payload at the current stream position (until endpos as
+// indicated by the block length field) and split it into laces. If allow_ref
+// is set, a lace may be a read-only reference to data owned by the stream.
+// Other laces are read into a single allocation, in which each lace is
+// followed by its own zeroed padding.
+static int demux_mkv_read_block_lacing(struct block_info *block, int laces,
+                                       uint32_t lace_size[MAX_NUM_LACES],
+                                       struct stream *s, uint64_t endpos,
+                                       bool allow_ref)
+{
+    uint64_t total = endpos - stream_tell(s);
+    if (total > (1 << 30))
+        return 1;
 
- error:
-    return 1;
+    int pad = MPMAX(AV_INPUT_BUFFER_PADDING_SIZE, AV_LZO_INPUT_PADDING);
+    AVBufferRef *buf = NULL;
+    uint8_t *dst = NULL;
+    int res = 1;
+    for (int i = 0; i < laces; i++) {
+        int size = lace_size[i];
+        AVBufferRef *ref = allow_ref ? stream_read_ref(s, size, pad) : NULL;
+        if (!ref) {
+            if (!buf) {
+                buf = av_buffer_alloc(total + (uint64_t)laces * pad);
+                if (!buf)
+                    goto done;
+                dst = buf->data;
+            }
+            if (stream_read(s, dst, size) != size)
+                goto done;
+            memset(dst + size, 0, pad);
+            ref = av_buffer_ref(buf);
+            if (!ref)
+                goto done;
+            ref->data = dst;
+            ref->size = size;
+            dst += size + pad;
+        }
+        block->laces[block->num_laces++] = ref;
+    }
+    res = 0;
+done:
+    av_buffer_unref(&buf);
+    return res;
 }
 
 // Return whether the packet was handled & freed.
@@ -2864,57 +2918,134 @@ static void index_block(demuxer_t *demuxer, struct block_info *block)
     }
 }
 
-static int read_block(demuxer_t *demuxer, int64_t end, struct block_info *block)
+// Block and cluster element headers are parsed from a copy of the next bytes in
+// the stream buffer, instead of reading them byte by byte from the stream.
+// This is large enough for the headers of any element, the small elements in
+// a BlockGroup, and the lacing headers of most blocks.
+#define PEEK_SIZE 64
+
+struct peek_buf {
+    int64_t pos;            // stream position of data[0]
+    const uint8_t *end;     // end of valid data
+    uint8_t *data;
+    uint8_t inline_data[PEEK_SIZE];
+};
+
+static void peek_free(struct peek_buf *b)
+{
+    if (b->data != b->inline_data)
+        TA_FREEP(&b->data);
+}
+
+static void peek_stream(stream_t *s, struct peek_buf *b, int size)
+{
+    if (size > PEEK_SIZE) {
+        if (b->data == b->inline_data)
+            b->data = NULL;
+        b->data = talloc_realloc_size(NULL, b->data, size);
+    } else {
+        peek_free(b);
+        b->data = b->inline_data;
+    }
+    b->pos = stream_tell(s);
+    b->end = b->data + stream_read_peek(s, b->data, size);
+}
+
+static int64_t peek_pos(struct peek_buf *b, const uint8_t *p)
+{
+    return b->pos + (p - b->data);
+}
+
+// Parse a Block or SimpleBlock, whose length field is at p in the peek buffer.
+// Leaves the stream positioned after the block.
+static int read_block(demuxer_t *demuxer, int64_t end, struct block_info *block,
+                      struct peek_buf *b, const uint8_t *p)
 {
     mkv_demuxer_t *mkv_d = (mkv_demuxer_t *) demuxer->priv;
     stream_t *s = demuxer->stream;
-    uint64_t num;
-    int16_t time;
-    uint64_t length;
+    uint32_t lace_size[MAX_NUM_LACES];
 
     free_block(block);
-    length = ebml_read_length(s);
-    if (!length || length > 500000000 || stream_tell(s) + length > (uint64_t)end)
+    uint64_t length = ebml_buf_read_length(&p, b->end);
+    int64_t start = peek_pos(b, p);
+    if (!length || length > 500000000 || start + length > (uint64_t)end) {
+        stream_seek_skip(s, start);
         return -1;
+    }
 
-    uint64_t endpos = stream_tell(s) + length;
+    uint64_t endpos = start + length;
+    const uint8_t *hdr_end = b->end;
+    if (hdr_end - p > length)
+        hdr_end = p + length;
     int res = -1;
 
     // Parse header of the Block element
     /* first byte(s): track num */
-    num = ebml_read_length(s);
-    if (num == EBML_UINT_INVALID || stream_tell(s) >= endpos)
+    uint64_t num = ebml_buf_read_length(&p, hdr_end);
+    if (num == EBML_UINT_INVALID || p >= hdr_end)
         goto exit;
 
     /* time (relative to cluster time) */
-    if (stream_tell(s) + 3 > endpos)
+    if (hdr_end - p < 3)
         goto exit;
-    uint8_t c1 = stream_read_char(s);
-    uint8_t c2 = stream_read_char(s);
-    time = c1 << 8 | c2;
-
-    uint8_t header_flags = stream_read_char(s);
-
-    block->filepos = stream_tell(s);
+    int16_t time = p[0] << 8 | p[1];
+    uint8_t header_flags = p[2];
+    p += 3;
 
-    int lace_type = (header_flags >> 1) & 0x03;
-    if (demux_mkv_read_block_lacing(block, lace_type, s, endpos))
-        goto exit;
+    block->filepos = peek_pos(b, p);
 
-    if (block->simple)
-        block->keyframe = header_flags & 0x80;
-    block->timecode = time * mkv_d->tc_scale + mkv_d->cluster_tc;
     for (int i = 0; i < mkv_d->num_tracks; i++) {
         if (mkv_d->tracks[i]->tnum == num) {
             block->track = mkv_d->tracks[i];
             break;
         }
     }
+
+    int lace_type = (header_flags >> 1) & 0x03;
+    int64_t lacing_pos = peek_pos(b, p);
+    uint64_t payload = endpos - lacing_pos;
+    int laces = parse_lacing(lace_type, &p, hdr_end, payload, lace_size);
+    int64_t data_pos = peek_pos(b, p);
+    if (laces == 0) {
+        // Lacing header larger than the peek buffer. This happens only with
+        // Xiph lacing and many or large laces.
+        // The peek starts at the element, not at the lacing header.
+        int64_t skip = lacing_pos - stream_tell(s);
+        peek_stream(s, b, skip + MPMIN(payload, 1 << 20));
+        p = b->data + (lacing_pos - b->pos);
+        hdr_end = b->end;
+        if (hdr_end - b->data > endpos - b->pos)
+            hdr_end = b->data + (endpos - b->pos);
+        laces = parse_lacing(lace_type, &p, hdr_end, payload, lace_size);
+        data_pos = peek_pos(b, p);
+        if (laces == 0 && lace_type == 1) {
+            // Doesn't fit into the stream buffer either.
+            if (!stream_seek_skip(s, lacing_pos))
+                goto exit;
+            laces = read_xiph_lacing(s, endpos, lace_size);
+            data_pos = stream_tell(s);
+        }
+    }
+    if (laces <= 0)
+        goto exit;
+
     if (!block->track) {
         res = 0;
         goto exit;
     }
 
+    // Subtitle packets are small, but can be kept around for a long time,
+    // which would keep the stream's mapped file data alive.
+    bool allow_ref = block->track->type != MATROSKA_TRACK_SUBTITLE;
+    if (!stream_seek_skip(s, data_pos) ||
+        demux_mkv_read_block_lacing(block, laces, lace_size, s, endpos,
+                                    allow_ref))
+        goto exit;
+
+    if (block->simple)
+        block->keyframe = header_flags & 0x80;
+    block->timecode = time * mkv_d->tc_scale + mkv_d->cluster_tc;
+
     if (stream_tell(s) != endpos)
         goto exit;
 
@@ -3059,12 +3190,19 @@ static int read_block_group(demuxer_t *demuxer, int64_t end,
 {
     mkv_demuxer_t *mkv_d = (mkv_demuxer_t *) demuxer->priv;
     stream_t *s = demuxer->stream;
+    struct peek_buf b = {0};
     *block = (struct block_info){ .keyframe = true };
 
     while (stream_tell(s) < end) {
-        switch (ebml_read_id(s)) {
+        peek_stream(s, &b, PEEK_SIZE);
+        const uint8_t *p = b.data;
+        const uint8_t *elem_end = b.end;
+        if (elem_end - p > end - b.pos)
+            elem_end = p + (end - b.pos);
+
+        switch (ebml_buf_read_id(&p, elem_end)) {
         case MATROSKA_ID_BLOCKDURATION:
-            block->duration = ebml_read_uint(s);
+            block->duration = ebml_buf_read_uint(&p, elem_end);
             if (block->duration == EBML_UINT_INVALID)
                 goto error;
             block->duration *= mkv_d->tc_scale;
@@ -3072,51 +3210,65 @@ static int read_block_group(demuxer_t *demuxer, int64_t end,
             break;
 
         case MATROSKA_ID_DISCARDPADDING:
-            block->discardpadding = ebml_read_uint(s);
+            block->discardpadding = ebml_buf_read_uint(&p, elem_end);
             if (block->discardpadding == EBML_UINT_INVALID)
                 goto error;
             break;
 
         case MATROSKA_ID_BLOCK:
-            if (read_block(demuxer, end, block) < 0)
+            if (read_block(demuxer, end, block, &b, p) < 0)
                 goto error;
-            break;
+            continue;
 
         case MATROSKA_ID_REFERENCEBLOCK:;
-            int64_t num = ebml_read_int(s);
+            int64_t num = ebml_buf_read_int(&p, elem_end);
             if (num == EBML_INT_INVALID)
                 goto error;
             block->keyframe = false;
             break;
 
         case MATROSKA_ID_BLOCKADDITIONS:;
+            stream_seek_skip(s, peek_pos(&b, p));
             struct ebml_block_additions additions = {0};
             struct ebml_parse_ctx parse_ctx = {demuxer->log};
             if (ebml_read_element(s, &parse_ctx, &additions,
                                   &ebml_block_additions_desc) < 0)
+            {
+                peek_free(&b);
                 return -1;
+            }
             if (additions.n_block_more > 0 && !block->additions) {
                 block->additions = talloc_dup(NULL, &additions);
                 talloc_steal(block->additions, parse_ctx.talloc_ctx);
                 parse_ctx.talloc_ctx = NULL;
             }
             talloc_free(parse_ctx.talloc_ctx);
-            break;
+            continue;
 
         case MATROSKA_ID_CLUSTER:
         case EBML_ID_INVALID:
             goto error;
 
-        default:
-            if (ebml_read_skip(demuxer->log, end, s) != 0)
+        default: ;
+            uint64_t length = ebml_buf_read_length(&p, elem_end);
+            int64_t pos = peek_pos(&b, p);
+            if (length == EBML_UINT_INVALID || length > end - pos) {
+                MP_ERR(demuxer, "Invalid EBML length at position %"PRId64"\n",
+                       pos);
                 goto error;
-            break;
+            }
+            if (!stream_seek_skip(s, pos + length))
+                goto error;
+            continue;
         }
+        stream_seek_skip(s, peek_pos(&b, p));
     }
 
+    peek_free(&b);
     return block->num_laces ? 1 : 0;
 
 error:
+    peek_free(&b);
     free_block(block);
     return -1;
 }
@@ -3131,10 +3283,18 @@ static int read_next_block_into_queue(demuxer_t *demuxer)
 
     while (1) {
         while (stream_tell(s) < mkv_d->cluster_end) {
-            int64_t start_filepos = stream_tell(s);
-            switch (ebml_read_id(s)) {
+            struct peek_buf b = {0};
+            peek_stream(s, &b, PEEK_SIZE);
+            const uint8_t *p = b.data;
+            uint32_t id = ebml_buf_read_id(&p, b.end);
+            if (id == EBML_ID_INVALID) {
+                stream_seek_skip(s, b.pos + 1);
+                goto find_next_cluster;
+            }
+            switch (id) {
             case MATROSKA_ID_TIMECODE: {
-                uint64_t num = ebml_read_uint(s);
+                uint64_t num = ebml_buf_read_uint(&p, b.end);
+                stream_seek_skip(s, peek_pos(&b, p));
                 if (num == EBML_UINT_INVALID)
                     goto find_next_cluster;
                 mkv_d->cluster_tc = num * mkv_d->tc_scale;
@@ -3142,7 +3302,8 @@ static int read_next_block_into_queue(demuxer_t *demuxer)
             }
 
             case MATROSKA_ID_BLOCKGROUP: {
-                int64_t end = ebml_read_length(s);
+                int64_t end = ebml_buf_read_length(&p, b.end);
+                stream_seek_skip(s, peek_pos(&b, p));
                 end += stream_tell(s);
                 if (end > mkv_d->cluster_end)
                     goto find_next_cluster;
@@ -3157,7 +3318,8 @@ static int read_next_block_into_queue(demuxer_t *demuxer)
 
             case MATROSKA_ID_SIMPLEBLOCK: {
                 block = (struct block_info){ .simple = true };
-                int res = read_block(demuxer, mkv_d->cluster_end, &block);
+                int res = read_block(demuxer, mkv_d->cluster_end, &block, &b, p);
+                peek_free(&b);
                 if (res > 0)
                     goto add_block;
                 free_block(&block);
@@ -3167,13 +3329,12 @@ static int read_next_block_into_queue(demuxer_t *demuxer)
             }
 
             case MATROSKA_ID_CLUSTER:
-                mkv_d->cluster_start = start_filepos;
+                mkv_d->cluster_start = b.pos;
+                stream_seek_skip(s, peek_pos(&b, p));
                 goto next_cluster;
 
-            case EBML_ID_INVALID:
-                goto find_next_cluster;
-
             default: ;
+                stream_seek_skip(s, peek_pos(&b, p));
                 if (ebml_read_skip(demuxer->log, mkv_d->cluster_end, s) != 0)
                     goto find_next_cluster;
                 break;
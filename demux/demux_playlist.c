@@ -26,6 +26,7 @@
 #include "common/msg.h"
 #include "common/playlist.h"
 #include "misc/charset_conv.h"
+#include "misc/thread_pool.h"
 #include "misc/thread_tools.h"
 #include "options/path.h"
 #include "player/core.h"
@@ -390,16 +391,47 @@ static int parse_txt(struct pl_parser *p)
 
 #define MAX_DIR_STACK 20
 
-static bool same_st(struct stat *st1, struct stat *st2)
-{
-    return st1->st_dev == st2->st_dev && st1->st_ino == st2->st_ino;
-}
+// Maximum number of directories read concurrently in recursive mode.
+#define MAX_DIR_THREADS 8
 
 struct pl_dir_entry {
     char *path;
-    char *name;
-    struct stat st;
+    bstr sort_key;
     bool is_dir;
+    struct dir_node *node; // if is_dir and recursive
+};
+
+enum dir_node_state {
+    NODE_NEW,
+    NODE_READING,
+    NODE_DONE,
+};
+
+struct dir_scan {
+    struct pl_parser *p;
+    int dir_mode;
+    struct mp_thread_pool *pool; // NULL if not recursive
+
+    mp_mutex lock;
+    mp_cond wakeup;
+    int pending; // queued jobs, which might still queue more jobs
+};
+
+// A directory to read. Allocated by whoever reads the parent directory, and
+// then owned by whoever reads it (which is signaled by the state). All fields
+// except state are immutable once the state is NODE_DONE.
+struct dir_node {
+    struct dir_scan *scan;
+    struct dir_node *parent;
+    char *path;
+    struct stat st; // not set for the root
+    int depth;
+
+    enum dir_node_state state; // protected by scan->lock
+
+    // Sorted, valid once state == NODE_DONE.
+    struct pl_dir_entry *entries;
+    int num_entries;
 };
 
 static int cmp_dir_entry(const void *a, const void *b)
@@ -407,7 +439,7 @@ static int cmp_dir_entry(const void *a, const void *b)
     struct pl_dir_entry *a_entry = (struct pl_dir_entry*) a;
     struct pl_dir_entry *b_entry = (struct pl_dir_entry*) b;
     if (a_entry->is_dir == b_entry->is_dir) {
-        return mp_natural_sort_cmp(a_entry->name, b_entry->name);
+        return bstrcmp(a_entry->sort_key, b_entry->sort_key);
     } else {
         return a_entry->is_dir ? 1 : -1;
     }
@@ -447,23 +479,60 @@ static bool test_path(struct pl_parser *p, char *path, int autocreate)
     return false;
 }
 
-// Return true if this was a readable directory.
-static bool scan_dir(struct pl_parser *p, char *path,
-                     struct stat *dir_stack, int num_dir_stack, int autocreate)
+static bool is_recursive_entry(struct dir_node *node, struct stat *st)
+{
+    for (struct dir_node *n = node; n && n->parent; n = n->parent) {
+        if (n->st.st_dev == st->st_dev && n->st.st_ino == st->st_ino)
+            return true;
+    }
+    return false;
+}
+
+static void read_dir_job(void *ptr);
+
+// Return whether this is a directory, or false if it should be skipped.
+// Directories are stat()ed only if needed for loop detection, and files not at
+// all if the directory entry says what type it is.
+static bool probe_entry(struct dir_node *node, struct dirent *ep,
+                        const char *file, struct stat *st, bool *is_dir)
+{
+    bool need_st = node->scan->dir_mode == DIR_RECURSIVE;
+#if defined(DT_DIR) && !defined(_WIN32)
+    // (mp_readdir() does not set d_type.)
+    if (ep->d_type == DT_REG) {
+        *is_dir = false;
+        return true;
+    }
+    if (ep->d_type == DT_DIR && !need_st) {
+        *is_dir = true;
+        return true;
+    }
+#endif
+    // Also follows symlinks.
+    *is_dir = stat(file, st) == 0 && S_ISDIR(st->st_mode);
+    if (*is_dir && need_st && is_recursive_entry(node, st)) {
+        MP_VERBOSE(node->scan->p, "Skip recursive entry: %s\n", file);
+        return false;
+    }
+    return true;
+}
+
+// Read the directory, and queue reading its subdirectories if recursive.
+static void read_dir(struct dir_node *node)
 {
-    if (strlen(path) >= 8192 || num_dir_stack == MAX_DIR_STACK)
-        return false; // things like mount bind loops
+    struct dir_scan *scan = node->scan;
+    struct pl_parser *p = scan->p;
+
+    if (strlen(node->path) >= 8192 || node->depth == MAX_DIR_STACK)
+        return; // things like mount bind loops
 
-    DIR *dp = opendir(path);
+    DIR *dp = opendir(node->path);
     if (!dp) {
         MP_ERR(p, "Could not read directory.\n");
-        return false;
+        return;
     }
 
-    struct pl_dir_entry *dir_entries = NULL;
-    int num_dir_entries = 0;
-    int path_len = strlen(path);
-    int dir_mode = p->opts->dir_mode;
+    int path_len = strlen(node->path);
 
     struct dirent *ep;
     while ((ep = readdir(dp))) {
@@ -473,46 +542,150 @@ static bool scan_dir(struct pl_parser *p, char *path,
         if (mp_cancel_test(p->s->cancel))
             break;
 
-        char *file = mp_path_join(p, path, ep->d_name);
+        char *file = mp_path_join(node, node->path, ep->d_name);
 
-        struct stat st;
-        if (stat(file, &st) == 0 && S_ISDIR(st.st_mode)) {
-            if (dir_mode != DIR_IGNORE) {
-                for (int n = 0; n < num_dir_stack; n++) {
-                    if (same_st(&dir_stack[n], &st)) {
-                        MP_VERBOSE(p, "Skip recursive entry: %s\n", file);
-                        goto skip;
-                    }
-                }
+        struct stat st = {0};
+        bool is_dir;
+        if (!probe_entry(node, ep, file, &st, &is_dir))
+            continue;
+        if (is_dir && scan->dir_mode == DIR_IGNORE)
+            continue;
 
-                struct pl_dir_entry d = {file, &file[path_len], st, true};
-                MP_TARRAY_APPEND(p, dir_entries, num_dir_entries, d);
-            }
-        } else {
-            struct pl_dir_entry f = {file, &file[path_len], .is_dir = false};
-            MP_TARRAY_APPEND(p, dir_entries, num_dir_entries, f);
+        struct pl_dir_entry e = {
+            .path = file,
+            .sort_key = mp_natural_sort_key(node, &file[path_len]),
+            .is_dir = is_dir,
+        };
+        if (is_dir && scan->dir_mode == DIR_RECURSIVE) {
+            e.node = talloc_ptrtype(node, e.node);
+            *e.node = (struct dir_node){
+                .scan = scan,
+                .parent = node,
+                .path = file,
+                .st = st,
+                .depth = node->depth + 1,
+            };
         }
-
-        skip: ;
+        MP_TARRAY_APPEND(node, node->entries, node->num_entries, e);
     }
     closedir(dp);
 
-    if (dir_entries)
-        qsort(dir_entries, num_dir_entries, sizeof(dir_entries[0]), cmp_dir_entry);
+    if (node->entries) {
+        qsort(node->entries, node->num_entries, sizeof(node->entries[0]),
+              cmp_dir_entry);
+    }
 
-    for (int n = 0; n < num_dir_entries; n++) {
-        char *file = dir_entries[n].path;
-        if (dir_mode == DIR_RECURSIVE && dir_entries[n].is_dir) {
-            dir_stack[num_dir_stack] = dir_entries[n].st;
-            scan_dir(p, file, dir_stack, num_dir_stack + 1, autocreate);
+    // Queue subdirectories in playlist order, so that the ones needed first
+    // are likely read first. Whatever is not picked up by a worker yet is
+    // read by emit_dir() itself.
+    for (int n = 0; n < node->num_entries; n++) {
+        struct dir_node *sub = node->entries[n].node;
+        if (!sub)
+            continue;
+        mp_mutex_lock(&scan->lock);
+        scan->pending++;
+        mp_mutex_unlock(&scan->lock);
+        if (!mp_thread_pool_queue(scan->pool, read_dir_job, sub)) {
+            mp_mutex_lock(&scan->lock);
+            scan->pending--;
+            mp_mutex_unlock(&scan->lock);
         }
-        else {
-            if (dir_entries[n].is_dir || test_path(p, file, autocreate))
-                playlist_append_file(p->pl, dir_entries[n].path);
+    }
+}
+
+// Read the node, unless someone else is already doing it or has done it.
+static void claim_and_read_dir(struct dir_node *node)
+{
+    struct dir_scan *scan = node->scan;
+
+    mp_mutex_lock(&scan->lock);
+    bool claimed = node->state == NODE_NEW;
+    if (claimed)
+        node->state = NODE_READING;
+    mp_mutex_unlock(&scan->lock);
+
+    if (!claimed)
+        return;
+
+    read_dir(node);
+
+    mp_mutex_lock(&scan->lock);
+    node->state = NODE_DONE;
+    mp_cond_broadcast(&scan->wakeup);
+    mp_mutex_unlock(&scan->lock);
+}
+
+static void read_dir_job(void *ptr)
+{
+    struct dir_node *node = ptr;
+    struct dir_scan *scan = node->scan;
+
+    claim_and_read_dir(node);
+
+    mp_mutex_lock(&scan->lock);
+    scan->pending--;
+    mp_cond_broadcast(&scan->wakeup);
+    mp_mutex_unlock(&scan->lock);
+}
+
+// Add the directory contents to the playlist in order, waiting for or reading
+// subdirectories as they are reached.
+static void emit_dir(struct dir_node *node, int autocreate)
+{
+    struct dir_scan *scan = node->scan;
+    struct pl_parser *p = scan->p;
+
+    claim_and_read_dir(node);
+
+    mp_mutex_lock(&scan->lock);
+    while (node->state != NODE_DONE)
+        mp_cond_wait(&scan->wakeup, &scan->lock);
+    mp_mutex_unlock(&scan->lock);
+
+    for (int n = 0; n < node->num_entries; n++) {
+        struct pl_dir_entry *e = &node->entries[n];
+        if (mp_cancel_test(p->s->cancel))
+            break;
+        if (e->node) {
+            emit_dir(e->node, autocreate);
+        } else if (e->is_dir || test_path(p, e->path, autocreate)) {
+            playlist_append_file(p->pl, e->path);
         }
     }
+}
 
-    return true;
+static void scan_dir(struct pl_parser *p, char *path, int autocreate)
+{
+    struct dir_scan scan = {
+        .p = p,
+        .dir_mode = p->opts->dir_mode,
+    };
+    mp_mutex_init(&scan.lock);
+    mp_cond_init(&scan.wakeup);
+
+    // Only recursive mode can make use of reading multiple directories.
+    if (scan.dir_mode == DIR_RECURSIVE)
+        scan.pool = mp_thread_pool_create(NULL, 0, 0, MAX_DIR_THREADS);
+
+    struct dir_node *root = talloc_ptrtype(NULL, root);
+    *root = (struct dir_node){
+        .scan = &scan,
+        .path = talloc_strdup(root, path),
+    };
+
+    emit_dir(root, autocreate);
+
+    // Wait until no more jobs can be queued. On cancellation, jobs for
+    // directories that were never reached might still be running.
+    mp_mutex_lock(&scan.lock);
+    while (scan.pending)
+        mp_cond_wait(&scan.wakeup, &scan.lock);
+    mp_mutex_unlock(&scan.lock);
+
+    talloc_free(scan.pool);
+    talloc_free(root);
+    mp_cond_destroy(&scan.wakeup);
+    mp_mutex_destroy(&scan.lock);
 }
 
 static enum autocreate_mode get_directory_filter(struct pl_parser *p)
@@ -584,15 +757,13 @@ static int parse_dir(struct pl_parser *p)
     if (autocreate == AUTO_NONE)
         goto done;
 
-    struct stat dir_stack[MAX_DIR_STACK];
-
     if (p->opts->dir_mode == DIR_AUTO) {
         struct MPOpts *opts = mp_get_config_group(NULL, p->global, &mp_opt_root);
         p->opts->dir_mode = opts->shuffle ? DIR_RECURSIVE : DIR_LAZY;
         talloc_free(opts);
     }
 
-    scan_dir(p, path, dir_stack, 0, autocreate);
+    scan_dir(p, path, autocreate);
 
     p->add_base = false;
     ret = p->pl->num_entries > 0 ? 0 : -1;
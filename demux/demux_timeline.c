@@ -17,9 +17,13 @@
 
 #include <assert.h>
 #include <limits.h>
+#include <stdatomic.h>
 
 #include "common/common.h"
 #include "common/msg.h"
+#include "misc/thread_tools.h"
+#include "options/m_config.h"
+#include "osdep/threads.h"
 
 #include "demux.h"
 #include "timeline.h"
@@ -74,6 +78,23 @@ struct virtual_source {
     bool any_selected;          // at least one stream is actually selected
 
     struct demux_packet *next;
+
+    // Segment after current, prepared before reaching its start.
+    struct segment *ahead;
+    struct segment_opener *opener; // opening ahead in the background
+    bool ahead_seeked;          // ahead->d was seeked to ahead->start
+};
+
+// Opens a lazy segment on a separate thread. The result is not accessed by the
+// timeline demuxer until the thread was joined.
+struct segment_opener {
+    struct mpv_global *global;
+    struct mp_cancel *cancel;
+    struct demuxer_params params;
+    char *url;
+    mp_thread thread;
+    atomic_bool done;
+    struct demuxer *d;
 };
 
 struct priv {
@@ -88,6 +109,8 @@ struct priv {
 
     struct virtual_source **sources;
     int num_sources;
+
+    double lookahead_secs;
 };
 
 static void update_slave_stats(struct demuxer *demuxer, struct demuxer *slave)
@@ -166,8 +189,11 @@ static void reselect_streams(struct demuxer *demuxer)
                 bool selected =
                     seg->stream_map[i] && seg->stream_map[i]->selected;
 
-                // This stops demuxer readahead for inactive segments.
-                if (!src->current || seg->d != src->current->d)
+                // This stops demuxer readahead for inactive segments. The
+                // segment prepared ahead is seeked with its streams selected.
+                bool active = src->current && (seg->d == src->current->d ||
+                              (src->ahead && seg->d == src->ahead->d));
+                if (!active)
                     selected = false;
                 struct sh_stream *sh = demux_get_stream(seg->d, i);
                 demuxer_select_track(seg->d, sh, MP_NOPTS_VALUE, selected);
@@ -204,23 +230,31 @@ static void close_lazy_segments(struct demuxer *demuxer,
     }
 }
 
+static struct demuxer_params segment_params(struct demuxer *demuxer,
+                                            struct virtual_source *src)
+{
+    return (struct demuxer_params){
+        .init_fragment = src->tl->init_fragment,
+        .skip_lavf_probing = src->tl->dash,
+        .stream_flags = demuxer->stream_origin,
+    };
+}
+
 static void reopen_lazy_segments(struct demuxer *demuxer,
                                  struct virtual_source *src)
 {
-    if (src->current->d)
-        return;
-
     // Note: in delay_open mode, we must _not_ close segments during demuxing,
     // because demuxed packets have demux_packet.codec set to objects owned
     // by the segments. Closing them would create dangling pointers.
+    // (The current segment might have been opened ahead, so the previous one
+    // is not necessarily closed yet.)
     if (!src->delay_open)
         close_lazy_segments(demuxer, src);
 
-    struct demuxer_params params = {
-        .init_fragment = src->tl->init_fragment,
-        .skip_lavf_probing = src->tl->dash,
-        .stream_flags = demuxer->stream_origin,
-    };
+    if (src->current->d)
+        return;
+
+    struct demuxer_params params = segment_params(demuxer, src);
     src->current->d = demux_open_url(src->current->url, &params,
                                      demuxer->cancel, demuxer->global);
     if (!src->current->d && !demux_cancel_test(demuxer))
@@ -230,6 +264,102 @@ static void reopen_lazy_segments(struct demuxer *demuxer,
     associate_streams(demuxer, src, src->current);
 }
 
+static MP_THREAD_VOID segment_opener_thread(void *ctx)
+{
+    struct segment_opener *op = ctx;
+    mp_thread_set_name("seg-opener");
+
+    op->d = demux_open_url(op->url, &op->params, op->cancel, op->global);
+
+    atomic_store(&op->done, true);
+    MP_THREAD_RETURN();
+}
+
+// Join the opener thread (possibly waiting for it), and make the segment use
+// the opened demuxer.
+static void finish_opener(struct demuxer *demuxer, struct virtual_source *src)
+{
+    struct segment_opener *op = src->opener;
+    if (!op)
+        return;
+
+    mp_thread_join(op->thread);
+    src->opener = NULL;
+
+    struct segment *seg = src->ahead;
+    assert(seg && !seg->d);
+    seg->d = op->d;
+    if (seg->d) {
+        MP_VERBOSE(demuxer, "segment %d opened ahead\n", seg->index);
+        update_slave_stats(demuxer, seg->d);
+        associate_streams(demuxer, src, seg);
+    }
+    talloc_free(op);
+}
+
+static void stop_lookahead(struct demuxer *demuxer, struct virtual_source *src)
+{
+    if (src->opener) {
+        mp_cancel_trigger(src->opener->cancel);
+        finish_opener(demuxer, src);
+    }
+    src->ahead = NULL;
+    src->ahead_seeked = false;
+}
+
+// Prepare the next segment if the current one is close to its end: open it in
+// the background if needed, and seek it to its start, so that switching to it
+// doesn't stall demuxing.
+static void update_lookahead(struct demuxer *demuxer, struct virtual_source *src)
+{
+    struct priv *p = demuxer->priv;
+    struct segment *seg = src->current;
+
+    if (p->lookahead_secs <= 0 || !seg || seg->index + 1 >= src->num_segments ||
+        src->dts == MP_NOPTS_VALUE)
+        return;
+
+    struct segment *next = src->segments[seg->index + 1];
+    if (src->dts < next->start - p->lookahead_secs)
+        return;
+
+    if (src->ahead != next) {
+        stop_lookahead(demuxer, src);
+        src->ahead = next;
+
+        if (!next->d) {
+            struct segment_opener *op = talloc_zero(NULL, struct segment_opener);
+            op->global = demuxer->global;
+            op->cancel = mp_cancel_new(op);
+            mp_cancel_set_parent(op->cancel, demuxer->cancel);
+            op->params = segment_params(demuxer, src);
+            op->url = talloc_strdup(op, next->url);
+            if (mp_thread_create(&op->thread, segment_opener_thread, op)) {
+                talloc_free(op);
+                return;
+            }
+            MP_VERBOSE(demuxer, "opening segment %d ahead\n", next->index);
+            src->opener = op;
+        }
+    }
+
+    if (src->opener) {
+        if (!atomic_load(&src->opener->done))
+            return;
+        finish_opener(demuxer, src);
+    }
+
+    // Can't seek a demuxer that's still being read from. Without clipping,
+    // the segment is read from its beginning anyway.
+    if (src->ahead_seeked || !next->d || next->d == seg->d || src->no_clip)
+        return;
+
+    reselect_streams(demuxer);
+    demux_set_ts_offset(next->d, next->start - next->d_start);
+    demux_seek(next->d, next->start, SEEK_HR);
+    src->ahead_seeked = true;
+}
+
 static void switch_segment(struct demuxer *demuxer, struct virtual_source *src,
                            struct segment *new, double start_pts, int flags,
                            bool init)
@@ -242,6 +372,18 @@ static void switch_segment(struct demuxer *demuxer, struct virtual_source *src,
     if (src->current && src->current->d)
         update_slave_stats(demuxer, src->current->d);
 
+    // The next segment might have been prepared ahead. If it's still being
+    // opened, waiting for that is still faster than opening it again.
+    bool seeked = false;
+    if (src->ahead == new) {
+        finish_opener(demuxer, src);
+        seeked = init && src->ahead_seeked && new->d;
+        src->ahead = NULL;
+        src->ahead_seeked = false;
+    } else {
+        stop_lookahead(demuxer, src);
+    }
+
     src->current = new;
     reopen_lazy_segments(demuxer, src);
     if (!new->d)
@@ -249,7 +391,7 @@ static void switch_segment(struct demuxer *demuxer, struct virtual_source *src,
     reselect_streams(demuxer);
     if (!src->no_clip)
         demux_set_ts_offset(new->d, new->start - new->d_start);
-    if (!src->no_clip || !init)
+    if ((!src->no_clip || !init) && !seeked)
         demux_seek(new->d, start_pts, flags);
 
     for (int n = 0; n < src->num_streams; n++) {
@@ -360,6 +502,8 @@ static void do_read_next_packet(struct demuxer *demuxer,
 
     pkt->stream = vs->sh->index;
     src->next = pkt;
+
+    update_lookahead(demuxer, src);
     return;
 
 drop:
@@ -607,6 +751,10 @@ static int d_open(struct demuxer *demuxer, enum demux_check check)
     demuxer->chapters = p->tl->chapters;
     demuxer->num_chapters = p->tl->num_chapters;
 
+    struct demux_opts *opts = mp_get_config_group(NULL, demuxer->global, &demux_conf);
+    p->lookahead_secs = opts->timeline_lookahead_secs;
+    talloc_free(opts);
+
     struct demuxer *meta = p->tl->meta;
     if (meta) {
         demuxer->metadata = meta->metadata;
@@ -653,6 +801,7 @@ static void d_close(struct demuxer *demuxer)
     for (int x = 0; x < p->num_sources; x++) {
         struct virtual_source *src = p->sources[x];
 
+        stop_lookahead(demuxer, src);
         src->current = NULL;
         TA_FREEP(&src->next);
         close_lazy_segments(demuxer, src);
@@ -667,6 +816,12 @@ static void d_close(struct demuxer *demuxer)
 
 static void d_switched_tracks(struct demuxer *demuxer)
 {
+    struct priv *p = demuxer->priv;
+
+    // Segments seeked ahead were positioned with the old stream selection.
+    for (int x = 0; x < p->num_sources; x++)
+        p->sources[x]->ahead_seeked = false;
+
     reselect_streams(demuxer);
 }
 
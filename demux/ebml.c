@@ -318,6 +318,56 @@ static double ebml_parse_float(uint8_t *data, int length)
         return av_int2double(i);
 }
 
+uint32_t ebml_buf_read_id(const uint8_t **p, const uint8_t *end)
+{
+    int len;
+    uint32_t id = ebml_parse_id((uint8_t *)*p, end - *p, &len);
+    if (len < 0 || len > end - *p)
+        return EBML_ID_INVALID;
+    *p += len;
+    return id;
+}
+
+uint64_t ebml_buf_read_length(const uint8_t **p, const uint8_t *end)
+{
+    int len;
+    uint64_t r = ebml_parse_length((uint8_t *)*p, end - *p, &len);
+    if (len < 0)
+        return EBML_UINT_INVALID;
+    *p += len;
+    return r;
+}
+
+int64_t ebml_buf_read_signed_length(const uint8_t **p, const uint8_t *end)
+{
+    const uint8_t *start = *p;
+    uint64_t unum = ebml_buf_read_length(p, end);
+    if (unum == EBML_UINT_INVALID)
+        return EBML_INT_INVALID;
+    int l = *p - start;
+    return unum - ((1LL << ((7 * l) - 1)) - 1);
+}
+
+uint64_t ebml_buf_read_uint(const uint8_t **p, const uint8_t *end)
+{
+    uint64_t len = ebml_buf_read_length(p, end);
+    if (len == EBML_UINT_INVALID || len > 8 || len > end - *p)
+        return EBML_UINT_INVALID;
+    uint64_t r = ebml_parse_uint((uint8_t *)*p, len);
+    *p += len;
+    return r;
+}
+
+int64_t ebml_buf_read_int(const uint8_t **p, const uint8_t *end)
+{
+    uint64_t len = ebml_buf_read_length(p, end);
+    if (len == EBML_UINT_INVALID || len > 8 || len > end - *p)
+        return EBML_INT_INVALID;
+    int64_t r = ebml_parse_sint((uint8_t *)*p, len);
+    *p += len;
+    return r;
+}
+
 
 // target must be initialized to zero
 static void ebml_parse_element(struct ebml_parse_ctx *ctx, void *target,
@@ -90,6 +90,15 @@ int64_t ebml_read_int (stream_t *s);
 int ebml_read_skip(struct mp_log *log, int64_t end, stream_t *s);
 int ebml_resync_cluster(struct mp_log *log, stream_t *s);
 
+// Like the functions above, but parse from the memory range [*p, end), and
+// advance *p past the parsed data. The same invalid values are returned if the
+// data is broken or reaches past end.
+uint32_t ebml_buf_read_id(const uint8_t **p, const uint8_t *end);
+uint64_t ebml_buf_read_length(const uint8_t **p, const uint8_t *end);
+int64_t ebml_buf_read_signed_length(const uint8_t **p, const uint8_t *end);
+uint64_t ebml_buf_read_uint(const uint8_t **p, const uint8_t *end);
+int64_t ebml_buf_read_int(const uint8_t **p, const uint8_t *end);
+
 int ebml_read_element(struct stream *s, struct ebml_parse_ctx *ctx,
                       void *target, const struct ebml_elem_desc *desc);
 
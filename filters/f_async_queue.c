@@ -4,7 +4,7 @@
 #include "audio/aframe.h"
 #include "common/common.h"
 #include "common/msg.h"
-#include "osdep/threads.h"
+#include "misc/spsc_queue.h"
 
 #include "f_async_queue.h"
 #include "filter_internal.h"
@@ -18,35 +18,52 @@ struct mp_async_queue {
 struct async_queue {
     _Atomic uint64_t refcount;
 
-    mp_mutex lock;
+    // Frames are passed from the producer to the consumer without locking.
+    // Everything else requires exclusive access (mp_spsc_queue_lock()).
+    struct mp_spsc_queue *frames; // struct queue_entry items
 
-    // -- protected by lock
+    // -- changed with exclusive access only
     struct mp_async_queue_config cfg;
-    bool active; // queue was resumed; consumer may request frames
-    bool reading; // data flow: reading => consumer has requested frames
-    int64_t samples_size; // queue size in the cfg.sample_unit
-    size_t byte_size; // queue size in bytes (using approx. frame sizes)
-    int num_frames;
-    struct mp_frame *frames;
-    int eof_count; // number of MP_FRAME_EOF in frames[], for draining
     struct mp_filter *conn[2]; // filters: in (0), out (1)
+
+    // -- changed with exclusive access, or by the consumer (reading)
+    atomic_bool active; // queue was resumed; consumer may request frames
+    atomic_bool reading; // data flow: reading => consumer has requested frames
+
+    // -- incremented by the producer before a frame is added, decremented by
+    //    the consumer after it was removed
+    _Atomic int64_t samples_size; // queue size in the cfg.sample_unit
+    _Atomic int64_t byte_size; // queue size in bytes (using approx. frame sizes)
+    atomic_int eof_count; // number of MP_FRAME_EOF in frames, for draining
+
+    // -- producer only (or exclusive access)
+    double newest_pts;
+};
+
+struct queue_entry {
+    struct mp_frame frame;
+    double pts; // cached, can be accessed without owning the frame
 };
 
 static void reset_queue(struct async_queue *q)
 {
-    mp_mutex_lock(&q->lock);
-    q->active = q->reading = false;
-    for (int n = 0; n < q->num_frames; n++)
-        mp_frame_unref(&q->frames[n]);
-    q->num_frames = 0;
-    q->eof_count = 0;
-    q->samples_size = 0;
-    q->byte_size = 0;
+    mp_spsc_queue_lock(q->frames);
+    atomic_store(&q->active, false);
+    atomic_store(&q->reading, false);
+    size_t num_frames = mp_spsc_queue_count(q->frames);
+    for (size_t n = 0; n < num_frames; n++) {
+        struct queue_entry *e = mp_spsc_queue_get(q->frames, n);
+        mp_frame_unref(&e->frame);
+    }
+    mp_spsc_queue_clear(q->frames);
+    atomic_store(&q->eof_count, 0);
+    atomic_store(&q->samples_size, 0);
+    atomic_store(&q->byte_size, 0);
     for (int n = 0; n < 2; n++) {
         if (q->conn[n])
             mp_filter_wakeup(q->conn[n]);
     }
-    mp_mutex_unlock(&q->lock);
+    mp_spsc_queue_unlock(q->frames);
 }
 
 static void unref_queue(struct async_queue *q)
@@ -57,7 +74,6 @@ static void unref_queue(struct async_queue *q)
     assert(count >= 0);
     if (count == 0) {
         reset_queue(q);
-        mp_mutex_destroy(&q->lock);
         talloc_free(q);
     }
 }
@@ -75,7 +91,7 @@ struct mp_async_queue *mp_async_queue_create(void)
     *r->q = (struct async_queue){
         .refcount = 1,
     };
-    mp_mutex_init(&r->q->lock);
+    r->q->frames = mp_spsc_queue_create(r->q, sizeof(struct queue_entry));
     talloc_set_destructor(r, on_free_queue);
     mp_async_queue_set_config(r, (struct mp_async_queue_config){0});
     return r;
@@ -93,13 +109,16 @@ static int64_t frame_get_samples(struct async_queue *q, struct mp_frame frame)
     return res;
 }
 
+// Must be called by the producer, or with exclusive access.
 static bool is_full(struct async_queue *q)
 {
-    if (q->samples_size >= q->cfg.max_samples || q->byte_size >= q->cfg.max_bytes)
+    if (atomic_load(&q->samples_size) >= q->cfg.max_samples ||
+        atomic_load(&q->byte_size) >= q->cfg.max_bytes)
         return true;
-    if (q->num_frames >= 2 && q->cfg.max_duration > 0) {
-        double pts1 = mp_frame_get_pts(q->frames[q->num_frames - 1]);
-        double pts2 = mp_frame_get_pts(q->frames[0]);
+    if (mp_spsc_queue_count(q->frames) >= 2 && q->cfg.max_duration > 0) {
+        struct queue_entry *oldest = mp_spsc_queue_peek(q->frames);
+        double pts1 = oldest ? oldest->pts : MP_NOPTS_VALUE;
+        double pts2 = q->newest_pts;
         if (pts1 != MP_NOPTS_VALUE && pts2 != MP_NOPTS_VALUE &&
             pts2 - pts1 >= q->cfg.max_duration)
             return true;
@@ -114,20 +133,24 @@ static void account_frame(struct async_queue *q, struct mp_frame frame,
 {
     assert(dir == 1 || dir == -1);
 
-    q->samples_size += dir * frame_get_samples(q, frame);
-    q->byte_size += dir * mp_frame_approx_size(frame);
+    atomic_fetch_add(&q->samples_size, dir * frame_get_samples(q, frame));
+    atomic_fetch_add(&q->byte_size, dir * (int64_t)mp_frame_approx_size(frame));
 
     if (frame.type == MP_FRAME_EOF)
-        q->eof_count += dir;
+        atomic_fetch_add(&q->eof_count, dir);
 }
 
+// Requires exclusive access.
 static void recompute_sizes(struct async_queue *q)
 {
-    q->eof_count = 0;
-    q->samples_size = 0;
-    q->byte_size = 0;
-    for (int n = 0; n < q->num_frames; n++)
-        account_frame(q, q->frames[n], 1);
+    atomic_store(&q->eof_count, 0);
+    atomic_store(&q->samples_size, 0);
+    atomic_store(&q->byte_size, 0);
+    size_t num_frames = mp_spsc_queue_count(q->frames);
+    for (size_t n = 0; n < num_frames; n++) {
+        struct queue_entry *e = mp_spsc_queue_get(q->frames, n);
+        account_frame(q, e->frame, 1);
+    }
 }
 
 void mp_async_queue_set_config(struct mp_async_queue *queue,
@@ -142,12 +165,12 @@ void mp_async_queue_set_config(struct mp_async_queue *queue,
 
     cfg.max_samples = MPMAX(cfg.max_samples, 1);
 
-    mp_mutex_lock(&q->lock);
+    mp_spsc_queue_lock(q->frames);
     bool recompute = q->cfg.sample_unit != cfg.sample_unit;
     q->cfg = cfg;
     if (recompute)
         recompute_sizes(q);
-    mp_mutex_unlock(&q->lock);
+    mp_spsc_queue_unlock(q->frames);
 }
 
 void mp_async_queue_reset(struct mp_async_queue *queue)
@@ -157,19 +180,15 @@ void mp_async_queue_reset(struct mp_async_queue *queue)
 
 bool mp_async_queue_is_active(struct mp_async_queue *queue)
 {
-    struct async_queue *q = queue->q;
-    mp_mutex_lock(&q->lock);
-    bool res = q->active;
-    mp_mutex_unlock(&q->lock);
-    return res;
+    return atomic_load(&queue->q->active);
 }
 
 bool mp_async_queue_is_full(struct mp_async_queue *queue)
 {
     struct async_queue *q = queue->q;
-    mp_mutex_lock(&q->lock);
+    mp_spsc_queue_lock(q->frames);
     bool res = is_full(q);
-    mp_mutex_unlock(&q->lock);
+    mp_spsc_queue_unlock(q->frames);
     return res;
 }
 
@@ -177,49 +196,41 @@ void mp_async_queue_resume(struct mp_async_queue *queue)
 {
     struct async_queue *q = queue->q;
 
-    mp_mutex_lock(&q->lock);
-    if (!q->active) {
-        q->active = true;
+    mp_spsc_queue_lock(q->frames);
+    if (!atomic_load(&q->active)) {
+        atomic_store(&q->active, true);
         // Possibly make the consumer request new frames.
         if (q->conn[1])
             mp_filter_wakeup(q->conn[1]);
     }
-    mp_mutex_unlock(&q->lock);
+    mp_spsc_queue_unlock(q->frames);
 }
 
 void mp_async_queue_resume_reading(struct mp_async_queue *queue)
 {
     struct async_queue *q = queue->q;
 
-    mp_mutex_lock(&q->lock);
-    if (!q->active || !q->reading) {
-        q->active = true;
-        q->reading = true;
+    mp_spsc_queue_lock(q->frames);
+    if (!atomic_load(&q->active) || !atomic_load(&q->reading)) {
+        atomic_store(&q->active, true);
+        atomic_store(&q->reading, true);
         // Possibly start producer/consumer.
         for (int n = 0; n < 2; n++) {
             if (q->conn[n])
                 mp_filter_wakeup(q->conn[n]);
         }
     }
-    mp_mutex_unlock(&q->lock);
+    mp_spsc_queue_unlock(q->frames);
 }
 
 int64_t mp_async_queue_get_samples(struct mp_async_queue *queue)
 {
-    struct async_queue *q = queue->q;
-    mp_mutex_lock(&q->lock);
-    int64_t res = q->samples_size;
-    mp_mutex_unlock(&q->lock);
-    return res;
+    return atomic_load(&queue->q->samples_size);
 }
 
 int mp_async_queue_get_frames(struct mp_async_queue *queue)
 {
-    struct async_queue *q = queue->q;
-    mp_mutex_lock(&q->lock);
-    int res = q->num_frames;
-    mp_mutex_unlock(&q->lock);
-    return res;
+    return mp_spsc_queue_count(queue->q->frames);
 }
 
 struct priv {
@@ -232,12 +243,12 @@ static void destroy(struct mp_filter *f)
     struct priv *p = f->priv;
     struct async_queue *q = p->q;
 
-    mp_mutex_lock(&q->lock);
+    mp_spsc_queue_lock(q->frames);
     for (int n = 0; n < 2; n++) {
         if (q->conn[n] == f)
             q->conn[n] = NULL;
     }
-    mp_mutex_unlock(&q->lock);
+    mp_spsc_queue_unlock(q->frames);
 
     unref_queue(q);
 }
@@ -248,8 +259,9 @@ static void process_in(struct mp_filter *f)
     struct async_queue *q = p->q;
     assert(q->conn[0] == f);
 
-    mp_mutex_lock(&q->lock);
-    if (!q->reading) {
+    mp_spsc_queue_reserve(q->frames);
+    mp_spsc_queue_enter(q->frames, MP_SPSC_PRODUCER);
+    if (!atomic_load(&q->reading)) {
         // mp_async_queue_reset()/reset_queue() is usually called asynchronously,
         // so we might have requested a frame earlier, and now can't use it.
         // Discard it; the expectation is that this is a benign logical race
@@ -261,8 +273,10 @@ static void process_in(struct mp_filter *f)
         }
     } else if (!is_full(q) && mp_pin_out_request_data(f->ppins[0])) {
         struct mp_frame frame = mp_pin_out_read(f->ppins[0]);
+        struct queue_entry e = {frame, mp_frame_get_pts(frame)};
         account_frame(q, frame, 1);
-        MP_TARRAY_INSERT_AT(q, q->frames, q->num_frames, 0, frame);
+        q->newest_pts = e.pts;
+        mp_spsc_queue_push(q->frames, &e);
         // Notify reader that we have new frames.
         if (q->conn[1])
             mp_filter_wakeup(q->conn[1]);
@@ -272,9 +286,9 @@ static void process_in(struct mp_filter *f)
         if (p->notify && full)
             mp_filter_wakeup(p->notify);
     }
-    if (p->notify && !q->num_frames)
+    if (p->notify && !mp_spsc_queue_count(q->frames))
         mp_filter_wakeup(p->notify);
-    mp_mutex_unlock(&q->lock);
+    mp_spsc_queue_leave(q->frames, MP_SPSC_PRODUCER);
 }
 
 static void process_out(struct mp_filter *f)
@@ -286,22 +300,24 @@ static void process_out(struct mp_filter *f)
     if (!mp_pin_in_needs_data(f->ppins[0]))
         return;
 
-    mp_mutex_lock(&q->lock);
-    if (q->active && !q->reading) {
-        q->reading = true;
+    mp_spsc_queue_enter(q->frames, MP_SPSC_CONSUMER);
+    bool active = atomic_load(&q->active);
+    if (active && !atomic_load(&q->reading)) {
+        atomic_store(&q->reading, true);
         mp_filter_wakeup(q->conn[0]);
     }
-    if (q->active && q->num_frames) {
-        struct mp_frame frame = q->frames[q->num_frames - 1];
-        q->num_frames -= 1;
+    struct queue_entry *e = active ? mp_spsc_queue_peek(q->frames) : NULL;
+    if (e) {
+        struct mp_frame frame = e->frame;
+        mp_spsc_queue_pop(q->frames);
         account_frame(q, frame, -1);
-        assert(q->samples_size >= 0);
+        assert(atomic_load(&q->samples_size) >= 0);
         mp_pin_in_write(f->ppins[0], frame);
         // Notify writer that we need new frames.
         if (q->conn[0])
             mp_filter_wakeup(q->conn[0]);
     }
-    mp_mutex_unlock(&q->lock);
+    mp_spsc_queue_leave(q->frames, MP_SPSC_CONSUMER);
 }
 
 static void reset(struct mp_filter *f)
@@ -309,12 +325,10 @@ static void reset(struct mp_filter *f)
     struct priv *p = f->priv;
     struct async_queue *q = p->q;
 
-    mp_mutex_lock(&q->lock);
     // If the queue is in reading state, it is logical that it should request
     // input immediately.
-    if (mp_pin_get_dir(f->pins[0]) == MP_PIN_IN && q->reading)
+    if (mp_pin_get_dir(f->pins[0]) == MP_PIN_IN && atomic_load(&q->reading))
         mp_filter_wakeup(f);
-    mp_mutex_unlock(&q->lock);
 }
 
 // producer
@@ -365,11 +379,11 @@ struct mp_filter *mp_async_queue_create_filter(struct mp_filter *parent,
     atomic_fetch_add(&q->refcount, 1);
     p->q = q;
 
-    mp_mutex_lock(&q->lock);
+    mp_spsc_queue_lock(q->frames);
     int slot = is_in ? 0 : 1;
     assert(!q->conn[slot]); // fails if already connected on this end
     q->conn[slot] = f;
-    mp_mutex_unlock(&q->lock);
+    mp_spsc_queue_unlock(q->frames);
 
     return f;
 }
@@ -220,6 +220,7 @@ struct priv {
     mp_thread dec_thread;
     bool dec_thread_valid;
     mp_mutex cache_lock;
+    bool prestart; // user thread only, changed with thread_lock held
 
     // --- Protected by cache_lock.
     char *cur_hwdec;
@@ -1066,6 +1067,10 @@ static void update_queue_config(struct priv *p)
         .max_samples = p->queue_opts->max_samples,
         .max_duration = p->queue_opts->max_duration,
     };
+    // Until the decoder is actually used, decode only what's needed to start
+    // playback (the full video queue could hold a lot of memory).
+    if (p->prestart && p->header->type == STREAM_VIDEO)
+        cfg.max_samples = 1;
     mp_async_queue_set_config(p->queue, cfg);
 }
 
@@ -1106,6 +1111,11 @@ static void public_f_reset(struct mp_filter *f)
     struct priv *p = f->priv;
     assert(p->public.f == f);
 
+    // The player resets the filter graph the decoder is adopted into, which
+    // must not drop the frames decoded ahead.
+    if (p->prestart)
+        return;
+
     if (p->queue) {
         mp_async_queue_reset(p->queue);
         thread_lock(p);
@@ -1166,8 +1176,9 @@ static void onlock_dec_thread(void *ptr)
     mp_filter_graph_interrupt(p->dec_root_filter);
 }
 
-struct mp_decoder_wrapper *mp_decoder_wrapper_create(struct mp_filter *parent,
-                                                     struct sh_stream *src)
+static struct mp_decoder_wrapper *create_wrapper(struct mp_filter *parent,
+                                                 struct sh_stream *src,
+                                                 bool force_queue)
 {
     struct mp_filter *public_f = mp_filter_create(parent, &decode_wrapper_filter);
     if (!public_f)
@@ -1205,7 +1216,7 @@ struct mp_decoder_wrapper *mp_decoder_wrapper_create(struct mp_filter *parent,
         goto error;
     }
 
-    if (p->queue_opts && p->queue_opts->use_queue) {
+    if (p->queue_opts && (p->queue_opts->use_queue || force_queue)) {
         p->queue = mp_async_queue_create();
         p->dec_dispatch = mp_dispatch_create(p);
         p->dec_root_filter = mp_filter_create_root(public_f->global);
@@ -1264,6 +1275,52 @@ error:
     return NULL;
 }
 
+struct mp_decoder_wrapper *mp_decoder_wrapper_create(struct mp_filter *parent,
+                                                     struct sh_stream *src)
+{
+    return create_wrapper(parent, src, false);
+}
+
+struct mp_decoder_wrapper *mp_decoder_wrapper_create_prestarted(
+    struct mp_filter *parent, struct sh_stream *src)
+{
+    struct mp_decoder_wrapper *d = create_wrapper(parent, src, true);
+    if (!d)
+        return NULL;
+    struct priv *p = d->f->priv;
+
+    if (src->type == STREAM_AUDIO)
+        mp_decoder_wrapper_set_spdif_flag(d, true);
+
+    if (!mp_decoder_wrapper_reinit(d)) {
+        talloc_free(d->f);
+        return NULL;
+    }
+
+    thread_lock(p);
+    p->prestart = true;
+    update_queue_config(p);
+    thread_unlock(p);
+
+    // Nothing reads from the queue yet, so let the decoder thread fill it.
+    mp_async_queue_resume_reading(p->queue);
+
+    return d;
+}
+
+void mp_decoder_wrapper_end_prestart(struct mp_decoder_wrapper *d)
+{
+    struct priv *p = d->f->priv;
+
+    if (!p->prestart)
+        return;
+
+    thread_lock(p);
+    p->prestart = false;
+    update_queue_config(p);
+    thread_unlock(p);
+}
+
 void lavc_process(struct mp_filter *f, struct lavc_state *state,
                   int (*send)(struct mp_filter *f, struct demux_packet *pkt),
                   int (*receive)(struct mp_filter *f, struct mp_frame *res))
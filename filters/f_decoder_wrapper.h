@@ -43,6 +43,19 @@ struct mp_decoder_wrapper {
 struct mp_decoder_wrapper *mp_decoder_wrapper_create(struct mp_filter *parent,
                                                      struct sh_stream *src);
 
+// Like mp_decoder_wrapper_create(), but always decode on a separate thread, and
+// start decoding immediately, even if nothing reads from the wrapper yet. Only
+// the first video frame (or audio up to the queue limits) is decoded ahead.
+// Resets are ignored until mp_decoder_wrapper_end_prestart() is called, so the
+// wrapper can be moved into a filter graph that is reset on initialization.
+// Audio is initialized with the spdif flag set.
+struct mp_decoder_wrapper *mp_decoder_wrapper_create_prestarted(
+    struct mp_filter *parent, struct sh_stream *src);
+
+// Switch a wrapper created with mp_decoder_wrapper_create_prestarted() to
+// normal operation.
+void mp_decoder_wrapper_end_prestart(struct mp_decoder_wrapper *d);
+
 // Legacy decoder framedrop control.
 void mp_decoder_wrapper_set_frame_drops(struct mp_decoder_wrapper *d, int num);
 int mp_decoder_wrapper_get_frames_dropped(struct mp_decoder_wrapper *d);
@@ -1,12 +1,17 @@
+#include <stdatomic.h>
+
 #include "audio/aframe.h"
 #include "audio/out/ao.h"
 #include "common/global.h"
+#include "misc/dispatch.h"
 #include "options/m_config.h"
 #include "options/m_option.h"
+#include "osdep/threads.h"
 #include "video/out/vo.h"
 
 #include "filter_internal.h"
 
+#include "f_async_queue.h"
 #include "f_autoconvert.h"
 #include "f_auto_filters.h"
 #include "f_lavfi.h"
@@ -42,6 +47,10 @@ struct chain {
     struct mp_user_filter *input, *output, *convert_wrapper;
     struct mp_autoconvert *convert;
 
+    // User filters after a "thread" entry run in a separate stage each.
+    struct chain_stage **stages;
+    int num_stages;
+
     struct vo *vo;
     struct ao *ao;
 
@@ -71,6 +80,34 @@ struct mp_user_filter {
 
     bool failed;
     bool error_eof_sent;
+
+    // Stage the filter runs in. NULL if it runs in the chain's filter graph.
+    // Accessing the filter or the fields above requires locking the stage.
+    struct chain_stage *stage;
+    int stage_index; // number of "thread" entries before the filter
+};
+
+// Number of frames buffered between the chain and a stage (per direction).
+#define STAGE_QUEUE_FRAMES 2
+
+// A group of consecutive user filters, which runs in its own filter graph on
+// a separate thread. It is connected to the rest of the chain with 2 async
+// queues, which preserve frame order, and pass through EOF.
+struct chain_stage {
+    struct chain *p;
+    int index;
+
+    struct mp_filter *root; // filter graph run on the stage thread
+    struct mp_dispatch_queue *dispatch;
+    mp_thread thread;
+    bool terminate; // accessed by the stage thread, or with dispatch locked
+
+    struct mp_async_queue *queue_in, *queue_out;
+    struct mp_filter *send, *recv; // queue access filters in the chain graph
+    struct mp_filter *stage_in, *stage_out; // queue access filters in root
+
+    // Set by the stage thread, transferred to reconfig_happened by the chain.
+    atomic_bool reconfig_happened;
 };
 
 static void update_output_caps(struct chain *p)
@@ -91,6 +128,18 @@ static void update_output_caps(struct chain *p)
     }
 }
 
+static void mark_reconfig(struct mp_user_filter *u)
+{
+    struct chain *p = u->p;
+
+    if (u->stage) {
+        atomic_store(&u->stage->reconfig_happened, true);
+        mp_filter_wakeup(p->f);
+    } else {
+        p->public.reconfig_happened = true;
+    }
+}
+
 static void check_in_format_change(struct mp_user_filter *u,
                                    struct mp_frame frame)
 {
@@ -120,7 +169,7 @@ static void check_in_format_change(struct mp_user_filter *u,
                 if (strcmp(u->name, "convert") == 0)
                     update_output_caps(p);
 
-                p->public.reconfig_happened = true;
+                mark_reconfig(u);
             }
             u->last_in_vformat = img->params;
         }
@@ -140,7 +189,7 @@ static void check_in_format_change(struct mp_user_filter *u,
                 mp_aframe_config_copy(p->public.output_aformat, aframe);
             }
 
-            p->public.reconfig_happened = true;
+            mark_reconfig(u);
         }
     }
 }
@@ -238,14 +287,20 @@ static const struct mp_filter_info user_wrapper_filter = {
     .destroy = user_wrapper_destroy,
 };
 
-static struct mp_user_filter *create_wrapper_filter(struct chain *p)
+// stage: if not NULL, create the filter in the stage's filter graph (the
+//        caller must have locked the stage)
+static struct mp_user_filter *create_wrapper_filter(struct chain *p,
+                                                    struct chain_stage *stage)
 {
-    struct mp_filter *f = mp_filter_create(p->f, &user_wrapper_filter);
+    struct mp_filter *f = mp_filter_create(stage ? stage->root : p->f,
+                                           &user_wrapper_filter);
     if (!f)
         abort();
     struct mp_user_filter *wrapper = f->priv;
     wrapper->wrapper = f;
     wrapper->p = p;
+    wrapper->stage = stage;
+    wrapper->stage_index = stage ? stage->index : 0;
     wrapper->last_in_aformat = talloc_steal(wrapper, mp_aframe_create());
     wrapper->last_is_active = true;
     mp_filter_add_pin(f, MP_PIN_IN, "in");
@@ -253,7 +308,179 @@ static struct mp_user_filter *create_wrapper_filter(struct chain *p)
     return wrapper;
 }
 
+static MP_THREAD_VOID stage_thread(void *ptr)
+{
+    struct chain_stage *s = ptr;
+
+    mp_thread_set_name(s->p->type == MP_OUTPUT_CHAIN_VIDEO ? "vf/stage"
+                                                            : "af/stage");
+
+    while (!s->terminate) {
+        mp_filter_graph_run(s->root);
+        mp_dispatch_queue_process(s->dispatch, INFINITY);
+    }
+
+    MP_THREAD_RETURN();
+}
+
+static void wakeup_stage(void *ptr)
+{
+    struct chain_stage *s = ptr;
+
+    mp_dispatch_interrupt(s->dispatch);
+}
+
+static void onlock_stage(void *ptr)
+{
+    struct chain_stage *s = ptr;
+
+    mp_filter_graph_interrupt(s->root);
+}
+
+// Lock the stage thread. Filters in the stage's graph can be accessed until
+// stage_unlock() is called.
+static void stage_lock(struct chain_stage *s)
+{
+    if (s)
+        mp_dispatch_lock(s->dispatch);
+}
+
+static void stage_unlock(struct chain_stage *s)
+{
+    if (s)
+        mp_dispatch_unlock(s->dispatch);
+}
+
+static void lock_all_stages(struct chain *p)
+{
+    for (int n = 0; n < p->num_stages; n++)
+        stage_lock(p->stages[n]);
+}
+
+static void unlock_all_stages(struct chain *p)
+{
+    for (int n = p->num_stages - 1; n >= 0; n--)
+        stage_unlock(p->stages[n]);
+}
+
+static struct chain_stage *find_stage(struct chain *p, int index)
+{
+    for (int n = 0; n < p->num_stages; n++) {
+        if (p->stages[n]->index == index)
+            return p->stages[n];
+    }
+    return NULL;
+}
+
+// Create a stage and its thread. The stage is returned locked.
+static struct chain_stage *create_stage(struct chain *p, int index)
+{
+    struct chain_stage *s = talloc_zero(p, struct chain_stage);
+    s->p = p;
+    s->index = index;
+
+    s->dispatch = mp_dispatch_create(s);
+    s->root = mp_filter_create_root(p->f->global);
+    s->root->stream_info = p->f->stream_info;
+    mp_filter_graph_set_wakeup_cb(s->root, wakeup_stage, s);
+    mp_dispatch_set_onlock_fn(s->dispatch, onlock_stage, s);
+
+    struct mp_async_queue_config cfg = {
+        .max_bytes = INT64_MAX,
+        .max_samples = STAGE_QUEUE_FRAMES,
+    };
+    s->queue_in = mp_async_queue_create();
+    s->queue_out = mp_async_queue_create();
+    mp_async_queue_set_config(s->queue_in, cfg);
+    mp_async_queue_set_config(s->queue_out, cfg);
+
+    s->send = mp_async_queue_create_filter(p->f, MP_PIN_IN, s->queue_in);
+    s->stage_in = mp_async_queue_create_filter(s->root, MP_PIN_OUT, s->queue_in);
+    s->stage_out = mp_async_queue_create_filter(s->root, MP_PIN_IN, s->queue_out);
+    s->recv = mp_async_queue_create_filter(p->f, MP_PIN_OUT, s->queue_out);
+
+    mp_async_queue_resume(s->queue_in);
+    mp_async_queue_resume(s->queue_out);
+
+    if (mp_thread_create(&s->thread, stage_thread, s)) {
+        MP_ERR(p, "Could not create filter thread.\n");
+        talloc_free(s->send);
+        talloc_free(s->recv);
+        talloc_free(s->root);
+        talloc_free(s->queue_in);
+        talloc_free(s->queue_out);
+        talloc_free(s);
+        return NULL;
+    }
+
+    MP_TARRAY_APPEND(p, p->stages, p->num_stages, s);
+    stage_lock(s);
+    return s;
+}
+
+// Stop the stage thread, and free the stage and all filters in it. The stage
+// must not be locked.
+static void destroy_stage(struct chain_stage *s)
+{
+    struct chain *p = s->p;
+
+    stage_lock(s);
+    s->terminate = true;
+    mp_dispatch_interrupt(s->dispatch);
+    stage_unlock(s);
+    mp_thread_join(s->thread);
+
+    talloc_free(s->root);
+    talloc_free(s->send);
+    talloc_free(s->recv);
+    talloc_free(s->queue_in);
+    talloc_free(s->queue_out);
+
+    for (int n = 0; n < p->num_stages; n++) {
+        if (p->stages[n] == s) {
+            MP_TARRAY_REMOVE_AT(p->stages, p->num_stages, n);
+            break;
+        }
+    }
+    talloc_free(s);
+}
+
+// Destroy stages which do not contain any user filters anymore.
+static void prune_stages(struct chain *p)
+{
+    for (int n = p->num_stages - 1; n >= 0; n--) {
+        struct chain_stage *s = p->stages[n];
+        bool used = false;
+        for (int i = 0; i < p->num_user_filters; i++)
+            used |= p->user_filters[i]->stage == s;
+        if (!used)
+            destroy_stage(s);
+    }
+}
+
+static void reset_stage(struct chain_stage *s)
+{
+    mp_async_queue_reset(s->queue_in);
+    mp_async_queue_reset(s->queue_out);
+    stage_lock(s);
+    mp_filter_reset(s->root);
+    mp_dispatch_interrupt(s->dispatch);
+    stage_unlock(s);
+    mp_async_queue_resume(s->queue_in);
+    mp_async_queue_resume(s->queue_out);
+}
+
+static bool user_filter_command(struct mp_user_filter *u,
+                                struct mp_filter_command *cmd)
+{
+    stage_lock(u->stage);
+    bool res = mp_filter_command(u->f, cmd);
+    stage_unlock(u->stage);
+    return res;
+}
+
 // Rebuild p->all_filters and relink the filters. Non-destructive if no change.
+// All stages must be locked.
 static void relink_filter_list(struct chain *p)
 {
     struct mp_user_filter **all_filters[3] =
@@ -272,20 +499,49 @@ static void relink_filter_list(struct chain *p)
 
     p->filters_in = NULL;
     p->filters_out = NULL;
+    struct chain_stage *stage = NULL;
+    struct mp_pin *stage_out = NULL; // last output within the stage graph
     for (int n = 0; n < p->num_all_filters; n++) {
-        struct mp_filter *f = p->all_filters[n]->wrapper;
+        struct mp_user_filter *u = p->all_filters[n];
+        struct mp_filter *f = u->wrapper;
+
+        if (u->stage != stage) {
+            if (stage)
+                mp_pin_connect(stage->stage_out->pins[0], stage_out);
+            stage = u->stage;
+            if (stage) {
+                // (The chain always starts and ends with builtin filters.)
+                assert(p->filters_out);
+                mp_pin_connect(stage->send->pins[0], p->filters_out);
+                p->filters_out = stage->recv->pins[0];
+                stage_out = stage->stage_in->pins[0];
+            }
+        }
+
+        if (stage) {
+            mp_pin_connect(f->pins[0], stage_out);
+            stage_out = f->pins[1];
+            continue;
+        }
+
         if (n == 0)
             p->filters_in = f->pins[0];
         if (p->filters_out)
             mp_pin_connect(f->pins[0], p->filters_out);
         p->filters_out = f->pins[1];
     }
+    assert(!stage);
 }
 
 static void output_chain_process(struct mp_filter *f)
 {
     struct chain *p = f->priv;
 
+    for (int n = 0; n < p->num_stages; n++) {
+        if (atomic_exchange(&p->stages[n]->reconfig_happened, false))
+            p->public.reconfig_happened = true;
+    }
+
     if (mp_pin_can_transfer_data(p->filters_in, f->ppins[0])) {
         struct mp_frame frame = mp_pin_out_read(f->ppins[0]);
 
@@ -318,6 +574,9 @@ static void output_chain_reset(struct mp_filter *f)
     p->public.ao_needs_update = false;
 
     p->public.got_output_eof = false;
+
+    for (int n = 0; n < p->num_stages; n++)
+        reset_stage(p->stages[n]);
 }
 
 void mp_output_chain_reset_harder(struct mp_output_chain *c)
@@ -327,6 +586,7 @@ void mp_output_chain_reset_harder(struct mp_output_chain *c)
     mp_filter_reset(p->f);
 
     p->public.failed_output_conversion = false;
+    lock_all_stages(p);
     for (int n = 0; n < p->num_all_filters; n++) {
         struct mp_user_filter *u = p->all_filters[n];
 
@@ -334,6 +594,7 @@ void mp_output_chain_reset_harder(struct mp_output_chain *c)
         u->last_in_vformat = (struct mp_image_params){0};
         mp_aframe_reset(u->last_in_aformat);
     }
+    unlock_all_stages(p);
 
     if (p->type == MP_OUTPUT_CHAIN_AUDIO) {
         p->ao = NULL;
@@ -343,6 +604,11 @@ void mp_output_chain_reset_harder(struct mp_output_chain *c)
 
 static void output_chain_destroy(struct mp_filter *f)
 {
+    struct chain *p = f->priv;
+
+    while (p->num_stages)
+        destroy_stage(p->stages[p->num_stages - 1]);
+
     output_chain_reset(f);
 }
 
@@ -374,11 +640,13 @@ void mp_output_chain_set_vo(struct mp_output_chain *c, struct vo *vo)
 {
     struct chain *p = c->f->priv;
 
+    lock_all_stages(p);
     p->stream_info.hwdec_devs = vo ? vo->hwdec_devs : NULL;
     p->stream_info.osd = vo ? vo->osd : NULL;
     p->stream_info.rotate90 = vo ? vo->driver->caps & VO_CAP_ROTATE90 : false;
     p->stream_info.dr_vo = vo;
     p->vo = vo;
+    unlock_all_stages(p);
     update_output_caps(p);
 }
 
@@ -452,7 +720,7 @@ bool mp_output_chain_command(struct mp_output_chain *c, const char *target,
     if (strcmp(target, "all") == 0 && cmd->type == MP_FILTER_COMMAND_TEXT) {
         // (Following old semantics.)
         for (int n = 0; n < p->num_user_filters; n++)
-            mp_filter_command(p->user_filters[n]->f, cmd);
+            user_filter_command(p->user_filters[n], cmd);
         return true;
     }
 
@@ -460,7 +728,7 @@ bool mp_output_chain_command(struct mp_output_chain *c, const char *target,
     if (!f)
         return false;
 
-    return mp_filter_command(f->f, cmd);
+    return user_filter_command(f, cmd);
 }
 
 // Set the speed on the last filter in the chain that supports it. If a filter
@@ -475,7 +743,7 @@ static void set_speed_any(struct mp_user_filter **filters, int num_filters,
             .type = command,
             .speed = *speed,
         };
-        if (mp_filter_command(filters[n]->f, &cmd))
+        if (user_filter_command(filters[n], &cmd))
             *speed = 1.0;
     }
 }
@@ -510,11 +778,13 @@ double mp_output_get_measured_total_delay(struct mp_output_chain *c)
     for (int n = 0; n < p->num_all_filters; n++) {
         struct mp_user_filter *u = p->all_filters[n];
 
+        stage_lock(u->stage);
         if (u->last_in_pts != MP_NOPTS_VALUE &&
             u->last_out_pts != MP_NOPTS_VALUE)
         {
             delay += u->last_in_pts - u->last_out_pts;
         }
+        stage_unlock(u->stage);
     }
 
     return delay;
@@ -541,6 +811,9 @@ bool mp_output_chain_update_filters(struct mp_output_chain *c,
     struct mp_user_filter **res = NULL;      // new final list
     int num_res = 0;
     bool *used = talloc_zero_array(NULL, bool, p->num_user_filters);
+    int stage_index = 0;
+
+    lock_all_stages(p);
 
     for (int n = 0; list && list[n].name; n++) {
         struct m_obj_settings *entry = &list[n];
@@ -548,10 +821,16 @@ bool mp_output_chain_update_filters(struct mp_output_chain *c,
         if (!entry->enabled)
             continue;
 
+        if (mp_user_filter_is_thread_split(p->type, entry->name)) {
+            stage_index++;
+            continue;
+        }
+
         struct mp_user_filter *u = NULL;
 
         for (int i = 0; i < p->num_user_filters; i++) {
-            if (!used[i] && m_obj_settings_equal(entry, p->user_filters[i]->args))
+            if (!used[i] && p->user_filters[i]->stage_index == stage_index &&
+                m_obj_settings_equal(entry, p->user_filters[i]->args))
             {
                 u = p->user_filters[i];
                 used[i] = true;
@@ -560,7 +839,16 @@ bool mp_output_chain_update_filters(struct mp_output_chain *c,
         }
 
         if (!u) {
-            u = create_wrapper_filter(p);
+            struct chain_stage *stage = NULL;
+            if (stage_index) {
+                stage = find_stage(p, stage_index);
+                if (!stage)
+                    stage = create_stage(p, stage_index);
+                if (!stage)
+                    goto error;
+            }
+
+            u = create_wrapper_filter(p, stage);
             u->name = talloc_strdup(u, entry->name);
             u->label = talloc_strdup(u, entry->label);
             u->f = mp_create_user_filter(u->wrapper, p->type, entry->name,
@@ -618,6 +906,12 @@ bool mp_output_chain_update_filters(struct mp_output_chain *c,
     if (!p->num_user_filters)
         MP_VERBOSE(p, "  (empty)\n");
 
+    unlock_all_stages(p);
+    prune_stages(p);
+
+    if (p->num_stages)
+        MP_VERBOSE(p, "Using %d filter threads.\n", p->num_stages);
+
     // Filters can load hwdec interops, which might add new formats.
     update_output_caps(p);
 
@@ -630,6 +924,8 @@ bool mp_output_chain_update_filters(struct mp_output_chain *c,
 error:
     for (int n = 0; n < num_add; n++)
         talloc_free(add[n]->wrapper);
+    unlock_all_stages(p);
+    prune_stages(p);
     talloc_free(add);
     talloc_free(used);
     return false;
@@ -645,14 +941,14 @@ static void create_video_things(struct chain *p)
 
     p->f->stream_info = &p->stream_info;
 
-    struct mp_user_filter *f = create_wrapper_filter(p);
+    struct mp_user_filter *f = create_wrapper_filter(p, NULL);
     f->name = "userdeint";
     f->f = mp_deint_create(f->wrapper);
     if (!f->f)
         abort();
     MP_TARRAY_APPEND(p, p->pre_filters, p->num_pre_filters, f);
 
-    f = create_wrapper_filter(p);
+    f = create_wrapper_filter(p, NULL);
     f->name = "autorotate";
     f->f = mp_autorotate_create(f->wrapper);
     if (!f->f)
@@ -664,7 +960,7 @@ static void create_audio_things(struct chain *p)
 {
     p->frame_type = MP_FRAME_AUDIO;
 
-    struct mp_user_filter *f = create_wrapper_filter(p);
+    struct mp_user_filter *f = create_wrapper_filter(p, NULL);
     f->name = "userspeed";
     f->f = mp_autoaspeed_create(f->wrapper);
     if (!f->f)
@@ -701,7 +997,7 @@ struct mp_output_chain *mp_output_chain_create(struct mp_filter *parent,
     c->output_aformat = talloc_steal(p, mp_aframe_create());
 
     // Dummy filter for reporting and logging the input format.
-    p->input = create_wrapper_filter(p);
+    p->input = create_wrapper_filter(p, NULL);
     p->input->f = mp_bidir_nop_filter_create(p->input->wrapper);
     if (!p->input->f)
         abort();
@@ -713,7 +1009,7 @@ struct mp_output_chain *mp_output_chain_create(struct mp_filter *parent,
     case MP_OUTPUT_CHAIN_AUDIO: create_audio_things(p); break;
     }
 
-    p->convert_wrapper = create_wrapper_filter(p);
+    p->convert_wrapper = create_wrapper_filter(p, NULL);
     p->convert = mp_autoconvert_create(p->convert_wrapper->wrapper);
     if (!p->convert)
         abort();
@@ -727,7 +1023,7 @@ struct mp_output_chain *mp_output_chain_create(struct mp_filter *parent,
     }
 
     // Dummy filter for reporting and logging the output format.
-    p->output = create_wrapper_filter(p);
+    p->output = create_wrapper_filter(p, NULL);
     p->output->f = mp_bidir_nop_filter_create(p->output->wrapper);
     if (!p->output->f)
         abort();
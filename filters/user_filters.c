@@ -103,6 +103,16 @@ const struct mp_user_filter_entry *vf_list[] = {
 #if (HAVE_GL && HAVE_EGL) || HAVE_VULKAN
     &vf_gpu,
 #endif
+    &vf_thread,
+};
+
+// Not a filter; f_output_chain.c runs the filters following it on a separate
+// thread.
+const struct mp_user_filter_entry vf_thread = {
+    .desc = {
+        .name = "thread",
+        .description = "run the following filters on a separate thread",
+    },
 };
 
 static bool get_vf_desc(struct m_obj_desc *dst, int index)
@@ -140,6 +150,15 @@ const struct m_obj_list vf_obj_list = {
     .get_lavfi_filters = get_lavfi_video_filters,
 };
 
+bool mp_user_filter_is_thread_split(enum mp_output_chain_type type,
+                                    const char *name)
+{
+    struct m_obj_desc desc;
+    return type == MP_OUTPUT_CHAIN_VIDEO &&
+           m_obj_list_find(&desc, &vf_obj_list, bstr0(name)) &&
+           desc.p == &vf_thread;
+}
+
 // Create a bidir, single-media filter from command line arguments.
 struct mp_filter *mp_create_user_filter(struct mp_filter *parent,
                                         enum mp_output_chain_type type,
@@ -186,7 +205,8 @@ struct mp_filter *mp_create_user_filter(struct mp_filter *parent,
     }
 
     const struct mp_user_filter_entry *entry = desc.p;
-    f = entry->create(parent, options);
+    if (entry->create)
+        f = entry->create(parent, options);
 
 done:
     if (!f) {
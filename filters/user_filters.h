@@ -11,6 +11,7 @@ struct mp_user_filter_entry {
     // Create a filter. The option pointer is non-NULL if desc implies a priv
     // struct to be allocated; then options are parsed into it. The callee
     // must always free options (but can reparent it with talloc to keep it).
+    // NULL for entries which are handled by the filter chain itself.
     struct mp_filter *(*create)(struct mp_filter *parent, void *options);
 };
 
@@ -18,6 +19,11 @@ struct mp_filter *mp_create_user_filter(struct mp_filter *parent,
                                         enum mp_output_chain_type type,
                                         const char *name, char **args);
 
+// Whether the entry is the "thread" pseudo filter, which splits the filter
+// chain into parts running on separate threads.
+bool mp_user_filter_is_thread_split(enum mp_output_chain_type type,
+                                    const char *name);
+
 extern const struct mp_user_filter_entry af_lavfi;
 extern const struct mp_user_filter_entry af_lavfi_bridge;
 extern const struct mp_user_filter_entry af_scaletempo;
@@ -37,3 +43,4 @@ extern const struct mp_user_filter_entry vf_vavpp;
 extern const struct mp_user_filter_entry vf_d3d11vpp;
 extern const struct mp_user_filter_entry vf_fingerprint;
 extern const struct mp_user_filter_entry vf_gpu;
+extern const struct mp_user_filter_entry vf_thread;
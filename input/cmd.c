@@ -16,12 +16,14 @@
  */
 
 #include <stddef.h>
+#include <stdint.h>
 
 #include "misc/bstr.h"
 #include "misc/node.h"
 #include "common/common.h"
 #include "common/msg.h"
 #include "options/m_option.h"
+#include "osdep/threads.h"
 
 #include "cmd.h"
 #include "input.h"
@@ -510,6 +512,303 @@ done:
 }
 
 struct mp_cmd *mp_input_parse_cmd_strv(struct mp_log *log, const char **argv)
+{
+    return mp_cmd_cache_parse_strv(NULL, log, argv);
+}
+
+// Number of parsed commands kept by struct mp_cmd_cache.
+#define CMD_CACHE_SIZE 64
+// Longest command text or argument that is considered for caching.
+#define CMD_CACHE_MAX_KEY 512
+
+struct cmd_cache_entry {
+    uint64_t hash;
+    bstr key;               // see cache_key_str()/cache_key_node()
+    uint64_t last_use;      // for LRU eviction
+    struct mp_cmd *proto;   // parsed command (owned by the entry)
+    // For node entries only: the raw values proto->args[n] were parsed from.
+    bstr *arg_keys;
+    int num_arg_keys;
+};
+
+struct mp_cmd_cache {
+    mp_mutex lock;
+    struct mp_log *log;
+    struct cmd_cache_entry entries[CMD_CACHE_SIZE];
+    int num_entries;
+    uint64_t use_counter;
+    uint64_t hits, misses;
+};
+
+static void destroy_cmd_cache(void *ptr)
+{
+    struct mp_cmd_cache *cache = ptr;
+    mp_verbose(cache->log, "Command cache: %"PRIu64" hits, %"PRIu64" misses.\n",
+               cache->hits, cache->misses);
+    mp_mutex_destroy(&cache->lock);
+}
+
+struct mp_cmd_cache *mp_cmd_cache_create(void *talloc_ctx, struct mp_log *log)
+{
+    struct mp_cmd_cache *cache = talloc_zero(talloc_ctx, struct mp_cmd_cache);
+    talloc_set_destructor(cache, destroy_cmd_cache);
+    cache->log = log;
+    mp_mutex_init(&cache->lock);
+    return cache;
+}
+
+// FNV-1a
+static uint64_t cache_hash(bstr key)
+{
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (size_t n = 0; n < key.len; n++)
+        h = (h ^ key.start[n]) * 0x100000001b3ULL;
+    return h;
+}
+
+static struct cmd_cache_entry *cache_find(struct mp_cmd_cache *cache, bstr key,
+                                          uint64_t hash)
+{
+    for (int n = 0; n < cache->num_entries; n++) {
+        struct cmd_cache_entry *e = &cache->entries[n];
+        if (e->hash == hash && bstr_equals(e->key, key)) {
+            e->last_use = ++cache->use_counter;
+            return e;
+        }
+    }
+    return NULL;
+}
+
+// Return a free (possibly evicted) entry. Must be filled by the caller.
+static struct cmd_cache_entry *cache_alloc(struct mp_cmd_cache *cache)
+{
+    struct cmd_cache_entry *e = NULL;
+    if (cache->num_entries < CMD_CACHE_SIZE) {
+        e = &cache->entries[cache->num_entries++];
+    } else {
+        e = &cache->entries[0];
+        for (int n = 1; n < cache->num_entries; n++) {
+            if (cache->entries[n].last_use < e->last_use)
+                e = &cache->entries[n];
+        }
+        talloc_free(e->key.start);
+        talloc_free(e->proto);
+        talloc_free(e->arg_keys);
+    }
+    *e = (struct cmd_cache_entry){.last_use = ++cache->use_counter};
+    return e;
+}
+
+struct mp_cmd *mp_cmd_cache_parse_str(struct mp_cmd_cache *cache,
+                                      struct mp_log *log, bstr str,
+                                      const char *loc)
+{
+    if (!cache || str.len > CMD_CACHE_MAX_KEY)
+        return mp_input_parse_cmd_str(log, str, loc);
+
+    // Text commands are cached by their exact text. Tokenizing the string
+    // would cost about as much as parsing it, so partial matches are not
+    // attempted.
+    uint64_t hash = cache_hash(str);
+
+    mp_mutex_lock(&cache->lock);
+    struct cmd_cache_entry *e = cache_find(cache, str, hash);
+    struct mp_cmd *cmd = e ? mp_cmd_clone(e->proto) : NULL;
+    if (cmd) {
+        cache->hits++;
+    } else {
+        cache->misses++;
+    }
+    mp_mutex_unlock(&cache->lock);
+
+    if (cmd)
+        return cmd;
+
+    cmd = mp_input_parse_cmd_str(log, str, loc);
+    if (!cmd)
+        return NULL;
+
+    mp_mutex_lock(&cache->lock);
+    if (!cache_find(cache, str, hash)) {
+        e = cache_alloc(cache);
+        e->hash = hash;
+        e->key = bstrdup(cache, str);
+        e->proto = talloc_steal(cache, mp_cmd_clone(cmd));
+    }
+    mp_mutex_unlock(&cache->lock);
+
+    return cmd;
+}
+
+// Append the raw value of an argument node to *dst. Returns false if the node
+// type is not supported by the cache.
+static bool append_node_value(void *ta_ctx, bstr *dst, mpv_node *val)
+{
+    switch (val->format) {
+    case MPV_FORMAT_STRING:
+        bstr_xappend(ta_ctx, dst, bstr0("s"));
+        bstr_xappend(ta_ctx, dst, bstr0(val->u.string));
+        return true;
+    case MPV_FORMAT_FLAG:
+        bstr_xappend(ta_ctx, dst, bstr0(val->u.flag ? "t" : "f"));
+        return true;
+    case MPV_FORMAT_INT64:
+        bstr_xappend(ta_ctx, dst, bstr0("i"));
+        bstr_xappend(ta_ctx, dst, (bstr){(void *)&val->u.int64,
+                                         sizeof(val->u.int64)});
+        return true;
+    case MPV_FORMAT_DOUBLE:
+        bstr_xappend(ta_ctx, dst, bstr0("d"));
+        bstr_xappend(ta_ctx, dst, (bstr){(void *)&val->u.double_,
+                                         sizeof(val->u.double_)});
+        return true;
+    default:
+        return false;
+    }
+}
+
+// The cache key of a node command is its "shape": the flag prefixes, the
+// command name, and the types of the arguments. The argument values are not
+// part of the key, but are re-bound to the cached prototype on every use.
+// Returns the index of the first argument, or -1 if not cacheable.
+static int cache_key_node(void *ta_ctx, bstr *key, mpv_node *node)
+{
+    if (node->format != MPV_FORMAT_NODE_ARRAY)
+        return -1;
+    mpv_node_list *args = node->u.list;
+    int cur = 0;
+    while (cur < args->num && args->values[cur].format == MPV_FORMAT_STRING) {
+        const char *s = args->values[cur++].u.string;
+        bstr_xappend(ta_ctx, key, bstr0(s));
+        bstr_xappend(ta_ctx, key, (bstr){(unsigned char *)"", 1});
+        bool is_flag = false;
+        for (int n = 0; cmd_flags[n].name; n++)
+            is_flag |= strcmp(s, cmd_flags[n].name) == 0;
+        if (!is_flag)
+            break;
+    }
+    if (!key->len)
+        return -1;
+    int first = cur;
+    for (; cur < args->num; cur++) {
+        char t;
+        switch (args->values[cur].format) {
+        case MPV_FORMAT_STRING: t = 's'; break;
+        case MPV_FORMAT_FLAG:   t = 'f'; break;
+        case MPV_FORMAT_INT64:  t = 'i'; break;
+        case MPV_FORMAT_DOUBLE: t = 'd'; break;
+        default:
+            return -1;
+        }
+        bstr_xappend(ta_ctx, key, (bstr){(unsigned char *)&t, 1});
+    }
+    return key->len > CMD_CACHE_MAX_KEY ? -1 : first;
+}
+
+// Set argument i of cmd from the cache entry if the raw value is the same,
+// parse it otherwise. Updates the entry with the new value.
+static bool rebind_node_arg(struct mp_log *log, struct cmd_cache_entry *e,
+                            struct mp_cmd *cmd, int i, mpv_node *val)
+{
+    void *tmp = talloc_new(NULL);
+    bstr raw = {0};
+    append_node_value(tmp, &raw, val);
+
+    bool ok = true;
+    struct mp_cmd *proto = e->proto;
+    if (i < e->num_arg_keys && bstr_equals(e->arg_keys[i], raw)) {
+        struct mp_cmd_arg arg = {.type = proto->args[i].type};
+        m_option_copy(arg.type, &arg.v, &proto->args[i].v);
+        MP_TARRAY_APPEND(cmd, cmd->args, cmd->nargs, arg);
+    } else if ((ok = set_node_arg(log, cmd, i, val)) && i < e->num_arg_keys) {
+        m_option_free(proto->args[i].type, &proto->args[i].v);
+        proto->args[i].type = cmd->args[i].type;
+        m_option_copy(proto->args[i].type, &proto->args[i].v, &cmd->args[i].v);
+        talloc_free(e->arg_keys[i].start);
+        e->arg_keys[i] = bstrdup(e->arg_keys, raw);
+    }
+
+    talloc_free(tmp);
+    return ok;
+}
+
+struct mp_cmd *mp_cmd_cache_parse_node(struct mp_cmd_cache *cache,
+                                       struct mp_log *log, mpv_node *node)
+{
+    if (!cache)
+        return mp_input_parse_cmd_node(log, node);
+
+    void *tmp = talloc_new(NULL);
+    bstr key = {0};
+    int first = cache_key_node(tmp, &key, node);
+    if (first < 0) {
+        talloc_free(tmp);
+        return mp_input_parse_cmd_node(log, node);
+    }
+    uint64_t hash = cache_hash(key);
+    mpv_node_list *args = node->u.list;
+    int nargs = args->num - first;
+
+    struct mp_cmd *cmd = NULL;
+
+    mp_mutex_lock(&cache->lock);
+    struct cmd_cache_entry *e = cache_find(cache, key, hash);
+    if (e) {
+        cache->hits++;
+        struct mp_cmd *proto = e->proto;
+        cmd = talloc_ptrtype(NULL, cmd);
+        talloc_set_destructor(cmd, destroy_cmd);
+        *cmd = (struct mp_cmd) {
+            .name = (char *)proto->def->name,
+            .def = proto->def,
+            .flags = proto->flags,
+            .scale = 1,
+            .scale_units = 1,
+        };
+        bool ok = true;
+        for (int i = 0; i < nargs && ok; i++)
+            ok = rebind_node_arg(log, e, cmd, i, &args->values[first + i]);
+        if (!ok || !finish_cmd(log, cmd))
+            TA_FREEP(&cmd);
+        mp_mutex_unlock(&cache->lock);
+        talloc_free(tmp);
+        return cmd;
+    }
+    cache->misses++;
+    mp_mutex_unlock(&cache->lock);
+
+    cmd = mp_input_parse_cmd_node(log, node);
+    if (!cmd) {
+        talloc_free(tmp);
+        return NULL;
+    }
+
+    bstr *arg_keys = talloc_zero_array(NULL, bstr, nargs);
+    for (int i = 0; i < nargs; i++) {
+        bstr raw = {0};
+        append_node_value(arg_keys, &raw, &args->values[first + i]);
+        arg_keys[i] = raw;
+    }
+
+    mp_mutex_lock(&cache->lock);
+    if (!cache_find(cache, key, hash)) {
+        e = cache_alloc(cache);
+        e->hash = hash;
+        e->key = bstrdup(cache, key);
+        e->proto = talloc_steal(cache, mp_cmd_clone(cmd));
+        e->arg_keys = talloc_steal(cache, arg_keys);
+        e->num_arg_keys = nargs;
+        arg_keys = NULL;
+    }
+    mp_mutex_unlock(&cache->lock);
+
+    talloc_free(arg_keys);
+    talloc_free(tmp);
+    return cmd;
+}
+
+struct mp_cmd *mp_cmd_cache_parse_strv(struct mp_cmd_cache *cache,
+                                       struct mp_log *log, const char **argv)
 {
     int count = 0;
     while (argv[count])
@@ -521,7 +820,7 @@ struct mp_cmd *mp_input_parse_cmd_strv(struct mp_log *log, const char **argv)
         items[n] = (mpv_node){.format = MPV_FORMAT_STRING,
                               .u = {.string = (char *)argv[n]}};
     }
-    struct mp_cmd *res = mp_input_parse_cmd_node(log, &node);
+    struct mp_cmd *res = mp_cmd_cache_parse_node(cache, log, &node);
     talloc_free(items);
     return res;
 }
@@ -146,6 +146,28 @@ struct mp_cmd *mp_input_parse_cmd_strv(struct mp_log *log, const char **argv);
 
 struct mp_cmd *mp_input_parse_cmd_node(struct mp_log *log, struct mpv_node *node);
 
+// Bounded cache of parsed commands, for clients which send the same commands
+// over and over (IPC, scripts, key bindings). The functions are thread-safe.
+// Free the cache with talloc_free().
+struct mp_cmd_cache;
+struct mp_cmd_cache *mp_cmd_cache_create(void *talloc_ctx, struct mp_log *log);
+
+// Like mp_input_parse_cmd_str(), but return a copy of the cached command if the
+// exact same text was parsed before. cache can be NULL (disables caching).
+struct mp_cmd *mp_cmd_cache_parse_str(struct mp_cmd_cache *cache,
+                                      struct mp_log *log, bstr str,
+                                      const char *loc);
+
+// Like mp_input_parse_cmd_node(), but reuse the resolved command definition
+// for commands with the same name, flags and argument types, and only parse
+// arguments whose values changed. cache can be NULL (disables caching).
+struct mp_cmd *mp_cmd_cache_parse_node(struct mp_cmd_cache *cache,
+                                       struct mp_log *log, struct mpv_node *node);
+
+// Like mp_input_parse_cmd_strv(), but using the cache as above.
+struct mp_cmd *mp_cmd_cache_parse_strv(struct mp_cmd_cache *cache,
+                                       struct mp_log *log, const char **argv);
+
 // After getting a command from mp_input_get_cmd you need to free it using this
 // function
 void mp_cmd_free(struct mp_cmd *cmd);
@@ -163,6 +163,9 @@ struct input_ctx {
 
     struct cmd_queue cmd_queue;
 
+    // Parsed command cache (has its own lock)
+    struct mp_cmd_cache *cmd_cache;
+
     void (*wakeup_cb)(void *ctx);
     void *wakeup_ctx;
 };
@@ -1509,6 +1512,7 @@ struct input_ctx *mp_input_init(struct mpv_global *global,
     };
 
     ictx->opts = ictx->opts_cache->opts;
+    ictx->cmd_cache = mp_cmd_cache_create(ictx, ictx->log);
 
     mp_mutex_init(&ictx->mutex);
 
@@ -1635,13 +1639,18 @@ bool mp_input_use_media_keys(struct input_ctx *ictx)
 struct mp_cmd *mp_input_parse_cmd(struct input_ctx *ictx, bstr str,
                                   const char *location)
 {
-    return mp_input_parse_cmd_str(ictx->log, str, location);
+    return mp_cmd_cache_parse_str(ictx->cmd_cache, ictx->log, str, location);
+}
+
+struct mp_cmd_cache *mp_input_get_cmd_cache(struct input_ctx *ictx)
+{
+    return ictx->cmd_cache;
 }
 
 void mp_input_run_cmd(struct input_ctx *ictx, const char **cmd)
 {
     input_lock(ictx);
-    queue_cmd(ictx, mp_input_parse_cmd_strv(ictx->log, cmd));
+    queue_cmd(ictx, mp_cmd_cache_parse_strv(ictx->cmd_cache, ictx->log, cmd));
     input_unlock(ictx);
 }
 
@@ -1859,7 +1868,9 @@ void mp_input_src_feed_cmd_text(struct mp_input_src *src, char *buf, size_t len)
             if (term) {
                 bstr s = {in->cmd_buffer, in->cmd_buffer_size};
                 s = bstr_strip(s);
-                struct mp_cmd *cmd = mp_input_parse_cmd_str(src->log, s, "<>");
+                struct mp_cmd *cmd =
+                    mp_cmd_cache_parse_str(src->input_ctx->cmd_cache, src->log,
+                                           s, "<>");
                 if (cmd) {
                     input_lock(src->input_ctx);
                     queue_cmd(src->input_ctx, cmd);
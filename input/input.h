@@ -135,6 +135,10 @@ struct mp_cmd *mp_input_read_cmd(struct input_ctx *ictx);
 struct mp_cmd *mp_input_parse_cmd(struct input_ctx *ictx, bstr str,
                                   const char *location);
 
+// Return the command cache used by mp_input_parse_cmd(). Can be passed to
+// mp_cmd_cache_parse_node() and similar functions from any thread.
+struct mp_cmd_cache *mp_input_get_cmd_cache(struct input_ctx *ictx);
+
 // Set current input section. The section is appended on top of the list of
 // active sections, so its bindings are considered first. If the section was
 // already active, it's moved to the top as well.
@@ -33,6 +33,7 @@
 #include "common/msg.h"
 #include "input/input.h"
 #include "libmpv/client.h"
+#include "misc/thread_pool.h"
 #include "options/m_config.h"
 #include "options/options.h"
 #include "options/path.h"
@@ -42,16 +43,28 @@
 #define MSG_NOSIGNAL 0
 #endif
 
+// Maximum number of threads running commands sent by clients. Commands can
+// block for a while, and this avoids that one client stalls all others.
+#define MAX_COMMAND_THREADS 4
+
+// Don't compact the output buffer for every partial write.
+#define OUTPUT_COMPACT_SIZE (64 * 1024)
+
 struct mp_ipc_ctx {
     struct mp_log *log;
     struct mp_client_api *client_api;
     const char *path;
 
-    mp_thread thread;
-    int death_pipe[2];
+    int listen_fd;
+    int client_num;             // owned by the loop thread
+
+    // -- protected by loop_lock
+    bool stop;                  // request to close listen_fd
+    bool stopped;               // listen_fd was closed by the loop thread
 };
 
 struct client_arg {
+    struct ipc_loop *loop;
     struct mp_log *log;
     struct mpv_handle *client;
 
@@ -59,180 +72,429 @@ struct client_arg {
     int client_fd;
     bool close_client_fd;
     bool quit_on_close;
+    int64_t max_output;
+
+    // -- protected by loop_lock
+    bool have_events;           // the wakeup callback was called
+    bool busy;                  // commands are run on a worker thread
 
+    // -- owned by the worker thread while busy, otherwise by the loop thread
+    bstr client_msg;            // received data (talloc root)
+    bstr replies;               // command replies not yet added to output
+
+    // -- owned by the loop thread
     bool writable;
+    bool idle;                  // !busy, as of the start of the iteration
+    bool read_events;           // have_events was set and reset
+    bool eof;                   // client closed its end of the connection
+    bool dead;                  // remove as soon as !busy
+    bstr output;                // data not yet written to client_fd
+    size_t output_pos;
+};
+
+// All clients (and listening sockets) of all mpv instances in the process are
+// served by a single thread, which polls the sockets and reads events from the
+// mpv_handles. It is started on demand, and exits if there is nothing left to
+// serve.
+struct ipc_loop {
+    int wakeup_pipe[2];
+    struct mp_thread_pool *pool;
+
+    // -- protected by loop_lock
+    bool woken;                 // wakeup_pipe was written to
+    struct client_arg **new_clients;
+    int num_new_clients;
+    struct mp_ipc_ctx **servers;
+    int num_servers;
+
+    // -- owned by the loop thread
+    struct client_arg **clients;
+    int num_clients;
+    struct mp_ipc_ctx **active_servers;
+    int num_active_servers;
+    struct pollfd *fds;
 };
 
-static int ipc_write_str(struct client_arg *client, const char *buf)
+static mp_static_mutex loop_lock = MP_STATIC_MUTEX_INITIALIZER;
+static mp_cond loop_wakeup = MP_STATIC_COND_INITIALIZER;
+static struct ipc_loop *loop_instance;
+
+static void wakeup_loop_locked(struct ipc_loop *loop)
 {
-    size_t count = strlen(buf);
-    while (count > 0) {
-        ssize_t rc = send(client->client_fd, buf, count, MSG_NOSIGNAL);
-        if (rc <= 0) {
-            if (rc == 0)
-                return -1;
+    if (!loop->woken) {
+        loop->woken = true;
+        (void)write(loop->wakeup_pipe[1], &(char){0}, 1);
+    }
+}
+
+static void client_wakeup(void *p)
+{
+    struct client_arg *arg = p;
+
+    mp_mutex_lock(&loop_lock);
+    if (!arg->have_events) {
+        arg->have_events = true;
+        wakeup_loop_locked(arg->loop);
+    }
+    mp_mutex_unlock(&loop_lock);
+}
+
+static void run_commands(void *p)
+{
+    struct client_arg *arg = p;
+
+    while (bstrchr(arg->client_msg, '\n') != -1) {
+        char *reply_msg = mp_ipc_consume_next_command(arg->client, NULL,
+                                                      &arg->client_msg);
+        if (reply_msg)
+            bstr_xappend(arg, &arg->replies, bstr0(reply_msg));
+        talloc_free(reply_msg);
+    }
+
+    mp_mutex_lock(&loop_lock);
+    arg->busy = false;
+    wakeup_loop_locked(arg->loop);
+    mp_mutex_unlock(&loop_lock);
+}
+
+static void destroy_client(void *p)
+{
+    struct client_arg *arg = p;
+
+    if (arg->client_msg.len > 0)
+        MP_WARN(arg, "Ignoring unterminated command on disconnect.\n");
+    talloc_free(arg->client_msg.start);
+    if (arg->close_client_fd)
+        close(arg->client_fd);
+    struct mpv_handle *h = arg->client;
+    bool quit = arg->quit_on_close;
+    talloc_free(arg);
+    if (quit) {
+        mpv_terminate_destroy(h);
+    } else {
+        mpv_destroy(h);
+    }
+}
 
-            if (errno == EBADF || errno == ENOTSOCK) {
-                client->writable = false;
-                return 0;
+// Move the pending output to the socket, as far as it can be done without
+// blocking. All output produced in one loop iteration is written at once.
+static void flush_output(struct client_arg *arg)
+{
+    while (arg->writable && arg->output_pos < arg->output.len) {
+        ssize_t rc = send(arg->client_fd, arg->output.start + arg->output_pos,
+                          arg->output.len - arg->output_pos, MSG_NOSIGNAL);
+        if (rc <= 0) {
+            if (rc < 0 && (errno == EBADF || errno == ENOTSOCK)) {
+                arg->writable = false;
+                break;
             }
 
-            if (errno == EINTR || errno == EAGAIN)
+            if (rc < 0 && errno == EINTR)
                 continue;
 
-            return rc;
+            if (rc < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                break;
+
+            MP_ERR(arg, "Write error (%s)\n", mp_strerror(errno));
+            arg->dead = true;
+            return;
         }
 
-        count -= rc;
-        buf   += rc;
+        arg->output_pos += rc;
     }
 
-    return 0;
+    if (!arg->writable || arg->output_pos == arg->output.len) {
+        arg->output.len = arg->output_pos = 0;
+    } else if (arg->output_pos >= OUTPUT_COMPACT_SIZE) {
+        arg->output.len -= arg->output_pos;
+        memmove(arg->output.start, arg->output.start + arg->output_pos,
+                arg->output.len);
+        arg->output_pos = 0;
+    }
+
+    if (arg->output.len - arg->output_pos > arg->max_output) {
+        MP_WARN(arg, "Client does not read its data, disconnecting.\n");
+        arg->dead = true;
+    }
 }
 
-static MP_THREAD_VOID client_thread(void *p)
+static void read_events(struct client_arg *arg)
 {
-    // We don't use MSG_NOSIGNAL because the moldy fruit OS doesn't support it.
-    struct sigaction sa = { .sa_handler = SIG_IGN, .sa_flags = SA_RESTART };
-    sigfillset(&sa.sa_mask);
-    sigaction(SIGPIPE, &sa, NULL);
+    while (1) {
+        mpv_event *event = mpv_wait_event(arg->client, 0);
 
-    int rc;
+        if (event->event_id == MPV_EVENT_NONE)
+            break;
 
-    struct client_arg *arg = p;
-    bstr client_msg = { talloc_strdup(NULL, ""), 0 };
+        if (event->event_id == MPV_EVENT_SHUTDOWN) {
+            arg->dead = true;
+            break;
+        }
 
-    char *tname = talloc_asprintf(NULL, "ipc/%s", arg->client_name);
-    mp_thread_set_name(tname);
-    talloc_free(tname);
+        if (!arg->writable)
+            continue;
 
-    int pipe_fd = mpv_get_wakeup_pipe(arg->client);
-    if (pipe_fd < 0) {
-        MP_ERR(arg, "Could not get wakeup pipe\n");
-        goto done;
+        char *event_msg = mp_json_encode_event(event);
+        if (!event_msg) {
+            MP_ERR(arg, "Encoding error\n");
+            arg->dead = true;
+            break;
+        }
+
+        bstr_xappend(arg, &arg->output, bstr0(event_msg));
+        talloc_free(event_msg);
     }
+}
 
-    MP_VERBOSE(arg, "Client connected\n");
+static void read_input(struct client_arg *arg)
+{
+    while (1) {
+        char buf[4096];
 
-    struct pollfd fds[2] = {
-        {.events = POLLIN, .fd = pipe_fd},
-        {.events = POLLIN, .fd = arg->client_fd},
-    };
+        ssize_t bytes = read(arg->client_fd, buf, sizeof(buf));
+        if (bytes < 0) {
+            if (errno == EINTR)
+                continue;
 
-    fcntl(arg->client_fd, F_SETFL, fcntl(arg->client_fd, F_GETFL, 0) | O_NONBLOCK);
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
 
-    while (1) {
-        rc = poll(fds, 2, 0);
-        if (rc == 0)
-            rc = poll(fds, 2, -1);
-        if (rc < 0) {
-            MP_ERR(arg, "Poll error\n");
-            continue;
+            MP_ERR(arg, "Read error (%s)\n", mp_strerror(errno));
+            arg->dead = true;
+            break;
         }
 
-        if (fds[0].revents & POLLIN) {
-            mp_flush_wakeup_pipe(pipe_fd);
+        if (bytes == 0) {
+            arg->eof = true;
+            break;
+        }
 
-            while (1) {
-                mpv_event *event = mpv_wait_event(arg->client, 0);
+        bstr_xappend(NULL, &arg->client_msg, (bstr){buf, bytes});
 
-                if (event->event_id == MPV_EVENT_NONE)
-                    break;
+        // Run the commands before reading more.
+        if (memchr(buf, '\n', bytes))
+            break;
+    }
+}
 
-                if (event->event_id == MPV_EVENT_SHUTDOWN)
-                    goto done;
+static void process_client(struct ipc_loop *loop, struct client_arg *arg)
+{
+    if (arg->idle) {
+        if (arg->replies.len) {
+            if (arg->writable)
+                bstr_xappend(arg, &arg->output, arg->replies);
+            arg->replies.len = 0;
+        }
 
-                if (!arg->writable)
-                    continue;
+        if (arg->read_events)
+            read_events(arg);
 
-                char *event_msg = mp_json_encode_event(event);
-                if (!event_msg) {
-                    MP_ERR(arg, "Encoding error\n");
-                    goto done;
-                }
+        if (!arg->dead && bstrchr(arg->client_msg, '\n') != -1) {
+            mp_mutex_lock(&loop_lock);
+            arg->busy = true;
+            mp_mutex_unlock(&loop_lock);
+            arg->idle = false;
+            mp_thread_pool_queue(loop->pool, run_commands, arg);
+        }
+    }
 
-                rc = ipc_write_str(arg, event_msg);
-                talloc_free(event_msg);
-                if (rc < 0) {
-                    MP_ERR(arg, "Write error (%s)\n", mp_strerror(errno));
-                    goto done;
-                }
+    if (!arg->dead)
+        flush_output(arg);
+
+    if (!arg->dead && arg->eof && arg->idle && !arg->output.len) {
+        MP_VERBOSE(arg, "Client disconnected\n");
+        arg->dead = true;
+    }
+}
+
+static void accept_client(struct mp_ipc_ctx *ctx);
+
+static MP_THREAD_VOID ipc_loop_thread(void *p)
+{
+    struct ipc_loop *loop = p;
+
+    mp_thread_set_name("ipc");
+
+    // We don't use MSG_NOSIGNAL because the moldy fruit OS doesn't support it.
+    struct sigaction sa = { .sa_handler = SIG_IGN, .sa_flags = SA_RESTART };
+    sigfillset(&sa.sa_mask);
+    sigaction(SIGPIPE, &sa, NULL);
+
+    while (1) {
+        int num_added = 0;
+
+        mp_mutex_lock(&loop_lock);
+
+        mp_flush_wakeup_pipe(loop->wakeup_pipe[0]);
+        loop->woken = false;
+
+        loop->num_active_servers = 0;
+        for (int n = loop->num_servers - 1; n >= 0; n--) {
+            struct mp_ipc_ctx *ctx = loop->servers[n];
+            if (ctx->stop) {
+                close(ctx->listen_fd);
+                ctx->stopped = true;
+                MP_TARRAY_REMOVE_AT(loop->servers, loop->num_servers, n);
+                mp_cond_broadcast(&loop_wakeup);
+            } else {
+                MP_TARRAY_APPEND(loop, loop->active_servers,
+                                 loop->num_active_servers, ctx);
             }
         }
 
-        if (fds[1].revents & (POLLIN | POLLHUP | POLLNVAL)) {
-            while (1) {
-                char buf[128];
-                bstr append = { buf, 0 };
+        for (int n = 0; n < loop->num_new_clients; n++) {
+            MP_TARRAY_APPEND(loop, loop->clients, loop->num_clients,
+                             loop->new_clients[n]);
+        }
+        num_added = loop->num_new_clients;
+        loop->num_new_clients = 0;
+
+        for (int n = 0; n < loop->num_clients; n++) {
+            struct client_arg *arg = loop->clients[n];
+            arg->idle = !arg->busy;
+            arg->read_events = arg->idle && arg->have_events;
+            if (arg->read_events)
+                arg->have_events = false;
+        }
 
-                ssize_t bytes = read(arg->client_fd, buf, sizeof(buf));
-                if (bytes < 0) {
-                    if (errno == EAGAIN)
-                        break;
+        if (!loop->num_clients && !loop->num_servers) {
+            loop_instance = NULL;
+            mp_mutex_unlock(&loop_lock);
+            break;
+        }
 
-                    MP_ERR(arg, "Read error (%s)\n", mp_strerror(errno));
-                    goto done;
-                }
+        mp_mutex_unlock(&loop_lock);
 
-                if (bytes == 0) {
-                    MP_VERBOSE(arg, "Client disconnected\n");
-                    goto done;
-                }
+        for (int n = loop->num_clients - num_added; n < loop->num_clients; n++) {
+            struct client_arg *arg = loop->clients[n];
+            MP_VERBOSE(arg, "Client connected\n");
+            fcntl(arg->client_fd, F_SETFL,
+                  fcntl(arg->client_fd, F_GETFL, 0) | O_NONBLOCK);
+            // Calls client_wakeup() once, so events are read right away.
+            mpv_set_wakeup_callback(arg->client, client_wakeup, arg);
+        }
 
-                append.len = bytes;
+        for (int n = loop->num_clients - 1; n >= 0; n--) {
+            struct client_arg *arg = loop->clients[n];
+            if (!arg->dead)
+                process_client(loop, arg);
+            if (arg->dead && arg->idle) {
+                MP_TARRAY_REMOVE_AT(loop->clients, loop->num_clients, n);
+                mpv_set_wakeup_callback(arg->client, NULL, NULL);
+                // Destroying the handle waits for its async commands.
+                mp_thread_pool_queue(loop->pool, destroy_client, arg);
+            }
+        }
 
-                bstr_xappend(NULL, &client_msg, append);
+        // Check whether the thread can exit.
+        if (!loop->num_clients && !loop->num_active_servers)
+            continue;
 
-                while (bstrchr(client_msg, '\n') != -1) {
-                    char *reply_msg = mp_ipc_consume_next_command(arg->client,
-                        NULL, &client_msg);
+        int num_fds = 1 + loop->num_active_servers + loop->num_clients;
+        MP_TARRAY_GROW(loop, loop->fds, num_fds);
+        struct pollfd *fds = loop->fds;
+        fds[0] = (struct pollfd){.events = POLLIN, .fd = loop->wakeup_pipe[0]};
+        struct pollfd *server_fds = fds + 1;
+        for (int n = 0; n < loop->num_active_servers; n++) {
+            server_fds[n] = (struct pollfd){
+                .events = POLLIN,
+                .fd = loop->active_servers[n]->listen_fd,
+            };
+        }
+        struct pollfd *client_fds = server_fds + loop->num_active_servers;
+        for (int n = 0; n < loop->num_clients; n++) {
+            struct client_arg *arg = loop->clients[n];
+            short events = 0;
+            if (arg->idle && !arg->eof && !arg->dead)
+                events |= POLLIN;
+            // Output of dead clients is never flushed; requesting POLLOUT
+            // would make poll() return immediately until they are removed.
+            if (arg->output.len && !arg->dead)
+                events |= POLLOUT;
+            // Negative FDs are ignored, so POLLHUP doesn't wake up the loop
+            // while the client is busy.
+            client_fds[n] = (struct pollfd){
+                .events = events,
+                .fd = events ? arg->client_fd : -1,
+            };
+        }
 
-                    if (reply_msg && arg->writable) {
-                        rc = ipc_write_str(arg, reply_msg);
-                        if (rc < 0) {
-                            MP_ERR(arg, "Write error (%s)\n", mp_strerror(errno));
-                            talloc_free(reply_msg);
-                            goto done;
-                        }
-                    }
+        if (poll(fds, num_fds, -1) < 0)
+            continue;
 
-                    talloc_free(reply_msg);
-                }
-            }
+        for (int n = 0; n < loop->num_active_servers; n++) {
+            if (server_fds[n].revents & POLLIN)
+                accept_client(loop->active_servers[n]);
         }
-    }
 
-done:
-    if (client_msg.len > 0)
-        MP_WARN(arg, "Ignoring unterminated command on disconnect.\n");
-    talloc_free(client_msg.start);
-    if (arg->close_client_fd)
-        close(arg->client_fd);
-    struct mpv_handle *h = arg->client;
-    bool quit = arg->quit_on_close;
-    talloc_free(arg);
-    if (quit) {
-        mpv_terminate_destroy(h);
-    } else {
-        mpv_destroy(h);
+        for (int n = 0; n < loop->num_clients; n++) {
+            struct client_arg *arg = loop->clients[n];
+            if ((client_fds[n].events & POLLIN) &&
+                (client_fds[n].revents & (POLLIN | POLLHUP | POLLNVAL)))
+                read_input(arg);
+        }
     }
+
+    talloc_free(loop->pool);
+    close(loop->wakeup_pipe[0]);
+    close(loop->wakeup_pipe[1]);
+    talloc_free(loop);
     MP_THREAD_RETURN();
 }
 
-static bool ipc_start_client(struct mp_ipc_ctx *ctx, struct client_arg *client,
-                             bool free_on_init_fail)
+// Return the loop thread, starting it if needed. Must be called with loop_lock
+// held.
+static struct ipc_loop *get_loop_locked(void)
+{
+    if (loop_instance)
+        return loop_instance;
+
+    struct ipc_loop *loop = talloc_zero(NULL, struct ipc_loop);
+    loop->pool = mp_thread_pool_create(loop, 1, 1, MAX_COMMAND_THREADS);
+    if (!loop->pool || mp_make_wakeup_pipe(loop->wakeup_pipe) < 0) {
+        talloc_free(loop);
+        return NULL;
+    }
+
+    mp_thread thread;
+    if (mp_thread_create(&thread, ipc_loop_thread, loop)) {
+        close(loop->wakeup_pipe[0]);
+        close(loop->wakeup_pipe[1]);
+        talloc_free(loop);
+        return NULL;
+    }
+    mp_thread_detach(thread);
+
+    loop_instance = loop;
+    return loop;
+}
+
+static bool ipc_start_client(struct mp_client_api *client_api,
+                             struct client_arg *client, bool free_on_init_fail)
 {
     if (!client->client)
-        client->client = mp_new_client(ctx->client_api, client->client_name);
+        client->client = mp_new_client(client_api, client->client_name);
     if (!client->client)
         goto err;
 
     client->log = mp_client_get_log(client->client);
 
-    mp_thread client_thr;
-    if (mp_thread_create(&client_thr, client_thread, client))
+    struct MPOpts *opts = mp_get_config_group(NULL,
+                    mp_client_get_global(client->client), &mp_opt_root);
+    client->max_output = opts->ipc_max_output;
+    talloc_free(opts);
+
+    mp_mutex_lock(&loop_lock);
+    struct ipc_loop *loop = get_loop_locked();
+    if (loop) {
+        client->loop = loop;
+        MP_TARRAY_APPEND(loop, loop->new_clients, loop->num_new_clients,
+                         client);
+        wakeup_loop_locked(loop);
+    }
+    mp_mutex_unlock(&loop_lock);
+    if (!loop)
         goto err;
-    mp_thread_detach(client_thr);
 
     return true;
 
@@ -249,7 +511,8 @@ err:
     return false;
 }
 
-static void ipc_start_client_json(struct mp_ipc_ctx *ctx, int id, int fd)
+static void ipc_start_client_json(struct mp_client_api *client_api, int id,
+                                  int fd)
 {
     struct client_arg *client = talloc_ptrtype(NULL, client);
     *client = (struct client_arg){
@@ -261,7 +524,7 @@ static void ipc_start_client_json(struct mp_ipc_ctx *ctx, int id, int fd)
         .writable = true,
     };
 
-    ipc_start_client(ctx, client, true);
+    ipc_start_client(client_api, client, true);
 }
 
 bool mp_ipc_start_anon_client(struct mp_ipc_ctx *ctx, struct mpv_handle *h,
@@ -282,7 +545,7 @@ bool mp_ipc_start_anon_client(struct mp_ipc_ctx *ctx, struct mpv_handle *h,
         .writable = true,
     };
 
-    if (!ipc_start_client(ctx, client, false)) {
+    if (!ipc_start_client(NULL, client, false)) {
         close(pair[0]);
         close(pair[1]);
         return false;
@@ -293,31 +556,46 @@ bool mp_ipc_start_anon_client(struct mp_ipc_ctx *ctx, struct mpv_handle *h,
     return true;
 }
 
-static MP_THREAD_VOID ipc_thread(void *p)
+static void accept_client(struct mp_ipc_ctx *ctx)
+{
+    int client_fd = accept(ctx->listen_fd, NULL, NULL);
+    if (client_fd < 0) {
+        if (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK ||
+            errno == ECONNABORTED)
+            return;
+        MP_ERR(ctx, "Could not accept IPC client (%s)\n", mp_strerror(errno));
+        // Don't spin on the listening socket, e.g. if out of FDs.
+        mp_mutex_lock(&loop_lock);
+        ctx->stop = true;
+        mp_mutex_unlock(&loop_lock);
+        return;
+    }
+
+    ipc_start_client_json(ctx->client_api, ctx->client_num++, client_fd);
+}
+
+static int ipc_listen(struct mp_ipc_ctx *arg)
 {
     int rc;
 
     int ipc_fd;
     struct sockaddr_un ipc_un = {0};
 
-    struct mp_ipc_ctx *arg = p;
-
-    mp_thread_set_name("ipc/socket");
-
     MP_VERBOSE(arg, "Starting IPC master\n");
 
     ipc_fd = socket(AF_UNIX, SOCK_STREAM, 0);
     if (ipc_fd < 0) {
         MP_ERR(arg, "Could not create IPC socket\n");
-        goto done;
+        goto error;
     }
 
+    mp_set_cloexec(ipc_fd);
     fchmod(ipc_fd, 0600);
 
     size_t path_len = strlen(arg->path);
     if (path_len >= sizeof(ipc_un.sun_path) - 1) {
         MP_ERR(arg, "Could not create IPC socket\n");
-        goto done;
+        goto error;
     }
 
     ipc_un.sun_family = AF_UNIX,
@@ -334,50 +612,25 @@ static MP_THREAD_VOID ipc_thread(void *p)
     rc = bind(ipc_fd, (struct sockaddr *) &ipc_un, addr_len);
     if (rc < 0) {
         MP_ERR(arg, "Could not bind IPC socket\n");
-        goto done;
+        goto error;
     }
 
-    rc = listen(ipc_fd, 10);
+    rc = listen(ipc_fd, 128);
     if (rc < 0) {
         MP_ERR(arg, "Could not listen on IPC socket\n");
-        goto done;
+        goto error;
     }
 
-    MP_VERBOSE(arg, "Listening to IPC socket.\n");
-
-    int client_num = 0;
-
-    struct pollfd fds[2] = {
-        {.events = POLLIN, .fd = arg->death_pipe[0]},
-        {.events = POLLIN, .fd = ipc_fd},
-    };
-
-    while (1) {
-        rc = poll(fds, 2, -1);
-        if (rc < 0) {
-            MP_ERR(arg, "Poll error\n");
-            continue;
-        }
-
-        if (fds[0].revents & POLLIN)
-            goto done;
+    fcntl(ipc_fd, F_SETFL, fcntl(ipc_fd, F_GETFL, 0) | O_NONBLOCK);
 
-        if (fds[1].revents & POLLIN) {
-            int client_fd = accept(ipc_fd, NULL, NULL);
-            if (client_fd < 0) {
-                MP_ERR(arg, "Could not accept IPC client\n");
-                goto done;
-            }
+    MP_VERBOSE(arg, "Listening to IPC socket.\n");
 
-            ipc_start_client_json(arg, client_num++, client_fd);
-        }
-    }
+    return ipc_fd;
 
-done:
+error:
     if (ipc_fd >= 0)
         close(ipc_fd);
-
-    MP_THREAD_RETURN();
+    return -1;
 }
 
 struct mp_ipc_ctx *mp_init_ipc(struct mp_client_api *client_api,
@@ -390,7 +643,7 @@ struct mp_ipc_ctx *mp_init_ipc(struct mp_client_api *client_api,
         .log        = mp_log_new(arg, global->log, "ipc"),
         .client_api = client_api,
         .path       = mp_get_user_path(arg, global, opts->ipc_path),
-        .death_pipe = {-1, -1},
+        .listen_fd  = -1,
     };
 
     if (opts->ipc_client && opts->ipc_client[0]) {
@@ -404,7 +657,7 @@ struct mp_ipc_ctx *mp_init_ipc(struct mp_client_api *client_api,
         if (fd < 0) {
             MP_ERR(arg, "Invalid IPC client argument: '%s'\n", opts->ipc_client);
         } else {
-            ipc_start_client_json(arg, -1, fd);
+            ipc_start_client_json(client_api, -1, fd);
         }
     }
 
@@ -413,19 +666,25 @@ struct mp_ipc_ctx *mp_init_ipc(struct mp_client_api *client_api,
     if (!arg->path || !arg->path[0])
         goto out;
 
-    if (mp_make_wakeup_pipe(arg->death_pipe) < 0)
+    arg->listen_fd = ipc_listen(arg);
+    if (arg->listen_fd < 0)
         goto out;
 
-    if (mp_thread_create(&arg->thread, ipc_thread, arg))
+    mp_mutex_lock(&loop_lock);
+    struct ipc_loop *loop = get_loop_locked();
+    if (loop) {
+        MP_TARRAY_APPEND(loop, loop->servers, loop->num_servers, arg);
+        wakeup_loop_locked(loop);
+    }
+    mp_mutex_unlock(&loop_lock);
+    if (!loop)
         goto out;
 
     return arg;
 
 out:
-    if (arg->death_pipe[0] >= 0) {
-        close(arg->death_pipe[0]);
-        close(arg->death_pipe[1]);
-    }
+    if (arg->listen_fd >= 0)
+        close(arg->listen_fd);
     talloc_free(arg);
     return NULL;
 }
@@ -435,10 +694,18 @@ void mp_uninit_ipc(struct mp_ipc_ctx *arg)
     if (!arg)
         return;
 
-    (void)write(arg->death_pipe[1], &(char){0}, 1);
-    mp_thread_join(arg->thread);
+    // The loop thread closes the socket, and exits if there are no clients.
+    // Clients that are still connected are kept.
+    // If the server was already stopped (after accept() failed), the loop
+    // thread may have exited.
+    mp_mutex_lock(&loop_lock);
+    if (!arg->stopped) {
+        arg->stop = true;
+        wakeup_loop_locked(loop_instance);
+        while (!arg->stopped)
+            mp_cond_wait(&loop_wakeup, &loop_lock);
+    }
+    mp_mutex_unlock(&loop_lock);
 
-    close(arg->death_pipe[0]);
-    close(arg->death_pipe[1]);
     talloc_free(arg);
 }
@@ -389,7 +389,7 @@ static char *text_execute_command(struct mpv_handle *client, void *tmp, char *sr
 
 char *mp_ipc_consume_next_command(struct mpv_handle *client, void *ctx, bstr *buf)
 {
-    void *tmp = talloc_new(NULL);
+    void *tmp = talloc_new_arena(NULL);
 
     bstr rest;
     bstr line = bstr_getline(*buf, &rest);
@@ -0,0 +1,570 @@
+/* Copyright (C) 2026 the mpv developers
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "config.h"
+
+#if HAVE_POSIX
+#include <sys/file.h>
+#endif
+
+#include "common/common.h"
+#include "common/msg.h"
+#include "osdep/io.h"
+#include "osdep/threads.h"
+#include "osdep/timer.h"
+
+#include "kv_log.h"
+
+// File format: an optional MAGIC line, followed by records. Each record is
+// either "S <key> <tag> <length>\n<value>\n" or "D <key>\n". Later records
+// override earlier ones with the same key. Unparseable lines are skipped.
+#define MAGIC "mpv-kv-log 1"
+
+#define MAX_KEY_LEN 256
+#define MAX_HEADER_LEN 1024
+
+// Smaller files are not worth compacting.
+#define MIN_COMPACT_SIZE (256 * 1024)
+
+// An incomplete record at the end of the file is normally being written by
+// another process. If it stays incomplete for longer than this, the writer
+// probably crashed, and the record is skipped.
+#define STUCK_TIMEOUT MP_TIME_S_TO_NS(2)
+
+struct entry {
+    struct entry *next;     // next in the same hash bucket
+    char *key;
+    int64_t value_pos;      // file offset of the value
+    size_t value_len;
+    int64_t tag;
+    int64_t record_len;
+};
+
+struct mp_kv_log {
+    struct mp_log *log;
+    char *path;
+
+    mp_mutex lock;
+
+    // File that is indexed, -1 if it does not exist (yet).
+    int fd;
+    struct stat fd_st;
+    int64_t parsed;         // everything before this offset is indexed
+    int64_t stuck_pos;      // parsed as of when an incomplete record was found
+    int64_t stuck_time;
+
+    void *index;            // talloc context for everything below
+    struct entry **buckets; // num_buckets is a power of 2
+    size_t num_buckets;
+    size_t num_entries;
+    int64_t live_bytes;     // sum of record_len of all entries
+
+    bool compacting;
+    bool have_thread;
+    mp_thread thread;
+};
+
+static void reset_index(struct mp_kv_log *kv)
+{
+    if (kv->fd >= 0)
+        close(kv->fd);
+    kv->fd = -1;
+    kv->parsed = 0;
+    kv->stuck_pos = -1;
+
+    talloc_free(kv->index);
+    kv->index = talloc_new(kv);
+    kv->num_buckets = 64;
+    kv->buckets = talloc_zero_array(kv->index, struct entry *, kv->num_buckets);
+    kv->num_entries = 0;
+    kv->live_bytes = 0;
+}
+
+static size_t hash_key(const char *key)
+{
+    // FNV-1a
+    uint64_t h = 14695981039346656037ull;
+    for (; *key; key++)
+        h = (h ^ (unsigned char)*key) * 1099511628211ull;
+    return h;
+}
+
+static struct entry **find_slot(struct mp_kv_log *kv, const char *key)
+{
+    struct entry **slot = &kv->buckets[hash_key(key) & (kv->num_buckets - 1)];
+    while (*slot && strcmp((*slot)->key, key) != 0)
+        slot = &(*slot)->next;
+    return slot;
+}
+
+static void grow_index(struct mp_kv_log *kv)
+{
+    struct entry **old = kv->buckets;
+    size_t num_old = kv->num_buckets;
+
+    kv->num_buckets *= 2;
+    kv->buckets = talloc_zero_array(kv->index, struct entry *, kv->num_buckets);
+    for (size_t n = 0; n < num_old; n++) {
+        struct entry *e = old[n];
+        while (e) {
+            struct entry *next = e->next;
+            size_t b = hash_key(e->key) & (kv->num_buckets - 1);
+            e->next = kv->buckets[b];
+            kv->buckets[b] = e;
+            e = next;
+        }
+    }
+    talloc_free(old);
+}
+
+static void remove_entry(struct mp_kv_log *kv, const char *key)
+{
+    struct entry **slot = find_slot(kv, key);
+    struct entry *e = *slot;
+    if (!e)
+        return;
+    *slot = e->next;
+    kv->live_bytes -= e->record_len;
+    kv->num_entries--;
+    talloc_free(e);
+}
+
+static void add_entry(struct mp_kv_log *kv, struct entry new)
+{
+    remove_entry(kv, new.key);
+
+    if (kv->num_entries >= kv->num_buckets)
+        grow_index(kv);
+
+    struct entry *e = talloc_ptrtype(kv->index, e);
+    *e = new;
+    e->key = talloc_strdup(e, new.key);
+    struct entry **slot = find_slot(kv, e->key);
+    e->next = NULL;
+    *slot = e;
+    kv->live_bytes += e->record_len;
+    kv->num_entries++;
+}
+
+// buf contains the file contents starting at kv->parsed. Index all complete
+// records, and advance kv->parsed past them. If skip_stuck is set, an
+// incomplete record at the start of buf is treated as invalid.
+static void index_records(struct mp_kv_log *kv, char *buf, size_t len,
+                          bool skip_stuck)
+{
+    size_t pos = 0;
+    while (pos < len) {
+        char *line = buf + pos;
+        char *nl = memchr(line, '\n', len - pos);
+        if (!nl)
+            break; // incomplete (or being written)
+        size_t line_len = nl - line;
+        size_t next = pos + line_len + 1;
+
+        char hdr[MAX_HEADER_LEN + 1];
+        char key[MAX_HEADER_LEN + 1];
+        int64_t tag;
+        uint64_t value_len;
+        int end = -1;
+        if (line_len > MAX_HEADER_LEN)
+            goto skip;
+        memcpy(hdr, line, line_len);
+        hdr[line_len] = '\0';
+
+        if (strcmp(hdr, MAGIC) == 0) {
+            pos = next;
+            continue;
+        }
+
+        if (sscanf(hdr, "S %1024s %" SCNd64 " %" SCNu64 "%n", key, &tag,
+                   &value_len, &end) == 3 && end == (int)line_len)
+        {
+            if (value_len >= len - next) {
+                if (skip_stuck && pos == 0)
+                    goto skip;
+                break; // incomplete
+            }
+            if (buf[next + value_len] != '\n')
+                goto skip;
+            add_entry(kv, (struct entry){
+                .key = key,
+                .value_pos = kv->parsed + next,
+                .value_len = value_len,
+                .tag = tag,
+                .record_len = next + value_len + 1 - pos,
+            });
+            pos = next + value_len + 1;
+            continue;
+        }
+
+        if (sscanf(hdr, "D %1024s%n", key, &end) == 1 && end == (int)line_len) {
+            remove_entry(kv, key);
+            pos = next;
+            continue;
+        }
+
+    skip:
+        MP_VERBOSE(kv, "Skipping invalid data in %s.\n", kv->path);
+        pos = next;
+    }
+    kv->parsed += pos;
+}
+
+static bool read_at(int fd, int64_t pos, char *buf, size_t len)
+{
+    if (lseek(fd, pos, SEEK_SET) != pos)
+        return false;
+    while (len) {
+        ssize_t r = read(fd, buf, len);
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r <= 0)
+            return false;
+        buf += r;
+        len -= r;
+    }
+    return true;
+}
+
+static bool same_file(struct stat *st1, struct stat *st2)
+{
+    return st1->st_dev == st2->st_dev && st1->st_ino == st2->st_ino;
+}
+
+static void refresh_locked(struct mp_kv_log *kv)
+{
+    struct stat st;
+    if (stat(kv->path, &st) != 0) {
+        if (kv->fd >= 0)
+            reset_index(kv);
+        return;
+    }
+
+    // Replaced by compaction (possibly by another process), or truncated.
+    if (kv->fd >= 0 && (!same_file(&st, &kv->fd_st) || st.st_size < kv->parsed))
+        reset_index(kv);
+
+    if (kv->fd < 0) {
+        kv->fd = open(kv->path, O_RDONLY | O_BINARY | O_CLOEXEC);
+        if (kv->fd < 0)
+            return;
+    }
+    if (fstat(kv->fd, &kv->fd_st) != 0 || kv->fd_st.st_size <= kv->parsed)
+        return;
+
+    size_t size = kv->fd_st.st_size - kv->parsed;
+    char *buf = talloc_size(NULL, size);
+    if (read_at(kv->fd, kv->parsed, buf, size)) {
+        int64_t now = mp_time_ns();
+        bool stuck = kv->stuck_pos == kv->parsed &&
+                     now - kv->stuck_time > STUCK_TIMEOUT;
+        index_records(kv, buf, size, stuck);
+        if (kv->parsed < kv->fd_st.st_size && kv->stuck_pos != kv->parsed) {
+            kv->stuck_pos = kv->parsed;
+            kv->stuck_time = now;
+        }
+    } else {
+        MP_ERR(kv, "Can't read %s.\n", kv->path);
+    }
+    talloc_free(buf);
+}
+
+static bool read_value(struct mp_kv_log *kv, void *ta_parent, struct entry *e,
+                       bstr *value)
+{
+    char *buf = talloc_size(ta_parent, e->value_len + 1);
+    if (!read_at(kv->fd, e->value_pos, buf, e->value_len)) {
+        talloc_free(buf);
+        return false;
+    }
+    buf[e->value_len] = '\0';
+    *value = (bstr){buf, e->value_len};
+    return true;
+}
+
+static void append_record(void *ta_parent, bstr *buf, const char *key,
+                          bstr value, int64_t tag)
+{
+    bstr_xappend_asprintf(ta_parent, buf, "S %s %" PRId64 " %zu\n", key, tag,
+                          value.len);
+    bstr_xappend(ta_parent, buf, value);
+    bstr_xappend(ta_parent, buf, bstr0("\n"));
+}
+
+#if HAVE_POSIX
+// Writers hold a shared flock() on the file while appending, and compaction
+// holds an exclusive one while copying the last records and replacing the
+// file. Locks are always taken while holding kv->lock, never the other way
+// around.
+static MP_THREAD_VOID compact_thread(void *ptr)
+{
+    struct mp_kv_log *kv = ptr;
+    mp_thread_set_name("kv-compact");
+
+    void *tmp = talloc_new(NULL);
+    char *tmp_path = talloc_asprintf(tmp, "%s.%d.tmp", kv->path, (int)getpid());
+    bstr data = {0};
+    bstr_xappend(tmp, &data, bstr0(MAGIC "\n"));
+
+    // Snapshot the live records. The values are read later with a separate
+    // file descriptor, so that other threads are not blocked meanwhile.
+    mp_mutex_lock(&kv->lock);
+    struct stat orig_st = kv->fd_st;
+    int64_t end = kv->parsed;
+    int fd = kv->fd >= 0 ? open(kv->path, O_RDONLY | O_BINARY | O_CLOEXEC) : -1;
+    struct entry *entries = talloc_array(tmp, struct entry, kv->num_entries);
+    size_t num_entries = 0;
+    for (size_t n = 0; fd >= 0 && n < kv->num_buckets; n++) {
+        for (struct entry *e = kv->buckets[n]; e; e = e->next) {
+            entries[num_entries] = *e;
+            entries[num_entries].key = talloc_strdup(tmp, e->key);
+            num_entries++;
+        }
+    }
+    mp_mutex_unlock(&kv->lock);
+
+    struct stat st;
+    bool ok = fd >= 0 && fstat(fd, &st) == 0 && same_file(&st, &orig_st);
+    for (size_t n = 0; ok && n < num_entries; n++) {
+        struct entry *e = &entries[n];
+        char *buf = talloc_size(tmp, e->value_len);
+        ok = read_at(fd, e->value_pos, buf, e->value_len);
+        if (ok)
+            append_record(tmp, &data, e->key, (bstr){buf, e->value_len}, e->tag);
+        talloc_free(buf);
+    }
+
+    FILE *f = ok ? fopen(tmp_path, "wb") : NULL;
+    ok = f && fwrite(data.start, data.len, 1, f) == 1;
+
+    // Append whatever was written in the meantime, and replace the file. The
+    // exclusive lock makes sure no record is appended to the old file after
+    // the final refresh.
+    mp_mutex_lock(&kv->lock);
+    ok = ok && flock(fd, LOCK_EX) == 0;
+    refresh_locked(kv);
+    if (ok && kv->fd >= 0 && same_file(&kv->fd_st, &orig_st) &&
+        kv->parsed >= end)
+    {
+        size_t size = kv->parsed - end;
+        char *buf = talloc_size(tmp, size);
+        ok = read_at(kv->fd, end, buf, size) &&
+             (!size || fwrite(buf, size, 1, f) == 1);
+    } else {
+        ok = false;
+    }
+    if (f) {
+        ok = fflush(f) == 0 && fsync(fileno(f)) == 0 && ok;
+        ok = fclose(f) == 0 && ok;
+    }
+    if (ok && rename(tmp_path, kv->path) == 0) {
+        MP_VERBOSE(kv, "Compacted %s.\n", kv->path);
+        reset_index(kv);
+        refresh_locked(kv);
+    } else if (f) {
+        unlink(tmp_path);
+    }
+    if (fd >= 0)
+        close(fd); // releases the lock
+    kv->compacting = false;
+    mp_mutex_unlock(&kv->lock);
+
+    talloc_free(tmp);
+    MP_THREAD_RETURN();
+}
+#endif
+
+// On win32, files that are open can not be replaced, so there is no
+// compaction.
+static void maybe_compact_locked(struct mp_kv_log *kv)
+{
+#if HAVE_POSIX
+    if (kv->compacting || kv->parsed < MIN_COMPACT_SIZE ||
+        kv->live_bytes * 2 > kv->parsed)
+        return;
+
+    // A previous compaction is done, but the thread was not joined yet.
+    if (kv->have_thread)
+        mp_thread_join(kv->thread);
+    kv->have_thread = false;
+
+    kv->compacting = true;
+    if (mp_thread_create(&kv->thread, compact_thread, kv)) {
+        kv->compacting = false;
+        return;
+    }
+    kv->have_thread = true;
+#endif
+}
+
+static int open_for_append(struct mp_kv_log *kv)
+{
+    while (1) {
+        int fd = open(kv->path,
+                      O_WRONLY | O_APPEND | O_CREAT | O_BINARY | O_CLOEXEC, 0666);
+        if (fd < 0)
+            return -1;
+#if HAVE_POSIX
+        // If compaction replaced the file while waiting for the lock, records
+        // appended to the old one would be lost.
+        struct stat st, cur;
+        if (flock(fd, LOCK_SH) == 0 && fstat(fd, &st) == 0 &&
+            (stat(kv->path, &cur) != 0 || !same_file(&st, &cur)))
+        {
+            close(fd);
+            continue;
+        }
+#endif
+        return fd;
+    }
+}
+
+static bool write_record(struct mp_kv_log *kv, bstr data)
+{
+    int fd = open_for_append(kv);
+    if (fd < 0) {
+        MP_ERR(kv, "Can't open %s for writing.\n", kv->path);
+        return false;
+    }
+
+    void *tmp = talloc_new(NULL);
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size == 0) {
+        bstr buf = {0};
+        bstr_xappend(tmp, &buf, bstr0(MAGIC "\n"));
+        bstr_xappend(tmp, &buf, data);
+        data = buf;
+    }
+
+    // A single write, so that concurrent writers don't interleave records.
+    bool ok = write(fd, data.start, data.len) == (ssize_t)data.len;
+    ok = close(fd) == 0 && ok;
+    if (!ok)
+        MP_ERR(kv, "Can't write %s.\n", kv->path);
+
+    talloc_free(tmp);
+
+    refresh_locked(kv);
+    maybe_compact_locked(kv);
+    return ok;
+}
+
+static bool valid_key(const char *key)
+{
+    size_t len = strlen(key);
+    if (!len || len > MAX_KEY_LEN)
+        return false;
+    for (size_t n = 0; n < len; n++) {
+        unsigned char c = key[n];
+        if (c <= ' ' || c == 127)
+            return false;
+    }
+    return true;
+}
+
+static void destroy_kv_log(void *ptr)
+{
+    struct mp_kv_log *kv = ptr;
+
+    if (kv->have_thread)
+        mp_thread_join(kv->thread);
+    if (kv->fd >= 0)
+        close(kv->fd);
+    mp_mutex_destroy(&kv->lock);
+}
+
+struct mp_kv_log *mp_kv_log_open(void *ta_parent, struct mp_log *log,
+                                 const char *path)
+{
+    struct mp_kv_log *kv = talloc_zero(ta_parent, struct mp_kv_log);
+    talloc_set_destructor(kv, destroy_kv_log);
+    kv->log = log;
+    kv->path = talloc_strdup(kv, path);
+    kv->fd = -1;
+    mp_mutex_init(&kv->lock);
+    reset_index(kv);
+    mp_kv_log_refresh(kv);
+    return kv;
+}
+
+void mp_kv_log_refresh(struct mp_kv_log *kv)
+{
+    mp_mutex_lock(&kv->lock);
+    refresh_locked(kv);
+    mp_mutex_unlock(&kv->lock);
+}
+
+bool mp_kv_log_has(struct mp_kv_log *kv, const char *key)
+{
+    mp_mutex_lock(&kv->lock);
+    bool res = *find_slot(kv, key);
+    mp_mutex_unlock(&kv->lock);
+    return res;
+}
+
+bool mp_kv_log_get(struct mp_kv_log *kv, void *ta_parent, const char *key,
+                   bstr *value, int64_t *tag)
+{
+    mp_mutex_lock(&kv->lock);
+    struct entry *e = *find_slot(kv, key);
+    bool res = e && read_value(kv, ta_parent, e, value);
+    if (res && tag)
+        *tag = e->tag;
+    mp_mutex_unlock(&kv->lock);
+    return res;
+}
+
+bool mp_kv_log_set(struct mp_kv_log *kv, const char *key, bstr value,
+                   int64_t tag)
+{
+    if (!valid_key(key))
+        return false;
+
+    void *tmp = talloc_new(NULL);
+    bstr data = {0};
+    append_record(tmp, &data, key, value, tag);
+
+    mp_mutex_lock(&kv->lock);
+    bool res = write_record(kv, data);
+    mp_mutex_unlock(&kv->lock);
+
+    talloc_free(tmp);
+    return res;
+}
+
+bool mp_kv_log_remove(struct mp_kv_log *kv, const char *key)
+{
+    if (!valid_key(key))
+        return false;
+
+    mp_mutex_lock(&kv->lock);
+    bool res = true;
+    refresh_locked(kv);
+    if (*find_slot(kv, key)) {
+        char data[MAX_KEY_LEN + 4];
+        snprintf(data, sizeof(data), "D %s\n", key);
+        res = write_record(kv, bstr0(data));
+    }
+    mp_mutex_unlock(&kv->lock);
+    return res;
+}
@@ -0,0 +1,42 @@
+#ifndef MP_KV_LOG_H_
+#define MP_KV_LOG_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "misc/bstr.h"
+
+// A persistent key/value store in a single append-only file. Every change
+// appends a record, and an in-memory hash index maps each key to its latest
+// record. Several processes can share the file: each record is appended with
+// a single write(), and is picked up by other processes on their next
+// mp_kv_log_refresh(). Once most of the file consists of overwritten or removed
+// records, it is rewritten on a background thread, and atomically replaced.
+// All functions are thread-safe.
+struct mp_kv_log;
+struct mp_log;
+
+// The file does not need to exist yet; it is created on the first write, but
+// not its parent directory. Free with talloc_free().
+struct mp_kv_log *mp_kv_log_open(void *ta_parent, struct mp_log *log,
+                                 const char *path);
+
+// Index records appended by other processes since the last call. Lookups only
+// see the state as of the last refresh (or write from this process), so for
+// looking up many keys at once, refresh once, and then check them all.
+void mp_kv_log_refresh(struct mp_kv_log *kv);
+
+bool mp_kv_log_has(struct mp_kv_log *kv, const char *key);
+
+// Return a copy of the value, allocated with ta_parent. Also returns the tag
+// passed to mp_kv_log_set() if tag is not NULL.
+bool mp_kv_log_get(struct mp_kv_log *kv, void *ta_parent, const char *key,
+                   bstr *value, int64_t *tag);
+
+// Keys must be non-empty, and must not contain whitespace or control
+// characters. tag is an arbitrary number stored along with the value.
+bool mp_kv_log_set(struct mp_kv_log *kv, const char *key, bstr value,
+                   int64_t tag);
+bool mp_kv_log_remove(struct mp_kv_log *kv, const char *key);
+
+#endif
@@ -15,6 +15,7 @@
  * License along with mpv.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include "common/common.h"
 #include "misc/ctype.h"
 
 #include "natural_sort.h"
@@ -65,3 +66,33 @@ int mp_natural_sort_cmp(const char *name1, const char *name2)
         return 1;
     return 0;
 }
+
+// Return a sort key for name, so that bstrcmp() on two keys orders them like
+// mp_natural_sort_cmp() on the names. This avoids parsing the names again on
+// every comparison when sorting many entries.
+// Characters are lowercased, and each number is replaced by a '0', the number
+// of digits without padding (4 bytes big endian), and the unpadded digits. The
+// '0' compares against non-digit characters like any digit would.
+struct bstr mp_natural_sort_key(void *talloc_ctx, const char *name)
+{
+    struct bstr key = {0};
+    while (name[0]) {
+        if (mp_isdigit(name[0])) {
+            while (name[0] == '0')
+                name++;
+            const char *end = name;
+            while (mp_isdigit(*end))
+                end++;
+            uint32_t len = end - name;
+            char hdr[5] = {'0', len >> 24, len >> 16, len >> 8, len};
+            bstr_xappend(talloc_ctx, &key, (struct bstr){hdr, sizeof(hdr)});
+            bstr_xappend(talloc_ctx, &key, (struct bstr){(char *)name, len});
+            name = end;
+        } else {
+            char c = mp_tolower(name[0]);
+            bstr_xappend(talloc_ctx, &key, (struct bstr){&c, 1});
+            name++;
+        }
+    }
+    return key;
+}
@@ -18,6 +18,9 @@
 #ifndef MP_NATURAL_SORT_H
 #define MP_NATURAL_SORT_H
 
+#include "misc/bstr.h"
+
 int mp_natural_sort_cmp(const char *name1, const char *name2);
+struct bstr mp_natural_sort_key(void *talloc_ctx, const char *name);
 
 #endif
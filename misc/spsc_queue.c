@@ -0,0 +1,180 @@
+/* Copyright (C) 2026 the mpv developers
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdatomic.h>
+#include <string.h>
+
+#include "common/common.h"
+#include "osdep/threads.h"
+
+#include "spsc_queue.h"
+
+#define MIN_ITEMS 16
+
+struct mp_spsc_queue {
+    size_t item_size;
+
+    // Ring buffer with a power of 2 number of items. Reallocated with
+    // exclusive access only.
+    char *items;
+    size_t num_items;
+
+    // Positions, counting up without wrapping. head is written by the
+    // producer only, tail by the consumer only.
+    _Atomic size_t head;
+    _Atomic size_t tail;
+
+    // Exclusive access works like Dekker's algorithm: an end sets its busy
+    // flag, then checks the exclusive flag. The exclusive side sets its flag,
+    // then waits until both busy flags are cleared.
+    atomic_bool busy[2];
+    atomic_bool exclusive;
+
+    mp_mutex lock;
+    mp_cond wakeup;
+};
+
+static void destroy_queue(void *ptr)
+{
+    struct mp_spsc_queue *q = ptr;
+
+    mp_cond_destroy(&q->wakeup);
+    mp_mutex_destroy(&q->lock);
+}
+
+struct mp_spsc_queue *mp_spsc_queue_create(void *ta_parent, size_t item_size)
+{
+    struct mp_spsc_queue *q = talloc_zero(ta_parent, struct mp_spsc_queue);
+    talloc_set_destructor(q, destroy_queue);
+    q->item_size = item_size;
+    q->num_items = MIN_ITEMS;
+    q->items = talloc_array_size(q, item_size, q->num_items);
+    mp_mutex_init(&q->lock);
+    mp_cond_init(&q->wakeup);
+    return q;
+}
+
+void mp_spsc_queue_leave(struct mp_spsc_queue *q, enum mp_spsc_queue_end end)
+{
+    atomic_store(&q->busy[end], false);
+    if (atomic_load(&q->exclusive)) {
+        // Possibly waiting in mp_spsc_queue_lock().
+        mp_mutex_lock(&q->lock);
+        mp_cond_broadcast(&q->wakeup);
+        mp_mutex_unlock(&q->lock);
+    }
+}
+
+void mp_spsc_queue_enter(struct mp_spsc_queue *q, enum mp_spsc_queue_end end)
+{
+    while (1) {
+        atomic_store(&q->busy[end], true);
+        if (!atomic_load(&q->exclusive))
+            return;
+        mp_spsc_queue_leave(q, end);
+        mp_mutex_lock(&q->lock);
+        while (atomic_load(&q->exclusive))
+            mp_cond_wait(&q->wakeup, &q->lock);
+        mp_mutex_unlock(&q->lock);
+    }
+}
+
+void mp_spsc_queue_lock(struct mp_spsc_queue *q)
+{
+    mp_mutex_lock(&q->lock);
+    // The mutex is released while waiting for the ends below, so another
+    // thread may already be in the middle of getting exclusive access.
+    while (atomic_load(&q->exclusive))
+        mp_cond_wait(&q->wakeup, &q->lock);
+    atomic_store(&q->exclusive, true);
+    while (atomic_load(&q->busy[0]) || atomic_load(&q->busy[1]))
+        mp_cond_wait(&q->wakeup, &q->lock);
+}
+
+void mp_spsc_queue_unlock(struct mp_spsc_queue *q)
+{
+    atomic_store(&q->exclusive, false);
+    mp_cond_broadcast(&q->wakeup);
+    mp_mutex_unlock(&q->lock);
+}
+
+static void *item_at(struct mp_spsc_queue *q, size_t pos)
+{
+    return q->items + (pos & (q->num_items - 1)) * q->item_size;
+}
+
+void mp_spsc_queue_reserve(struct mp_spsc_queue *q)
+{
+    if (mp_spsc_queue_count(q) < q->num_items)
+        return;
+
+    mp_spsc_queue_lock(q);
+    size_t count = mp_spsc_queue_count(q);
+    if (count >= q->num_items) {
+        char *items = talloc_array_size(q, q->item_size, q->num_items * 2);
+        for (size_t n = 0; n < count; n++) {
+            memcpy(items + n * q->item_size, mp_spsc_queue_get(q, n),
+                   q->item_size);
+        }
+        talloc_free(q->items);
+        q->items = items;
+        q->num_items *= 2;
+        atomic_store(&q->tail, 0);
+        atomic_store(&q->head, count);
+    }
+    mp_spsc_queue_unlock(q);
+}
+
+void mp_spsc_queue_push(struct mp_spsc_queue *q, const void *item)
+{
+    size_t head = atomic_load_explicit(&q->head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&q->tail, memory_order_acquire);
+    assert(head - tail < q->num_items);
+    memcpy(item_at(q, head), item, q->item_size);
+    atomic_store_explicit(&q->head, head + 1, memory_order_release);
+}
+
+void *mp_spsc_queue_peek(struct mp_spsc_queue *q)
+{
+    size_t tail = atomic_load_explicit(&q->tail, memory_order_acquire);
+    size_t head = atomic_load_explicit(&q->head, memory_order_acquire);
+    return tail == head ? NULL : item_at(q, tail);
+}
+
+void mp_spsc_queue_pop(struct mp_spsc_queue *q)
+{
+    size_t tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+    assert(tail != atomic_load_explicit(&q->head, memory_order_acquire));
+    atomic_store_explicit(&q->tail, tail + 1, memory_order_release);
+}
+
+void *mp_spsc_queue_get(struct mp_spsc_queue *q, size_t index)
+{
+    assert(index < mp_spsc_queue_count(q));
+    return item_at(q, atomic_load_explicit(&q->tail, memory_order_relaxed) + index);
+}
+
+void mp_spsc_queue_clear(struct mp_spsc_queue *q)
+{
+    atomic_store(&q->tail, atomic_load(&q->head));
+}
+
+size_t mp_spsc_queue_count(struct mp_spsc_queue *q)
+{
+    // Load tail first, so the result can't underflow if both ends are active.
+    size_t tail = atomic_load(&q->tail);
+    size_t head = atomic_load(&q->head);
+    return head - tail;
+}
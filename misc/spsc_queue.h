@@ -0,0 +1,61 @@
+#ifndef MP_SPSC_QUEUE_H_
+#define MP_SPSC_QUEUE_H_
+
+#include <stddef.h>
+
+// A FIFO of fixed-size items, with 1 producer and 1 consumer thread. The
+// producer and consumer access it without taking any locks, as long as they
+// are between mp_spsc_queue_enter() and mp_spsc_queue_leave(). Anything else
+// (like clearing the queue from a third thread) requires exclusive access with
+// mp_spsc_queue_lock(), which waits until both ends have left, and makes them
+// wait in mp_spsc_queue_enter() until mp_spsc_queue_unlock() is called.
+struct mp_spsc_queue;
+
+enum mp_spsc_queue_end {
+    MP_SPSC_PRODUCER = 0,
+    MP_SPSC_CONSUMER = 1,
+};
+
+// Create a queue. Free with talloc_free(). Must not be in use when freed.
+struct mp_spsc_queue *mp_spsc_queue_create(void *ta_parent, size_t item_size);
+
+// Start/end lock-free access to the queue from the given end. Must not be
+// nested, and must not be called while holding exclusive access.
+void mp_spsc_queue_enter(struct mp_spsc_queue *q, enum mp_spsc_queue_end end);
+void mp_spsc_queue_leave(struct mp_spsc_queue *q, enum mp_spsc_queue_end end);
+
+// Get/release exclusive access. Must not be called while entered.
+void mp_spsc_queue_lock(struct mp_spsc_queue *q);
+void mp_spsc_queue_unlock(struct mp_spsc_queue *q);
+
+// Producer only, outside of enter/leave: make sure there is space for at least
+// 1 more item, so that the next mp_spsc_queue_push() does not need to allocate.
+// This may briefly take exclusive access.
+void mp_spsc_queue_reserve(struct mp_spsc_queue *q);
+
+// Producer only: append a copy of the item. mp_spsc_queue_reserve() must have
+// been called before mp_spsc_queue_enter().
+void mp_spsc_queue_push(struct mp_spsc_queue *q, const void *item);
+
+// Return the oldest item, or NULL if the queue is empty. The pointer is valid
+// until the item is removed.
+// Usually called by the consumer. If called by the producer, the consumer might
+// remove the item at any time; its memory stays valid, but the consumer owns
+// its contents once it has read it.
+void *mp_spsc_queue_peek(struct mp_spsc_queue *q);
+
+// Consumer only: remove the oldest item. The queue must not be empty.
+void mp_spsc_queue_pop(struct mp_spsc_queue *q);
+
+// Return the item at the given position (0 is the oldest). Requires exclusive
+// access. index must be < mp_spsc_queue_count().
+void *mp_spsc_queue_get(struct mp_spsc_queue *q, size_t index);
+
+// Remove all items. Requires exclusive access.
+void mp_spsc_queue_clear(struct mp_spsc_queue *q);
+
+// Number of queued items. Can be called from any thread; if the queue is in use
+// concurrently, the result might be outdated once it is returned.
+size_t mp_spsc_queue_count(struct mp_spsc_queue *q);
+
+#endif
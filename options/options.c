@@ -80,6 +80,7 @@ extern const struct m_sub_options gl_next_conf;
 extern const struct m_sub_options ao_alsa_conf;
 
 extern const struct m_sub_options demux_conf;
+extern const struct m_sub_options thumbnail_conf;
 extern const struct m_sub_options demux_cache_conf;
 
 extern const struct m_obj_list vf_obj_list;
@@ -332,6 +333,10 @@ const struct m_sub_options mp_subtitle_sub_opts = {
         {"sub-past-video-end", OPT_BOOL(sub_past_video_end)},
         {"sub-ass-force-style", OPT_REPLACED("sub-ass-style-overrides")},
         {"sub-lavc-o", OPT_KEYVALUELIST(sub_avopts), .flags = UPDATE_SUB_HARD},
+        {"sub-bitmap-cache-size", OPT_BYTE_SIZE(sub_bitmap_cache_size),
+            M_RANGE(0, M_MAX_MEM_BYTES)},
+        {"sub-bitmap-preload", OPT_DOUBLE(sub_bitmap_preload),
+            M_RANGE(0, DBL_MAX)},
         {0}
     },
     .size = sizeof(OPT_BASE_STRUCT),
@@ -349,6 +354,8 @@ const struct m_sub_options mp_subtitle_sub_opts = {
         .ass_video_aspect = 0,
         .sub_shaper = 1,
         .use_embedded_fonts = true,
+        .sub_bitmap_cache_size = 128 * 1024 * 1024,
+        .sub_bitmap_preload = 5,
     },
     .change_flags = UPDATE_OSD,
 };
@@ -632,6 +639,7 @@ static const m_option_t mp_opts[] = {
     {"demuxer-termination-timeout", OPT_DOUBLE(demux_termination_timeout)},
     {"demuxer-cache-wait", OPT_BOOL(demuxer_cache_wait)},
     {"prefetch-playlist", OPT_BOOL(prefetch_open)},
+    {"prefetch-playlist-decoders", OPT_BOOL(prefetch_decoders)},
     {"cache-pause", OPT_BOOL(cache_pause)},
     {"cache-pause-initial", OPT_BOOL(cache_pause_initial)},
     {"cache-pause-wait", OPT_FLOAT(cache_pause_wait), M_RANGE(0, DBL_MAX)},
@@ -809,6 +817,8 @@ static const m_option_t mp_opts[] = {
     {"watch-later-dir", OPT_STRING(watch_later_dir),
         .flags = M_OPT_FILE},
     {"watch-later-directory", OPT_ALIAS("watch-later-dir")},
+    {"watch-later-store", OPT_CHOICE(watch_later_store,
+        {"files", 0}, {"index", 1})},
     {"watch-later-options", OPT_STRINGLIST(watch_later_options)},
 
     {"ordered-chapters", OPT_BOOL(ordered_chapters)},
@@ -834,6 +844,9 @@ static const m_option_t mp_opts[] = {
         {"no", -1}, {"absolute", 0}, {"yes", 1}, {"always", 1}, {"default", 2})},
     {"hr-seek-demuxer-offset", OPT_FLOAT(hr_seek_demuxer_offset)},
     {"hr-seek-framedrop", OPT_BOOL(hr_seek_framedrop)},
+    {"frame-history-max-bytes", OPT_BYTE_SIZE(frame_history_max_bytes),
+        M_RANGE(0, M_MAX_MEM_BYTES)},
+    {"frame-history-hwdec-download", OPT_BOOL(frame_history_hwdec_download)},
     {"autosync", OPT_CHOICE(autosync, {"no", -1}), M_RANGE(0, 10000)},
 
     {"term-osd", OPT_CHOICE(term_osd,
@@ -866,6 +879,10 @@ static const m_option_t mp_opts[] = {
 
     {"input-ipc-server", OPT_STRING(ipc_path), .flags = M_OPT_FILE},
     {"input-ipc-client", OPT_STRING(ipc_client)},
+    {"input-ipc-max-output", OPT_BYTE_SIZE(ipc_max_output),
+        M_RANGE(1, M_MAX_MEM_BYTES)},
+    {"input-ipc-shm-path", OPT_STRING(ipc_shm_path), .flags = M_OPT_FILE},
+    {"input-ipc-shm-properties", OPT_STRINGLIST(ipc_shm_properties)},
 
     {"screenshot", OPT_SUBSTRUCT(screenshot_image_opts, screenshot_conf)},
     {"screenshot-template", OPT_STRING(screenshot_template)},
@@ -874,6 +891,8 @@ static const m_option_t mp_opts[] = {
     {"screenshot-directory", OPT_ALIAS("screenshot-dir")},
     {"screenshot-sw", OPT_BOOL(screenshot_sw)},
 
+    {"thumbnail", OPT_SUBSTRUCT(thumbnail_opts, thumbnail_conf)},
+
     {"", OPT_SUBSTRUCT(resample_opts, resample_conf)},
 
     {"", OPT_SUBSTRUCT(input_opts, input_config)},
@@ -1001,6 +1020,7 @@ static const struct MPOpts mp_default_opts = {
     .term_osd = 2,
     .term_osd_bar_chars = "[-+-]",
     .consolecontrols = true,
+    .ipc_max_output = 16 * 1024 * 1024,
     .playlist_pos = -1,
     .play_frames = -1,
     .rebase_start_time = true,
@@ -1045,6 +1065,12 @@ static const struct MPOpts mp_default_opts = {
     .playlist_exts = (char *[]){
         "m3u", "m3u8", "pls", "edl", NULL
     },
+    .ipc_shm_properties = (char *[]){
+        "time-pos", "playback-time", "percent-pos", "duration", "pause",
+        "paused-for-cache", "cache-buffering-state", "demuxer-cache-duration",
+        "estimated-vf-fps", "speed", "volume", "mute", "idle-active",
+        "eof-reached", "playlist-pos", NULL
+    },
 
     .sub_auto_exts = (char *[]){
         "ass",
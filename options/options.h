@@ -126,6 +126,8 @@ struct mp_subtitle_opts {
     int teletext_page;
     bool sub_past_video_end;
     char **sub_avopts;
+    int64_t sub_bitmap_cache_size;
+    double sub_bitmap_preload;
 };
 
 // Options for both primary and secondary subs.
@@ -240,6 +242,8 @@ typedef struct MPOpts {
     int hr_seek;
     float hr_seek_demuxer_offset;
     bool hr_seek_framedrop;
+    int64_t frame_history_max_bytes;
+    bool frame_history_hwdec_download;
     float audio_delay;
     float default_max_pts_correction;
     int autosync;
@@ -275,6 +279,7 @@ typedef struct MPOpts {
     bool write_filename_in_watch_later_config;
     bool ignore_path_in_watch_later_config;
     char *watch_later_dir;
+    int watch_later_store;
     char **watch_later_options;
     bool pause;
     int keep_open;
@@ -297,6 +302,7 @@ typedef struct MPOpts {
     double demux_termination_timeout;
     bool demuxer_cache_wait;
     bool prefetch_open;
+    bool prefetch_decoders;
     char *audio_demuxer_name;
     char *sub_demuxer_name;
 
@@ -354,6 +360,7 @@ typedef struct MPOpts {
     struct demux_mkv_opts *demux_mkv;
 
     struct demux_opts *demux_opts;
+    struct thumbnail_opts *thumbnail_opts;
     struct demux_cache_opts *demux_cache_opts;
     struct stream_opts *stream_opts;
 
@@ -368,6 +375,9 @@ typedef struct MPOpts {
 
     char *ipc_path;
     char *ipc_client;
+    int64_t ipc_max_output;
+    char *ipc_shm_path;
+    char **ipc_shm_properties;
 
     struct mp_resample_opts *resample_opts;
 
@@ -239,6 +239,15 @@ static inline void mp_thread_set_name(const char *name)
 #endif
 }
 
+// Let the calling thread run only if the CPU is otherwise idle, if supported.
+static inline void mp_thread_set_idle_priority(void)
+{
+#ifdef SCHED_IDLE
+    struct sched_param param = {0};
+    pthread_setschedparam(pthread_self(), SCHED_IDLE, &param);
+#endif
+}
+
 static inline int64_t mp_thread_cpu_time_ns(mp_thread_id thread)
 {
 #if defined(_POSIX_TIMERS) && _POSIX_TIMERS > 0 && defined(_POSIX_THREAD_CPUTIME)
@@ -207,6 +207,12 @@ static inline void mp_thread_set_name(const char *name)
     talloc_free(wname);
 }
 
+// Let the calling thread run only if the CPU is otherwise idle, if supported.
+static inline void mp_thread_set_idle_priority(void)
+{
+    SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_IDLE);
+}
+
 static inline int64_t mp_thread_cpu_time_ns(mp_thread_id thread)
 {
     (void) thread;
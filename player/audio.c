@@ -518,6 +518,13 @@ int init_audio_decoder(struct MPContext *mpctx, struct track *track)
     if (!track->stream)
         goto init_error;
 
+    // (Pre-started decoders have the spdif flag set.)
+    if (track->ao_c) {
+        track->dec = take_preroll_decoder(mpctx, track);
+        if (track->dec)
+            return 1;
+    }
+
     track->dec = mp_decoder_wrapper_create(mpctx->filter_root, track->stream);
     if (!track->dec)
         goto init_error;
@@ -1102,6 +1102,11 @@ static void cmd_complete(struct mp_cmd_ctx *cmd)
     mp_waiter_wakeup(&req->completion, 0);
 }
 
+static struct mp_cmd_cache *cmd_cache(mpv_handle *ctx)
+{
+    return mp_input_get_cmd_cache(ctx->mpctx->input);
+}
+
 static int run_client_command(mpv_handle *ctx, struct mp_cmd *cmd, mpv_node *res)
 {
     if (!cmd)
@@ -1143,13 +1148,15 @@ static int run_client_command(mpv_handle *ctx, struct mp_cmd *cmd, mpv_node *res
 
 int mpv_command(mpv_handle *ctx, const char **args)
 {
-    return run_client_command(ctx, mp_input_parse_cmd_strv(ctx->log, args), NULL);
+    struct mp_cmd *cmd = mp_cmd_cache_parse_strv(cmd_cache(ctx), ctx->log, args);
+    return run_client_command(ctx, cmd, NULL);
 }
 
 int mpv_command_node(mpv_handle *ctx, mpv_node *args, mpv_node *result)
 {
     struct mpv_node rn = {.format = MPV_FORMAT_NONE};
-    int r = run_client_command(ctx, mp_input_parse_cmd_node(ctx->log, args), &rn);
+    struct mp_cmd *cmd = mp_cmd_cache_parse_node(cmd_cache(ctx), ctx->log, args);
+    int r = run_client_command(ctx, cmd, &rn);
     if (result && r >= 0)
         *result = rn;
     return r;
@@ -1158,7 +1165,8 @@ int mpv_command_node(mpv_handle *ctx, mpv_node *args, mpv_node *result)
 int mpv_command_ret(mpv_handle *ctx, const char **args, mpv_node *result)
 {
     struct mpv_node rn = {.format = MPV_FORMAT_NONE};
-    int r = run_client_command(ctx, mp_input_parse_cmd_strv(ctx->log, args), &rn);
+    struct mp_cmd *cmd = mp_cmd_cache_parse_strv(cmd_cache(ctx), ctx->log, args);
+    int r = run_client_command(ctx, cmd, &rn);
     if (result && r >= 0)
         *result = rn;
     return r;
@@ -1240,12 +1248,14 @@ static int run_async_cmd(mpv_handle *ctx, uint64_t ud, struct mp_cmd *cmd)
 
 int mpv_command_async(mpv_handle *ctx, uint64_t ud, const char **args)
 {
-    return run_async_cmd(ctx, ud, mp_input_parse_cmd_strv(ctx->log, args));
+    struct mp_cmd *cmd = mp_cmd_cache_parse_strv(cmd_cache(ctx), ctx->log, args);
+    return run_async_cmd(ctx, ud, cmd);
 }
 
 int mpv_command_node_async(mpv_handle *ctx, uint64_t ud, mpv_node *args)
 {
-    return run_async_cmd(ctx, ud, mp_input_parse_cmd_node(ctx->log, args));
+    struct mp_cmd *cmd = mp_cmd_cache_parse_node(cmd_cache(ctx), ctx->log, args);
+    return run_async_cmd(ctx, ud, cmd);
 }
 
 void mpv_abort_async_command(mpv_handle *ctx, uint64_t reply_userdata)
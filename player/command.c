@@ -68,6 +68,8 @@
 #include "video/out/bitmap_packer.h"
 #include "options/path.h"
 #include "screenshot.h"
+#include "state_shm.h"
+#include "thumbnail.h"
 #include "misc/dispatch.h"
 #include "misc/language.h"
 #include "misc/node.h"
@@ -730,6 +732,24 @@ static int mp_property_total_avsync_change(void *ctx, struct m_property *prop,
     return m_property_double_ro(action, arg, mpctx->total_avsync_change);
 }
 
+static int mp_property_transition_latency(void *ctx, struct m_property *prop,
+                                          int action, void *arg)
+{
+    MPContext *mpctx = ctx;
+    if (mpctx->transition_latency == MP_NOPTS_VALUE)
+        return M_PROPERTY_UNAVAILABLE;
+    return m_property_double_ro(action, arg, mpctx->transition_latency);
+}
+
+static int mp_property_stream_record_file(void *ctx, struct m_property *prop,
+                                          int action, void *arg)
+{
+    MPContext *mpctx = ctx;
+    if (!mpctx->stream_record_file)
+        return M_PROPERTY_UNAVAILABLE;
+    return m_property_strdup_ro(action, arg, mpctx->stream_record_file);
+}
+
 static int mp_property_frame_drop_dec(void *ctx, struct m_property *prop,
                                       int action, void *arg)
 {
@@ -3096,6 +3116,46 @@ static int mp_property_vf_fps(void *ctx, struct m_property *prop,
     return m_property_double_ro(action, arg, 1.0 / avg);
 }
 
+static int mp_property_thumbnail_cache(void *ctx, struct m_property *prop,
+                                       int action, void *arg)
+{
+    MPContext *mpctx = ctx;
+    if (!mpctx->thumbnailer)
+        return M_PROPERTY_UNAVAILABLE;
+
+    struct mp_thumbnailer_stats s;
+    mp_thumbnailer_get_stats(mpctx->thumbnailer, &s);
+
+    struct m_sub_property props[] = {
+        {"count",       SUB_PROP_INT(s.count)},
+        {"bytes",       SUB_PROP_INT64(s.bytes)},
+        {"hits",        SUB_PROP_INT64(s.hits)},
+        {"misses",      SUB_PROP_INT64(s.misses)},
+        {0}
+    };
+
+    return m_property_read_sub(props, action, arg);
+}
+
+static int mp_property_frame_history(void *ctx, struct m_property *prop,
+                                     int action, void *arg)
+{
+    MPContext *mpctx = ctx;
+    if (!mpctx->opts->frame_history_max_bytes)
+        return M_PROPERTY_UNAVAILABLE;
+
+    struct m_sub_property props[] = {
+        {"frames",      SUB_PROP_INT(mpctx->num_frame_history)},
+        {"bytes",       SUB_PROP_INT64(mpctx->frame_history_bytes)},
+        {"browsing",    SUB_PROP_BOOL(mpctx->frame_history_browsing)},
+        {"hits",        SUB_PROP_INT64(mpctx->frame_history_hits)},
+        {"misses",      SUB_PROP_INT64(mpctx->frame_history_misses)},
+        {0}
+    };
+
+    return m_property_read_sub(props, action, arg);
+}
+
 #define doubles_equal(x, y) (fabs((x) - (y)) <= 0.001)
 
 static int mp_property_video_aspect_override(void *ctx, struct m_property *prop,
@@ -4231,9 +4291,11 @@ static const struct m_property mp_properties_base[] = {
     {"file-format", mp_property_file_format},
     {"stream-pos", mp_property_stream_pos},
     {"stream-end", mp_property_stream_end},
+    {"stream-record-file", mp_property_stream_record_file},
     {"duration", mp_property_duration},
     {"avsync", mp_property_avsync},
     {"total-avsync-change", mp_property_total_avsync_change},
+    {"transition-latency", mp_property_transition_latency},
     {"mistimed-frame-count", mp_property_mistimed_frame_count},
     {"vsync-ratio", mp_property_vsync_ratio},
     {"display-width", mp_property_display_resolution},
@@ -4329,6 +4391,8 @@ static const struct m_property mp_properties_base[] = {
     {"current-gpu-context", mp_property_gpu_context},
     {"container-fps", mp_property_fps},
     {"estimated-vf-fps", mp_property_vf_fps},
+    {"frame-history", mp_property_frame_history},
+    {"thumbnail-cache", mp_property_thumbnail_cache},
     {"video-aspect-override", mp_property_video_aspect_override},
     {"vid", property_switch_track, .priv = (void *)(const int[]){0, STREAM_VIDEO}},
     {"hwdec-current", mp_property_hwdec_current},
@@ -4456,7 +4520,7 @@ static const char *const *const mp_event_property_change[] = {
       "decoder-frame-drop-count", "frame-drop-count", "video-frame-info",
       "vf-metadata", "af-metadata", "sub-start", "sub-end", "secondary-sub-start",
       "secondary-sub-end", "video-out-params", "video-dec-params", "video-params",
-      "deinterlace-active", "video-target-params"),
+      "deinterlace-active", "video-target-params", "frame-history"),
     E(MP_EVENT_DURATION_UPDATE, "duration"),
     E(MPV_EVENT_VIDEO_RECONFIG, "video-out-params", "video-params",
       "video-format", "video-codec", "video-bitrate", "dwidth", "dheight",
@@ -7192,6 +7256,21 @@ const struct mp_cmd_def mp_cmds[] = {
                 OPTDEF_INT(0)},
         },
     },
+    { "thumbnail-raw", cmd_thumbnail_raw,
+        {
+            {"time", OPT_TIME(v.d)},
+        },
+        .spawn_thread = true,
+        .can_abort = true,
+    },
+    { "thumbnail-to-file", cmd_thumbnail_to_file,
+        {
+            {"time", OPT_TIME(v.d)},
+            {"filename", OPT_STRING(v.s)},
+        },
+        .spawn_thread = true,
+        .can_abort = true,
+    },
     { "loadfile", cmd_loadfile,
         {
             {"url", OPT_STRING(v.s)},
@@ -7697,6 +7776,16 @@ void mp_option_change_callback(void *ctx, struct m_config_option *co, int flags,
         mpctx->ipc_ctx = mp_init_ipc(mpctx->clients, mpctx->global);
     }
 
+    if (init || opt_ptr == &opts->ipc_shm_path ||
+        opt_ptr == &opts->ipc_shm_properties)
+    {
+        TA_FREEP(&mpctx->state_shm);
+        if (opts->ipc_shm_path && opts->ipc_shm_path[0]) {
+            mpctx->state_shm = mp_state_shm_create(mpctx, opts->ipc_shm_path,
+                                                   opts->ipc_shm_properties);
+        }
+    }
+
     if (flags & UPDATE_VO && mpctx->video_out) {
         struct track *track = mpctx->current_track[0][STREAM_VIDEO];
         uninit_video_out(mpctx);
@@ -37,6 +37,7 @@
 #include "common/encode.h"
 #include "common/msg.h"
 #include "misc/ctype.h"
+#include "misc/kv_log.h"
 #include "options/path.h"
 #include "options/m_config.h"
 #include "options/m_config_frontend.h"
@@ -170,6 +171,7 @@ void mp_load_auto_profiles(struct MPContext *mpctx)
 }
 
 #define MP_WATCH_LATER_CONF "watch_later"
+#define MP_WATCH_LATER_INDEX "index"
 
 static bool check_mtime(const char *f1, const char *f2)
 {
@@ -208,8 +210,11 @@ char *mp_get_playback_resume_dir(struct MPContext *mpctx)
     return wl_dir;
 }
 
-static char *mp_get_playback_resume_config_filename(struct MPContext *mpctx,
-                                                    const char *fname)
+// Return the name of the watch later file for fname, which is also the key
+// used with --watch-later-store=index.
+static char *mp_get_playback_resume_key(void *ta_parent,
+                                        struct MPContext *mpctx,
+                                        const char *fname)
 {
     struct MPOpts *opts = mpctx->opts;
     char *res = NULL;
@@ -226,19 +231,55 @@ static char *mp_get_playback_resume_config_filename(struct MPContext *mpctx,
     }
     uint8_t md5[16];
     av_md5_sum(md5, path, strlen(path));
-    char *conf = talloc_strdup(tmp, "");
+    res = talloc_strdup(ta_parent, "");
     for (int i = 0; i < 16; i++)
-        conf = talloc_asprintf_append(conf, "%02X", md5[i]);
-
-    char *wl_dir = mp_get_playback_resume_dir(mpctx);
-    if (wl_dir && wl_dir[0])
-        res = mp_path_join(NULL, wl_dir, conf);
+        res = talloc_asprintf_append(res, "%02X", md5[i]);
 
 exit:
     talloc_free(tmp);
     return res;
 }
 
+static char *mp_get_playback_resume_config_filename(struct MPContext *mpctx,
+                                                    const char *fname)
+{
+    char *res = NULL;
+    char *conf = mp_get_playback_resume_key(NULL, mpctx, fname);
+    char *wl_dir = mp_get_playback_resume_dir(mpctx);
+    if (conf && wl_dir && wl_dir[0])
+        res = mp_path_join(NULL, wl_dir, conf);
+    talloc_free(conf);
+    return res;
+}
+
+// Return the store for --watch-later-store=index, or NULL if separate files
+// are used.
+static struct mp_kv_log *get_resume_index(struct MPContext *mpctx)
+{
+    if (!mpctx->opts->watch_later_store)
+        return NULL;
+
+    char *wl_dir = mp_get_playback_resume_dir(mpctx);
+    char *path = wl_dir && wl_dir[0] ?
+                 mp_path_join(mpctx, wl_dir, MP_WATCH_LATER_INDEX) : NULL;
+    talloc_free(wl_dir);
+    if (!path)
+        return NULL;
+
+    if (mpctx->watch_later_index &&
+        strcmp(mpctx->watch_later_index_path, path) == 0)
+    {
+        talloc_free(path);
+        return mpctx->watch_later_index;
+    }
+
+    talloc_free(mpctx->watch_later_index);
+    talloc_free(mpctx->watch_later_index_path);
+    mpctx->watch_later_index = mp_kv_log_open(mpctx, mpctx->log, path);
+    mpctx->watch_later_index_path = path;
+    return mpctx->watch_later_index;
+}
+
 // Should follow what parser-cfg.c does/needs
 static bool needs_config_quoting(const char *s)
 {
@@ -252,7 +293,7 @@ static bool needs_config_quoting(const char *s)
     return false;
 }
 
-static void write_filename(struct MPContext *mpctx, FILE *file, char *filename)
+static void write_filename(struct MPContext *mpctx, char **data, char *filename)
 {
     if (mpctx->opts->ignore_path_in_watch_later_config && !mp_is_url(bstr0(filename)))
         filename = mp_basename(filename);
@@ -261,27 +302,81 @@ static void write_filename(struct MPContext *mpctx, FILE *file, char *filename)
         char write_name[1024] = {0};
         for (int n = 0; filename[n] && n < sizeof(write_name) - 1; n++)
             write_name[n] = (unsigned char)filename[n] < 32 ? '_' : filename[n];
-        fprintf(file, "# %s\n", write_name);
+        *data = talloc_asprintf_append_buffer(*data, "# %s\n", write_name);
     }
 }
 
-static void write_redirect(struct MPContext *mpctx, char *path)
+// Store the watch later config for path, either as separate file, or in the
+// index. With the index, the file's mtime is stored as tag of the entry,
+// instead of being copied to the config file.
+static bool write_resume_data(struct MPContext *mpctx, char *path,
+                              const char *data)
 {
-    char *conffile = mp_get_playback_resume_config_filename(mpctx, path);
-    if (conffile) {
-        FILE *file = fopen(conffile, "wb");
-        if (file) {
-            fprintf(file, "# redirect entry\n");
-            write_filename(mpctx, file, path);
-            fclose(file);
+    bool check_mtime = mpctx->opts->position_check_mtime &&
+                       !mp_is_url(bstr0(path));
+
+    struct mp_kv_log *index = get_resume_index(mpctx);
+    if (index) {
+        char *key = mp_get_playback_resume_key(NULL, mpctx, path);
+        if (!key)
+            return false;
+        int64_t mtime = -1;
+        struct stat st;
+        if (check_mtime) {
+            if (stat(path, &st) == 0) {
+                mtime = st.st_mtime;
+            } else {
+                MP_WARN(mpctx, "Can't get mtime of %s\n", path);
+            }
         }
+        bool ok = mp_kv_log_set(index, key, bstr0(data), mtime);
+        talloc_free(key);
+        return ok;
+    }
 
-        if (mpctx->opts->position_check_mtime &&
-            !mp_is_url(bstr0(path)) && !copy_mtime(path, conffile))
-            MP_WARN(mpctx, "Can't copy mtime from %s to %s\n", path, conffile);
+    char *conffile = mp_get_playback_resume_config_filename(mpctx, path);
+    if (!conffile)
+        return false;
 
+    FILE *file = fopen(conffile, "wb");
+    if (!file) {
+        MP_WARN(mpctx, "Can't open %s for writing\n", conffile);
         talloc_free(conffile);
+        return false;
+    }
+    fputs(data, file);
+    fclose(file);
+
+    if (check_mtime && !copy_mtime(path, conffile))
+        MP_WARN(mpctx, "Can't copy mtime from %s to %s\n", path, conffile);
+
+    talloc_free(conffile);
+    return true;
+}
+
+static void delete_resume_data(struct MPContext *mpctx, const char *path)
+{
+    struct mp_kv_log *index = get_resume_index(mpctx);
+    if (index) {
+        char *key = mp_get_playback_resume_key(NULL, mpctx, path);
+        if (key)
+            mp_kv_log_remove(index, key);
+        talloc_free(key);
+        return;
     }
+
+    char *fname = mp_get_playback_resume_config_filename(mpctx, path);
+    if (fname)
+        unlink(fname);
+    talloc_free(fname);
+}
+
+static void write_redirect(struct MPContext *mpctx, char *path)
+{
+    char *data = talloc_strdup(NULL, "# redirect entry\n");
+    write_filename(mpctx, &data, path);
+    write_resume_data(mpctx, path, data);
+    talloc_free(data);
 }
 
 static void write_redirects_for_parent_dirs(struct MPContext *mpctx, char *path)
@@ -308,7 +403,6 @@ static void write_redirects_for_parent_dirs(struct MPContext *mpctx, char *path)
 void mp_write_watch_later_conf(struct MPContext *mpctx)
 {
     struct playlist_entry *cur = mpctx->playing;
-    char *conffile = NULL;
     void *ctx = talloc_new(NULL);
 
     if (!cur)
@@ -320,22 +414,16 @@ void mp_write_watch_later_conf(struct MPContext *mpctx)
 
     struct demuxer *demux = mpctx->demuxer;
 
-    conffile = mp_get_playback_resume_config_filename(mpctx, path);
-    if (!conffile)
+    char *wl_dir = mp_get_playback_resume_dir(mpctx);
+    if (!wl_dir || !wl_dir[0] || !mp_get_playback_resume_key(ctx, mpctx, path))
         goto exit;
 
-    char *wl_dir = mp_get_playback_resume_dir(mpctx);
     mp_mkdirp(wl_dir);
 
     MP_INFO(mpctx, "Saving state.\n");
 
-    FILE *file = fopen(conffile, "wb");
-    if (!file) {
-        MP_WARN(mpctx, "Can't open %s for writing\n", conffile);
-        goto exit;
-    }
-
-    write_filename(mpctx, file, path);
+    char *data = talloc_strdup(ctx, "");
+    write_filename(mpctx, &data, path);
 
     bool write_start = true;
     double pos = get_playback_time(mpctx);
@@ -351,7 +439,7 @@ void mp_write_watch_later_conf(struct MPContext *mpctx)
         char *pname = watch_later_options[i];
         // Always save start if we have it in the array.
         if (write_start && strcmp(pname, "start") == 0) {
-            fprintf(file, "%s=%f\n", pname, pos);
+            data = talloc_asprintf_append_buffer(data, "%s=%f\n", pname, pos);
             continue;
         }
         // Only store it if it's different from the initial value.
@@ -360,21 +448,17 @@ void mp_write_watch_later_conf(struct MPContext *mpctx)
             mp_property_do(pname, M_PROPERTY_GET_STRING, &val, mpctx);
             if (needs_config_quoting(val)) {
                 // e.g. '%6%STRING'
-                fprintf(file, "%s=%%%d%%%s\n", pname, (int)strlen(val), val);
+                data = talloc_asprintf_append_buffer(data, "%s=%%%d%%%s\n",
+                                                     pname, (int)strlen(val), val);
             } else {
-                fprintf(file, "%s=%s\n", pname, val);
+                data = talloc_asprintf_append_buffer(data, "%s=%s\n", pname, val);
             }
             talloc_free(val);
         }
     }
-    fclose(file);
 
-    if (mpctx->opts->position_check_mtime && !mp_is_url(bstr0(path)) &&
-        !copy_mtime(path, conffile))
-    {
-        MP_WARN(mpctx, "Can't copy mtime from %s to %s\n", cur->filename,
-                conffile);
-    }
+    if (!write_resume_data(mpctx, path, data))
+        goto exit;
 
     write_redirects_for_parent_dirs(mpctx, path);
 
@@ -390,7 +474,6 @@ void mp_write_watch_later_conf(struct MPContext *mpctx)
     }
 
 exit:
-    talloc_free(conffile);
     talloc_free(ctx);
 }
 
@@ -401,12 +484,7 @@ void mp_delete_watch_later_conf(struct MPContext *mpctx, const char *file)
     if (!path)
         goto exit;
 
-    char *fname = mp_get_playback_resume_config_filename(mpctx, path);
-    if (!fname)
-        goto exit;
-
-    unlink(fname);
-    talloc_free(fname);
+    delete_resume_data(mpctx, path);
 
     if (mp_is_url(bstr0(path)) || mpctx->opts->ignore_path_in_watch_later_config)
         goto exit;
@@ -415,11 +493,7 @@ void mp_delete_watch_later_conf(struct MPContext *mpctx, const char *file)
     while (dir.len > 1 && dir.len < strlen(path)) {
         path[dir.len] = '\0';
         mp_path_strip_trailing_separator(path);
-        fname = mp_get_playback_resume_config_filename(mpctx, path);
-        if (!fname)
-            break;
-        unlink(fname);
-        talloc_free(fname);
+        delete_resume_data(mpctx, path);
         dir = mp_dirname(path);
     }
 
@@ -427,11 +501,47 @@ exit:
     talloc_free(ctx);
 }
 
+static bool load_playback_resume_index(struct MPContext *mpctx,
+                                      struct mp_kv_log *index, const char *file)
+{
+    void *tmp = talloc_new(NULL);
+    bool resume = false;
+    char *key = mp_get_playback_resume_key(tmp, mpctx, file);
+    bstr data;
+    int64_t mtime;
+    mp_kv_log_refresh(index);
+    if (!key || !mp_kv_log_get(index, tmp, key, &data, &mtime))
+        goto done;
+
+    struct stat st;
+    if (mpctx->opts->position_check_mtime && !mp_is_url(bstr0(file)) &&
+        (stat(file, &st) != 0 || st.st_mtime != mtime))
+        goto done;
+
+    // Never apply the saved start position to following files
+    m_config_backup_opt(mpctx->mconfig, "start");
+    MP_INFO(mpctx, "Resuming playback. This behavior can "
+           "be disabled with --no-resume-playback.\n");
+    char *location = talloc_asprintf(tmp, "%s:%s",
+                                     mpctx->watch_later_index_path, key);
+    MP_VERBOSE(mpctx, "Loading config '%s'\n", location);
+    m_config_parse(mpctx->mconfig, location, data, NULL,
+                   M_SETOPT_PRESERVE_CMDLINE | M_SETOPT_FROM_CONFIG_FILE);
+    resume = true;
+
+done:
+    talloc_free(tmp);
+    return resume;
+}
+
 bool mp_load_playback_resume(struct MPContext *mpctx, const char *file)
 {
     bool resume = false;
     if (!mpctx->opts->position_resume)
         return resume;
+    struct mp_kv_log *index = get_resume_index(mpctx);
+    if (index)
+        return load_playback_resume_index(mpctx, index, file);
     char *fname = mp_get_playback_resume_config_filename(mpctx, file);
     if (fname && mp_path_exists(fname)) {
         if (mpctx->opts->position_check_mtime &&
@@ -462,11 +572,22 @@ struct playlist_entry *mp_check_playlist_resume(struct MPContext *mpctx,
 {
     if (!mpctx->opts->position_resume)
         return NULL;
+    // With the index, all entries are looked up in memory after one refresh.
+    struct mp_kv_log *index = get_resume_index(mpctx);
+    if (index)
+        mp_kv_log_refresh(index);
     for (int n = 0; n < playlist->num_entries; n++) {
         struct playlist_entry *e = playlist->entries[n];
-        char *conf = mp_get_playback_resume_config_filename(mpctx, e->filename);
-        bool exists = conf && mp_path_exists(conf);
-        talloc_free(conf);
+        bool exists;
+        if (index) {
+            char *key = mp_get_playback_resume_key(NULL, mpctx, e->filename);
+            exists = key && mp_kv_log_has(index, key);
+            talloc_free(key);
+        } else {
+            char *conf = mp_get_playback_resume_config_filename(mpctx, e->filename);
+            exists = conf && mp_path_exists(conf);
+            talloc_free(conf);
+        }
         if (exists)
             return e;
     }
@@ -255,6 +255,12 @@ typedef struct MPContext {
 
     struct mp_thread_pool *thread_pool; // for coarse I/O, often during loading
 
+    struct mp_external_files_cache *external_files_cache;
+
+    // For --watch-later-store=index, opened on first use.
+    struct mp_kv_log *watch_later_index;
+    char *watch_later_index_path;
+
     struct mp_log *statusline;
     struct osd_state *osd;
     char *term_osd_text;
@@ -334,6 +340,16 @@ typedef struct MPContext {
     struct mp_image *next_frames[VO_MAX_REQ_FRAMES + 1];
     int num_next_frames;
     struct mp_image *saved_frame;   // for hrseek_lastframe and hrseek_backstep
+    // Recently displayed and hr-seek skipped frames, oldest first, for
+    // serving frame-back-step without seeking (--frame-history-max-bytes).
+    struct mp_image **frame_history;
+    int num_frame_history;
+    int64_t frame_history_bytes;
+    // If true, frame_history[frame_history_pos] is displayed by the VO instead
+    // of the frame at the normal playback position.
+    bool frame_history_browsing;
+    int frame_history_pos;
+    int64_t frame_history_hits, frame_history_misses;
 
     enum playback_status video_status, audio_status;
     bool restart_complete;
@@ -438,10 +454,12 @@ typedef struct MPContext {
     bool drop_message_shown;
 
     struct screenshot_ctx *screenshot_ctx;
+    struct mp_thumbnailer *thumbnailer;
     struct command_ctx *command_ctx;
     struct encode_lavc_context *encode_lavc_ctx;
 
     struct mp_ipc_ctx *ipc_ctx;
+    struct mp_state_shm *state_shm;
 
     int64_t builtin_script_ids[6];
 
@@ -467,6 +485,20 @@ typedef struct MPContext {
     //     to true.
     struct demuxer *open_res_demuxer;
     int open_res_error;
+
+    // Decoders started ahead for open_res_demuxer (--prefetch-playlist-decoders).
+    struct demuxer *preroll_demuxer; // non-NULL if attempted
+    struct mp_filter *preroll_root; // becomes the next filter_root
+    struct mp_decoder_wrapper *preroll_dec[STREAM_TYPE_COUNT];
+    struct sh_stream *preroll_stream[STREAM_TYPE_COUNT];
+    double preroll_ts_offset;
+
+    // Time from the end of the previous file to the first frame of this one.
+    int64_t transition_start; // mp_time_ns(), 0 if not a transition
+    double transition_latency; // in seconds, or MP_NOPTS_VALUE
+
+    // Last file completed by --stream-record (talloc'ed, or NULL).
+    char *stream_record_file;
 } MPContext;
 
 // Contains information about an asynchronous work item, how it can be aborted,
@@ -552,6 +584,10 @@ void autoload_external_files(struct MPContext *mpctx, struct mp_cancel *cancel);
 struct track *select_default_track(struct MPContext *mpctx, int order,
                                    enum stream_type type);
 void prefetch_next(struct MPContext *mpctx);
+void preroll_next(struct MPContext *mpctx);
+void discard_preroll(struct MPContext *mpctx);
+struct mp_decoder_wrapper *take_preroll_decoder(struct MPContext *mpctx,
+                                                struct track *track);
 void update_lavfi_complex(struct MPContext *mpctx);
 
 // main.c
@@ -659,6 +695,8 @@ void reinit_video_chain(struct MPContext *mpctx);
 void reinit_video_chain_src(struct MPContext *mpctx, struct track *track);
 int reinit_video_filters(struct MPContext *mpctx);
 void write_video(struct MPContext *mpctx);
+bool step_frame_history(struct MPContext *mpctx, int dir);
+void end_frame_history_browsing(struct MPContext *mpctx);
 void mp_force_video_refresh(struct MPContext *mpctx);
 void uninit_video_out(struct MPContext *mpctx);
 void uninit_video_chain(struct MPContext *mpctx);
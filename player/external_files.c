@@ -18,6 +18,8 @@
 #include <string.h>
 #include <stdlib.h>
 #include <assert.h>
+#include <time.h>
+#include <sys/stat.h>
 
 #include "osdep/io.h"
 
@@ -28,6 +30,7 @@
 #include "misc/language.h"
 #include "options/options.h"
 #include "options/path.h"
+#include "osdep/threads.h"
 #include "player/core.h"
 #include "external_files.h"
 
@@ -85,7 +88,143 @@ static int compare_sub_priority(const void *a, const void *b)
     return strcoll(s1->fname, s2->fname);
 }
 
+// Maximum number of directory listings kept by mp_external_files_cache.
+#define MAX_CACHED_DIRS 16
+
+struct dir_entry {
+    char *name;     // as returned by readdir()
+    bstr dename;    // converted to UTF-8
+    bstr ext;
+    bstr trim;      // stripped name without extension
+    bstr lang;      // guessed from the filename, if any
+    int lang_start;
+};
+
+struct dir_listing {
+    char *path;
+    struct stat st;     // of the directory at the time it was read
+    time_t read_time;
+    struct dir_entry *entries;
+    int num_entries;
+};
+
+struct mp_external_files_cache {
+    mp_mutex lock;
+    // Most recently used first.
+    struct dir_listing *dirs[MAX_CACHED_DIRS];
+    int num_dirs;
+};
+
+static void destroy_cache(void *ptr)
+{
+    struct mp_external_files_cache *cache = ptr;
+    mp_mutex_destroy(&cache->lock);
+}
+
+struct mp_external_files_cache *mp_external_files_cache_create(void *ta_parent)
+{
+    struct mp_external_files_cache *cache =
+        talloc_zero(ta_parent, struct mp_external_files_cache);
+    talloc_set_destructor(cache, destroy_cache);
+    mp_mutex_init(&cache->lock);
+    return cache;
+}
+
+static struct dir_listing *read_dir_listing(void *ta_parent, struct mp_log *log,
+                                            const char *path, struct stat *st)
+{
+    DIR *d = opendir(path);
+    if (!d)
+        return NULL;
+
+    struct dir_listing *dir = talloc_zero(ta_parent, struct dir_listing);
+    dir->path = talloc_strdup(dir, path);
+    dir->st = *st;
+    dir->read_time = time(NULL);
+
+    struct dirent *de;
+    while ((de = readdir(d))) {
+        struct dir_entry e = {.name = talloc_strdup(dir, de->d_name)};
+        bstr den = bstr0(e.name);
+        e.dename = mp_iconv_to_utf8(log, den, "UTF-8-MAC", MP_NO_LATIN1_FALLBACK);
+        if (den.start != e.dename.start)
+            talloc_steal(dir, e.dename.start);
+        // retrieve various parts of the filename
+        e.trim = bstr_strip(bstr_strip_ext(e.dename));
+        e.ext = bstr_get_ext(e.dename);
+        e.lang = mp_guess_lang_from_filename(e.dename, &e.lang_start);
+        MP_TARRAY_APPEND(dir, dir->entries, dir->num_entries, e);
+    }
+    closedir(d);
+
+    return dir;
+}
+
+// Whether the directory might have changed since it was read. The mtime has
+// only 1 second resolution on some systems, so a directory modified around the
+// time it was read is always considered changed.
+static bool dir_listing_is_stale(struct dir_listing *dir, struct stat *st)
+{
+    return dir->st.st_dev != st->st_dev || dir->st.st_ino != st->st_ino ||
+           dir->st.st_mtime != st->st_mtime ||
+           st->st_mtime >= dir->read_time - 1;
+}
+
+// Return the listing of the directory, read it if it's not cached or stale.
+// cache->lock must be held if cache is not NULL. Without cache, the result
+// is allocated with ta_parent.
+static struct dir_listing *get_dir_listing(struct mp_external_files_cache *cache,
+                                           void *ta_parent, struct mp_log *log,
+                                           const char *path)
+{
+    struct stat st;
+    if (stat(path, &st) != 0 || !S_ISDIR(st.st_mode))
+        return NULL;
+
+    if (!cache)
+        return read_dir_listing(ta_parent, log, path, &st);
+
+    struct dir_listing *dir = NULL;
+    int index = cache->num_dirs;
+    for (int n = 0; n < cache->num_dirs; n++) {
+        if (strcmp(cache->dirs[n]->path, path) == 0) {
+            dir = cache->dirs[n];
+            index = n;
+            break;
+        }
+    }
+
+    if (dir && dir_listing_is_stale(dir, &st)) {
+        talloc_free(dir);
+        dir = NULL;
+    }
+
+    if (!dir) {
+        dir = read_dir_listing(cache, log, path, &st);
+        if (!dir) {
+            if (index < cache->num_dirs)
+                MP_TARRAY_REMOVE_AT(cache->dirs, cache->num_dirs, index);
+            return NULL;
+        }
+        if (index == cache->num_dirs) {
+            if (cache->num_dirs == MAX_CACHED_DIRS) {
+                talloc_free(cache->dirs[--cache->num_dirs]);
+                index--;
+            }
+            cache->num_dirs++;
+        }
+    } else {
+        mp_trace(log, "Using cached listing of %s\n", path);
+    }
+
+    // Move to front.
+    memmove(&cache->dirs[1], &cache->dirs[0], index * sizeof(cache->dirs[0]));
+    cache->dirs[0] = dir;
+    return dir;
+}
+
 static void append_dir_subtitles(struct mpv_global *global, struct MPOpts *opts,
+                                 struct mp_external_files_cache *cache,
                                  struct subfn **slist, int *nsub,
                                  struct bstr path, const char *fname,
                                  int limit_fuzziness, int limit_type)
@@ -107,26 +246,19 @@ static void append_dir_subtitles(struct mpv_global *global, struct MPOpts *opts,
     if (mp_is_url(bstr0(path0)))
         goto out;
 
-    DIR *d = opendir(path0);
-    if (!d)
-        goto out;
-    mp_verbose(log, "Loading external files in %.*s\n", BSTR_P(path));
-    struct dirent *de;
-    while ((de = readdir(d))) {
-        void *tmpmem2 = talloc_new(tmpmem);
-        struct bstr den = bstr0(de->d_name);
-        struct bstr dename = mp_iconv_to_utf8(log, den,
-                                              "UTF-8-MAC", MP_NO_LATIN1_FALLBACK);
-        // retrieve various parts of the filename
-        struct bstr tmp_fname_noext = bstrdup(tmpmem2, bstr_strip_ext(dename));
-        struct bstr tmp_fname_ext = bstr_get_ext(dename);
-        struct bstr tmp_fname_trim = bstr_strip(tmp_fname_noext);
+    if (cache)
+        mp_mutex_lock(&cache->lock);
 
-        if (den.start != dename.start)
-            talloc_steal(tmpmem2, dename.start);
+    struct dir_listing *dir = get_dir_listing(cache, tmpmem, log, path0);
+    if (!dir)
+        goto done;
+    mp_verbose(log, "Loading external files in %.*s\n", BSTR_P(path));
+    for (int i = 0; i < dir->num_entries; i++) {
+        struct dir_entry *de = &dir->entries[i];
+        struct bstr tmp_fname_trim = de->trim;
 
         // check what it is (most likely)
-        int type = test_ext(opts, tmp_fname_ext);
+        int type = test_ext(opts, de->ext);
         char **langs = NULL;
         int fuzz = -1;
         switch (type) {
@@ -144,7 +276,7 @@ static void append_dir_subtitles(struct mpv_global *global, struct MPOpts *opts,
         }
 
         if (fuzz < 0 || (limit_type >= 0 && limit_type != type))
-            goto next_sub;
+            continue;
 
         // we have a (likely) subtitle file
         // higher prio -> auto-selection may prefer it (0 = not loaded)
@@ -153,11 +285,9 @@ static void append_dir_subtitles(struct mpv_global *global, struct MPOpts *opts,
         if (bstrcasecmp(tmp_fname_trim, f_fname_trim) == 0)
             prio |= 32; // exact movie name match
 
-        bstr lang = {0};
-        int start = 0;
-        lang = mp_guess_lang_from_filename(dename, &start);
+        bstr lang = de->lang;
         if (bstr_case_startswith(tmp_fname_trim, f_fname_trim)) {
-            if (lang.len && start == f_fname_trim.len)
+            if (lang.len && de->lang_start == f_fname_trim.len)
                 prio |= 16; // exact movie name + followed by lang
 
             if (lang.len && fuzz >= 1)
@@ -184,10 +314,10 @@ static void append_dir_subtitles(struct mpv_global *global, struct MPOpts *opts,
             prio |= 1;
 
         mp_trace(log, "Potential external file: \"%s\"  Priority: %d\n",
-               de->d_name, prio);
+               de->name, prio);
 
         if (prio) {
-            char *subpath = mp_path_join_bstr(*slist, path, dename);
+            char *subpath = mp_path_join_bstr(*slist, path, de->dename);
             if (mp_path_exists(subpath)) {
                 MP_TARRAY_GROW(NULL, *slist, *nsub);
                 struct subfn *sub = *slist + (*nsub)++;
@@ -203,12 +333,11 @@ static void append_dir_subtitles(struct mpv_global *global, struct MPOpts *opts,
             } else
                 talloc_free(subpath);
         }
-
-    next_sub:
-        talloc_free(tmpmem2);
     }
-    closedir(d);
 
+ done:
+    if (cache)
+        mp_mutex_unlock(&cache->lock);
  out:
     talloc_free(tmpmem);
 }
@@ -241,6 +370,7 @@ static void filter_subidx(struct subfn **slist, int *nsub)
 }
 
 static void load_paths(struct mpv_global *global, struct MPOpts *opts,
+                       struct mp_external_files_cache *cache,
                        struct subfn **slist, int *nsubs, const char *fname,
                        char **paths, char *cfg_path, int type)
 {
@@ -249,7 +379,7 @@ static void load_paths(struct mpv_global *global, struct MPOpts *opts,
         char *path = mp_path_join_bstr(
             *slist, mp_dirname(fname),
             bstr0(expanded_path ? expanded_path : paths[i]));
-        append_dir_subtitles(global, opts, slist, nsubs, bstr0(path),
+        append_dir_subtitles(global, opts, cache, slist, nsubs, bstr0(path),
                              fname, 0, type);
         talloc_free(expanded_path);
     }
@@ -257,31 +387,34 @@ static void load_paths(struct mpv_global *global, struct MPOpts *opts,
     // Load subtitles in ~/.mpv/sub (or similar) limiting sub fuzziness
     char *mp_subdir = mp_find_config_file(NULL, global, cfg_path);
     if (mp_subdir) {
-        append_dir_subtitles(global, opts, slist, nsubs, bstr0(mp_subdir),
-                             fname, 1, type);
+        append_dir_subtitles(global, opts, cache, slist, nsubs,
+                             bstr0(mp_subdir), fname, 1, type);
     }
     talloc_free(mp_subdir);
 }
 
 // Return a list of subtitles and audio files found, sorted by priority.
 // Last element is terminated with a fname==NULL entry.
+// cache can be NULL, in which case directories are always read again.
 struct subfn *find_external_files(struct mpv_global *global, const char *fname,
-                                  struct MPOpts *opts)
+                                  struct MPOpts *opts,
+                                  struct mp_external_files_cache *cache)
 {
     struct subfn *slist = talloc_array_ptrtype(NULL, slist, 1);
     int n = 0;
 
     // Load subtitles from current media directory
-    append_dir_subtitles(global, opts, &slist, &n, mp_dirname(fname), fname, 0, -1);
+    append_dir_subtitles(global, opts, cache, &slist, &n, mp_dirname(fname),
+                         fname, 0, -1);
 
     // Load subtitles in dirs specified by sub-paths option
     if (opts->sub_auto >= 0) {
-        load_paths(global, opts, &slist, &n, fname, opts->sub_paths, "sub",
-                   STREAM_SUB);
+        load_paths(global, opts, cache, &slist, &n, fname, opts->sub_paths,
+                   "sub", STREAM_SUB);
     }
 
     if (opts->audiofile_auto >= 0) {
-        load_paths(global, opts, &slist, &n, fname, opts->audiofile_paths,
+        load_paths(global, opts, cache, &slist, &n, fname, opts->audiofile_paths,
                    "audio", STREAM_AUDIO);
     }
 
@@ -29,8 +29,15 @@ struct subfn {
 
 struct mpv_global;
 struct MPOpts;
+
+// Cache of directory listings, to avoid reading the same directories again for
+// every file in a playlist. Thread-safe. Free with talloc_free().
+struct mp_external_files_cache;
+struct mp_external_files_cache *mp_external_files_cache_create(void *ta_parent);
+
 struct subfn *find_external_files(struct mpv_global *global, const char *fname,
-                                  struct MPOpts *opts);
+                                  struct MPOpts *opts,
+                                  struct mp_external_files_cache *cache);
 
 bool mp_might_be_subtitle_file(const char *filename);
 void mp_update_subtitle_exts(struct MPOpts *opts);
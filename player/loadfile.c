@@ -58,6 +58,7 @@
 
 #include "core.h"
 #include "command.h"
+#include "thumbnail.h"
 #include "libmpv/client.h"
 
 // Called from the demuxer thread if a new packet is available, or other changes.
@@ -188,6 +189,20 @@ static void kill_demuxers_reentrant(struct MPContext *mpctx,
     MP_DBG(mpctx, "Done terminating demuxers.\n");
 }
 
+static void report_recorded_files(struct MPContext *mpctx,
+                                  struct demuxer *demuxer)
+{
+    int num_recorded = 0;
+    char **recorded = demux_get_recorded_files(demuxer, NULL, &num_recorded);
+    for (int n = 0; n < num_recorded; n++) {
+        MP_INFO(mpctx, "Finished recording: %s\n", recorded[n]);
+        talloc_free(mpctx->stream_record_file);
+        mpctx->stream_record_file = talloc_strdup(mpctx, recorded[n]);
+        mp_notify_property(mpctx, "stream-record-file");
+    }
+    talloc_free(recorded);
+}
+
 static void uninit_demuxer(struct MPContext *mpctx)
 {
     for (int t = 0; t < STREAM_TYPE_COUNT; t++) {
@@ -201,6 +216,15 @@ static void uninit_demuxer(struct MPContext *mpctx)
 
     mp_abort_cache_dumping(mpctx);
 
+    // Finish the last --stream-record file while it can still be reported.
+    if (mpctx->demuxer) {
+        demux_stop_recording(mpctx->demuxer);
+        report_recorded_files(mpctx, mpctx->demuxer);
+    }
+
+    if (mpctx->thumbnailer)
+        mp_thumbnailer_set_source(mpctx->thumbnailer, NULL, 0, -1, 0);
+
     struct demuxer **demuxers = NULL;
     int num_demuxers = 0;
 
@@ -316,6 +340,7 @@ void update_demuxer_properties(struct MPContext *mpctx)
             MP_INFO(mpctx, "%s\n", b);
         }
     }
+    report_recorded_files(mpctx, demuxer);
     struct demuxer *tracks = mpctx->demuxer;
     if (tracks->events & DEMUX_EVENT_STREAMS) {
         add_demuxer_tracks(mpctx, tracks);
@@ -392,16 +417,10 @@ static int find_new_tid(struct MPContext *mpctx, enum stream_type t)
     return new_id + 1;
 }
 
-static struct track *add_stream_track(struct MPContext *mpctx,
+static struct track *new_stream_track(struct MPContext *mpctx,
                                       struct demuxer *demuxer,
                                       struct sh_stream *stream)
 {
-    for (int i = 0; i < mpctx->num_tracks; i++) {
-        struct track *track = mpctx->tracks[i];
-        if (track->stream == stream)
-            return track;
-    }
-
     struct track *track = talloc_ptrtype(NULL, track);
     *track = (struct track) {
         .type = stream->type,
@@ -423,6 +442,20 @@ static struct track *add_stream_track(struct MPContext *mpctx,
         .stream = stream,
     };
     MP_TARRAY_APPEND(mpctx, mpctx->tracks, mpctx->num_tracks, track);
+    return track;
+}
+
+static struct track *add_stream_track(struct MPContext *mpctx,
+                                      struct demuxer *demuxer,
+                                      struct sh_stream *stream)
+{
+    for (int i = 0; i < mpctx->num_tracks; i++) {
+        struct track *track = mpctx->tracks[i];
+        if (track->stream == stream)
+            return track;
+    }
+
+    struct track *track = new_stream_track(mpctx, demuxer, stream);
 
     mp_notify(mpctx, MP_EVENT_TRACKS_CHANGED, NULL);
 
@@ -944,7 +977,8 @@ void autoload_external_files(struct MPContext *mpctx, struct mp_cancel *cancel)
         return;
 
     void *tmp = talloc_new(NULL);
-    struct subfn *list = find_external_files(mpctx->global, mpctx->filename, opts);
+    struct subfn *list = find_external_files(mpctx->global, mpctx->filename, opts,
+                                             mpctx->external_files_cache);
     talloc_steal(tmp, list);
 
     int sc[STREAM_TYPE_COUNT] = {0};
@@ -1151,8 +1185,10 @@ static void cancel_open(struct MPContext *mpctx)
         mp_thread_join(mpctx->open_thread);
     mpctx->open_active = false;
 
-    if (mpctx->open_res_demuxer)
+    if (mpctx->open_res_demuxer) {
+        discard_preroll(mpctx);
         demux_cancel_and_free(mpctx->open_res_demuxer);
+    }
     mpctx->open_res_demuxer = NULL;
 
     TA_FREEP(&mpctx->open_cancel);
@@ -1264,6 +1300,134 @@ void prefetch_next(struct MPContext *mpctx)
     }
 }
 
+void discard_preroll(struct MPContext *mpctx)
+{
+    bool consumed = false;
+    for (int t = 0; t < STREAM_TYPE_COUNT; t++) {
+        if (mpctx->preroll_dec[t]) {
+            talloc_free(mpctx->preroll_dec[t]->f);
+            consumed |= demux_stream_is_selected(mpctx->preroll_stream[t]);
+        }
+        mpctx->preroll_dec[t] = NULL;
+        mpctx->preroll_stream[t] = NULL;
+    }
+    TA_FREEP(&mpctx->preroll_root);
+
+    // The decoders read the first packets of the file that is being loaded
+    // now, and a selected stream would start without them. Go back to the
+    // start. (Playback of this file hasn't started yet. A seek also resets
+    // the decoders that were taken over already.)
+    if (consumed && mpctx->demuxer && mpctx->preroll_demuxer == mpctx->demuxer) {
+        MP_VERBOSE(mpctx, "Seeking to start after discarding pre-started "
+                   "decoders.\n");
+        queue_seek(mpctx, MPSEEK_ABSOLUTE, get_start_time(mpctx, 1),
+                   MPSEEK_DEFAULT, 0);
+    }
+    mpctx->preroll_demuxer = NULL;
+}
+
+// Guess the track selection of the prefetched file, and start decoding these
+// tracks, so that the next file can start without waiting for the decoders.
+// Only what can be reused as-is when the file is actually loaded is created;
+// if the guess turns out to be wrong, it's discarded.
+void preroll_next(struct MPContext *mpctx)
+{
+    struct MPOpts *opts = mpctx->opts;
+    struct demuxer *demux = mpctx->open_res_demuxer;
+
+    if (!opts->prefetch_decoders || !mpctx->open_for_prefetch ||
+        !atomic_load(&mpctx->open_done) || !demux ||
+        mpctx->preroll_demuxer == demux)
+        return;
+
+    mpctx->preroll_demuxer = demux;
+
+    struct playlist_entry *next = mp_next_file(mpctx, +1, false);
+    if (!next || !next->filename || strcmp(next->filename, mpctx->open_url) ||
+        next->num_params || demux->playlist || mpctx->encode_lavc_ctx ||
+        (opts->lavfi_complex && opts->lavfi_complex[0]) ||
+        opts->play_dir != 1 || !opts->stream_auto_sel)
+        return;
+
+    // Run the normal track selection on a temporary track list.
+    struct track **tracks = mpctx->tracks;
+    int num_tracks = mpctx->num_tracks;
+    struct track *current[MAX_PTRACKS][STREAM_TYPE_COUNT];
+    memcpy(current, mpctx->current_track, sizeof(current));
+    memset(mpctx->current_track, 0, sizeof(current));
+    mpctx->tracks = NULL;
+    mpctx->num_tracks = 0;
+
+    for (int n = 0; n < demux_get_num_stream(demux); n++)
+        new_stream_track(mpctx, demux, demux_get_stream(demux, n));
+
+    struct sh_stream *sel[STREAM_TYPE_COUNT] = {0};
+    for (int t = STREAM_VIDEO; t <= STREAM_AUDIO; t++) {
+        struct track *track = select_default_track(mpctx, 0, t);
+        mpctx->current_track[0][t] = track;
+        // Cover art and images are decoded in a special mode.
+        if (track && !track->attached_picture && !track->image)
+            sel[t] = track->stream;
+    }
+
+    for (int n = 0; n < mpctx->num_tracks; n++)
+        talloc_free(mpctx->tracks[n]);
+    talloc_free(mpctx->tracks);
+    mpctx->tracks = tracks;
+    mpctx->num_tracks = num_tracks;
+    memcpy(mpctx->current_track, current, sizeof(current));
+
+    // The video decoder may use the VO's hwdec and DR interfaces, so it can
+    // be used only with the current VO.
+    if (!mpctx->video_out || (sel[STREAM_VIDEO] && sel[STREAM_VIDEO]->still_image))
+        sel[STREAM_VIDEO] = NULL;
+    if (!sel[STREAM_VIDEO] && !sel[STREAM_AUDIO])
+        return;
+
+    mpctx->preroll_ts_offset =
+        opts->rebase_start_time ? -demux->start_time : 0;
+    demux_set_ts_offset(demux, mpctx->preroll_ts_offset);
+
+    mpctx->preroll_root = mp_filter_create_root(mpctx->global);
+    struct mp_stream_info sinfo = {0};
+    if (mpctx->video_out) {
+        sinfo.hwdec_devs = mpctx->video_out->hwdec_devs;
+        sinfo.dr_vo = mpctx->video_out;
+    }
+    mpctx->preroll_root->stream_info = &sinfo;
+
+    for (int t = STREAM_VIDEO; t <= STREAM_AUDIO; t++) {
+        if (!sel[t])
+            continue;
+        MP_VERBOSE(mpctx, "Pre-starting %s decoder of next file.\n",
+                   stream_type_name(t));
+        mpctx->preroll_dec[t] =
+            mp_decoder_wrapper_create_prestarted(mpctx->preroll_root, sel[t]);
+        mpctx->preroll_stream[t] = sel[t];
+    }
+
+    // (Decoders copy the stream info on creation.)
+    mpctx->preroll_root->stream_info = NULL;
+}
+
+// Return the pre-started decoder for the track, if there is one. The track
+// selection and timestamp offset must be final.
+struct mp_decoder_wrapper *take_preroll_decoder(struct MPContext *mpctx,
+                                                struct track *track)
+{
+    struct mp_decoder_wrapper *dec = mpctx->preroll_dec[track->type];
+    if (!dec || track->type == STREAM_SUB || !track->stream ||
+        track->demuxer != mpctx->preroll_demuxer ||
+        mpctx->preroll_stream[track->type] != track->stream)
+        return NULL;
+
+    mpctx->preroll_dec[track->type] = NULL;
+    mp_decoder_wrapper_end_prestart(dec);
+    MP_VERBOSE(mpctx, "Using pre-started %s decoder.\n",
+               stream_type_name(track->type));
+    return dec;
+}
+
 static void clear_playlist_paths(struct MPContext *mpctx)
 {
     TA_FREEP(&mpctx->playlist_paths);
@@ -1530,6 +1694,10 @@ static void play_current_file(struct MPContext *mpctx)
     assert(mpctx->stop_play);
     mpctx->stop_play = 0;
 
+    // Set again when playback starts, if this file continues the previous one.
+    if (!mpctx->transition_start)
+        mpctx->transition_latency = MP_NOPTS_VALUE;
+
     process_hooks(mpctx, "on_before_start_file");
     if (mpctx->stop_play || !mpctx->playlist->current)
         return;
@@ -1562,7 +1730,14 @@ static void play_current_file(struct MPContext *mpctx)
     // let get_current_time() show 0 as start time (before playback_pts is set)
     mpctx->last_seek_pts = 0.0;
     mpctx->seek = (struct seek_params){ 0 };
-    mpctx->filter_root = mp_filter_create_root(mpctx->global);
+    // Adopt the root of the pre-started decoders; they're discarded later if
+    // they can't be used.
+    if (mpctx->preroll_root) {
+        mpctx->filter_root = mpctx->preroll_root;
+        mpctx->preroll_root = NULL;
+    } else {
+        mpctx->filter_root = mp_filter_create_root(mpctx->global);
+    }
     mp_filter_graph_set_wakeup_cb(mpctx->filter_root, mp_wakeup_core_cb, mpctx);
     mp_filter_graph_set_max_run_time(mpctx->filter_root, 0.1);
 
@@ -1664,6 +1839,11 @@ static void play_current_file(struct MPContext *mpctx)
         demux_set_ts_offset(mpctx->demuxer, -mpctx->demuxer->start_time);
     enable_demux_thread(mpctx, mpctx->demuxer);
 
+    if (mpctx->preroll_demuxer != mpctx->demuxer ||
+        mpctx->preroll_ts_offset !=
+            (opts->rebase_start_time ? -mpctx->demuxer->start_time : 0))
+        discard_preroll(mpctx);
+
     add_demuxer_tracks(mpctx, mpctx->demuxer);
 
     load_external_opts(mpctx);
@@ -1732,6 +1912,7 @@ static void play_current_file(struct MPContext *mpctx)
     reinit_video_chain(mpctx);
     reinit_audio_chain(mpctx);
     reinit_sub_all(mpctx);
+    discard_preroll(mpctx); // unused pre-started decoders
 
     if (mpctx->encode_lavc_ctx) {
         if (mpctx->vo_chain)
@@ -1819,6 +2000,9 @@ terminate_playback:
     if (!mpctx->stop_play)
         mpctx->stop_play = PT_ERROR;
 
+    mpctx->transition_start =
+        mpctx->stop_play == AT_END_OF_FILE ? mp_time_ns() : 0;
+
     if (mpctx->stop_play != AT_END_OF_FILE)
         clear_audio_output_buffers(mpctx);
 
@@ -1839,6 +2023,10 @@ terminate_playback:
     if (!opts->gapless_audio && !mpctx->encode_lavc_ctx)
         uninit_audio_out(mpctx);
 
+    // Pre-started decoders adopted with filter_root, but not used yet.
+    if (!mpctx->preroll_root)
+        discard_preroll(mpctx);
+
     mpctx->playback_initialized = false;
 
     uninit_demuxer(mpctx);
@@ -2005,8 +2193,11 @@ void mp_play_files(struct MPContext *mpctx)
             new_entry = mpctx->playlist->current;
         }
 
-        if (!new_entry)
+        if (!new_entry) {
             mpctx->playlist->playlist_completed = true;
+            // Nothing continues the previous file directly.
+            mpctx->transition_start = 0;
+        }
 
         mpctx->playlist->current = new_entry;
         mpctx->playlist->current_was_replaced = false;
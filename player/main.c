@@ -50,6 +50,7 @@
 #include "common/msg_control.h"
 #include "common/stats.h"
 #include "common/global.h"
+#include "demux/demux.h"
 #include "filters/f_decoder_wrapper.h"
 #include "options/parse_configfile.h"
 #include "options/parse_commandline.h"
@@ -66,7 +67,10 @@
 #include "core.h"
 #include "client.h"
 #include "command.h"
+#include "external_files.h"
 #include "screenshot.h"
+#include "state_shm.h"
+#include "thumbnail.h"
 
 static const char def_config[] =
 #include "etc/builtin.conf.inc"
@@ -174,9 +178,13 @@ void mp_destroy(struct MPContext *mpctx)
     mp_uninit_ipc(mpctx->ipc_ctx);
     mpctx->ipc_ctx = NULL;
 
+    TA_FREEP(&mpctx->state_shm);
+
     uninit_audio_out(mpctx);
     uninit_video_out(mpctx);
 
+    TA_FREEP(&mpctx->thumbnailer);
+
     // If it's still set here, it's an error.
     encode_lavc_free(mpctx->encode_lavc_ctx);
     mpctx->encode_lavc_ctx = NULL;
@@ -199,6 +207,7 @@ void mp_destroy(struct MPContext *mpctx)
     mp_input_uninit(mpctx->input);
     mp_clipboard_destroy(mpctx->clipboard);
 
+    demux_lavf_uninit_probe_cache(mpctx->global);
     uninit_libav(mpctx->global);
 
     mp_msg_uninit(mpctx->global);
@@ -276,8 +285,10 @@ struct MPContext *mp_create(void)
         .dispatch = mp_dispatch_create(mpctx),
         .playback_abort = mp_cancel_new(mpctx),
         .thread_pool = mp_thread_pool_create(mpctx, 0, 1, 30),
+        .external_files_cache = mp_external_files_cache_create(mpctx),
         .stop_play = PT_NEXT_ENTRY,
         .play_dir = 1,
+        .transition_latency = MP_NOPTS_VALUE,
     };
 
     mp_mutex_init(&mpctx->abort_lock);
@@ -26,6 +26,7 @@
 #include "core.h"
 #include "mpv_talloc.h"
 #include "screenshot.h"
+#include "state_shm.h"
 
 #include "audio/out/ao.h"
 #include "common/common.h"
@@ -46,6 +47,7 @@
 #include "stream/stream.h"
 #include "sub/dec_sub.h"
 #include "sub/osd.h"
+#include "video/mp_image_pool.h"
 #include "video/out/vo.h"
 
 // Wait until mp_wakeup_core() is called, since the last time
@@ -53,9 +55,18 @@
 void mp_wait_events(struct MPContext *mpctx)
 {
     mp_client_send_property_changes(mpctx);
+    if (mpctx->state_shm)
+        mp_state_shm_update(mpctx->state_shm);
 
     stats_event(mpctx->stats, "iterations");
 
+    struct mp_image_pool_stats pool_stats;
+    mp_image_pool_get_stats(&pool_stats);
+    stats_size_value(mpctx->stats, "image-pool-bytes", pool_stats.bytes);
+    stats_value(mpctx->stats, "image-pool-reused", pool_stats.hits);
+    stats_value(mpctx->stats, "image-pool-allocated", pool_stats.misses);
+    stats_value(mpctx->stats, "image-pool-trimmed", pool_stats.trimmed);
+
     bool sleeping = mpctx->sleeptime > 0;
     if (sleeping)
         MP_STATS(mpctx, "start sleep");
@@ -155,6 +166,9 @@ void set_pause_state(struct MPContext *mpctx, bool user_pause)
 {
     struct MPOpts *opts = mpctx->opts;
 
+    if (!user_pause)
+        end_frame_history_browsing(mpctx);
+
     opts->pause = user_pause;
 
     bool internal_paused = get_internal_paused(mpctx);
@@ -208,12 +222,15 @@ void add_step_frame(struct MPContext *mpctx, int dir)
     if (!mpctx->vo_chain)
         return;
     if (dir > 0) {
+        if (step_frame_history(mpctx, 1))
+            return;
         mpctx->step_frames += 1;
         set_pause_state(mpctx, false);
     } else if (dir < 0) {
         if (!mpctx->hrseek_active) {
-            queue_seek(mpctx, MPSEEK_BACKSTEP, 0, MPSEEK_VERY_EXACT, 0);
             set_pause_state(mpctx, true);
+            if (!step_frame_history(mpctx, -1))
+                queue_seek(mpctx, MPSEEK_BACKSTEP, 0, MPSEEK_VERY_EXACT, 0);
         }
     }
 }
@@ -486,6 +503,9 @@ void execute_queued_seek(struct MPContext *mpctx)
         }
         mp_seek(mpctx, mpctx->seek);
         mpctx->seek = (struct seek_params){0};
+        // If the seek failed, resume from wherever the decoder is.
+        if (!mpctx->opts->pause)
+            mpctx->frame_history_browsing = false;
     }
 }
 
@@ -779,8 +799,10 @@ static void handle_update_cache(struct MPContext *mpctx)
         force_update = true;
     }
 
-    if (s.eof && !busy)
+    if (s.eof && !busy) {
         prefetch_next(mpctx);
+        preroll_next(mpctx);
+    }
 
     if (force_update) {
         mpctx->cache_update_pts = mpctx->playback_pts;
@@ -1150,6 +1172,14 @@ static void handle_playback_restart(struct MPContext *mpctx)
         mp_notify(mpctx, MPV_EVENT_PLAYBACK_RESTART, NULL);
         update_core_idle_state(mpctx);
         if (!mpctx->playing_msg_shown) {
+            if (mpctx->transition_start) {
+                mpctx->transition_latency =
+                    MP_TIME_NS_TO_S(mp_time_ns() - mpctx->transition_start);
+                mpctx->transition_start = 0;
+                MP_VERBOSE(mpctx, "Transition from previous file took %f ms.\n",
+                           mpctx->transition_latency * 1e3);
+                mp_notify_property(mpctx, "transition-latency");
+            }
             if (opts->playing_msg && opts->playing_msg[0]) {
                 char *msg =
                     mp_property_expand_escaped_string(mpctx, opts->playing_msg);
@@ -1304,6 +1334,8 @@ void idle_loop(struct MPContext *mpctx)
     bool need_reinit = true;
     while (mpctx->opts->player_idle_mode && mpctx->stop_play == PT_STOP) {
         if (need_reinit) {
+            // A file loaded after idling is not a transition.
+            mpctx->transition_start = 0;
             uninit_audio_out(mpctx);
             handle_force_window(mpctx, true);
             mp_wakeup_core(mpctx);
@@ -0,0 +1,278 @@
+/*
+ * This file is part of mpv.
+ *
+ * mpv is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * mpv is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with mpv.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <string.h>
+
+#include "config.h"
+
+#if HAVE_POSIX
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#include "osdep/io.h"
+
+#include "mpv_talloc.h"
+#include "state_shm.h"
+#include "core.h"
+#include "client.h"
+#include "common/common.h"
+#include "common/msg.h"
+#include "libmpv/client.h"
+#include "options/path.h"
+
+// Binary layout of the page, see ipc.rst. All fields are in native byte order.
+// Changing anything except the reserved fields requires bumping STATE_VERSION.
+#define STATE_MAGIC "mpvstate"
+#define STATE_VERSION 1
+
+#define STATE_FLAG_EXITED (1 << 0)
+
+#define NAME_SIZE 48
+#define STRING_SIZE 56
+
+struct state_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t header_size;
+    uint32_t entry_size;
+    uint32_t num_entries;
+    _Atomic uint64_t seq;       // odd while the page is being written
+    uint64_t pid;
+    uint64_t update_count;
+    uint64_t flags;             // STATE_FLAG_*
+    uint8_t reserved[8];
+};
+
+struct state_entry {
+    char name[NAME_SIZE];
+    uint32_t format;            // MPV_FORMAT_NONE/FLAG/INT64/DOUBLE/STRING
+    uint32_t length;            // length of string (without terminating \0)
+    union {
+        int64_t i;              // MPV_FORMAT_FLAG, MPV_FORMAT_INT64
+        double d;               // MPV_FORMAT_DOUBLE
+    } u;
+    uint64_t change_count;
+    char string[STRING_SIZE];   // MPV_FORMAT_STRING, \0-terminated
+};
+
+static_assert(sizeof(struct state_header) == 64, "");
+static_assert(sizeof(struct state_entry) == 128, "");
+
+struct mp_state_shm {
+    struct mp_log *log;
+    struct mpv_handle *client;
+    void *map;
+    size_t map_size;
+    struct state_header *header;
+    struct state_entry *entries;
+    int num_entries;
+    bool writing;
+};
+
+// Seqlock writer side. Readers retry while seq is odd or has changed.
+static void begin_write(struct mp_state_shm *shm)
+{
+    if (shm->writing)
+        return;
+    struct state_header *h = shm->header;
+    uint64_t seq = atomic_load_explicit(&h->seq, memory_order_relaxed);
+    atomic_store_explicit(&h->seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    shm->writing = true;
+}
+
+static void end_write(struct mp_state_shm *shm)
+{
+    if (!shm->writing)
+        return;
+    struct state_header *h = shm->header;
+    h->update_count += 1;
+    uint64_t seq = atomic_load_explicit(&h->seq, memory_order_relaxed);
+    atomic_store_explicit(&h->seq, seq + 1, memory_order_release);
+    shm->writing = false;
+}
+
+static void write_entry(struct state_entry *e, struct mpv_event_property *prop)
+{
+    struct mpv_node *node = prop->format == MPV_FORMAT_NODE ? prop->data : NULL;
+
+    e->format = MPV_FORMAT_NONE;
+    e->length = 0;
+    e->u.i = 0;
+    e->string[0] = '\0';
+
+    // Other types (lists and maps) are exported as unavailable.
+    switch (node ? node->format : MPV_FORMAT_NONE) {
+    case MPV_FORMAT_FLAG:
+        e->format = MPV_FORMAT_FLAG;
+        e->u.i = node->u.flag;
+        break;
+    case MPV_FORMAT_INT64:
+        e->format = MPV_FORMAT_INT64;
+        e->u.i = node->u.int64;
+        break;
+    case MPV_FORMAT_DOUBLE:
+        e->format = MPV_FORMAT_DOUBLE;
+        e->u.d = node->u.double_;
+        break;
+    case MPV_FORMAT_STRING: {
+        const char *s = node->u.string;
+        size_t len = strlen(s);
+        if (len >= STRING_SIZE) {
+            // Truncate, but don't cut UTF-8 sequences in half.
+            len = STRING_SIZE - 1;
+            while (len > 0 && (s[len] & 0xC0) == 0x80)
+                len--;
+        }
+        e->format = MPV_FORMAT_STRING;
+        e->length = len;
+        memcpy(e->string, s, len);
+        e->string[len] = '\0';
+        break;
+    }
+    default: ;
+    }
+
+    e->change_count += 1;
+}
+
+void mp_state_shm_update(struct mp_state_shm *shm)
+{
+    while (shm->client) {
+        struct mpv_event *ev = mpv_wait_event(shm->client, 0);
+        if (ev->event_id == MPV_EVENT_NONE)
+            break;
+        if (ev->event_id == MPV_EVENT_SHUTDOWN) {
+            // Must go away, or the core waits for it forever.
+            mpv_destroy(shm->client);
+            shm->client = NULL;
+            begin_write(shm);
+            shm->header->flags |= STATE_FLAG_EXITED;
+        } else if (ev->event_id == MPV_EVENT_PROPERTY_CHANGE &&
+                   ev->reply_userdata < shm->num_entries)
+        {
+            begin_write(shm);
+            write_entry(&shm->entries[ev->reply_userdata], ev->data);
+        }
+    }
+    end_write(shm);
+}
+
+static void destroy_shm(void *p)
+{
+    struct mp_state_shm *shm = p;
+
+    if (shm->client)
+        mpv_destroy(shm->client);
+
+#if HAVE_POSIX
+    if (shm->map) {
+        // Readers can keep the file open, so tell them it's stale.
+        begin_write(shm);
+        shm->header->flags |= STATE_FLAG_EXITED;
+        end_write(shm);
+        munmap(shm->map, shm->map_size);
+    }
+#endif
+}
+
+struct mp_state_shm *mp_state_shm_create(struct MPContext *mpctx,
+                                         const char *path, char **props)
+{
+    struct mp_state_shm *shm = talloc_zero(NULL, struct mp_state_shm);
+    talloc_set_destructor(shm, destroy_shm);
+    shm->log = mp_log_new(shm, mpctx->log, "state-shm");
+
+#if HAVE_POSIX
+    shm->client = mp_new_client(mpctx->clients, "state_shm");
+    if (!shm->client)
+        goto error;
+    // Don't keep the player alive.
+    mp_client_set_weak(shm->client);
+    for (int n = 0; n < 64; n++) {
+        if (mpv_event_name(n) && n != MPV_EVENT_SHUTDOWN &&
+            n != MPV_EVENT_PROPERTY_CHANGE)
+            mpv_request_event(shm->client, n, 0);
+    }
+
+    char *fname = mp_get_user_path(shm, mpctx->global, path);
+
+    for (int n = 0; props && props[n]; n++)
+        shm->num_entries++;
+    shm->map_size = sizeof(struct state_header) +
+                    shm->num_entries * sizeof(struct state_entry);
+
+    // Always create a new file, so readers which still have the old one
+    // mapped see the exited flag instead of a layout that changes under them.
+    unlink(fname);
+    int fd = open(fname, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        MP_ERR(shm, "Could not create '%s': %s\n", fname, mp_strerror(errno));
+        goto error;
+    }
+    void *map = MAP_FAILED;
+    if (ftruncate(fd, shm->map_size) == 0) {
+        map = mmap(NULL, shm->map_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                   fd, 0);
+    }
+    int err = errno;
+    close(fd);
+    if (map == MAP_FAILED) {
+        MP_ERR(shm, "Could not map '%s': %s\n", fname, mp_strerror(err));
+        unlink(fname);
+        goto error;
+    }
+    shm->map = map;
+    shm->header = map;
+    shm->entries = (void *)(shm->header + 1);
+
+    begin_write(shm);
+    memcpy(shm->header->magic, STATE_MAGIC, sizeof(shm->header->magic));
+    shm->header->version = STATE_VERSION;
+    shm->header->header_size = sizeof(struct state_header);
+    shm->header->entry_size = sizeof(struct state_entry);
+    shm->header->num_entries = shm->num_entries;
+    shm->header->pid = getpid();
+    for (int n = 0; n < shm->num_entries; n++) {
+        struct state_entry *e = &shm->entries[n];
+        if (strlen(props[n]) >= NAME_SIZE) {
+            MP_WARN(shm, "Property name '%s' is too long.\n", props[n]);
+            continue;
+        }
+        snprintf(e->name, sizeof(e->name), "%s", props[n]);
+        mpv_observe_property(shm->client, n, props[n], MPV_FORMAT_NODE);
+    }
+    end_write(shm);
+
+    MP_VERBOSE(shm, "Exporting %d properties to '%s'.\n", shm->num_entries,
+               fname);
+    return shm;
+
+error:
+    talloc_free(shm);
+    return NULL;
+#else
+    MP_ERR(shm, "--input-ipc-shm-path is not supported on this platform.\n");
+    talloc_free(shm);
+    return NULL;
+#endif
+}
@@ -0,0 +1,37 @@
+/*
+ * This file is part of mpv.
+ *
+ * mpv is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * mpv is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with mpv.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MPLAYER_STATE_SHM_H
+#define MPLAYER_STATE_SHM_H
+
+struct MPContext;
+
+// Exports the current values of a fixed set of properties in a file mapped
+// into memory (--input-ipc-shm-path), so that local processes can read them
+// without going through IPC. The layout is documented in ipc.rst. Must only
+// be used on the playloop thread. Free with talloc_free().
+struct mp_state_shm;
+
+// Returns NULL on failure (and if not supported on this platform).
+struct mp_state_shm *mp_state_shm_create(struct MPContext *mpctx,
+                                         const char *path, char **props);
+
+// Write the properties that changed since the last call to the page. Called
+// after mp_client_send_property_changes().
+void mp_state_shm_update(struct mp_state_shm *shm);
+
+#endif /* MPLAYER_STATE_SHM_H */
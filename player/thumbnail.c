@@ -0,0 +1,640 @@
+/*
+ * This file is part of mpv.
+ *
+ * mpv is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * mpv is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with mpv.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+
+#include <libavcodec/avcodec.h>
+
+#include "osdep/io.h"
+#include "osdep/threads.h"
+#include "osdep/timer.h"
+
+#include "mpv_talloc.h"
+#include "thumbnail.h"
+#include "core.h"
+#include "command.h"
+#include "common/av_common.h"
+#include "common/global.h"
+#include "common/msg.h"
+#include "common/playlist.h"
+#include "demux/demux.h"
+#include "demux/packet.h"
+#include "demux/stheader.h"
+#include "input/cmd.h"
+#include "misc/node.h"
+#include "misc/thread_tools.h"
+#include "options/m_config.h"
+#include "options/m_option.h"
+#include "options/options.h"
+#include "video/mp_image.h"
+#include "video/sws_utils.h"
+
+// Give up if no keyframe shows up after seeking.
+#define MAX_SKIP_PACKETS 1000
+
+struct thumbnail_opts {
+    int width;
+    int64_t cache_max_bytes;
+};
+
+#define OPT_BASE_STRUCT struct thumbnail_opts
+const struct m_sub_options thumbnail_conf = {
+    .opts = (const struct m_option[]) {
+        {"width", OPT_INT(width), M_RANGE(16, 4096)},
+        {"cache-max-bytes", OPT_BYTE_SIZE(cache_max_bytes),
+            M_RANGE(0, M_MAX_MEM_BYTES)},
+        {0}
+    },
+    .size = sizeof(struct thumbnail_opts),
+    .defaults = &(const struct thumbnail_opts){
+        .width = 256,
+        .cache_max_bytes = 16 * 1024 * 1024,
+    },
+};
+
+struct thumbnail {
+    // Requests for timestamps within this range map to this keyframe.
+    double start, end;
+    struct mp_image *img;
+};
+
+struct thumbnail_request {
+    double pts;
+    bool done;
+    struct mp_image *img;   // result, NULL on failure
+};
+
+struct mp_thumbnailer {
+    struct mpv_global *global;
+    struct mp_log *log;
+    struct m_config_cache *opts_cache;
+    struct thumbnail_opts *opts;
+
+    mp_thread thread;
+    mp_mutex lock;
+    mp_cond wakeup;
+    struct mp_cancel *cancel;
+
+    // --- Protected by lock.
+    bool terminate;
+    char *url;              // NULL if no source
+    int stream_flags;
+    int stream_index;
+    double ts_offset;
+    uint64_t source_id;     // incremented on every source change
+    bool source_failed;
+    struct thumbnail_request **requests;
+    int num_requests;
+    struct thumbnail *cache; // most recently used first
+    int num_cache;
+    int64_t cache_bytes;
+    int64_t hits, misses;
+
+    // --- Owned by the thumbnail thread.
+    struct demuxer *demuxer;
+    AVCodecContext *avctx;
+    AVRational codec_timebase;
+    AVPacket *avpkt;
+    AVFrame *frame;
+    struct mp_sws_context *sws;
+};
+
+static int64_t thumbnail_size(struct mp_image *img)
+{
+    return (int64_t)img->stride[0] * img->h;
+}
+
+static void remove_thumbnail(struct mp_thumbnailer *th, int index)
+{
+    struct thumbnail *t = &th->cache[index];
+    th->cache_bytes -= thumbnail_size(t->img);
+    talloc_free(t->img);
+    MP_TARRAY_REMOVE_AT(th->cache, th->num_cache, index);
+}
+
+// Find the thumbnail for pts, and mark it as most recently used.
+static struct thumbnail *find_thumbnail(struct mp_thumbnailer *th, double pts)
+{
+    for (int n = 0; n < th->num_cache; n++) {
+        struct thumbnail t = th->cache[n];
+        if (pts >= t.start && pts <= t.end) {
+            MP_TARRAY_REMOVE_AT(th->cache, th->num_cache, n);
+            MP_TARRAY_INSERT_AT(th, th->cache, th->num_cache, 0, t);
+            return &th->cache[0];
+        }
+    }
+    return NULL;
+}
+
+// If the thumbnail for this keyframe exists, make it cover pts as well.
+static bool extend_thumbnail(struct mp_thumbnailer *th, double kf_pts,
+                             double pts)
+{
+    for (int n = 0; n < th->num_cache; n++) {
+        struct thumbnail *t = &th->cache[n];
+        if (t->img->pts == kf_pts) {
+            t->start = MPMIN(t->start, pts);
+            t->end = MPMAX(t->end, pts);
+            return true;
+        }
+    }
+    return false;
+}
+
+static void add_thumbnail(struct mp_thumbnailer *th, double pts,
+                          struct mp_image *img)
+{
+    struct thumbnail t = {
+        .start = MPMIN(img->pts, pts),
+        .end = MPMAX(img->pts, pts),
+        .img = talloc_steal(th, img),
+    };
+    MP_TARRAY_INSERT_AT(th, th->cache, th->num_cache, 0, t);
+    th->cache_bytes += thumbnail_size(img);
+    while (th->num_cache > 1 && th->cache_bytes > th->opts->cache_max_bytes)
+        remove_thumbnail(th, th->num_cache - 1);
+}
+
+static void remove_request(struct mp_thumbnailer *th,
+                           struct thumbnail_request *req)
+{
+    for (int n = 0; n < th->num_requests; n++) {
+        if (th->requests[n] == req) {
+            MP_TARRAY_REMOVE_AT(th->requests, th->num_requests, n);
+            break;
+        }
+    }
+}
+
+// Answer all requests that can be served from the cache now. The request for
+// failed_pts is answered in any case.
+static void complete_requests(struct mp_thumbnailer *th, double failed_pts)
+{
+    for (int n = th->num_requests - 1; n >= 0; n--) {
+        struct thumbnail_request *req = th->requests[n];
+        struct thumbnail *t = find_thumbnail(th, req->pts);
+        if (t || req->pts == failed_pts) {
+            req->img = t ? mp_image_new_ref(t->img) : NULL;
+            req->done = true;
+            MP_TARRAY_REMOVE_AT(th->requests, th->num_requests, n);
+        }
+    }
+    mp_cond_broadcast(&th->wakeup);
+}
+
+static void fail_requests(struct mp_thumbnailer *th)
+{
+    for (int n = 0; n < th->num_requests; n++)
+        th->requests[n]->done = true;
+    th->num_requests = 0;
+    mp_cond_broadcast(&th->wakeup);
+}
+
+static void close_source(struct mp_thumbnailer *th)
+{
+    avcodec_free_context(&th->avctx);
+    demux_free(th->demuxer);
+    th->demuxer = NULL;
+}
+
+static bool open_source(struct mp_thumbnailer *th, const char *url, int flags,
+                        int index, double ts_offset)
+{
+    // Not a top level demuxer, so there is no cache or demuxer thread.
+    struct demuxer_params params = {
+        .stream_flags = flags,
+    };
+    th->demuxer = demux_open_url(url, &params, th->cancel, th->global);
+    if (!th->demuxer)
+        return false;
+    demux_set_ts_offset(th->demuxer, ts_offset);
+
+    struct sh_stream *sh = NULL;
+    if (index >= 0 && index < demux_get_num_stream(th->demuxer))
+        sh = demux_get_stream(th->demuxer, index);
+    if (!sh || sh->type != STREAM_VIDEO || !th->demuxer->seekable) {
+        MP_VERBOSE(th, "Can't create thumbnails for this stream.\n");
+        return false;
+    }
+    demuxer_select_track(th->demuxer, sh, MP_NOPTS_VALUE, true);
+
+    struct mp_codec_params *c = sh->codec;
+    const AVCodec *codec = avcodec_find_decoder(mp_codec_to_av_codec_id(c->codec));
+    if (!codec)
+        return false;
+    th->avctx = avcodec_alloc_context3(codec);
+    if (!th->avctx)
+        return false;
+
+    th->codec_timebase = mp_get_codec_timebase(c);
+    th->avctx->pkt_timebase = th->codec_timebase;
+    // Only keyframes are ever decoded, and only one at a time.
+    th->avctx->skip_frame = AVDISCARD_NONKEY;
+    th->avctx->thread_count = 1;
+    // The loop filter's effect is hardly visible after downscaling.
+    th->avctx->skip_loop_filter = AVDISCARD_ALL;
+
+    // Decode at a reduced resolution if the decoder supports it, as long as
+    // the result is still at least as wide as the thumbnails.
+    m_config_cache_update(th->opts_cache);
+    int lowres = 0;
+    while (lowres < codec->max_lowres &&
+           (c->disp_w >> (lowres + 1)) >= th->opts->width)
+        lowres++;
+    th->avctx->lowres = lowres;
+
+    if (mp_set_avctx_codec_headers(th->avctx, c) < 0 ||
+        avcodec_open2(th->avctx, codec, NULL) < 0)
+    {
+        MP_VERBOSE(th, "Could not open decoder.\n");
+        return false;
+    }
+
+    MP_VERBOSE(th, "Creating thumbnails with decoder %s (lowres=%d).\n",
+               codec->name, lowres);
+    return true;
+}
+
+static double packet_pts(struct demux_packet *pkt)
+{
+    return pkt->pts != MP_NOPTS_VALUE ? pkt->pts : pkt->dts;
+}
+
+// Seek to the keyframe at or before pts and return its packet.
+static struct demux_packet *seek_keyframe(struct mp_thumbnailer *th, double pts)
+{
+    if (!demux_seek(th->demuxer, pts, 0))
+        return NULL;
+
+    for (int n = 0; n < MAX_SKIP_PACKETS; n++) {
+        struct demux_packet *pkt = demux_read_any_packet(th->demuxer);
+        if (!pkt || (pkt->keyframe && packet_pts(pkt) != MP_NOPTS_VALUE))
+            return pkt;
+        talloc_free(pkt);
+    }
+    return NULL;
+}
+
+static struct mp_image *scale_thumbnail(struct mp_thumbnailer *th,
+                                        struct mp_image *img)
+{
+    int d_w, d_h;
+    mp_image_params_get_dsize(&img->params, &d_w, &d_h);
+    if (d_w < 1 || d_h < 1)
+        return NULL;
+
+    int w = MPMIN(th->opts->width, d_w);
+    struct mp_image_params p = {
+        .imgfmt = IMGFMT_BGRA,
+        .w = w,
+        .h = MPMAX(1, (int)((int64_t)w * d_h / d_w)),
+        .p_w = 1,
+        .p_h = 1,
+    };
+    mp_image_params_guess_csp(&p);
+
+    struct mp_image *dst = mp_image_alloc(p.imgfmt, p.w, p.h);
+    if (!dst)
+        return NULL;
+    mp_image_copy_attributes(dst, img);
+    dst->params = p;
+
+    if (mp_sws_scale(th->sws, dst, img) < 0) {
+        talloc_free(dst);
+        return NULL;
+    }
+    return dst;
+}
+
+static struct mp_image *decode_thumbnail(struct mp_thumbnailer *th,
+                                         struct demux_packet *pkt)
+{
+    avcodec_flush_buffers(th->avctx);
+
+    mp_set_av_packet(th->avpkt, pkt, &th->codec_timebase);
+    int ret = avcodec_send_packet(th->avctx, th->avpkt);
+    av_packet_unref(th->avpkt);
+    if (ret < 0)
+        return NULL;
+
+    // Drain, as codecs with reordering delay would wait for more packets.
+    avcodec_send_packet(th->avctx, NULL);
+
+    struct mp_image *res = NULL;
+    if (avcodec_receive_frame(th->avctx, th->frame) >= 0) {
+        struct mp_image *img = mp_image_from_av_frame(th->frame);
+        if (img) {
+            res = scale_thumbnail(th, img);
+            if (res)
+                res->pts = packet_pts(pkt);
+        }
+        talloc_free(img);
+    }
+    av_frame_unref(th->frame);
+    return res;
+}
+
+static MP_THREAD_VOID thumbnail_thread(void *p)
+{
+    struct mp_thumbnailer *th = p;
+
+    mp_thread_set_name("thumbnail");
+    // Must never take CPU time away from actual playback.
+    mp_thread_set_idle_priority();
+
+    uint64_t source_id = 0;
+
+    mp_mutex_lock(&th->lock);
+    while (!th->terminate) {
+        if (source_id != th->source_id) {
+            source_id = th->source_id;
+            char *url = talloc_strdup(NULL, th->url);
+            int flags = th->stream_flags;
+            int index = th->stream_index;
+            double ts_offset = th->ts_offset;
+            mp_cancel_reset(th->cancel);
+            mp_mutex_unlock(&th->lock);
+
+            close_source(th);
+            bool ok = !url || open_source(th, url, flags, index, ts_offset);
+            if (!ok)
+                close_source(th);
+            talloc_free(url);
+
+            mp_mutex_lock(&th->lock);
+            if (!ok && source_id == th->source_id) {
+                th->source_failed = true;
+                fail_requests(th);
+            }
+            continue;
+        }
+
+        if (!th->num_requests || !th->avctx) {
+            mp_cond_wait(&th->wakeup, &th->lock);
+            continue;
+        }
+
+        // Serve the most recent request first; with a seek bar, older ones
+        // are probably not interesting anymore.
+        double pts = th->requests[th->num_requests - 1]->pts;
+        mp_mutex_unlock(&th->lock);
+
+        m_config_cache_update(th->opts_cache);
+        struct demux_packet *pkt = seek_keyframe(th, pts);
+
+        mp_mutex_lock(&th->lock);
+        if (pkt && source_id == th->source_id &&
+            !extend_thumbnail(th, packet_pts(pkt), pts))
+        {
+            mp_mutex_unlock(&th->lock);
+            struct mp_image *img = decode_thumbnail(th, pkt);
+            mp_mutex_lock(&th->lock);
+            if (img && source_id == th->source_id) {
+                add_thumbnail(th, pts, img);
+            } else {
+                talloc_free(img);
+            }
+        }
+        talloc_free(pkt);
+        if (source_id == th->source_id)
+            complete_requests(th, pts);
+    }
+    mp_mutex_unlock(&th->lock);
+
+    close_source(th);
+    MP_THREAD_RETURN();
+}
+
+static void destroy_thumbnailer(void *p)
+{
+    struct mp_thumbnailer *th = p;
+
+    mp_mutex_lock(&th->lock);
+    th->terminate = true;
+    mp_cancel_trigger(th->cancel);
+    mp_cond_broadcast(&th->wakeup);
+    mp_mutex_unlock(&th->lock);
+
+    mp_thread_join(th->thread);
+
+    assert(!th->num_requests);
+    mp_cond_destroy(&th->wakeup);
+    mp_mutex_destroy(&th->lock);
+    av_packet_free(&th->avpkt);
+    av_frame_free(&th->frame);
+}
+
+struct mp_thumbnailer *mp_thumbnailer_create(void *ta_parent,
+                                             struct mpv_global *global)
+{
+    struct mp_thumbnailer *th = talloc_zero(ta_parent, struct mp_thumbnailer);
+    th->global = global;
+    th->log = mp_log_new(th, global->log, "thumbnail");
+    th->opts_cache = m_config_cache_alloc(th, global, &thumbnail_conf);
+    th->opts = th->opts_cache->opts;
+    th->cancel = mp_cancel_new(th);
+    th->avpkt = av_packet_alloc();
+    th->frame = av_frame_alloc();
+    MP_HANDLE_OOM(th->avpkt);
+    MP_HANDLE_OOM(th->frame);
+    th->sws = mp_sws_alloc(th);
+    th->sws->log = th->log;
+    // Prefer zimg if available, and fall back to swscale.
+    th->sws->allow_zimg = true;
+    mp_mutex_init(&th->lock);
+    mp_cond_init(&th->wakeup);
+
+    if (mp_thread_create(&th->thread, thumbnail_thread, th)) {
+        mp_cond_destroy(&th->wakeup);
+        mp_mutex_destroy(&th->lock);
+        av_packet_free(&th->avpkt);
+        av_frame_free(&th->frame);
+        talloc_free(th);
+        return NULL;
+    }
+
+    talloc_set_destructor(th, destroy_thumbnailer);
+    return th;
+}
+
+void mp_thumbnailer_set_source(struct mp_thumbnailer *th, const char *url,
+                               int stream_flags, int stream_index,
+                               double ts_offset)
+{
+    mp_mutex_lock(&th->lock);
+    bool same = url && th->url && strcmp(url, th->url) == 0 &&
+                stream_flags == th->stream_flags &&
+                stream_index == th->stream_index &&
+                ts_offset == th->ts_offset;
+    if (!same && (url || th->url)) {
+        talloc_free(th->url);
+        th->url = talloc_strdup(th, url);
+        th->stream_flags = stream_flags;
+        th->stream_index = stream_index;
+        th->ts_offset = ts_offset;
+        th->source_id++;
+        th->source_failed = false;
+        while (th->num_cache)
+            remove_thumbnail(th, th->num_cache - 1);
+        fail_requests(th);
+        mp_cancel_trigger(th->cancel);
+    }
+    mp_mutex_unlock(&th->lock);
+}
+
+struct mp_image *mp_thumbnailer_get(struct mp_thumbnailer *th, double pts,
+                                    struct mp_cancel *abort)
+{
+    struct mp_image *res = NULL;
+
+    mp_mutex_lock(&th->lock);
+    struct thumbnail *t = find_thumbnail(th, pts);
+    if (t) {
+        th->hits++;
+        res = mp_image_new_ref(t->img);
+    } else if (th->url && !th->source_failed) {
+        th->misses++;
+        struct thumbnail_request req = {.pts = pts};
+        MP_TARRAY_APPEND(th, th->requests, th->num_requests, &req);
+        mp_cond_broadcast(&th->wakeup);
+        while (!req.done) {
+            if (abort && mp_cancel_test(abort)) {
+                remove_request(th, &req);
+                break;
+            }
+            mp_cond_timedwait(&th->wakeup, &th->lock, MP_TIME_MS_TO_NS(50));
+        }
+        res = req.img;
+    }
+    mp_mutex_unlock(&th->lock);
+
+    return res;
+}
+
+void mp_thumbnailer_get_stats(struct mp_thumbnailer *th,
+                              struct mp_thumbnailer_stats *stats)
+{
+    mp_mutex_lock(&th->lock);
+    *stats = (struct mp_thumbnailer_stats){
+        .count = th->num_cache,
+        .bytes = th->cache_bytes,
+        .hits = th->hits,
+        .misses = th->misses,
+    };
+    mp_mutex_unlock(&th->lock);
+}
+
+// Run with the core locked; unlocks it while waiting for the thumbnail.
+static struct mp_image *get_thumbnail(struct mp_cmd_ctx *cmd, double pts)
+{
+    struct MPContext *mpctx = cmd->mpctx;
+    struct track *track = mpctx->current_track[0][STREAM_VIDEO];
+
+    if (!mpctx->playback_initialized || !track || !track->stream ||
+        track->is_external || track->image || !mpctx->demuxer->seekable)
+    {
+        mp_cmd_msg(cmd, MSGL_ERR, "No video to create thumbnails from.");
+        return NULL;
+    }
+
+    if (!mpctx->thumbnailer)
+        mpctx->thumbnailer = mp_thumbnailer_create(mpctx, mpctx->global);
+    if (!mpctx->thumbnailer)
+        return NULL;
+
+    double ts_offset = 0;
+    if (mpctx->opts->rebase_start_time)
+        ts_offset = -mpctx->demuxer->start_time;
+    mp_thumbnailer_set_source(mpctx->thumbnailer, mpctx->stream_open_filename,
+                              mpctx->playing->stream_flags,
+                              track->stream->index, ts_offset);
+
+    // The thumbnailer is destroyed only after all async commands are done.
+    struct mp_thumbnailer *th = mpctx->thumbnailer;
+    struct mp_cancel *abort = cmd->abort ? cmd->abort->cancel : NULL;
+    mp_core_unlock(mpctx);
+    struct mp_image *img = mp_thumbnailer_get(th, pts, abort);
+    mp_core_lock(mpctx);
+
+    if (!img)
+        mp_cmd_msg(cmd, MSGL_ERR, "Creating thumbnail failed.");
+    return img;
+}
+
+static void add_image_info(struct mpv_node *res, struct mp_image *img,
+                           int stride)
+{
+    node_init(res, MPV_FORMAT_NODE_MAP, NULL);
+    node_map_add_int64(res, "w", img->w);
+    node_map_add_int64(res, "h", img->h);
+    node_map_add_int64(res, "stride", stride);
+    node_map_add_string(res, "format", "bgra");
+    node_map_add_double(res, "pts", img->pts);
+}
+
+void cmd_thumbnail_raw(void *p)
+{
+    struct mp_cmd_ctx *cmd = p;
+    struct mpv_node *res = &cmd->result;
+
+    struct mp_image *img = get_thumbnail(cmd, cmd->args[0].v.d);
+    if (!img) {
+        cmd->success = false;
+        return;
+    }
+
+    add_image_info(res, img, img->stride[0]);
+    struct mpv_byte_array *ba =
+        node_map_add(res, "data", MPV_FORMAT_BYTE_ARRAY)->u.ba;
+    *ba = (struct mpv_byte_array){
+        .data = img->planes[0],
+        .size = img->stride[0] * img->h,
+    };
+    talloc_steal(ba, img);
+}
+
+void cmd_thumbnail_to_file(void *p)
+{
+    struct mp_cmd_ctx *cmd = p;
+    const char *filename = cmd->args[1].v.s;
+
+    struct mp_image *img = get_thumbnail(cmd, cmd->args[0].v.d);
+    if (!img) {
+        cmd->success = false;
+        return;
+    }
+
+    // Rows are written without padding, so the file can be mapped directly.
+    bool ok = false;
+    FILE *f = fopen(filename, "wb");
+    if (f) {
+        ok = true;
+        for (int y = 0; y < img->h; y++) {
+            ok &= fwrite(img->planes[0] + y * img->stride[0], img->w * 4, 1,
+                         f) == 1;
+        }
+        ok &= fclose(f) == 0;
+    }
+
+    if (ok) {
+        add_image_info(&cmd->result, img, img->w * 4);
+    } else {
+        mp_cmd_msg(cmd, MSGL_ERR, "Error writing thumbnail to '%s'.", filename);
+        cmd->success = false;
+    }
+    talloc_free(img);
+}
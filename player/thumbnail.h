@@ -0,0 +1,62 @@
+/*
+ * This file is part of mpv.
+ *
+ * mpv is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * mpv is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with mpv.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MPLAYER_THUMBNAIL_H
+#define MPLAYER_THUMBNAIL_H
+
+#include <stdint.h>
+
+struct MPContext;
+struct mp_cancel;
+struct mp_image;
+struct mpv_global;
+
+// Creates small BGRA images of the keyframes of a video stream, using a
+// separate demuxer and decoder on a low priority thread, and keeps them in a
+// bounded LRU cache. All functions are thread-safe.
+struct mp_thumbnailer;
+
+struct mp_thumbnailer *mp_thumbnailer_create(void *ta_parent,
+                                             struct mpv_global *global);
+
+// Set the file and video stream (index into the demuxer's streams) to create
+// thumbnails from. Passing a different source than the current one clears the
+// cache and fails pending requests. url==NULL closes the current source.
+void mp_thumbnailer_set_source(struct mp_thumbnailer *th, const char *url,
+                               int stream_flags, int stream_index,
+                               double ts_offset);
+
+// Return the thumbnail of the keyframe at or before pts, or NULL on failure.
+// Blocks until the thumbnail was created, or abort is triggered.
+struct mp_image *mp_thumbnailer_get(struct mp_thumbnailer *th, double pts,
+                                    struct mp_cancel *abort);
+
+struct mp_thumbnailer_stats {
+    int count;          // number of cached thumbnails
+    int64_t bytes;      // memory used by them
+    int64_t hits;       // requests served from the cache
+    int64_t misses;     // requests that had to decode
+};
+
+void mp_thumbnailer_get_stats(struct mp_thumbnailer *th,
+                              struct mp_thumbnailer_stats *stats);
+
+// Handlers for the user-facing commands.
+void cmd_thumbnail_raw(void *p);
+void cmd_thumbnail_to_file(void *p);
+
+#endif /* MPLAYER_THUMBNAIL_H */
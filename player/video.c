@@ -38,6 +38,7 @@
 #include "stream/stream.h"
 #include "sub/osd.h"
 #include "video/hwdec.h"
+#include "video/mp_image_pool.h"
 #include "filters/f_decoder_wrapper.h"
 #include "video/out/vo.h"
 
@@ -95,6 +96,68 @@ static void vo_chain_reset_state(struct vo_chain *vo_c)
     vo_c->underrun_signaled = false;
 }
 
+static int64_t frame_history_image_size(struct mp_image *img)
+{
+    int64_t size = 0;
+    for (int n = 0; n < MP_MAX_PLANES && img->bufs[n]; n++)
+        size += img->bufs[n]->size;
+    return size;
+}
+
+static void drop_frame_history(struct MPContext *mpctx, int index)
+{
+    struct mp_image *img = mpctx->frame_history[index];
+    mpctx->frame_history_bytes -= frame_history_image_size(img);
+    talloc_free(img);
+    MP_TARRAY_REMOVE_AT(mpctx->frame_history, mpctx->num_frame_history, index);
+}
+
+static void clear_frame_history(struct MPContext *mpctx)
+{
+    while (mpctx->num_frame_history)
+        drop_frame_history(mpctx, mpctx->num_frame_history - 1);
+    mpctx->frame_history_browsing = false;
+}
+
+// Append a frame that comes after all frames in the history in display order.
+// If it can't be kept, the history is cleared, as it must not have gaps.
+static void add_frame_history(struct MPContext *mpctx, struct mp_image *img)
+{
+    struct MPOpts *opts = mpctx->opts;
+
+    if (!opts->frame_history_max_bytes || mpctx->play_dir != 1 ||
+        img->pts == MP_NOPTS_VALUE)
+    {
+        clear_frame_history(mpctx);
+        return;
+    }
+
+    // The hr-seek backstep target is added when it's skipped, and again when
+    // it's displayed. This also deals with timestamp resets.
+    while (mpctx->num_frame_history &&
+           mpctx->frame_history[mpctx->num_frame_history - 1]->pts >= img->pts)
+        drop_frame_history(mpctx, mpctx->num_frame_history - 1);
+
+    struct mp_image *ref = NULL;
+    if (IMGFMT_IS_HWACCEL(img->imgfmt)) {
+        // Keeping hw surfaces would starve the decoder's surface pool.
+        if (opts->frame_history_hwdec_download)
+            ref = mp_image_hw_download(img, NULL);
+    } else {
+        ref = mp_image_new_ref(img);
+    }
+    if (!ref) {
+        clear_frame_history(mpctx);
+        return;
+    }
+
+    MP_TARRAY_APPEND(mpctx, mpctx->frame_history, mpctx->num_frame_history, ref);
+    mpctx->frame_history_bytes += frame_history_image_size(ref);
+    while (mpctx->num_frame_history > 1 &&
+           mpctx->frame_history_bytes > opts->frame_history_max_bytes)
+        drop_frame_history(mpctx, 0);
+}
+
 void reset_video_state(struct MPContext *mpctx)
 {
     if (mpctx->vo_chain) {
@@ -108,6 +171,7 @@ void reset_video_state(struct MPContext *mpctx)
         mp_image_unrefp(&mpctx->next_frames[n]);
     mpctx->num_next_frames = 0;
     mp_image_unrefp(&mpctx->saved_frame);
+    clear_frame_history(mpctx);
 
     mpctx->delay = 0;
     mpctx->time_frame = 0;
@@ -128,6 +192,9 @@ void reset_video_state(struct MPContext *mpctx)
 void uninit_video_out(struct MPContext *mpctx)
 {
     uninit_video_chain(mpctx);
+    // A pre-started video decoder might reference the VO.
+    if (mpctx->preroll_dec[STREAM_VIDEO])
+        discard_preroll(mpctx);
     if (mpctx->video_out) {
         vo_destroy(mpctx->video_out);
         mpctx->video_out = NULL;
@@ -181,9 +248,14 @@ int init_video_decoder(struct MPContext *mpctx, struct track *track)
     // Note: We rely on being able to get rid of all references to the VO by
     //       destroying the VO chain. Thus, decoders not linked to vo_chain
     //       must not use the hwdec context.
-    if (track->vo_c)
+    if (track->vo_c) {
         parent = track->vo_c->filter->f;
 
+        track->dec = take_preroll_decoder(mpctx, track);
+        if (track->dec)
+            return 1;
+    }
+
     track->dec = mp_decoder_wrapper_create(parent, track->stream);
     if (!track->dec)
         goto err_out;
@@ -523,6 +595,7 @@ static int video_output_image(struct MPContext *mpctx, bool *logical_eof)
             {
                 /* just skip - but save in case it was the last frame */
                 mp_image_setrefp(&mpctx->saved_frame, img);
+                add_frame_history(mpctx, img);
             } else {
                 if (hrseek && mpctx->hrseek_backstep) {
                     if (mpctx->saved_frame) {
@@ -1066,6 +1139,10 @@ void write_video(struct MPContext *mpctx)
     if (mpctx->paused && mpctx->video_status >= STATUS_READY)
         return;
 
+    // Wait for the seek that ends browsing the frame history.
+    if (mpctx->frame_history_browsing)
+        return;
+
     bool logical_eof = false;
     int r = video_output_image(mpctx, &logical_eof);
     MP_TRACE(mpctx, "video_output_image: r=%d/eof=%d/st=%s\n", r, logical_eof,
@@ -1258,6 +1335,7 @@ void write_video(struct MPContext *mpctx)
     mpctx->last_frame_duration =
         mpctx->next_frames[0]->pkt_duration / mpctx->video_speed;
 
+    add_frame_history(mpctx, mpctx->next_frames[0]);
     shift_frames(mpctx);
 
     schedule_frame(mpctx, frame);
@@ -1316,3 +1394,91 @@ error:
     handle_force_window(mpctx, true);
     mp_wakeup_core(mpctx);
 }
+
+// Display the previous (dir<0) or next (dir>0) frame from the frame history
+// directly, without involving the decoder. Returns false if the frame is not
+// available, and the caller has to seek instead.
+bool step_frame_history(struct MPContext *mpctx, int dir)
+{
+    struct vo *vo = mpctx->video_out;
+
+    if (!mpctx->opts->frame_history_max_bytes || !mpctx->vo_chain || !vo ||
+        mpctx->seek.type)
+        return false;
+
+    // Stepping forward from the normal playback position just decodes. When
+    // stepping back, the newest frame in the history must be the one on screen.
+    int pos = -1;
+    int last = mpctx->num_frame_history - 1;
+    if (mpctx->frame_history_browsing) {
+        pos = mpctx->frame_history_pos + dir;
+    } else if (dir < 0 && last >= 0 && mpctx->video_status >= STATUS_READY &&
+               mpctx->frame_history[last]->pts == mpctx->video_pts)
+    {
+        pos = last + dir;
+    }
+
+    if (pos >= 0 && pos < mpctx->num_frame_history) {
+        // Possibly still rendering the frame from the previous step.
+        vo_wait_frame(vo);
+        if (!vo_is_ready_for_frame(vo, -1))
+            pos = -1;
+    }
+
+    if (pos < 0 || pos >= mpctx->num_frame_history) {
+        if (dir < 0)
+            mpctx->frame_history_misses++;
+        return false;
+    }
+
+    struct mp_image *img = mpctx->frame_history[pos];
+    if (!vo->params || !mp_image_params_static_equal(&img->params, vo->params)) {
+        // Happens with frames downloaded from hwdec.
+        if (vo_reconfig2(vo, img) < 0) {
+            clear_frame_history(mpctx);
+            if (dir < 0)
+                mpctx->frame_history_misses++;
+            return false;
+        }
+        mp_notify(mpctx, MPV_EVENT_VIDEO_RECONFIG, NULL);
+    }
+
+    struct vo_frame dummy = {
+        .pts = mp_time_ns(),
+        .duration = -1,
+        .still = true,
+        .num_frames = 1,
+        .num_vsyncs = 1,
+        .frames = {img},
+    };
+    vo_queue_frame(vo, vo_frame_ref(&dummy));
+
+    MP_VERBOSE(mpctx, "Showing frame %f from frame history.\n", img->pts);
+
+    // (Forward steps are counted neither way, as they never have to seek.)
+    if (dir < 0)
+        mpctx->frame_history_hits++;
+    mpctx->frame_history_pos = pos;
+    mpctx->frame_history_browsing = pos < mpctx->num_frame_history - 1;
+    mpctx->video_pts = img->pts;
+    mpctx->playback_pts = img->pts;
+
+    osd_set_force_video_pts(mpctx->osd, MP_NOPTS_VALUE);
+    update_subtitles(mpctx, img->pts);
+    mpctx->osd_force_update = true;
+    update_osd_msg(mpctx);
+    mp_notify(mpctx, MPV_EVENT_TICK, NULL);
+    return true;
+}
+
+// Called when resuming playback. The decoder is still positioned after the
+// newest history frame, so it has to be moved back to the displayed frame.
+// Browsing ends with the seek resetting the video state.
+void end_frame_history_browsing(struct MPContext *mpctx)
+{
+    if (!mpctx->frame_history_browsing)
+        return;
+
+    double pts = mpctx->frame_history[mpctx->frame_history_pos]->pts;
+    queue_seek(mpctx, MPSEEK_ABSOLUTE, pts, MPSEEK_VERY_EXACT, 0);
+}
@@ -21,6 +21,8 @@
 
 #include <assert.h>
 
+#include <libavutil/buffer.h>
+
 #include "osdep/io.h"
 
 #include "mpv_talloc.h"
@@ -104,6 +106,7 @@ static const stream_info_t *const stream_list[] = {
 struct stream_opts {
     int64_t buffer_size;
     bool load_unsafe_playlists;
+    bool mmap;
 };
 
 #define OPT_BASE_STRUCT struct stream_opts
@@ -113,6 +116,7 @@ const struct m_sub_options stream_conf = {
         {"stream-buffer-size", OPT_BYTE_SIZE(buffer_size),
             M_RANGE(STREAM_MIN_BUFFER_SIZE, STREAM_MAX_BUFFER_SIZE)},
         {"load-unsafe-playlists", OPT_BOOL(load_unsafe_playlists)},
+        {"stream-mmap", OPT_BOOL(mmap)},
         {0}
     },
     .size = sizeof(struct stream_opts),
@@ -355,6 +359,7 @@ static int stream_create_instance(const stream_info_t *sinfo,
     s->mode = flags & (STREAM_READ | STREAM_WRITE);
     s->requested_buffer_size = opts->buffer_size;
     s->allow_partial_read = flags & STREAM_ALLOW_PARTIAL_READ;
+    s->allow_mmap = opts->mmap;
 
     if (flags & STREAM_LESS_NOISE)
         mp_msg_set_max_level(s->log, MSGL_WARN);
@@ -763,6 +768,35 @@ bool stream_seek_skip(stream_t *s, int64_t pos)
         : stream_seek(s, pos);
 }
 
+// Like stream_read(), but return the data as a read-only reference to memory
+// owned by the stream implementation (such as a memory mapped file), followed
+// by at least padding bytes of zeroed memory (as FFmpeg requires for packets).
+// Returns NULL without changing the position if the stream can't do this, in
+// which case the caller should fall back to stream_read().
+struct AVBufferRef *stream_read_ref(stream_t *s, int len, int padding)
+{
+    if (!s->get_data_ref || len <= 0)
+        return NULL;
+
+    int64_t pos = stream_tell(s);
+    struct AVBufferRef *ref = s->get_data_ref(s, pos, len, padding);
+    if (!ref)
+        return NULL;
+
+    if (len <= s->buf_end - s->buf_cur) {
+        s->buf_cur += len;
+    } else {
+        // Skip the data without reading it into the buffer.
+        stream_drop_buffers(s);
+        if (!stream_seek_unbuffered(s, pos + len)) {
+            av_buffer_unref(&ref);
+            stream_seek(s, pos);
+            return NULL;
+        }
+    }
+    return ref;
+}
+
 int stream_control(stream_t *s, int cmd, void *arg)
 {
     return s->control ? s->control(s, cmd, arg) : STREAM_UNSUPPORTED;
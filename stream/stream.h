@@ -141,6 +141,11 @@ typedef struct stream {
     int64_t (*get_size)(struct stream *s);
     // Control
     int (*control)(struct stream *s, int cmd, void *arg);
+    // Optional: return a read-only reference to the data at pos..pos+len,
+    // followed by at least padding zero bytes, without copying it. Must not
+    // change the position of fill_buffer. Returns NULL if not possible.
+    struct AVBufferRef *(*get_data_ref)(struct stream *s, int64_t pos, int len,
+                                        int padding);
     // Close
     void (*close)(struct stream *s);
 
@@ -162,6 +167,7 @@ typedef struct stream {
     bool is_directory : 1; // directory on the filesystem
     bool access_references : 1; // open other streams
     bool allow_partial_read : 1; // allows partial read with stream_read_file()
+    bool allow_mmap : 1; // local files may be memory mapped (--stream-mmap)
     struct mp_log *log;
     struct mpv_global *global;
 
@@ -226,6 +232,7 @@ int stream_read(stream_t *s, void *mem, int total);
 int stream_read_partial(stream_t *s, void *buf, int buf_size);
 int stream_peek(stream_t *s, int forward_size);
 int stream_read_peek(stream_t *s, void *buf, int buf_size);
+struct AVBufferRef *stream_read_ref(stream_t *s, int len, int padding);
 void stream_drop_buffers(stream_t *s);
 int64_t stream_get_size(stream_t *s);
 
@@ -25,16 +25,22 @@
 #include <fcntl.h>
 #include <errno.h>
 
+#if HAVE_POSIX
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
 
+#ifndef __MINGW32__
 #include <poll.h>
 #endif
 
+#include <libavutil/buffer.h>
+
 #include "osdep/io.h"
 
 #include "common/common.h"
 #include "common/msg.h"
 #include "misc/thread_tools.h"
-#include "misc/ring.h"
 #include "stream.h"
 #include "options/m_option.h"
 #include "options/path.h"
@@ -94,40 +100,49 @@ struct priv {
     bool appending;
     int64_t orig_size;
     struct mp_cancel *cancel;
-    struct mp_ring *ring;
-    pthread_t thread;
-    pthread_mutex_t lock;
-    pthread_cond_t wakeup;
-    bool read_ok, in_io, eof, terminate;
-    int64_t size;
+
+    // For --stream-mmap. The file is mapped in windows, which are only used by
+    // fill_buffer. Data references use separate, private windows.
+    AVBufferRef *map;       // current window
+    int64_t map_offset;     // file position of map->data
+    int64_t map_size;       // file size when it was opened
+    int64_t map_pos;        // file position of the next fill_buffer call
+    int64_t map_advised;    // end of the data that was advised for readahead
+    AVBufferRef *ref_map;   // current window for data references
+    int64_t ref_map_offset; // file position of ref_map->data
+    int64_t ref_map_used;   // end of the last reference's padding
+    long page_size;
 };
 
 // Total timeout = RETRY_TIMEOUT * MAX_RETRIES
 #define RETRY_TIMEOUT 0.2
 #define MAX_RETRIES 10
 
-static void stop_io(stream_t *s)
-{
-    struct priv *p = s->priv;
-
-    pthread_mutex_lock(&p->lock);
-    p->read_ok = false;
-    while (p->in_io)
-        pthread_cond_wait(&p->wakeup, &p->lock);
-    pthread_mutex_unlock(&p->lock);
-}
+// Maximum size of a mapped window.
+#define MAP_WINDOW_SIZE (sizeof(void *) >= 8 ? (INT64_C(1) << 30) : (64 << 20))
+// How much data ahead of the read position the kernel is asked to read.
+#define MAP_READAHEAD (8 << 20)
+// Smaller data references are copied, which is cheaper than a new mapping.
+#define MAP_REF_MIN_SIZE (64 * 1024)
 
 static int64_t get_size(stream_t *s)
 {
     struct priv *p = s->priv;
-
+    struct stat st;
+    if (fstat(p->fd, &st) == 0) {
+        if (st.st_size <= 0 && !s->seekable)
+            st.st_size = -1;
+        if (st.st_size >= 0)
+            return st.st_size;
+    }
+    return -1;
 }
 
 static int fill_buffer(stream_t *s, void *buffer, int max_len)
 {
     struct priv *p = s->priv;
 
-
+#ifndef __MINGW32__
     if (p->use_poll) {
         int c = mp_cancel_get_fd(p->cancel);
         struct pollfd fds[2] = {
@@ -165,61 +180,175 @@ static int fill_buffer(stream_t *s, void *buffer, int max_len)
     return 0;
 }
 
-static void *read_thread(void *arg)
+static int write_buffer(stream_t *s, void *buffer, int len)
 {
-    stream_t *s = arg;
     struct priv *p = s->priv;
+    return write(p->fd, buffer, len);
+}
 
-    pthread_mutex_lock(&p->lock);
-    while (!p->terminate) {
-        int a = mp_ring_available(p->ring);
-        if (p->read_ok && a >= 64 * 1024) {
-            p->in_io = true;
-            pthread_mutex_unlock(&p->lock);
-            uint8_t buf[64 * 1024];
-            int r = real_fill_buffer(s, buf, sizeof(buf));
-            r = MPMAX(r, 0);
-            pthread_mutex_lock(&p->lock);
-            p->in_io = false;
-            mp_ring_write(p->ring, buf, r);
-            p->eof = !r;
-            pthread_cond_broadcast(&p->wakeup);
-        } else {
-            pthread_cond_wait(&p->wakeup, &p->lock);
-        }
+static int seek(stream_t *s, int64_t newpos)
+{
+    struct priv *p = s->priv;
+    return lseek(p->fd, newpos, SEEK_SET) != (off_t)-1;
+}
+
+#if HAVE_POSIX
+static void unmap_window(void *opaque, uint8_t *data)
+{
+    munmap(data, (uintptr_t)opaque);
+}
+
+// Make sure the current window contains the file range pos..pos+len.
+static bool map_window(stream_t *s, int64_t pos, int64_t len)
+{
+    struct priv *p = s->priv;
+    if (p->map && pos >= p->map_offset &&
+        pos + len <= p->map_offset + (int64_t)p->map->size)
+        return true;
+    if (pos < 0 || pos + len > p->map_size)
+        return false;
+
+    int64_t offset = pos - pos % p->page_size;
+    size_t size = MPMIN(MAP_WINDOW_SIZE, p->map_size - offset);
+    if (pos + len > offset + (int64_t)size)
+        return false;
+
+    void *data = mmap(NULL, size, PROT_READ, MAP_SHARED, p->fd, offset);
+    if (data == MAP_FAILED) {
+        MP_ERR(s, "Failed to map file: %s\n", mp_strerror(errno));
+        return false;
+    }
+#ifdef MADV_SEQUENTIAL
+    madvise(data, size, MADV_SEQUENTIAL);
+#endif
+    AVBufferRef *map = av_buffer_create(data, size, unmap_window,
+                                        (void *)(uintptr_t)size,
+                                        AV_BUFFER_FLAG_READONLY);
+    if (!map) {
+        munmap(data, size);
+        return false;
     }
-    pthread_mutex_unlock(&p->lock);
+    av_buffer_unref(&p->map);
+    p->map = map;
+    p->map_offset = offset;
+    p->map_advised = MPMAX(p->map_pos, offset);
+    return true;
+}
 
-    return NULL;
+// Ask the kernel to read the data after the current position in the
+// background, so that fill_buffer() rarely has to wait for page faults.
+static void map_readahead(stream_t *s)
+{
+#ifdef MADV_WILLNEED
+    struct priv *p = s->priv;
+    int64_t end = MPMIN(p->map_pos + MAP_READAHEAD,
+                        p->map_offset + (int64_t)p->map->size);
+    if (p->map_advised - p->map_pos >= MAP_READAHEAD / 2 || end <= p->map_advised)
+        return;
+    int64_t start = MPMAX(p->map_advised, p->map_pos);
+    start -= (start - p->map_offset) % p->page_size;
+    madvise(p->map->data + (start - p->map_offset), end - start, MADV_WILLNEED);
+    p->map_advised = end;
+#endif
 }
 
-static int write_buffer(stream_t *s, void *buffer, int len)
+static int map_fill_buffer(stream_t *s, void *buffer, int max_len)
 {
     struct priv *p = s->priv;
-    stop_io(s);
-    return write(p->fd, buffer, len);
+    int64_t len = MPMIN(max_len, p->map_size - p->map_pos);
+    len = MPMIN(len, MAP_WINDOW_SIZE / 2);
+    if (len <= 0)
+        return 0;
+    if (!map_window(s, p->map_pos, len))
+        return -1;
+    memcpy(buffer, p->map->data + (p->map_pos - p->map_offset), len);
+    p->map_pos += len;
+    map_readahead(s);
+    return len;
 }
 
-static int seek(stream_t *s, int64_t newpos)
+static int map_seek(stream_t *s, int64_t newpos)
 {
     struct priv *p = s->priv;
-    stop_io(s);
-    pthread_mutex_lock(&p->lock);
-    mp_ring_reset(p->ring);
-    p->eof = false;
-    pthread_mutex_unlock(&p->lock);
-    return lseek(p->fd, newpos, SEEK_SET) != (off_t)-1;
+    p->map_pos = newpos;
+    p->map_advised = newpos;
+    return 1;
 }
 
+static struct AVBufferRef *map_get_data_ref(stream_t *s, int64_t pos, int len,
+                                            int padding)
+{
+    struct priv *p = s->priv;
+    if (len < MAP_REF_MIN_SIZE || pos < 0 || pos + len > p->map_size)
+        return NULL;
+
+    // The padding may extend into the last partial page of the file (which
+    // is zero-filled past the end of the file), but not beyond it, as that
+    // raises SIGBUS.
+    int64_t file_end = MP_ALIGN_UP(p->map_size, (int64_t)p->page_size);
+    int64_t end = pos + len + padding;
+    if (end > file_end)
+        return NULL;
+
+    // The padding must be zeroed, so references can't use the fill_buffer
+    // window: that would overwrite the data after the reference before it's
+    // read. They share a private window instead, which is reused as long as
+    // each reference starts after the padding of the previous one. Writing
+    // the padding copies only a page or two; the rest stays shared with the
+    // page cache (which the fill_buffer window readahead has filled).
+    if (!p->ref_map || pos < p->ref_map_used ||
+        end > p->ref_map_offset + (int64_t)p->ref_map->size)
+    {
+        int64_t offset = pos - pos % p->page_size;
+        int64_t map_end = MPMIN(offset + MAP_WINDOW_SIZE, file_end);
+        size_t size = MPMAX(end, map_end) - offset;
+        void *data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+                          p->fd, offset);
+        if (data == MAP_FAILED)
+            return NULL;
+        AVBufferRef *map = av_buffer_create(data, size, unmap_window,
+                                            (void *)(uintptr_t)size,
+                                            AV_BUFFER_FLAG_READONLY);
+        if (!map) {
+            munmap(data, size);
+            return NULL;
+        }
+        av_buffer_unref(&p->ref_map);
+        p->ref_map = map;
+        p->ref_map_offset = offset;
+    }
+
+    AVBufferRef *ref = av_buffer_ref(p->ref_map);
+    if (!ref)
+        return NULL;
+    ref->data += pos - p->ref_map_offset;
+    ref->size = len;
+    memset(ref->data + len, 0, padding);
+    p->ref_map_used = end;
+    return ref;
+}
+
+static void setup_mmap(stream_t *s)
+{
+    struct priv *p = s->priv;
+    p->page_size = sysconf(_SC_PAGESIZE);
+    p->map_size = p->orig_size;
+    if (p->page_size <= 0 || p->map_size <= 0)
+        return;
+    if (!map_window(s, 0, MPMIN(p->map_size, MAP_READAHEAD)))
+        return;
+    MP_VERBOSE(s, "Using memory mapped file access.\n");
+    s->fill_buffer = map_fill_buffer;
+    s->seek = map_seek;
+    s->get_data_ref = map_get_data_ref;
+}
+#endif
+
 static void s_close(stream_t *s)
 {
     struct priv *p = s->priv;
-    stop_io(s);
-    pthread_mutex_lock(&p->lock);
-    p->terminate = true;
-    pthread_cond_broadcast(&p->wakeup);
-    pthread_mutex_unlock(&p->lock);
-    pthread_join(p->thread, NULL);
+    av_buffer_unref(&p->map);
+    av_buffer_unref(&p->ref_map);
     if (p->close)
         close(p->fd);
 }
@@ -450,12 +579,13 @@ static int open_f(stream_t *stream, const struct stream_open_args *args)
     if (stream->cancel)
         mp_cancel_set_parent(p->cancel, stream->cancel);
 
-    pthread_mutex_init(&p->lock, NULL);
-    pthread_cond_init(&p->wakeup, NULL);
-    p->ring = mp_ring_new(stream, 1 * 64 * 1024);
-    int r = pthread_create(&p->thread, NULL, read_thread, stream);
-    if (r)
-        return -1;
+#if HAVE_POSIX
+    // Files on network filesystems or being appended to can be truncated or
+    // go away while mapped, which would crash with SIGBUS on access.
+    if (stream->allow_mmap && p->regular_file && !write && !p->appending &&
+        !stream->streaming && stream->seekable)
+        setup_mmap(stream);
+#endif
 
     return STREAM_OK;
 }
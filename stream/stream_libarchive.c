@@ -306,6 +306,7 @@ static bool find_volumes(struct mp_archive *mpa, int flags)
         if (!add_volume(mpa, NULL, url, i + 1))
             return false;
     }
+    mpa->multi_volume = true;
 
     MP_WARN(mpa, "This appears to be a multi-volume archive.\n"
             "Support is not very good due to libarchive limitations.\n"
@@ -445,18 +446,42 @@ bool mp_archive_next_entry(struct mp_archive *mpa)
     return success;
 }
 
+// Decoded data of compressed entries is cached in chunks of this size, so that
+// backward seeks don't need to decode the whole entry from the start again.
+#define CACHE_CHUNK_SIZE (256 * 1024)
+#define CACHE_MAX_CHUNKS 256 // 64 MiB
+
+// Number of bytes compared to verify the data offset of stored entries.
+#define DIRECT_VERIFY_SIZE (64 * 1024)
+
+struct cache_chunk {
+    int64_t index;      // entry offset / CACHE_CHUNK_SIZE
+    int size;           // < CACHE_CHUNK_SIZE only for the last chunk
+    uint64_t last_use;
+    uint8_t *data;      // NULL if slot was never used
+};
+
 struct priv {
     struct mp_archive *mpa;
     bool broken_seek;
     struct stream *src;
     int64_t entry_size;
     char *entry_name;
+
+    // Stored entry, read directly from src at data_offset.
+    bool direct;
+    int64_t data_offset;
+
+    // Position of libarchive in the entry data (always at a chunk boundary).
+    int64_t arch_pos;
+    struct cache_chunk chunks[CACHE_MAX_CHUNKS];
+    uint64_t use_counter;
 };
 
 static int reopen_archive(stream_t *s)
 {
     struct priv *p = s->priv;
-    s->pos = 0;
+    p->arch_pos = 0;
     if (!p->mpa) {
         p->mpa = mp_archive_new(s->log, p->src, MP_ARCHIVE_FLAG_UNSAFE, 0);
     } else {
@@ -474,7 +499,6 @@ static int reopen_archive(stream_t *s)
     while (mp_archive_next_entry(mpa)) {
         if (strcmp(p->entry_name, mpa->entry_filename) == 0) {
             locale_t oldlocale = uselocale(mpa->locale);
-            p->entry_size = -1;
             if (archive_entry_size_is_set(mpa->entry))
                 p->entry_size = archive_entry_size(mpa->entry);
             uselocale(oldlocale);
@@ -488,78 +512,189 @@ static int reopen_archive(stream_t *s)
     return STREAM_ERROR;
 }
 
-static int archive_entry_fill_buffer(stream_t *s, void *buffer, int max_len)
+static int read_archive_data(stream_t *s, void *buffer, int len)
 {
     struct priv *p = s->priv;
-    if (!p->mpa)
-        return 0;
     locale_t oldlocale = uselocale(p->mpa->locale);
-    int r = archive_read_data(p->mpa->arch, buffer, max_len);
-    if (r < 0) {
+    int r = archive_read_data(p->mpa->arch, buffer, len);
+    if (r < 0)
         MP_ERR(s, "%s\n", archive_error_string(p->mpa->arch));
-        if (mp_archive_check_fatal(p->mpa, r)) {
+    uselocale(oldlocale);
+    if (r < 0 && mp_archive_check_fatal(p->mpa, r)) {
+        mp_archive_free(p->mpa);
+        p->mpa = NULL;
+    }
+    return r;
+}
+
+// Stored (uncompressed) ZIP entries are mapped directly to the source stream,
+// which makes seeking free. libarchive does not export the data offset, but
+// after reading the local header its read position is at the start of the
+// entry data. Verify this by comparing the first bytes. On failure, the archive
+// is closed and needs to be reopened.
+static bool open_direct(stream_t *s)
+{
+    struct priv *p = s->priv;
+    struct mp_archive *mpa = p->mpa;
+    if (!p->src->seekable || p->entry_size <= 0 || mpa->multi_volume)
+        return false;
+
+    locale_t oldlocale = uselocale(mpa->locale);
+    const char *name = archive_format_name(mpa->arch);
+    int format = archive_format(mpa->arch) & ARCHIVE_FORMAT_BASE_MASK;
+    bool stored =
+        format == ARCHIVE_FORMAT_ZIP &&
+        archive_filter_count(mpa->arch) == 1 &&
+        !archive_entry_is_encrypted(mpa->entry) &&
+        name && strstr(name, "(uncompressed)");
+    int64_t offset = archive_filter_bytes(mpa->arch, 0);
+    uselocale(oldlocale);
+    if (!stored || offset < 0)
+        return false;
+
+    int size = MPMIN(p->entry_size, DIRECT_VERIFY_SIZE);
+    uint8_t *a = talloc_size(NULL, size);
+    uint8_t *b = talloc_size(NULL, size);
+    int len = 0;
+    while (len < size && p->mpa) {
+        int r = read_archive_data(s, a + len, size - len);
+        if (r <= 0)
+            break;
+        len += r;
+    }
+    bool ok = len == size && stream_seek(p->src, offset) &&
+              stream_read(p->src, b, size) == size && memcmp(a, b, size) == 0;
+    talloc_free(a);
+    talloc_free(b);
+
+    mp_archive_free(p->mpa);
+    p->mpa = NULL;
+    if (!ok) {
+        MP_VERBOSE(s, "could not map stored entry, decoding it instead\n");
+        return false;
+    }
+
+    MP_VERBOSE(s, "reading stored entry at offset %"PRId64"\n", offset);
+    p->direct = true;
+    p->data_offset = offset;
+    return true;
+}
+
+// Decode the chunk at the current libarchive position into a cache slot,
+// replacing the least recently used one. Returns NULL on EOF or error; on error,
+// the archive is closed.
+static struct cache_chunk *decode_chunk(stream_t *s)
+{
+    struct priv *p = s->priv;
+    struct cache_chunk *c = &p->chunks[0];
+    for (int n = 1; n < CACHE_MAX_CHUNKS; n++) {
+        if (p->chunks[n].last_use < c->last_use)
+            c = &p->chunks[n];
+    }
+    if (!c->data)
+        c->data = talloc_size(p, CACHE_CHUNK_SIZE);
+    c->last_use = 0;
+    c->size = 0;
+    while (c->size < CACHE_CHUNK_SIZE && p->mpa) {
+        int r = read_archive_data(s, c->data + c->size,
+                                  CACHE_CHUNK_SIZE - c->size);
+        if (r < 0) {
+            // The libarchive position is unknown now, so caching the partial
+            // chunk would misalign all following ones. Reopen on next access.
             mp_archive_free(p->mpa);
             p->mpa = NULL;
+            return NULL;
         }
+        if (!r)
+            break;
+        c->size += r;
     }
-    uselocale(oldlocale);
-    return r;
+    // A short chunk is the last one. Remember the size if the header lacked it.
+    if (c->size < CACHE_CHUNK_SIZE && p->mpa && p->entry_size < 0)
+        p->entry_size = p->arch_pos + c->size;
+    if (!c->size)
+        return NULL;
+    c->index = p->arch_pos / CACHE_CHUNK_SIZE;
+    c->last_use = ++p->use_counter;
+    p->arch_pos += c->size;
+    return c;
 }
 
-static int archive_entry_seek(stream_t *s, int64_t newpos)
+static struct cache_chunk *get_chunk(stream_t *s, int64_t index)
 {
     struct priv *p = s->priv;
-    if (p->mpa && !p->broken_seek) {
+    for (int n = 0; n < CACHE_MAX_CHUNKS; n++) {
+        struct cache_chunk *c = &p->chunks[n];
+        if (c->last_use && c->index == index) {
+            c->last_use = ++p->use_counter;
+            return c;
+        }
+    }
+
+    int64_t offset = index * CACHE_CHUNK_SIZE;
+    if (p->entry_size >= 0 && offset >= p->entry_size)
+        return NULL;
+
+    if (p->mpa && p->arch_pos != offset && !p->broken_seek) {
         locale_t oldlocale = uselocale(p->mpa->locale);
-        int r = archive_seek_data(p->mpa->arch, newpos, SEEK_SET);
+        int r = archive_seek_data(p->mpa->arch, offset, SEEK_SET);
         uselocale(oldlocale);
-        if (r >= 0)
-            return 1;
-        MP_WARN(s, "possibly unsupported seeking - switching to reopening\n");
-        p->broken_seek = true;
-        if (reopen_archive(s) < STREAM_OK)
-            return -1;
+        if (r >= 0) {
+            p->arch_pos = offset;
+        } else {
+            MP_WARN(s, "possibly unsupported seeking - switching to "
+                    "reopening\n");
+            p->broken_seek = true;
+            mp_archive_free(p->mpa);
+            p->mpa = NULL;
+        }
     }
-    // libarchive can't seek in most formats.
-    if (newpos < s->pos) {
-        // Hack seeking backwards into working by reopening the archive and
-        // starting over.
-        MP_VERBOSE(s, "trying to reopen archive for performing seek\n");
+
+    // libarchive can't seek in most formats. Hack seeking backwards into
+    // working by reopening the archive and starting over.
+    if (!p->mpa || p->arch_pos > offset) {
+        MP_VERBOSE(s, "reopening archive to decode from %"PRId64"\n", offset);
         if (reopen_archive(s) < STREAM_OK)
-            return -1;
+            return NULL;
     }
-    if (newpos > s->pos) {
-        if (!p->mpa && reopen_archive(s) < STREAM_OK)
-            return -1;
-        // For seeking forwards, just keep reading data (there's no libarchive
-        // skip function either).
-        char buffer[4096];
-        while (newpos > s->pos) {
-            if (mp_cancel_test(s->cancel))
-                return -1;
-
-            int size = MPMIN(newpos - s->pos, sizeof(buffer));
-            locale_t oldlocale = uselocale(p->mpa->locale);
-            int r = archive_read_data(p->mpa->arch, buffer, size);
-            if (r <= 0) {
-                if (r == 0 && newpos > p->entry_size) {
-                    MP_ERR(s, "demuxer trying to seek beyond end of archive "
-                           "entry\n");
-                } else if (r == 0) {
-                    MP_ERR(s, "end of archive entry reached while seeking\n");
-                } else {
-                    MP_ERR(s, "%s\n", archive_error_string(p->mpa->arch));
-                }
-                uselocale(oldlocale);
-                if (mp_archive_check_fatal(p->mpa, r)) {
-                    mp_archive_free(p->mpa);
-                    p->mpa = NULL;
-                }
-                return -1;
-            }
-            uselocale(oldlocale);
-            s->pos += r;
-        }
+
+    // For seeking forwards, just keep decoding (there's no libarchive skip
+    // function either). Skipped chunks are cached as well.
+    while (p->mpa && !mp_cancel_test(s->cancel)) {
+        struct cache_chunk *c = decode_chunk(s);
+        if (!c || c->index == index)
+            return c;
+    }
+    return NULL;
+}
+
+static int archive_entry_fill_buffer(stream_t *s, void *buffer, int max_len)
+{
+    struct priv *p = s->priv;
+    if (p->direct) {
+        int64_t left = p->entry_size - s->pos;
+        if (left <= 0 || !stream_seek(p->src, p->data_offset + s->pos))
+            return 0;
+        return stream_read_partial(p->src, buffer, MPMIN(max_len, left));
+    }
+
+    int64_t index = s->pos / CACHE_CHUNK_SIZE;
+    struct cache_chunk *c = get_chunk(s, index);
+    int offset = s->pos - index * CACHE_CHUNK_SIZE;
+    if (!c || offset >= c->size)
+        return 0;
+    int len = MPMIN(max_len, c->size - offset);
+    memcpy(buffer, c->data + offset, len);
+    return len;
+}
+
+// Reading is lazy, so there is nothing to do here.
+static int archive_entry_seek(stream_t *s, int64_t newpos)
+{
+    struct priv *p = s->priv;
+    if (p->entry_size >= 0 && newpos > p->entry_size) {
+        MP_ERR(s, "demuxer trying to seek beyond end of archive entry\n");
+        return -1;
     }
     return 1;
 }
@@ -581,6 +716,7 @@ static int archive_entry_open(stream_t *stream)
 {
     struct priv *p = talloc_zero(stream, struct priv);
     stream->priv = p;
+    p->entry_size = -1;
 
     if (!strchr(stream->path, '|'))
         return STREAM_ERROR;
@@ -607,6 +743,7 @@ static int archive_entry_open(stream_t *stream)
         archive_entry_close(stream);
         return r;
     }
+    open_direct(stream);
 
     stream->fill_buffer = archive_entry_fill_buffer;
     if (p->src->seekable) {
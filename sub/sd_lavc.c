@@ -36,10 +36,10 @@
 #include "dec_sub.h"
 
 #define MAX_QUEUE 4
+// Limit for the number of events decoded ahead with --sub-bitmap-preload.
+#define MAX_PRELOAD_QUEUE 64
 
 struct sub {
-    bool valid;
-    AVSubtitle avsub;
     struct sub_bitmap *inbitmaps;
     int count;
     struct mp_image *data;
@@ -48,6 +48,13 @@ struct sub {
     double pts;
     double endpts;
     int64_t id;
+    bool queued;
+    // Cache key: the packet the event was decoded from.
+    bool cacheable;
+    int64_t pkt_pos;
+    double pkt_pts;
+    double pkt_sub_duration;
+    int64_t bytes;
 };
 
 struct seekpoint {
@@ -60,7 +67,20 @@ struct sd_lavc_priv {
     AVCodecContext *avctx;
     AVPacket *avpkt;
     AVRational pkt_timebase;
-    struct sub subs[MAX_QUEUE]; // most recent event first
+    bool stateless; // decoder output depends only on the current packet
+    // All decoded events. Events not in the queue are kept as cache, up to
+    // --sub-bitmap-cache-size bytes, so that seeking back doesn't need to
+    // convert them again.
+    struct sub **subs;
+    int num_subs;
+    int64_t cache_bytes;
+    struct sub **queue; // most recent event first
+    int num_queue;
+    // Options that affect the converted bitmaps of cached events.
+    float cache_gauss;
+    bool cache_gray;
+    bool cache_forced_only;
+    int cache_teletext_page;
     struct sub_bitmap *outbitmaps;
     struct sub_bitmap *prevret;
     int prevret_num;
@@ -130,6 +150,8 @@ static int init(struct sd *sd)
     if (avcodec_open2(ctx, sub_codec, NULL) < 0)
         goto error;
     priv->avctx = ctx;
+    priv->stateless = cid == AV_CODEC_ID_DVD_SUBTITLE ||
+                      cid == AV_CODEC_ID_XSUB;
     sd->priv = priv;
     priv->displayed_id = -1;
     priv->current_pts = MP_NOPTS_VALUE;
@@ -145,29 +167,122 @@ error_probe:
     return -1;
 }
 
-static void clear_sub(struct sub *sub)
+static void free_sub(struct sd_lavc_priv *priv, struct sub *sub)
 {
-    sub->count = 0;
-    sub->pts = MP_NOPTS_VALUE;
-    sub->endpts = MP_NOPTS_VALUE;
-    if (sub->valid)
-        avsubtitle_free(&sub->avsub);
-    sub->valid = false;
+    assert(!sub->queued);
+    for (int n = 0; n < priv->num_subs; n++) {
+        if (priv->subs[n] == sub) {
+            MP_TARRAY_REMOVE_AT(priv->subs, priv->num_subs, n);
+            break;
+        }
+    }
+    priv->cache_bytes -= sub->bytes;
+    talloc_free(sub);
+}
+
+// Whether the event may still be displayed at or after pts.
+static bool sub_needed(struct sub *sub, double pts)
+{
+    return pts == MP_NOPTS_VALUE ||
+           ((sub->pts == MP_NOPTS_VALUE || sub->pts >= pts) ||
+            (sub->endpts == MP_NOPTS_VALUE || pts < sub->endpts));
+}
+
+// Drop old events from the queue, and the cached events farthest away from the
+// playback position if the cache is over budget.
+static void trim_subs(struct sd *sd)
+{
+    struct sd_lavc_priv *priv = sd->priv;
+    struct mp_subtitle_opts *opts = sd->opts;
+
+    // Without preloading, this behaves like a fixed size queue. With it, the
+    // queue can be longer, but then only events that ended are dropped.
+    int max_queue = opts->sub_bitmap_preload > 0 ? MAX_PRELOAD_QUEUE : MAX_QUEUE;
+    while (priv->num_queue > MAX_QUEUE) {
+        struct sub *last = priv->queue[priv->num_queue - 1];
+        if (priv->num_queue <= max_queue && sub_needed(last, priv->current_pts))
+            break;
+        last->queued = false;
+        priv->num_queue--;
+    }
+
+    while (priv->cache_bytes > opts->sub_bitmap_cache_size) {
+        struct sub *worst = NULL;
+        double worst_dist = -1;
+        for (int n = 0; n < priv->num_subs; n++) {
+            struct sub *sub = priv->subs[n];
+            if (sub->queued)
+                continue;
+            double dist = INFINITY;
+            if (sub->pts != MP_NOPTS_VALUE && priv->current_pts != MP_NOPTS_VALUE)
+                dist = fabs(sub->pts - priv->current_pts);
+            if (dist > worst_dist) {
+                worst = sub;
+                worst_dist = dist;
+            }
+        }
+        if (!worst)
+            break;
+        free_sub(priv, worst);
+    }
+}
+
+// Make sub the most recent event in the queue.
+static void queue_sub(struct sd *sd, struct sub *sub)
+{
+    struct sd_lavc_priv *priv = sd->priv;
+    for (int n = 0; n < priv->num_queue; n++) {
+        if (priv->queue[n] == sub) {
+            MP_TARRAY_REMOVE_AT(priv->queue, priv->num_queue, n);
+            break;
+        }
+    }
+    MP_TARRAY_INSERT_AT(priv, priv->queue, priv->num_queue, 0, sub);
+    sub->queued = true;
+    trim_subs(sd);
 }
 
-static void alloc_sub(struct sd_lavc_priv *priv)
+static void clear_queue(struct sd_lavc_priv *priv)
 {
-    clear_sub(&priv->subs[MAX_QUEUE - 1]);
-    struct sub tmp = priv->subs[MAX_QUEUE - 1];
-    for (int n = MAX_QUEUE - 1; n > 0; n--)
-        priv->subs[n] = priv->subs[n - 1];
-    priv->subs[0] = tmp;
-    // clear only some fields; the memory allocs can be reused
-    priv->subs[0].valid = false;
-    priv->subs[0].count = 0;
-    priv->subs[0].src_w = 0;
-    priv->subs[0].src_h = 0;
-    priv->subs[0].id = priv->new_id++;
+    for (int n = 0; n < priv->num_queue; n++)
+        priv->queue[n]->queued = false;
+    priv->num_queue = 0;
+}
+
+// Cached events can't be reused if they were converted with other settings.
+static void check_cache_opts(struct sd *sd)
+{
+    struct sd_lavc_priv *priv = sd->priv;
+    struct mp_subtitle_opts *opts = sd->opts;
+    if (priv->cache_gauss == opts->sub_gauss &&
+        priv->cache_gray == opts->sub_gray &&
+        priv->cache_forced_only == opts->sub_forced_events_only &&
+        priv->cache_teletext_page == opts->teletext_page)
+        return;
+    for (int n = priv->num_subs - 1; n >= 0; n--) {
+        struct sub *sub = priv->subs[n];
+        sub->cacheable = false;
+        if (!sub->queued)
+            free_sub(priv, sub);
+    }
+    priv->cache_gauss = opts->sub_gauss;
+    priv->cache_gray = opts->sub_gray;
+    priv->cache_forced_only = opts->sub_forced_events_only;
+    priv->cache_teletext_page = opts->teletext_page;
+}
+
+static struct sub *find_cached_sub(struct sd_lavc_priv *priv,
+                                   struct demux_packet *packet)
+{
+    if (packet->pos < 0 && packet->pts == MP_NOPTS_VALUE)
+        return NULL;
+    for (int n = 0; n < priv->num_subs; n++) {
+        struct sub *sub = priv->subs[n];
+        if (sub->cacheable && sub->pkt_pos == packet->pos &&
+            sub->pkt_pts == packet->pts)
+            return sub;
+    }
+    return NULL;
 }
 
 static void convert_pal(uint32_t *colors, size_t count, bool gray)
@@ -188,14 +303,13 @@ static void convert_pal(uint32_t *colors, size_t count, bool gray)
     }
 }
 
-// Initialize sub from sub->avsub.
-static void read_sub_bitmaps(struct sd *sd, struct sub *sub)
+// Initialize sub from avsub.
+static void read_sub_bitmaps(struct sd *sd, struct sub *sub, AVSubtitle *avsub)
 {
     struct mp_subtitle_opts *opts = sd->opts;
     struct sd_lavc_priv *priv = sd->priv;
-    AVSubtitle *avsub = &sub->avsub;
 
-    MP_TARRAY_GROW(priv, sub->inbitmaps, avsub->num_rects);
+    MP_TARRAY_GROW(sub, sub->inbitmaps, avsub->num_rects);
 
     packer_set_size(priv->packer, avsub->num_rects);
 
@@ -247,20 +361,12 @@ static void read_sub_bitmaps(struct sd *sd, struct sub *sub)
     sub->bound_w = bb[1].x;
     sub->bound_h = bb[1].y;
 
-    if (!sub->data || sub->data->w < sub->bound_w || sub->data->h < sub->bound_h) {
-        talloc_free(sub->data);
-        sub->data = mp_image_alloc(IMGFMT_BGRA, priv->packer->w, priv->packer->h);
-        if (!sub->data) {
-            sub->count = 0;
-            return;
-        }
-        talloc_steal(priv, sub->data);
-    }
-
-    if (!mp_image_make_writeable(sub->data)) {
+    sub->data = mp_image_alloc(IMGFMT_BGRA, priv->packer->w, priv->packer->h);
+    if (!sub->data) {
         sub->count = 0;
         return;
     }
+    talloc_steal(sub, sub->data);
 
     for (int i = 0; i < sub->count; i++) {
         struct sub_bitmap *b = &sub->inbitmaps[i];
@@ -318,6 +424,29 @@ static void read_sub_bitmaps(struct sd *sd, struct sub *sub)
     }
 }
 
+// Set end time of the previous event, if a new one starts at pts.
+static void set_prev_endpts(struct sd *sd, double pts)
+{
+    struct mp_subtitle_opts *opts = sd->opts;
+    struct sd_lavc_priv *priv = sd->priv;
+    if (!priv->num_queue)
+        return;
+    struct sub *prev = priv->queue[0];
+
+    if (prev->endpts == MP_NOPTS_VALUE || prev->endpts > pts)
+        prev->endpts = pts;
+
+    if (opts->sub_fix_timing && pts - prev->endpts <= SUB_GAP_THRESHOLD)
+        prev->endpts = pts;
+
+    for (int n = 0; n < priv->num_seekpoints; n++) {
+        if (priv->seekpoints[n].pts == prev->pts) {
+            priv->seekpoints[n].endpts = prev->endpts;
+            break;
+        }
+    }
+}
+
 static void decode(struct sd *sd, struct demux_packet *packet)
 {
     struct mp_subtitle_opts *opts = sd->opts;
@@ -344,6 +473,28 @@ static void decode(struct sd *sd, struct demux_packet *packet)
         }
     }
 
+    check_cache_opts(sd);
+    struct sub *cached = find_cached_sub(priv, packet);
+    if (cached) {
+        // Decoders like PGS and DVB keep state (object and region definitions)
+        // across packets, so they have to see every packet. The expensive part
+        // is the conversion to BGRA, which is skipped either way.
+        if (!priv->stateless) {
+            int got_sub;
+            if (avcodec_decode_subtitle2(ctx, &sub, &got_sub, priv->avpkt) >= 0
+                && got_sub)
+                avsubtitle_free(&sub);
+        }
+        packet->sub_duration = cached->pkt_sub_duration;
+        // (Already queued if packets are redecoded.)
+        if (!cached->queued) {
+            if (cached->pts != MP_NOPTS_VALUE)
+                set_prev_endpts(sd, cached->pts);
+            queue_sub(sd, cached);
+        }
+        return;
+    }
+
     int got_sub;
     int res = avcodec_decode_subtitle2(ctx, &sub, &got_sub, priv->avpkt);
     if (res < 0 || !got_sub)
@@ -364,22 +515,7 @@ static void decode(struct sd *sd, struct demux_packet *packet)
         }
         pts += sub.start_display_time / 1000.0;
 
-        // set end time of previous sub
-        struct sub *prev = &priv->subs[0];
-        if (prev->valid) {
-            if (prev->endpts == MP_NOPTS_VALUE || prev->endpts > pts)
-                prev->endpts = pts;
-
-            if (opts->sub_fix_timing && pts - prev->endpts <= SUB_GAP_THRESHOLD)
-                prev->endpts = pts;
-
-            for (int n = 0; n < priv->num_seekpoints; n++) {
-                if (priv->seekpoints[n].pts == prev->pts) {
-                    priv->seekpoints[n].endpts = prev->endpts;
-                    break;
-                }
-            }
-        }
+        set_prev_endpts(sd, pts);
 
         // This subtitle packet only signals the end of subtitle display.
         if (!sub.num_rects) {
@@ -388,15 +524,26 @@ static void decode(struct sd *sd, struct demux_packet *packet)
         }
     }
 
-    alloc_sub(priv);
-    struct sub *current = &priv->subs[0];
-
-    current->valid = true;
+    struct sub *current = talloc_zero(NULL, struct sub);
+    current->id = priv->new_id++;
     current->pts = pts;
     current->endpts = endpts;
-    current->avsub = sub;
-
-    read_sub_bitmaps(sd, current);
+    current->cacheable = packet->pos >= 0 || packet->pts != MP_NOPTS_VALUE;
+    current->pkt_pos = packet->pos;
+    current->pkt_pts = packet->pts;
+    current->pkt_sub_duration = packet->sub_duration;
+
+    read_sub_bitmaps(sd, current, &sub);
+    avsubtitle_free(&sub);
+
+    current->bytes = sizeof(*current) +
+                     current->count * sizeof(current->inbitmaps[0]);
+    if (current->data)
+        current->bytes += current->data->stride[0] * (int64_t)current->data->h;
+    priv->cache_bytes += current->bytes;
+    MP_TARRAY_APPEND(priv, priv->subs, priv->num_subs, current);
+    talloc_steal(priv, current);
+    queue_sub(sd, current);
 
     if (pts != MP_NOPTS_VALUE) {
         for (int n = 0; n < priv->num_seekpoints; n++) {
@@ -415,10 +562,8 @@ static void decode(struct sd *sd, struct demux_packet *packet)
 static struct sub *get_current(struct sd_lavc_priv *priv, double pts)
 {
     struct sub *current = NULL;
-    for (int n = 0; n < MAX_QUEUE; n++) {
-        struct sub *sub = &priv->subs[n];
-        if (!sub->valid)
-            continue;
+    for (int n = 0; n < priv->num_queue; n++) {
+        struct sub *sub = priv->queue[n];
         if (pts == MP_NOPTS_VALUE ||
             ((sub->pts == MP_NOPTS_VALUE || pts + 1e-6 >= sub->pts) &&
              (sub->endpts == MP_NOPTS_VALUE || pts + 1e-6 < sub->endpts)))
@@ -584,6 +729,7 @@ static struct sd_times get_times(struct sd *sd, double pts)
 static bool accepts_packet(struct sd *sd, double min_pts)
 {
     struct sd_lavc_priv *priv = sd->priv;
+    struct mp_subtitle_opts *opts = sd->opts;
 
     double pts = priv->current_pts;
     if (min_pts != MP_NOPTS_VALUE) {
@@ -597,28 +743,34 @@ static bool accepts_packet(struct sd *sd, double min_pts)
     }
 
     int last_needed = -1;
-    for (int n = 0; n < MAX_QUEUE; n++) {
-        struct sub *sub = &priv->subs[n];
-        if (!sub->valid)
-            continue;
-        if (pts == MP_NOPTS_VALUE ||
-            ((sub->pts == MP_NOPTS_VALUE || sub->pts >= pts) ||
-             (sub->endpts == MP_NOPTS_VALUE || pts < sub->endpts)))
-        {
+    for (int n = 0; n < priv->num_queue; n++) {
+        if (sub_needed(priv->queue[n], pts))
             last_needed = n;
-        }
     }
     // We can accept a packet if it wouldn't overflow the fixed subtitle queue.
     // We assume that get_bitmaps() never decreases the PTS.
-    return last_needed + 1 < MAX_QUEUE;
+    if (last_needed + 1 < MAX_QUEUE)
+        return true;
+
+    // Decode events ahead of time while the demuxer has their packets, so
+    // they are in the cache when seeking around.
+    if (opts->sub_bitmap_preload <= 0 || pts == MP_NOPTS_VALUE ||
+        priv->num_queue >= MAX_PRELOAD_QUEUE ||
+        priv->cache_bytes >= opts->sub_bitmap_cache_size)
+        return false;
+    struct sub *newest = priv->queue[0];
+    return newest->pts != MP_NOPTS_VALUE &&
+           newest->pts < pts + opts->sub_bitmap_preload;
 }
 
 static void reset(struct sd *sd)
 {
     struct sd_lavc_priv *priv = sd->priv;
 
-    for (int n = 0; n < MAX_QUEUE; n++)
-        clear_sub(&priv->subs[n]);
+    // The events stay cached, but will be queued again only when their packet
+    // is decoded again.
+    clear_queue(priv);
+    trim_subs(sd);
     // lavc might not do this right for all codecs; may need close+reopen
     avcodec_flush_buffers(priv->avctx);
 
@@ -629,8 +781,6 @@ static void uninit(struct sd *sd)
 {
     struct sd_lavc_priv *priv = sd->priv;
 
-    for (int n = 0; n < MAX_QUEUE; n++)
-        clear_sub(&priv->subs[n]);
     avcodec_free_context(&priv->avctx);
     mp_free_av_packet(&priv->avpkt);
     talloc_free(priv);
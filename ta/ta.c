@@ -14,6 +14,8 @@
  */
 
 #include <assert.h>
+#include <limits.h>
+#include <stdatomic.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -31,7 +33,8 @@
 #endif
 
 struct ta_header {
-    size_t size;                // size of the user allocation
+    size_t size;                // size of the user allocation, and the kind of
+                                // the allocation in the upper bits (see below)
     // Invariant: parent!=NULL => prev==NULL
     struct ta_header *prev;     // siblings list (by destructor order)
     struct ta_header *next;
@@ -63,7 +66,42 @@ union aligned_header {
 #define PTR_TO_HEADER(ptr) (&((union aligned_header *)(ptr) - 1)->ta)
 #define PTR_FROM_HEADER(h) ((void *)((union aligned_header *)(h) + 1))
 
-#define MAX_ALLOC (((size_t)-1) - sizeof(union aligned_header))
+#define ALIGN_UP(x) (((x) + MIN_ALIGN - 1) & ~(size_t)(MIN_ALIGN - 1))
+
+// The 2 upper bits of ta_header.size are used for the allocation kind.
+#define SIZE_BITS (sizeof(size_t) * CHAR_BIT - 2)
+#define SIZE_MASK (((size_t)1 << SIZE_BITS) - 1)
+
+// Invariants, which make sure arena memory is never used after it was freed,
+// and that arena memory is only allocated by the thread owning the arena tree:
+// - KIND_ARENA_BLOCK allocations are always (indirect) children of their
+//   arena root, and never of a KIND_NORMAL or KIND_ARENA_ESCAPED allocation.
+// - Only KIND_ARENA_ROOT and KIND_ARENA_BLOCK parents allocate from the arena.
+// - Each KIND_ARENA_ESCAPED allocation holds its own arena reference.
+enum ta_kind {
+    KIND_NORMAL = 0,        // allocated with malloc()
+    KIND_ARENA_ROOT,        // allocated with malloc(), owns a struct ta_arena
+    KIND_ARENA_BLOCK,       // allocated from a struct ta_arena
+    KIND_ARENA_ESCAPED,     // in arena memory, but moved out of the arena tree;
+                            // holds a reference to the arena
+};
+
+// Arena allocations are prefixed with a pointer to their arena.
+#define ARENA_PREFIX ALIGN_UP(sizeof(struct ta_arena *))
+// Larger allocations are never placed in an arena.
+#define ARENA_MAX_ALLOC 4096
+#define ARENA_MIN_CHUNK 1024
+#define ARENA_MAX_CHUNK (64 * 1024)
+
+#define MAX_ALLOC (SIZE_MASK - sizeof(union aligned_header) - ARENA_PREFIX)
+
+struct ta_arena {
+    char *pos, *end;        // free space in the current chunk
+    void *chunks;           // singly linked list through the first pointer
+    size_t next_chunk_size;
+    atomic_size_t refs;     // arena root + number of escaped blocks
+    // Followed by the arena root allocation.
+};
 
 static void ta_dbg_add(struct ta_header *h);
 static void ta_dbg_check_header(struct ta_header *h);
@@ -76,20 +114,72 @@ static struct ta_header *get_header(void *ptr)
     return h;
 }
 
-/* Set the parent allocation of ptr. If parent==NULL, remove the parent.
- * Setting parent==NULL (with ptr!=NULL) unsets the parent of ptr.
- * With ptr==NULL, the function does nothing.
- *
- * Warning: if ta_parent is a direct or indirect child of ptr, things will go
- *          wrong. The function will apparently succeed, but creates circular
- *          parent links, which are not allowed.
- */
-void ta_set_parent(void *ptr, void *ta_parent)
+static size_t get_size(struct ta_header *h)
 {
-    struct ta_header *ch = get_header(ptr);
-    if (!ch)
+    return h->size & SIZE_MASK;
+}
+
+static enum ta_kind get_kind(struct ta_header *h)
+{
+    return h->size >> SIZE_BITS;
+}
+
+static void set_size(struct ta_header *h, size_t size, enum ta_kind kind)
+{
+    h->size = size | ((size_t)kind << SIZE_BITS);
+}
+
+// Return the arena the allocation is part of (or owns), or NULL.
+static struct ta_arena *get_arena(struct ta_header *h)
+{
+    if (get_kind(h) == KIND_NORMAL)
+        return NULL;
+    return *(struct ta_arena **)((char *)h - ARENA_PREFIX);
+}
+
+// Escaped blocks can be freed on any thread, so this is atomic.
+static void arena_unref(struct ta_arena *arena)
+{
+    size_t refs = atomic_fetch_sub(&arena->refs, 1);
+    assert(refs > 0);
+    if (refs > 1)
         return;
-    struct ta_header *new_parent = get_header(ta_parent);
+    while (arena->chunks) {
+        void *next = *(void **)arena->chunks;
+        free(arena->chunks);
+        arena->chunks = next;
+    }
+    free(arena);
+}
+
+// Bump-allocate a header and size bytes from the arena. Returns NULL on OOM.
+static struct ta_header *arena_alloc(struct ta_arena *arena, size_t size)
+{
+    size_t need = ARENA_PREFIX + sizeof(union aligned_header) + ALIGN_UP(size);
+    if (arena->end - arena->pos < need) {
+        size_t chunk_size = arena->next_chunk_size;
+        while (chunk_size < ARENA_PREFIX + need)
+            chunk_size *= 2;
+        void *chunk = malloc(chunk_size);
+        if (!chunk)
+            return NULL;
+        *(void **)chunk = arena->chunks;
+        arena->chunks = chunk;
+        // (the first pointer is padded like the prefix)
+        arena->pos = (char *)chunk + ARENA_PREFIX;
+        arena->end = (char *)chunk + chunk_size;
+        if (arena->next_chunk_size < ARENA_MAX_CHUNK)
+            arena->next_chunk_size *= 2;
+    }
+    char *p = arena->pos;
+    arena->pos += need;
+    *(struct ta_arena **)p = arena;
+    return (struct ta_header *)(p + ARENA_PREFIX);
+}
+
+// Remove ptr from the parent/sibling links.
+static void unlink_header(struct ta_header *ch)
+{
     // Unlink from previous parent
     if (ch->prev)
         ch->prev->next = ch->next;
@@ -105,6 +195,75 @@ void ta_set_parent(void *ptr, void *ta_parent)
         }
     }
     ch->next = ch->prev = ch->parent = NULL;
+}
+
+// Update all links to h after it was moved in memory.
+static void relink_header(struct ta_header *h)
+{
+    // Relink parent
+    if (h->parent)
+        h->parent->child = h;
+    // Relink siblings
+    if (h->next)
+        h->next->prev = h;
+    if (h->prev)
+        h->prev->next = h;
+    // Relink children
+    if (h->child)
+        h->child->parent = h;
+}
+
+// Whether children of h are allocated from its arena.
+static bool in_arena_tree(struct ta_header *h)
+{
+    enum ta_kind kind = get_kind(h);
+    return kind == KIND_ARENA_ROOT || kind == KIND_ARENA_BLOCK;
+}
+
+// Turn h and all arena blocks below it into escaped blocks. Returns the number
+// of new arena references. (KIND_NORMAL and KIND_ARENA_ESCAPED allocations
+// have no KIND_ARENA_BLOCK children, so their subtrees are skipped.)
+static size_t escape_tree(struct ta_header *h)
+{
+    if (get_kind(h) != KIND_ARENA_BLOCK)
+        return 0;
+    set_size(h, get_size(h), KIND_ARENA_ESCAPED);
+    size_t refs = 1;
+    for (struct ta_header *s = h->child; s; s = s->next)
+        refs += escape_tree(s);
+    return refs;
+}
+
+/* Set the parent allocation of ptr. If parent==NULL, remove the parent.
+ * Setting parent==NULL (with ptr!=NULL) unsets the parent of ptr.
+ * With ptr==NULL, the function does nothing.
+ *
+ * Warning: if ta_parent is a direct or indirect child of ptr, things will go
+ *          wrong. The function will apparently succeed, but creates circular
+ *          parent links, which are not allowed.
+ */
+void ta_set_parent(void *ptr, void *ta_parent)
+{
+    struct ta_header *ch = get_header(ptr);
+    if (!ch)
+        return;
+    struct ta_header *new_parent = get_header(ta_parent);
+    unlink_header(ch);
+    // Arena blocks moved out of their arena tree keep the arena memory alive.
+    // This walks the subtree, which is fine, because it's the uncommon case.
+    enum ta_kind kind = get_kind(ch);
+    if (kind == KIND_ARENA_BLOCK || kind == KIND_ARENA_ESCAPED) {
+        struct ta_arena *arena = get_arena(ch);
+        bool inside = new_parent && in_arena_tree(new_parent) &&
+                      get_arena(new_parent) == arena;
+        if (!inside && kind == KIND_ARENA_BLOCK) {
+            atomic_fetch_add(&arena->refs, escape_tree(ch));
+        } else if (inside && kind == KIND_ARENA_ESCAPED) {
+            // (Children of ch stay escaped.)
+            set_size(ch, get_size(ch), KIND_ARENA_BLOCK);
+            arena_unref(arena);
+        }
+    }
     // Link to new parent - insert at start of list (LIFO destructor order)
     if (new_parent) {
         ch->next = new_parent->child;
@@ -127,42 +286,139 @@ void *ta_get_parent(void *ptr)
     return ch ? ch->parent : NULL;
 }
 
-/* Allocate size bytes of memory. If ta_parent is not NULL, this is used as
- * parent allocation (if ta_parent is freed, this allocation is automatically
- * freed as well). size==0 allocates a block of size 0 (i.e. returns non-NULL).
- * Returns NULL on OOM.
- */
-void *ta_alloc_size(void *ta_parent, size_t size)
+static void *alloc_size(void *ta_parent, size_t size, bool zero)
 {
     if (size >= MAX_ALLOC)
         return NULL;
-    struct ta_header *h = malloc(sizeof(union aligned_header) + size);
+    struct ta_header *parent = get_header(ta_parent);
+    struct ta_arena *arena =
+        parent && in_arena_tree(parent) ? get_arena(parent) : NULL;
+    struct ta_header *h;
+    enum ta_kind kind = KIND_NORMAL;
+    if (arena && size <= ARENA_MAX_ALLOC) {
+        h = arena_alloc(arena, size);
+        kind = KIND_ARENA_BLOCK;
+        if (h && zero)
+            memset(PTR_FROM_HEADER(h), 0, size);
+    } else if (zero) {
+        h = calloc(1, sizeof(union aligned_header) + size);
+    } else {
+        h = malloc(sizeof(union aligned_header) + size);
+    }
     if (!h)
         return NULL;
-    *h = (struct ta_header) {.size = size};
+    *h = (struct ta_header) {0};
+    set_size(h, size, kind);
     ta_dbg_add(h);
     void *ptr = PTR_FROM_HEADER(h);
     ta_set_parent(ptr, ta_parent);
     return ptr;
 }
 
+/* Allocate size bytes of memory. If ta_parent is not NULL, this is used as
+ * parent allocation (if ta_parent is freed, this allocation is automatically
+ * freed as well). size==0 allocates a block of size 0 (i.e. returns non-NULL).
+ * If ta_parent is an arena (see ta_new_arena()), or was allocated from one,
+ * small allocations are taken from the arena.
+ * Returns NULL on OOM.
+ */
+void *ta_alloc_size(void *ta_parent, size_t size)
+{
+    return alloc_size(ta_parent, size, false);
+}
+
 /* Exactly the same as ta_alloc_size(), but the returned memory block is
  * initialized to 0.
  */
 void *ta_zalloc_size(void *ta_parent, size_t size)
 {
-    if (size >= MAX_ALLOC)
-        return NULL;
-    struct ta_header *h = calloc(1, sizeof(union aligned_header) + size);
-    if (!h)
+    return alloc_size(ta_parent, size, true);
+}
+
+/* Create an arena context. Allocations of moderate size with the arena (or
+ * with any allocation inside of the arena) as parent are bump-allocated from
+ * chunks owned by the arena, instead of going through malloc() each. This
+ * applies recursively to allocations taken from the arena. Apart from that,
+ * they behave like normal allocations: they can be freed or
+ * reallocated individually (but their memory is reclaimed only when the arena
+ * is freed), destructors are run, and they can be moved to a parent outside of
+ * the arena (then the arena memory is kept alive until they are freed).
+ *
+ * This is useful for big, short-lived trees of small allocations, which are
+ * freed all at once.
+ *
+ * The returned context has size 0 and cannot be reallocated.
+ * Returns NULL on OOM.
+ */
+void *ta_new_arena(void *ta_parent)
+{
+    // The arena root is allocated together with the struct ta_arena. Both are
+    // freed when the last reference to the arena is gone.
+    size_t arena_size = ALIGN_UP(sizeof(struct ta_arena));
+    struct ta_arena *arena =
+        malloc(arena_size + ARENA_PREFIX + sizeof(union aligned_header));
+    if (!arena)
         return NULL;
-    *h = (struct ta_header) {.size = size};
+    *arena = (struct ta_arena) {
+        .next_chunk_size = ARENA_MIN_CHUNK,
+    };
+    atomic_init(&arena->refs, 1);
+    char *p = (char *)arena + arena_size;
+    *(struct ta_arena **)p = arena;
+    struct ta_header *h = (struct ta_header *)(p + ARENA_PREFIX);
+    *h = (struct ta_header) {0};
+    set_size(h, 0, KIND_ARENA_ROOT);
     ta_dbg_add(h);
     void *ptr = PTR_FROM_HEADER(h);
     ta_set_parent(ptr, ta_parent);
     return ptr;
 }
 
+static void *arena_realloc(struct ta_header *h, size_t size)
+{
+    struct ta_arena *arena = get_arena(h);
+    enum ta_kind kind = get_kind(h);
+    size_t old_size = get_size(h);
+    char *user = PTR_FROM_HEADER(h);
+
+    // Fits into the padding, or is the last allocation and can be extended.
+    // Escaped blocks may be on another thread, and must not touch the arena.
+    bool last = kind == KIND_ARENA_BLOCK &&
+                user + ALIGN_UP(old_size) == arena->pos;
+    if (ALIGN_UP(size) <= ALIGN_UP(old_size) ||
+        (last && ALIGN_UP(size) - ALIGN_UP(old_size) <= arena->end - arena->pos))
+    {
+        if (last)
+            arena->pos = user + ALIGN_UP(size);
+        set_size(h, size, kind);
+        return user;
+    }
+
+    // Blocks with children stay in the arena, because a KIND_NORMAL parent
+    // must not have arena block children.
+    struct ta_header *new_h;
+    enum ta_kind new_kind = kind;
+    if (kind == KIND_ARENA_BLOCK && (size <= ARENA_MAX_ALLOC || h->child)) {
+        new_h = arena_alloc(arena, size);
+    } else {
+        new_h = malloc(sizeof(union aligned_header) + size);
+        new_kind = KIND_NORMAL;
+    }
+    if (!new_h)
+        return NULL;
+    ta_dbg_remove(h);
+    memcpy(new_h, h, sizeof(union aligned_header) +
+                     (old_size < size ? old_size : size));
+    set_size(new_h, size, new_kind);
+    ta_dbg_add(new_h);
+    relink_header(new_h);
+    // An escaped block leaving the arena memory drops its reference. Its
+    // children, if in arena memory, are escaped and hold their own.
+    if (kind == KIND_ARENA_ESCAPED)
+        arena_unref(arena);
+    return PTR_FROM_HEADER(new_h);
+}
+
 /* Reallocate the allocation given by ptr and return a new pointer. Much like
  * realloc(), the returned pointer can be different, and on OOM, NULL is
  * returned.
@@ -187,27 +443,24 @@ void *ta_realloc_size(void *ta_parent, void *ptr, size_t size)
         return ta_alloc_size(ta_parent, size);
     struct ta_header *h = get_header(ptr);
     struct ta_header *old_h = h;
-    if (h->size == size)
+    size_t old_size = get_size(h);
+    enum ta_kind kind = get_kind(h);
+    if (old_size == size)
         return ptr;
+    if (kind == KIND_ARENA_ROOT) {
+        assert(0); // not supported
+        return NULL;
+    }
+    if (kind != KIND_NORMAL)
+        return arena_realloc(h, size);
     ta_dbg_remove(h);
     h = realloc(h, sizeof(union aligned_header) + size);
     ta_dbg_add(h ? h : old_h);
     if (!h)
         return NULL;
-    h->size = size;
-    if (h != old_h) {
-        // Relink parent
-        if (h->parent)
-            h->parent->child = h;
-        // Relink siblings
-        if (h->next)
-            h->next->prev = h;
-        if (h->prev)
-            h->prev->next = h;
-        // Relink children
-        if (h->child)
-            h->child->parent = h;
-    }
+    set_size(h, size, kind);
+    if (h != old_h)
+        relink_header(h);
     return PTR_FROM_HEADER(h);
 }
 
@@ -218,7 +471,7 @@ void *ta_realloc_size(void *ta_parent, void *ptr, size_t size)
 size_t ta_get_size(void *ptr)
 {
     struct ta_header *h = get_header(ptr);
-    return h ? h->size : 0;
+    return h ? get_size(h) : 0;
 }
 
 /* Free all allocations that (recursively) have ptr as parent allocation, but
@@ -241,9 +494,22 @@ void ta_free(void *ptr)
     if (h->destructor)
         h->destructor(ptr);
     ta_free_children(ptr);
-    ta_set_parent(ptr, NULL);
+    unlink_header(h);
     ta_dbg_remove(h);
-    free(h);
+    switch (get_kind(h)) {
+    case KIND_NORMAL:
+        free(h);
+        break;
+    case KIND_ARENA_ROOT:
+        arena_unref(get_arena(h));
+        break;
+    case KIND_ARENA_BLOCK:
+        // The memory is reclaimed when the arena is freed.
+        break;
+    case KIND_ARENA_ESCAPED:
+        arena_unref(get_arena(h));
+        break;
+    }
 }
 
 /* Set a destructor that is to be called when the given allocation is freed.
@@ -313,7 +579,7 @@ static size_t get_children_size(struct ta_header *h)
 {
     size_t size = 0;
     for (struct ta_header *s = h->child; s; s = s->next)
-        size += s->size + get_children_size(s);
+        size += get_size(s) + get_children_size(s);
     return size;
 }
 
@@ -336,16 +602,20 @@ static void print_leak_report(void)
                     snprintf(name, sizeof(name), "%s", cur->name);
                 if (cur->name == &allocation_is_string) {
                     snprintf(name, sizeof(name), "'%.*s'",
-                             (int)cur->size, (char *)PTR_FROM_HEADER(cur));
+                             (int)get_size(cur), (char *)PTR_FROM_HEADER(cur));
+                }
+                if (get_kind(cur) == KIND_ARENA_ROOT) {
+                    size_t len = strlen(name);
+                    snprintf(name + len, sizeof(name) - len, " (arena)");
                 }
                 for (int n = 0; n < sizeof(name); n++) {
                     if (name[n] && name[n] < 0x20)
                         name[n] = '.';
                 }
                 fprintf(stderr, "  %-20p %10zu %10zu  %s\n",
-                        cur, cur->size, c_size, name);
+                        cur, get_size(cur), c_size, name);
             }
-            size += cur->size;
+            size += get_size(cur);
             num_blocks += 1;
             // Unlink, and don't confuse valgrind by leaving live pointers.
             cur->leak_next->leak_prev = cur->leak_prev;
@@ -125,9 +125,14 @@ char *ta_strndup(void *ta_parent, const char *str, size_t n)
 {
     if (!str)
         return NULL;
-    char *new = NULL;
-    strndup_append_at(&new, 0, str, n);
-    ta_set_parent(new, ta_parent);
+    // Allocate with the parent directly, so arenas are used.
+    size_t len = strnlen(str, n);
+    char *new = ta_alloc_size(ta_parent, len + 1);
+    if (!new)
+        return NULL;
+    memcpy(new, str, len);
+    new[len] = '\0';
+    ta_dbg_mark_as_string(new);
     return new;
 }
 
@@ -214,13 +219,20 @@ char *ta_asprintf(void *ta_parent, const char *fmt, ...)
 
 char *ta_vasprintf(void *ta_parent, const char *fmt, va_list ap)
 {
-    char *res = NULL;
-    ta_vasprintf_append_at(&res, 0, fmt, ap);
-    ta_set_parent(res, ta_parent);
-    if (!res) {
-        ta_free(res);
+    va_list copy;
+    va_copy(copy, ap);
+    char c;
+    int size = vsnprintf(&c, 1, fmt, copy);
+    va_end(copy);
+    if (size < 0)
         return NULL;
-    }
+
+    // Allocate with the parent directly, so arenas are used.
+    char *res = ta_alloc_size(ta_parent, size + 1);
+    if (!res)
+        return NULL;
+    vsnprintf(res, size + 1, fmt, ap);
+    ta_dbg_mark_as_string(res);
     return res;
 }
 
@@ -0,0 +1,151 @@
+#include <float.h>
+#include <math.h>
+
+#include "audio/format.h"
+#include "osdep/endian.h"
+#include "osdep/timer.h"
+#include "test_utils.h"
+
+#define MAX_SAMPLES 1000
+
+// The straightforward version of af_s32_to_s24().
+#if BYTE_ORDER == BIG_ENDIAN
+#define SHIFT24(x) ((3-(x))*8)
+#else
+#define SHIFT24(x) (((x)+1)*8)
+#endif
+
+static void ref_s32_to_s24(uint8_t *dst, const int32_t *src, int samples,
+                           bool pad_msb)
+{
+    int bytes = pad_msb ? 4 : 3;
+    for (int n = 0; n < samples; n++) {
+        uint32_t val = src[n];
+        uint8_t *ptr = dst + n * bytes;
+        ptr[0] = val >> SHIFT24(0);
+        ptr[1] = val >> SHIFT24(1);
+        ptr[2] = val >> SHIFT24(2);
+        if (pad_msb)
+            ptr[3] = 0;
+    }
+}
+
+static void test_s32_to_s24(void)
+{
+    static int32_t src[MAX_SAMPLES];
+    static int32_t buf[MAX_SAMPLES];
+    static uint8_t ref[MAX_SAMPLES * 4];
+    static uint8_t out[MAX_SAMPLES * 4 + 1];
+
+    uint32_t seed = 1;
+    for (int n = 0; n < MAX_SAMPLES; n++) {
+        seed = seed * 1664525 + 1013904223;
+        src[n] = seed;
+    }
+
+    // Odd sizes to cover the tail handling.
+    static const int sizes[] = {0, 1, 3, 4, 5, 7, 8, 63, MAX_SAMPLES};
+    for (int i = 0; i < MP_ARRAY_SIZE(sizes); i++) {
+        int samples = sizes[i];
+        for (int pad = 0; pad < 2; pad++) {
+            int bytes = samples * (pad ? 4 : 3);
+
+            ref_s32_to_s24(ref, src, samples, pad);
+
+            memset(out, 0xAA, sizeof(out));
+            af_s32_to_s24(out, src, samples, pad);
+            assert_memcmp(out, ref, bytes);
+            assert_int_equal(out[bytes], 0xAA); // no write past the end
+
+            memcpy(buf, src, sizeof(buf));
+            af_s32_to_s24(buf, buf, samples, pad);
+            assert_memcmp(buf, ref, bytes);
+        }
+    }
+}
+
+static void test_sanitize(void)
+{
+    float f[] = {0.5f, -1.0f, NAN, INFINITY, -INFINITY, FLT_MIN / 2, -0.0f,
+                 FLT_MAX, 1e-30f};
+    float f_ref[] = {0.5f, -1.0f, 0, 0, 0, 0, 0, FLT_MAX, 1e-30f};
+    af_sanitize_float(f, MP_ARRAY_SIZE(f));
+    for (int n = 0; n < MP_ARRAY_SIZE(f); n++)
+        assert_true(f[n] == f_ref[n]);
+
+    double d[] = {0.5, -1.0, NAN, INFINITY, -INFINITY, DBL_MIN / 2, DBL_MAX};
+    double d_ref[] = {0.5, -1.0, 0, 0, 0, 0, DBL_MAX};
+    af_sanitize_double(d, MP_ARRAY_SIZE(d));
+    for (int n = 0; n < MP_ARRAY_SIZE(d); n++)
+        assert_true(d[n] == d_ref[n]);
+}
+
+// 1 second of 32 channel 192 kHz audio, processed in AO-sized chunks.
+#define BENCH_CHANNELS 32
+#define BENCH_CHUNK 1024
+#define BENCH_ITERATIONS (192000 / BENCH_CHUNK)
+
+static void bench_report(const char *name, int64_t t)
+{
+    double samples = (double)BENCH_ITERATIONS * BENCH_CHUNK * BENCH_CHANNELS;
+    printf("%-16s %6.2f ns/sample %8.2f Msamples/s\n", name, t / samples,
+           samples / (t / 1e3));
+}
+
+static void bench(void)
+{
+    size_t samples = BENCH_CHUNK * BENCH_CHANNELS;
+    int32_t *s32 = calloc(samples, 4);
+    float *flt = calloc(samples, sizeof(float));
+    double *dbl = calloc(samples, sizeof(double));
+    assert_true(s32 && flt && dbl);
+
+    for (size_t n = 0; n < samples; n++) {
+        s32[n] = n * 123456789;
+        flt[n] = (n % 100) / 100.0f;
+        dbl[n] = (n % 100) / 100.0;
+    }
+
+    int64_t t = mp_time_ns();
+    for (int n = 0; n < BENCH_ITERATIONS; n++)
+        af_s32_to_s24(s32, s32, samples, false);
+    bench_report("s32->s24", mp_time_ns() - t);
+
+    t = mp_time_ns();
+    for (int n = 0; n < BENCH_ITERATIONS; n++)
+        af_s32_to_s24(s32, s32, samples, true);
+    bench_report("s32->s24-pad", mp_time_ns() - t);
+
+    t = mp_time_ns();
+    for (int n = 0; n < BENCH_ITERATIONS; n++)
+        af_sanitize_float(flt, samples);
+    bench_report("sanitize-float", mp_time_ns() - t);
+
+    t = mp_time_ns();
+    for (int n = 0; n < BENCH_ITERATIONS; n++)
+        af_sanitize_double(dbl, samples);
+    bench_report("sanitize-double", mp_time_ns() - t);
+
+    t = mp_time_ns();
+    for (int n = 0; n < BENCH_ITERATIONS; n++)
+        af_fill_silence(s32, samples * 4, AF_FORMAT_S32);
+    bench_report("silence-s32", mp_time_ns() - t);
+
+    free(s32);
+    free(flt);
+    free(dbl);
+}
+
+int main(int argc, char *argv[])
+{
+    mp_time_init();
+
+    if (argc > 1 && strcmp(argv[1], "bench") == 0) {
+        bench();
+        return 0;
+    }
+
+    test_s32_to_s24();
+    test_sanitize();
+    return 0;
+}
@@ -0,0 +1,128 @@
+#include <sys/stat.h>
+
+#include "config.h"
+
+#if HAVE_POSIX
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+#include "misc/kv_log.h"
+#include "osdep/timer.h"
+#include "test_utils.h"
+
+static void assert_value(struct mp_kv_log *kv, const char *key,
+                         const char *value, int64_t tag)
+{
+    bstr got;
+    int64_t got_tag;
+    assert_true(mp_kv_log_get(kv, NULL, key, &got, &got_tag));
+    assert_string_equal(got.start, value);
+    assert_int_equal(got_tag, tag);
+    talloc_free(got.start);
+}
+
+#if HAVE_POSIX
+// Several processes append while each of them compacts the file. No record
+// must get lost by being appended to a file that was just replaced.
+static void test_concurrent_compaction(const char *path)
+{
+    const int num_procs = 3, num_keys = 1000;
+    unlink(path);
+
+    for (int i = 0; i < num_procs; i++) {
+        pid_t pid = fork();
+        assert_true(pid >= 0);
+        if (pid)
+            continue;
+        struct mp_kv_log *kv = mp_kv_log_open(NULL, NULL, path);
+        char key[64], junk[2000];
+        memset(junk, 'a' + i, sizeof(junk) - 1);
+        junk[sizeof(junk) - 1] = '\0';
+        bool ok = true;
+        for (int n = 0; n < num_keys; n++) {
+            snprintf(key, sizeof(key), "p%d_%d", i, n);
+            ok &= mp_kv_log_set(kv, key, bstr0("x"), n);
+            snprintf(key, sizeof(key), "junk%d", i);
+            ok &= mp_kv_log_set(kv, key, bstr0(junk), n);
+        }
+        talloc_free(kv);
+        _exit(ok ? 0 : 1);
+    }
+    int status;
+    while (wait(&status) > 0)
+        assert_true(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+    struct mp_kv_log *kv = mp_kv_log_open(NULL, NULL, path);
+    for (int i = 0; i < num_procs; i++) {
+        for (int n = 0; n < num_keys; n++)
+            assert_true(mp_kv_log_has(kv, mp_tprintf(64, "p%d_%d", i, n)));
+    }
+    talloc_free(kv);
+}
+#endif
+
+int main(int argc, char *argv[])
+{
+    if (argc != 2)
+        return 1;
+
+    mp_time_init();
+
+    char *path = mp_tprintf(4096, "%s/%s", argv[1], "kv_log");
+    fclose(test_open_out(argv[1], "kv_log"));
+
+    struct mp_kv_log *a = mp_kv_log_open(NULL, NULL, path);
+    struct mp_kv_log *b = mp_kv_log_open(NULL, NULL, path);
+
+    assert_false(mp_kv_log_has(a, "key1"));
+    assert_false(mp_kv_log_set(a, "bad key", bstr0("x"), 0));
+    assert_true(mp_kv_log_set(a, "key1", bstr0("multi\nline\n"), 5));
+    assert_value(a, "key1", "multi\nline\n", 5);
+
+    // Only visible to other instances after refreshing.
+    assert_false(mp_kv_log_has(b, "key1"));
+    mp_kv_log_refresh(b);
+    assert_value(b, "key1", "multi\nline\n", 5);
+
+    // Overwrite a key until the file gets compacted.
+    char value[200];
+    for (int n = 0; n < 5000; n++) {
+        snprintf(value, sizeof(value), "%0150d", n);
+        assert_true(mp_kv_log_set(a, "key2", bstr0(value), n));
+    }
+    talloc_free(a); // wait for compaction
+    struct stat st;
+    assert_true(stat(path, &st) == 0);
+    assert_true(st.st_size < 256 * 1024);
+
+    mp_kv_log_refresh(b);
+    assert_value(b, "key1", "multi\nline\n", 5);
+    assert_value(b, "key2", value, 4999);
+
+    // Invalid data is skipped. A truncated record (like from a crashed writer)
+    // blocks indexing the following records for a while.
+    FILE *f = fopen(path, "ab");
+    fprintf(f, "garbage\nS key3 0 100\nshort\n");
+    fclose(f);
+    assert_true(mp_kv_log_remove(b, "key1"));
+    assert_true(mp_kv_log_set(b, "key4", bstr0(""), -1));
+
+    struct mp_kv_log *c = mp_kv_log_open(NULL, NULL, path);
+    assert_true(mp_kv_log_has(c, "key1"));
+    assert_false(mp_kv_log_has(c, "key4"));
+    mp_sleep_ns(MP_TIME_MS_TO_NS(2100));
+    mp_kv_log_refresh(c);
+    assert_false(mp_kv_log_has(c, "key1"));
+    assert_false(mp_kv_log_has(c, "key3"));
+    assert_value(c, "key2", value, 4999);
+    assert_value(c, "key4", "", -1);
+
+    talloc_free(b);
+    talloc_free(c);
+
+#if HAVE_POSIX
+    test_concurrent_compaction(path);
+#endif
+    return 0;
+}
@@ -0,0 +1,282 @@
+/*
+ * This file is part of mpv.
+ *
+ * mpv is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * mpv is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with mpv.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Measures how many commands per second go through the client API and the
+// JSON IPC. The commands are repeated a lot, like automation clients do. Also
+// compares polling a property over IPC with reading it from the shared memory
+// state page (--input-ipc-shm-path).
+
+#include <libmpv/client.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#define NUM_COMMANDS 20000
+
+static mpv_handle *ctx;
+static char socket_path[256];
+static char shm_path[256];
+
+#ifdef __GNUC__
+__attribute__((noreturn, format(printf, 1, 2)))
+#endif
+static void fail(const char *fmt, ...)
+{
+    va_list va;
+    va_start(va, fmt);
+    vfprintf(stderr, fmt, va);
+    va_end(va);
+    exit(1);
+}
+
+static void exit_cleanup(void)
+{
+    if (ctx)
+        mpv_destroy(ctx);
+    if (socket_path[0])
+        unlink(socket_path);
+    if (shm_path[0])
+        unlink(shm_path);
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void report(const char *name, int count, double start)
+{
+    double t = now() - start;
+    printf("%-20s %10.0f commands/s\n", name, count / t);
+}
+
+static void bench_client_api(void)
+{
+    double start = now();
+    for (int n = 0; n < NUM_COMMANDS; n++) {
+        char val[20];
+        snprintf(val, sizeof(val), "%d", n % 100);
+        const char *cmd[] = {"set", "volume", val, NULL};
+        if (mpv_command(ctx, cmd) < 0)
+            fail("command failed\n");
+    }
+    report("client-api", NUM_COMMANDS, start);
+
+    start = now();
+    for (int n = 0; n < NUM_COMMANDS; n++) {
+        if (mpv_command_string(ctx, "add volume 0") < 0)
+            fail("command failed\n");
+    }
+    report("client-api-string", NUM_COMMANDS, start);
+}
+
+static int connect_ipc(void)
+{
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", socket_path);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+        fail("socket() failed\n");
+    for (int retry = 0; retry < 100; retry++) {
+        if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0)
+            return fd;
+        usleep(10000);
+    }
+    fail("could not connect to %s\n", socket_path);
+}
+
+// Send one line and wait for the reply (only JSON requests send one).
+static void roundtrip(int fd, const char *line, bool reply)
+{
+    size_t len = strlen(line);
+    if (write(fd, line, len) != (ssize_t)len)
+        fail("write() failed\n");
+    if (!reply)
+        return;
+    char c;
+    do {
+        if (read(fd, &c, 1) != 1)
+            fail("read() failed\n");
+    } while (c != '\n');
+}
+
+static void bench_ipc(void)
+{
+    int fd = connect_ipc();
+    char line[256];
+
+    // Make sure only replies are received.
+    roundtrip(fd, "{\"command\": [\"disable_event\", \"all\"]}\n", true);
+
+    double start = now();
+    for (int n = 0; n < NUM_COMMANDS; n++) {
+        snprintf(line, sizeof(line),
+                 "{\"command\": [\"set\", \"volume\", \"%d\"], "
+                 "\"request_id\": %d}\n", n % 100, n);
+        roundtrip(fd, line, true);
+    }
+    report("ipc-json", NUM_COMMANDS, start);
+
+    start = now();
+    for (int n = 0; n < NUM_COMMANDS; n++) {
+        snprintf(line, sizeof(line),
+                 "{\"command\": [\"script-message\", \"bench\", \"%d\"]}\n",
+                 n % 16);
+        roundtrip(fd, line, true);
+    }
+    report("ipc-json-message", NUM_COMMANDS, start);
+
+    // Text commands do not send replies; finish with a JSON request so that
+    // all of them are processed before the time is taken.
+    start = now();
+    for (int n = 0; n < NUM_COMMANDS; n++)
+        roundtrip(fd, "add volume 0\n", false);
+    roundtrip(fd, "{\"command\": [\"ignore\"]}\n", true);
+    report("ipc-text", NUM_COMMANDS, start);
+
+    close(fd);
+}
+
+// Layout of the state page as documented in ipc.rst.
+struct shm_header {
+    char magic[8];
+    uint32_t version, header_size, entry_size, num_entries;
+    _Atomic uint64_t seq;
+    uint64_t pid, update_count, flags;
+};
+
+struct shm_entry {
+    char name[48];
+    uint32_t format, length;
+    union {
+        int64_t i;
+        double d;
+    } u;
+    uint64_t change_count;
+    char string[56];
+};
+
+// Read the entry for name, retrying while mpv is writing the page.
+static bool shm_read(const struct shm_header *hdr, const char *name,
+                     struct shm_entry *out)
+{
+    uint64_t seq1, seq2;
+    bool found;
+    do {
+        seq1 = atomic_load_explicit(&hdr->seq, memory_order_acquire);
+        found = false;
+        for (uint32_t n = 0; n < hdr->num_entries; n++) {
+            const struct shm_entry *e = (const void *)((const char *)hdr +
+                            hdr->header_size + (size_t)n * hdr->entry_size);
+            if (strncmp(e->name, name, sizeof(e->name)) == 0) {
+                memcpy(out, e, sizeof(*out));
+                found = true;
+                break;
+            }
+        }
+        atomic_thread_fence(memory_order_acquire);
+        seq2 = atomic_load_explicit(&hdr->seq, memory_order_relaxed);
+    } while ((seq1 & 1) || seq1 != seq2);
+    return found;
+}
+
+static void bench_shm(void)
+{
+    int fd = connect_ipc();
+    roundtrip(fd, "{\"command\": [\"disable_event\", \"all\"]}\n", true);
+
+    double start = now();
+    for (int n = 0; n < NUM_COMMANDS; n++)
+        roundtrip(fd, "{\"command\": [\"get_property\", \"volume\"]}\n", true);
+    report("ipc-get-property", NUM_COMMANDS, start);
+    close(fd);
+
+    fd = open(shm_path, O_RDONLY);
+    if (fd < 0)
+        fail("could not open %s\n", shm_path);
+    size_t size = lseek(fd, 0, SEEK_END);
+    const struct shm_header *hdr = mmap(NULL, size, PROT_READ, MAP_SHARED,
+                                        fd, 0);
+    close(fd);
+    if (hdr == MAP_FAILED)
+        fail("mmap() failed\n");
+    if (memcmp(hdr->magic, "mpvstate", 8) != 0 || hdr->version != 1)
+        fail("unexpected state page header\n");
+
+    // Check that the page follows changes made through the client API.
+    if (mpv_set_property_string(ctx, "volume", "42") < 0)
+        fail("setting volume failed\n");
+    struct shm_entry e;
+    for (int retry = 0; ; retry++) {
+        if (!shm_read(hdr, "volume", &e))
+            fail("volume not exported\n");
+        if (e.format == MPV_FORMAT_DOUBLE && e.u.d == 42)
+            break;
+        if (retry == 1000)
+            fail("volume not updated\n");
+        usleep(1000);
+    }
+
+    int reads = NUM_COMMANDS * 100;
+    start = now();
+    for (int n = 0; n < reads; n++) {
+        if (!shm_read(hdr, "volume", &e))
+            fail("volume not exported\n");
+    }
+    report("shm-read", reads, start);
+
+    munmap((void *)hdr, size);
+}
+
+int main(void)
+{
+    atexit(exit_cleanup);
+
+    ctx = mpv_create();
+    if (!ctx)
+        return 1;
+
+    snprintf(socket_path, sizeof(socket_path), "/tmp/mpv-ipc-bench-%d",
+             (int)getpid());
+    snprintf(shm_path, sizeof(shm_path), "/tmp/mpv-ipc-bench-shm-%d",
+             (int)getpid());
+
+    mpv_set_option_string(ctx, "vo", "null");
+    mpv_set_option_string(ctx, "ao", "null");
+    mpv_set_option_string(ctx, "idle", "yes");
+    mpv_set_option_string(ctx, "input-ipc-server", socket_path);
+    mpv_set_option_string(ctx, "input-ipc-shm-path", shm_path);
+    if (mpv_initialize(ctx) < 0)
+        fail("mpv_initialize() failed\n");
+
+    bench_client_api();
+    bench_ipc();
+    bench_shm();
+
+    return 0;
+}
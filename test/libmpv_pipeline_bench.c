@@ -0,0 +1,625 @@
+/*
+ * This file is part of mpv.
+ *
+ * mpv is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * mpv is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with mpv.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Measures throughput of the decode, filter, subtitle and demux paths by
+// playing generated sources as fast as possible (--untimed, null outputs).
+// The results are written as JSON to stdout and to <outdir>/pipeline_bench.json,
+// so that they can be compared between builds.
+
+#include <libmpv/client.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Stolen from osdep/compiler.h
+#ifdef __GNUC__
+#define PRINTF_ATTRIBUTE(a1, a2) __attribute__ ((format(printf, a1, a2)))
+#define MP_NORETURN __attribute__((noreturn))
+#else
+#define PRINTF_ATTRIBUTE(a1, a2)
+#define MP_NORETURN
+#endif
+
+// Broken crap with __USE_MINGW_ANSI_STDIO
+#if defined(__MINGW32__) && defined(__GNUC__) && !defined(__clang__)
+#undef PRINTF_ATTRIBUTE
+#define PRINTF_ATTRIBUTE(a1, a2) __attribute__ ((format (gnu_printf, a1, a2)))
+#endif
+
+#define MAX_THREADS 32
+#define NUM_SEEKS 20
+
+// Generated files.
+#define FILE_SECS 20
+#define FILE_FPS 25
+#define FILE_FRAMES (FILE_SECS * FILE_FPS)
+#define LACED_TRACKS 8
+#define LACED_FRAMES (FILE_SECS * 1000 * LACED_TRACKS)
+
+struct thread_cpu {
+    char name[80];
+    double ms;
+};
+
+struct result {
+    const char *name;
+    double startup;         // loadfile to first frame (seconds)
+    double frames;          // video frames output, or packets demuxed
+    double frames_time;     // time it took to process them
+    double bytes;           // bytes demuxed
+    double cache_bytes;     // demuxer cache memory after reading everything
+    double seek_avg, seek_max;
+    struct thread_cpu cpu[MAX_THREADS];
+    int num_cpu;
+};
+
+static mpv_handle *ctx;
+static char *outdir;
+static char *files_to_remove[8];
+static int num_files_to_remove;
+static FILE *json_out;
+static bool json_first = true;
+
+static void exit_cleanup(void)
+{
+    if (ctx)
+        mpv_destroy(ctx);
+    for (int n = 0; n < num_files_to_remove; n++)
+        remove(files_to_remove[n]);
+}
+
+MP_NORETURN PRINTF_ATTRIBUTE(1, 2)
+static void fail(const char *fmt, ...)
+{
+    va_list va;
+    va_start(va, fmt);
+    vfprintf(stderr, fmt, va);
+    va_end(va);
+    exit(1);
+}
+
+static void check_api_error(int status)
+{
+    if (status < 0)
+        fail("libmpv error: %s\n", mpv_error_string(status));
+}
+
+static double now(void)
+{
+    return mpv_get_time_ns(ctx) / 1e9;
+}
+
+// Create a player instance; opts is a NULL terminated list of name/value
+// pairs on top of the defaults for benchmarking.
+static void create_player(const char **opts)
+{
+    ctx = mpv_create();
+    if (!ctx)
+        fail("mpv_create() failed\n");
+
+    check_api_error(mpv_set_option_string(ctx, "vo", "null"));
+    check_api_error(mpv_set_option_string(ctx, "ao", "null"));
+    check_api_error(mpv_set_option_string(ctx, "ao-null-untimed", "yes"));
+    check_api_error(mpv_set_option_string(ctx, "untimed", "yes"));
+    check_api_error(mpv_set_option_string(ctx, "audio-display", "no"));
+    check_api_error(mpv_set_option_string(ctx, "msg-level", "all=warn"));
+    check_api_error(mpv_set_option_string(ctx, "config", "no"));
+    check_api_error(mpv_set_option_string(ctx, "load-scripts", "no"));
+
+    for (int n = 0; opts && opts[n]; n += 2)
+        check_api_error(mpv_set_option_string(ctx, opts[n], opts[n + 1]));
+
+    check_api_error(mpv_initialize(ctx));
+}
+
+static void destroy_player(void)
+{
+    mpv_destroy(ctx);
+    ctx = NULL;
+}
+
+static void loadfile(const char *file)
+{
+    const char *cmd[] = {"loadfile", file, NULL};
+    check_api_error(mpv_command(ctx, cmd));
+}
+
+// Add the CPU time the player threads used since the last call. This must be
+// called regularly, because the perf-info property resets itself if it wasn't
+// queried for a while.
+static void poll_thread_cpu(struct result *r)
+{
+    mpv_node info;
+    if (mpv_get_property(ctx, "perf-info", MPV_FORMAT_NODE, &info) < 0)
+        return;
+    if (info.format != MPV_FORMAT_NODE_ARRAY)
+        goto done;
+
+    for (int n = 0; n < info.u.list->num; n++) {
+        mpv_node *e = &info.u.list->values[n];
+        if (e->format != MPV_FORMAT_NODE_MAP)
+            continue;
+        const char *name = NULL;
+        double value = 0;
+        for (int i = 0; i < e->u.list->num; i++) {
+            mpv_node *v = &e->u.list->values[i];
+            if (!strcmp(e->u.list->keys[i], "name") &&
+                v->format == MPV_FORMAT_STRING)
+                name = v->u.string;
+            if (!strcmp(e->u.list->keys[i], "value") &&
+                v->format == MPV_FORMAT_DOUBLE)
+                value = v->u.double_;
+        }
+        // Per-thread CPU time entries (see stats_register_thread_cputime()).
+        if (!name || (!strstr(name, "/thread") && !strstr(name, "/cpu")))
+            continue;
+        int i = 0;
+        while (i < r->num_cpu && strcmp(r->cpu[i].name, name))
+            i++;
+        if (i == r->num_cpu) {
+            if (r->num_cpu == MAX_THREADS)
+                continue;
+            snprintf(r->cpu[i].name, sizeof(r->cpu[i].name), "%s", name);
+            r->num_cpu++;
+        }
+        r->cpu[i].ms += value;
+    }
+
+done:
+    mpv_free_node_contents(&info);
+}
+
+static double get_cache_bytes(bool *eof)
+{
+    mpv_node state;
+    double bytes = 0;
+    *eof = false;
+    if (mpv_get_property(ctx, "demuxer-cache-state", MPV_FORMAT_NODE, &state) < 0)
+        return 0;
+    if (state.format == MPV_FORMAT_NODE_MAP) {
+        for (int n = 0; n < state.u.list->num; n++) {
+            mpv_node *v = &state.u.list->values[n];
+            const char *key = state.u.list->keys[n];
+            if (!strcmp(key, "total-bytes") && v->format == MPV_FORMAT_INT64)
+                bytes = v->u.int64;
+            if (!strcmp(key, "eof") && v->format == MPV_FORMAT_FLAG)
+                *eof = v->u.flag;
+        }
+    }
+    mpv_free_node_contents(&state);
+    return bytes;
+}
+
+// Wait for the next event of the given type, while sampling CPU usage.
+// Returns the time the event was received.
+static double wait_event(struct result *r, mpv_event_id id)
+{
+    while (1) {
+        mpv_event *ev = mpv_wait_event(ctx, 0.25);
+        double t = now();
+        poll_thread_cpu(r);
+        if (ev->event_id == id) {
+            if (id == MPV_EVENT_END_FILE) {
+                mpv_event_end_file *ef = ev->data;
+                if (ef->reason == MPV_END_FILE_REASON_ERROR)
+                    fail("%s: playback failed: %s\n", r->name,
+                         mpv_error_string(ef->error));
+            }
+            return t;
+        }
+        if (ev->event_id == MPV_EVENT_END_FILE)
+            fail("%s: playback ended unexpectedly\n", r->name);
+        if (ev->event_id == MPV_EVENT_SHUTDOWN)
+            fail("%s: player quit unexpectedly\n", r->name);
+    }
+}
+
+static void json_result(struct result *r)
+{
+    FILE *f = json_out;
+    fprintf(f, "%s\n    {\n", json_first ? "" : ",");
+    json_first = false;
+    fprintf(f, "      \"name\": \"%s\",\n", r->name);
+    if (r->startup > 0)
+        fprintf(f, "      \"startup_ms\": %.3f,\n", r->startup * 1e3);
+    if (r->frames > 0 && r->frames_time > 0) {
+        bool demux = r->bytes > 0;
+        fprintf(f, "      \"%s\": %.2f,\n",
+                demux ? "packets_per_sec" : "frames_per_sec",
+                r->frames / r->frames_time);
+        if (demux)
+            fprintf(f, "      \"bytes_per_sec\": %.0f,\n", r->bytes / r->frames_time);
+    }
+    if (r->cache_bytes > 0)
+        fprintf(f, "      \"demuxer_cache_bytes\": %.0f,\n", r->cache_bytes);
+    if (r->seek_max > 0) {
+        fprintf(f, "      \"seek_avg_ms\": %.3f,\n", r->seek_avg * 1e3);
+        fprintf(f, "      \"seek_max_ms\": %.3f,\n", r->seek_max * 1e3);
+    }
+    fprintf(f, "      \"thread_cpu_ms\": {");
+    for (int n = 0; n < r->num_cpu; n++) {
+        fprintf(f, "%s\n        \"%s\": %.3f", n ? "," : "", r->cpu[n].name,
+                r->cpu[n].ms);
+    }
+    fprintf(f, "%s}\n    }", r->num_cpu ? "\n      " : "");
+
+    fprintf(stderr, "%-16s done\n", r->name);
+}
+
+// Play the file to the end, and measure the time to the first frame and the
+// output frame rate.
+static void bench_playback(const char *name, const char *file, int frames,
+                           const char **opts)
+{
+    struct result r = {.name = name, .frames = frames};
+
+    create_player(opts);
+    poll_thread_cpu(&r); // start collecting
+
+    double start = now();
+    loadfile(file);
+    double first = wait_event(&r, MPV_EVENT_PLAYBACK_RESTART);
+    double end = wait_event(&r, MPV_EVENT_END_FILE);
+
+    r.startup = first - start;
+    r.frames_time = end - first;
+    destroy_player();
+
+    json_result(&r);
+}
+
+// Read the whole file into the demuxer cache while paused (so only the first
+// frame is decoded).
+static void bench_demux(const char *name, const char *file, int packets)
+{
+    struct result r = {.name = name, .frames = packets};
+
+    const char *opts[] = {
+        "pause", "yes",
+        "cache", "yes",
+        "demuxer-max-bytes", "1GiB",
+        NULL
+    };
+    create_player(opts);
+    poll_thread_cpu(&r);
+
+    double start = now();
+    loadfile(file);
+    wait_event(&r, MPV_EVENT_FILE_LOADED);
+
+    bool eof = false;
+    while (!eof) {
+        mpv_event *ev = mpv_wait_event(ctx, 0.005);
+        if (ev->event_id == MPV_EVENT_END_FILE)
+            fail("%s: playback ended unexpectedly\n", name);
+        r.cache_bytes = get_cache_bytes(&eof);
+    }
+    r.frames_time = now() - start;
+    poll_thread_cpu(&r);
+
+    FILE *fp = fopen(file, "rb");
+    if (fp) {
+        fseek(fp, 0, SEEK_END);
+        r.bytes = ftell(fp);
+        fclose(fp);
+    }
+    destroy_player();
+
+    json_result(&r);
+}
+
+// Time from issuing a seek until the new position is displayed.
+static void bench_seek(const char *name, const char *file)
+{
+    struct result r = {.name = name};
+
+    const char *opts[] = {"pause", "yes", "hr-seek", "yes", NULL};
+    create_player(opts);
+    poll_thread_cpu(&r);
+
+    double start = now();
+    loadfile(file);
+    r.startup = wait_event(&r, MPV_EVENT_PLAYBACK_RESTART) - start;
+
+    double total = 0;
+    for (int n = 0; n < NUM_SEEKS; n++) {
+        // Jump around the file in a fixed pattern.
+        char target[40];
+        snprintf(target, sizeof(target), "%f",
+                 (n * 7 % NUM_SEEKS) * (FILE_SECS - 1.0) / NUM_SEEKS + 0.5);
+        const char *cmd[] = {"seek", target, "absolute+exact", NULL};
+        start = now();
+        check_api_error(mpv_command(ctx, cmd));
+        double t = wait_event(&r, MPV_EVENT_PLAYBACK_RESTART) - start;
+        total += t;
+        if (t > r.seek_max)
+            r.seek_max = t;
+    }
+    r.seek_avg = total / NUM_SEEKS;
+    destroy_player();
+
+    json_result(&r);
+}
+
+static char *out_file(const char *name)
+{
+    size_t len = strlen(outdir) + strlen(name) + 2;
+    char *path = malloc(len);
+    if (!path)
+        fail("out of memory\n");
+    snprintf(path, len, "%s/%s", outdir, name);
+    return path;
+}
+
+// Encode a test file, which is then used to benchmark demuxing and decoding
+// of real (compressed) data. Returns false if encoding is unavailable.
+static bool create_file(const char *path, const char *format)
+{
+    const char *opts[] = {
+        "o", path,
+        "of", format,
+        "ovc", "mpeg2video",
+        "ovcopts", "g=25,b=4M",
+        "untimed", "no", // encoding mode handles timing itself
+        NULL
+    };
+    create_player(opts);
+    char src[100];
+    snprintf(src, sizeof(src), "av://lavfi:testsrc2=size=1280x720:rate=%d:"
+             "duration=%d", FILE_FPS, FILE_SECS);
+    loadfile(src);
+    mpv_event *ev;
+    do {
+        ev = mpv_wait_event(ctx, -1);
+    } while (ev->event_id != MPV_EVENT_END_FILE);
+    mpv_event_end_file *ef = ev->data;
+    bool ok = ef->reason == MPV_END_FILE_REASON_EOF;
+    destroy_player();
+
+    files_to_remove[num_files_to_remove++] = (char *)path;
+    if (!ok)
+        fprintf(stderr, "Could not create %s, skipping it.\n", path);
+    return ok;
+}
+
+static void put_id(FILE *f, uint32_t id)
+{
+    for (int shift = 24; shift >= 0; shift -= 8) {
+        if (id >> shift)
+            fputc((id >> shift) & 0xFF, f);
+    }
+}
+
+static void put_be(FILE *f, uint64_t val, int bytes)
+{
+    while (bytes--)
+        fputc((val >> (bytes * 8)) & 0xFF, f);
+}
+
+static void put_uint(FILE *f, uint32_t id, uint64_t val)
+{
+    put_id(f, id);
+    fputc(0x88, f);
+    put_be(f, val, 8);
+}
+
+static void put_float(FILE *f, uint32_t id, double val)
+{
+    uint64_t bits;
+    memcpy(&bits, &val, sizeof(bits));
+    put_uint(f, id, bits);
+}
+
+static void put_string(FILE *f, uint32_t id, const char *str)
+{
+    put_id(f, id);
+    fputc(0x80 | strlen(str), f);
+    fputs(str, f);
+}
+
+// Master elements use 8 byte size fields, which are filled in by end_master().
+static long start_master(FILE *f, uint32_t id)
+{
+    put_id(f, id);
+    put_be(f, 0x01ULL << 56, 8);
+    return ftell(f);
+}
+
+static void end_master(FILE *f, long start)
+{
+    long end = ftell(f);
+    fseek(f, start - 7, SEEK_SET);
+    put_be(f, end - start, 7);
+    fseek(f, end, SEEK_SET);
+}
+
+// Many tracks with small packets, so that the time is dominated by Matroska
+// block parsing rather than by reading the data: 8 tracks of 48 kHz PCM with
+// 1 ms frames. Half of them use SimpleBlocks, the other half BlockGroups with
+// 4 EBML laced frames each. Written by hand, because libavformat doesn't lace.
+static char *create_laced_mkv(void)
+{
+    char *path = out_file("pipeline_bench_laced.mkv");
+    FILE *f = fopen(path, "wb");
+    if (!f)
+        fail("could not create %s\n", path);
+    files_to_remove[num_files_to_remove++] = path;
+
+    long ebml = start_master(f, 0x1A45DFA3);
+    put_string(f, 0x4282, "matroska");
+    put_uint(f, 0x4287, 4);
+    put_uint(f, 0x4285, 2);
+    end_master(f, ebml);
+
+    long segment = start_master(f, 0x18538067);
+    long info = start_master(f, 0x1549A966);
+    put_uint(f, 0x2AD7B1, 1000000);
+    end_master(f, info);
+
+    long tracks = start_master(f, 0x1654AE6B);
+    for (int t = 1; t <= LACED_TRACKS; t++) {
+        long entry = start_master(f, 0xAE);
+        put_uint(f, 0xD7, t);
+        put_uint(f, 0x73C5, t);
+        put_uint(f, 0x83, 2);
+        put_string(f, 0x86, "A_PCM/INT/LIT");
+        put_uint(f, 0x23E383, 1000000);
+        long audio = start_master(f, 0xE1);
+        put_float(f, 0xB5, 48000);
+        put_uint(f, 0x9F, 1);
+        put_uint(f, 0x6264, 16);
+        end_master(f, audio);
+        end_master(f, entry);
+    }
+    end_master(f, tracks);
+
+    uint8_t frame[96];
+    for (int n = 0; n < sizeof(frame); n++)
+        frame[n] = n * 7;
+
+    for (int sec = 0; sec < FILE_SECS; sec++) {
+        long cluster = start_master(f, 0x1F43B675);
+        put_uint(f, 0xE7, sec * 1000);
+        for (int ms = 0; ms < 1000; ms++) {
+            for (int t = 1; t <= LACED_TRACKS / 2; t++) {
+                put_id(f, 0xA3);
+                fputc(0x80 | (4 + sizeof(frame)), f);
+                fputc(0x80 | t, f);
+                put_be(f, ms, 2);
+                fputc(0x80, f); // keyframe, no lacing
+                fwrite(frame, sizeof(frame), 1, f);
+            }
+            if (ms % 4)
+                continue;
+            for (int t = LACED_TRACKS / 2 + 1; t <= LACED_TRACKS; t++) {
+                long group = start_master(f, 0xA0);
+                long block = start_master(f, 0xA1);
+                fputc(0x80 | t, f);
+                put_be(f, ms, 2);
+                fputc(0x06, f);     // EBML lacing
+                fputc(4 - 1, f);    // number of frames - 1
+                fputc(0x80 | sizeof(frame), f);
+                fputc(0xBF, f);     // size difference 0
+                fputc(0xBF, f);
+                for (int n = 0; n < 4; n++)
+                    fwrite(frame, sizeof(frame), 1, f);
+                end_master(f, block);
+                put_uint(f, 0x9B, 4);
+                end_master(f, group);
+            }
+        }
+        end_master(f, cluster);
+    }
+    end_master(f, segment);
+
+    fclose(f);
+    return path;
+}
+
+// Subtitles with a lot of styled events, rendered into the video by vf_sub.
+static char *create_subs(void)
+{
+    char *path = out_file("pipeline_bench.ass");
+    FILE *f = fopen(path, "wb");
+    if (!f)
+        fail("could not create %s\n", path);
+    files_to_remove[num_files_to_remove++] = path;
+
+    fprintf(f, "[Script Info]\nScriptType: v4.00+\nPlayResX: 1280\n"
+            "PlayResY: 720\n\n[V4+ Styles]\nFormat: Name, Fontsize, "
+            "PrimaryColour, Outline, Shadow, Alignment\n"
+            "Style: Default,40,&H00FFFFFF,2,1,2\n\n[Events]\n"
+            "Format: Layer, Start, End, Style, Text\n");
+    for (int n = 0; n < 100; n++) {
+        for (int l = 0; l < 4; l++) {
+            fprintf(f, "Dialogue: %d,0:00:%02d.%02d,0:00:%02d.%02d,Default,"
+                    "{\\pos(%d,%d)\\blur2}Line %d of event %d\n", l,
+                    n / 10, n % 10 * 10, (n + 5) / 10, (n + 5) % 10 * 10,
+                    100 + l * 250, 100 + (n % 5) * 120, l, n);
+        }
+    }
+    fclose(f);
+    return path;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc != 2)
+        fail("usage: %s <output directory>\n", argv[0]);
+    outdir = argv[1];
+
+    atexit(exit_cleanup);
+
+    char *json_path = out_file("pipeline_bench.json");
+    json_out = fopen(json_path, "wb");
+    if (!json_out)
+        fail("could not create %s\n", json_path);
+
+    create_player(NULL);
+    char *version = mpv_get_property_string(ctx, "mpv-version");
+    fprintf(json_out, "{\n  \"mpv_version\": \"%s\",\n  \"benchmarks\": [",
+            version ? version : "unknown");
+    mpv_free(version);
+    destroy_player();
+
+    bench_playback("decode",
+                   "av://lavfi:testsrc2=size=1920x1080:rate=60:duration=10",
+                   600, NULL);
+
+    const char *filter_opts[] = {"vf", "hflip,scale=w=960:h=540,format=rgb24", NULL};
+    bench_playback("filter",
+                   "av://lavfi:testsrc2=size=1920x1080:rate=60:duration=10",
+                   600, filter_opts);
+
+    char *subs = create_subs();
+    const char *sub_opts[] = {"vf", "sub", "sub-files", subs, NULL};
+    bench_playback("subtitle",
+                   "av://lavfi:testsrc2=size=1280x720:rate=30:duration=10",
+                   300, sub_opts);
+
+    char *mkv = out_file("pipeline_bench.mkv");
+    if (create_file(mkv, "matroska")) {
+        bench_playback("decode-mkv", mkv, FILE_FRAMES, NULL);
+        bench_demux("demux-mkv", mkv, FILE_FRAMES);
+        bench_seek("seek-mkv", mkv);
+    }
+
+    char *ts = out_file("pipeline_bench.ts");
+    if (create_file(ts, "mpegts"))
+        bench_demux("demux-ts", ts, FILE_FRAMES);
+
+    bench_demux("demux-mkv-laced", create_laced_mkv(), LACED_FRAMES);
+
+    fprintf(json_out, "\n  ]\n}\n");
+    fclose(json_out);
+
+    // Also print it, so it ends up in the meson log.
+    FILE *f = fopen(json_path, "rb");
+    if (f) {
+        char buf[4096];
+        size_t len;
+        while ((len = fread(buf, 1, sizeof(buf), f)))
+            fwrite(buf, 1, len, stdout);
+        fclose(f);
+    }
+    free(json_path);
+
+    return 0;
+}
@@ -223,6 +223,19 @@ static void test_lavfi_complex(char *file)
         fail("Lavfi complex failed!\n");
 }
 
+// The last --stream-record file is completed when playback ends, and must
+// still be reported.
+static void test_stream_record(char *file)
+{
+    const char *path = "libmpv-test-record.nut";
+    check_api_error(mpv_set_property_string(ctx, "stream-record", path));
+    test_file_loading(file);
+    check_string("stream-record-file", path);
+    check_api_error(mpv_set_property_string(ctx, "stream-record", ""));
+    if (remove(path))
+        fail("Recorded file was not created!\n");
+}
+
 // Ensure that setting options/properties work correctly and
 // have the expected values.
 static void test_options_and_properties(void)
@@ -271,6 +284,55 @@ static void test_options_and_properties(void)
         fail("Node: expected 1 but got %d'!\n", result_node.u.flag);
 }
 
+// Debug messages that only go to the log file are queued without taking the
+// global log lock. mp_cmd_dump() logs the command in several partial lines,
+// which must still be merged into one message. If subscribe is set, a client
+// requests the messages too, so they take the normal path.
+static void test_log_file(int subscribe)
+{
+    const char *path = "libmpv-test.log";
+    mpv_handle *h = mpv_create();
+    if (!h)
+        fail("mpv_create failed\n");
+    check_api_error(mpv_set_option_string(h, "log-file", path));
+    if (subscribe)
+        check_api_error(mpv_request_log_messages(h, "debug"));
+    check_api_error(mpv_initialize(h));
+    check_api_error(mpv_command_string(h, "print-text log-file-test"));
+
+    int found = !subscribe;
+    while (!found) {
+        mpv_event *ev = mpv_wait_event(h, 10);
+        if (ev->event_id == MPV_EVENT_NONE)
+            fail("Log message not received!\n");
+        if (ev->event_id != MPV_EVENT_LOG_MESSAGE)
+            continue;
+        mpv_event_log_message *msg = (mpv_event_log_message*)ev->data;
+        if (strstr(msg->text, "Run command: print-text")) {
+            if (msg->log_level != MPV_LOG_LEVEL_DEBUG ||
+                !strstr(msg->text, "log-file-test"))
+                fail("Unexpected log message: %s", msg->text);
+            found = 1;
+        }
+    }
+    mpv_destroy(h);
+
+    FILE *f = fopen(path, "r");
+    if (!f)
+        fail("Log file was not created!\n");
+    char line[4096];
+    found = 0;
+    while (fgets(line, sizeof(line), f)) {
+        if (strstr(line, "Run command: print-text") &&
+            strstr(line, "log-file-test"))
+            found = 1;
+    }
+    fclose(f);
+    remove(path);
+    if (!found)
+        fail("Message not found in log file!\n");
+}
+
 int main(int argc, char *argv[])
 {
     if (argc != 2)
@@ -294,6 +356,12 @@ int main(int argc, char *argv[])
     test_file_loading(argv[1]);
     printf(fmt, "test_lavfi_complex");
     test_lavfi_complex(argv[1]);
+    printf(fmt, "test_stream_record");
+    test_stream_record(argv[1]);
+    printf(fmt, "test_log_file");
+    test_log_file(0);
+    printf(fmt, "test_log_file_subscribed");
+    test_log_file(1);
 
     printf("================ SHUTDOWN ================\n");
     mpv_command_string(ctx, "quit");
@@ -0,0 +1,242 @@
+#include <stdatomic.h>
+
+#include "misc/spsc_queue.h"
+#include "osdep/threads.h"
+#include "osdep/timer.h"
+#include "test_utils.h"
+
+struct item {
+    uint64_t seq;
+    uint64_t check;
+};
+
+#define CHECK(seq) ((seq) * 0x9E3779B97F4A7C15ull)
+
+static void test_basic(void)
+{
+    struct mp_spsc_queue *q = mp_spsc_queue_create(NULL, sizeof(struct item));
+
+    assert_true(!mp_spsc_queue_peek(q));
+
+    // Wrap around and grow the ring a few times, with items in the middle.
+    uint64_t next_in = 0, next_out = 0;
+    for (int round = 0; round < 10; round++) {
+        int num = 5 + round * 13;
+        for (int n = 0; n < num; n++) {
+            mp_spsc_queue_reserve(q);
+            mp_spsc_queue_enter(q, MP_SPSC_PRODUCER);
+            mp_spsc_queue_push(q, &(struct item){next_in, CHECK(next_in)});
+            mp_spsc_queue_leave(q, MP_SPSC_PRODUCER);
+            next_in++;
+        }
+        assert_int_equal(mp_spsc_queue_count(q), next_in - next_out);
+        for (int n = 0; n < num / 2; n++) {
+            mp_spsc_queue_enter(q, MP_SPSC_CONSUMER);
+            struct item *it = mp_spsc_queue_peek(q);
+            assert_true(it);
+            assert_int_equal(it->seq, next_out);
+            assert_true(it->check == CHECK(next_out));
+            mp_spsc_queue_pop(q);
+            mp_spsc_queue_leave(q, MP_SPSC_CONSUMER);
+            next_out++;
+        }
+    }
+
+    mp_spsc_queue_lock(q);
+    size_t count = mp_spsc_queue_count(q);
+    for (size_t n = 0; n < count; n++) {
+        struct item *it = mp_spsc_queue_get(q, n);
+        assert_int_equal(it->seq, next_out + n);
+    }
+    mp_spsc_queue_clear(q);
+    assert_int_equal(mp_spsc_queue_count(q), 0);
+    mp_spsc_queue_unlock(q);
+
+    assert_true(!mp_spsc_queue_peek(q));
+
+    talloc_free(q);
+}
+
+#define STRESS_ITEMS 2000000
+#define STRESS_MAX_QUEUED 5000
+
+struct stress {
+    struct mp_spsc_queue *q;
+    atomic_bool producer_done;
+    atomic_bool consumer_done;
+    uint64_t consumed;
+    uint64_t cleared;
+    int clears;
+};
+
+static MP_THREAD_VOID producer_thread(void *ptr)
+{
+    struct stress *s = ptr;
+
+    for (uint64_t seq = 1; seq <= STRESS_ITEMS; seq++) {
+        while (mp_spsc_queue_count(s->q) > STRESS_MAX_QUEUED)
+            mp_sleep_ns(1000);
+        mp_spsc_queue_reserve(s->q);
+        mp_spsc_queue_enter(s->q, MP_SPSC_PRODUCER);
+        mp_spsc_queue_push(s->q, &(struct item){seq, CHECK(seq)});
+        mp_spsc_queue_leave(s->q, MP_SPSC_PRODUCER);
+    }
+
+    atomic_store(&s->producer_done, true);
+    MP_THREAD_RETURN();
+}
+
+static MP_THREAD_VOID consumer_thread(void *ptr)
+{
+    struct stress *s = ptr;
+    uint64_t last = 0;
+
+    while (1) {
+        bool done = atomic_load(&s->producer_done);
+        mp_spsc_queue_enter(s->q, MP_SPSC_CONSUMER);
+        struct item *it = mp_spsc_queue_peek(s->q);
+        if (it) {
+            // Items can be dropped by clearing, but never reordered.
+            assert_true(it->seq > last);
+            assert_true(it->check == CHECK(it->seq));
+            last = it->seq;
+            mp_spsc_queue_pop(s->q);
+            s->consumed++;
+        }
+        mp_spsc_queue_leave(s->q, MP_SPSC_CONSUMER);
+        if (!it && done)
+            break;
+    }
+
+    atomic_store(&s->consumer_done, true);
+    MP_THREAD_RETURN();
+}
+
+static void test_stress(void)
+{
+    struct stress s = {
+        .q = mp_spsc_queue_create(NULL, sizeof(struct item)),
+    };
+
+    mp_thread producer, consumer;
+    assert_false(mp_thread_create(&producer, producer_thread, &s));
+    assert_false(mp_thread_create(&consumer, consumer_thread, &s));
+
+    // Clear the queue asynchronously, like mp_async_queue_reset() does.
+    while (!atomic_load(&s.consumer_done)) {
+        mp_spsc_queue_lock(s.q);
+        size_t count = mp_spsc_queue_count(s.q);
+        for (size_t n = 0; n + 1 < count; n++) {
+            struct item *a = mp_spsc_queue_get(s.q, n);
+            struct item *b = mp_spsc_queue_get(s.q, n + 1);
+            assert_true(a->seq < b->seq);
+        }
+        mp_spsc_queue_clear(s.q);
+        s.cleared += count;
+        s.clears++;
+        mp_spsc_queue_unlock(s.q);
+        mp_sleep_ns(MP_TIME_US_TO_NS(200));
+    }
+
+    mp_thread_join(producer);
+    mp_thread_join(consumer);
+
+    assert_int_equal(s.consumed + s.cleared, STRESS_ITEMS);
+    assert_true(s.clears > 0);
+    assert_int_equal(mp_spsc_queue_count(s.q), 0);
+
+    talloc_free(s.q);
+}
+
+#define LOCKER_THREADS 3
+#define LOCKER_ITERATIONS 2000
+
+struct lockers {
+    struct mp_spsc_queue *q;
+    atomic_int locked;
+    atomic_int entered;
+    atomic_bool done;
+};
+
+static MP_THREAD_VOID locker_thread(void *ptr)
+{
+    struct lockers *s = ptr;
+
+    for (int n = 0; n < LOCKER_ITERATIONS; n++) {
+        mp_spsc_queue_lock(s->q);
+        assert_int_equal(atomic_fetch_add(&s->locked, 1), 0);
+        assert_int_equal(atomic_load(&s->entered), 0);
+        mp_sleep_ns(1000);
+        assert_int_equal(atomic_fetch_sub(&s->locked, 1), 1);
+        mp_spsc_queue_unlock(s->q);
+    }
+
+    MP_THREAD_RETURN();
+}
+
+static MP_THREAD_VOID end_thread(void *ptr, enum mp_spsc_queue_end end)
+{
+    struct lockers *s = ptr;
+
+    // Keep the ends busy, so that the lockers have to wait for them, and
+    // check that no locker is active while they are entered.
+    for (uint64_t seq = 1; !atomic_load(&s->done); seq++) {
+        if (end == MP_SPSC_PRODUCER)
+            mp_spsc_queue_reserve(s->q);
+        mp_spsc_queue_enter(s->q, end);
+        atomic_fetch_add(&s->entered, 1);
+        assert_int_equal(atomic_load(&s->locked), 0);
+        mp_sleep_ns(1000);
+        if (end == MP_SPSC_PRODUCER) {
+            mp_spsc_queue_push(s->q, &(struct item){seq, CHECK(seq)});
+        } else if (mp_spsc_queue_peek(s->q)) {
+            mp_spsc_queue_pop(s->q);
+        }
+        atomic_fetch_sub(&s->entered, 1);
+        mp_spsc_queue_leave(s->q, end);
+    }
+
+    MP_THREAD_RETURN();
+}
+
+static MP_THREAD_VOID producer_end_thread(void *ptr)
+{
+    return end_thread(ptr, MP_SPSC_PRODUCER);
+}
+
+static MP_THREAD_VOID consumer_end_thread(void *ptr)
+{
+    return end_thread(ptr, MP_SPSC_CONSUMER);
+}
+
+// Exclusive access must stay exclusive with multiple threads taking it.
+static void test_lockers(void)
+{
+    struct lockers s = {
+        .q = mp_spsc_queue_create(NULL, sizeof(struct item)),
+    };
+
+    mp_thread producer, consumer, lockers[LOCKER_THREADS];
+    assert_false(mp_thread_create(&producer, producer_end_thread, &s));
+    assert_false(mp_thread_create(&consumer, consumer_end_thread, &s));
+    for (int n = 0; n < LOCKER_THREADS; n++)
+        assert_false(mp_thread_create(&lockers[n], locker_thread, &s));
+
+    for (int n = 0; n < LOCKER_THREADS; n++)
+        mp_thread_join(lockers[n]);
+    atomic_store(&s.done, true);
+    mp_thread_join(producer);
+    mp_thread_join(consumer);
+
+    talloc_free(s.q);
+}
+
+int main(void)
+{
+    mp_time_init();
+
+    test_basic();
+    test_stress();
+    test_lockers();
+    return 0;
+}
@@ -0,0 +1,194 @@
+#include "osdep/timer.h"
+#include "test_utils.h"
+
+static int destructor_calls;
+
+static void count_destructor(void *p)
+{
+    destructor_calls++;
+}
+
+static void test_arena_basic(void)
+{
+    void *arena = ta_new_arena(NULL);
+    assert_true(arena);
+    assert_int_equal(ta_get_size(arena), 0);
+
+    destructor_calls = 0;
+    char *last = NULL;
+    for (int n = 0; n < 1000; n++) {
+        char *s = ta_asprintf(n % 2 || !last ? arena : last, "item %d", n);
+        ta_set_destructor(s, count_destructor);
+        if (n % 2 || !last)
+            last = s;
+    }
+    assert_string_equal(last, "item 999");
+
+    // Freeing single allocations works, and runs the destructors.
+    char *s = ta_strdup(arena, "single");
+    ta_set_destructor(s, count_destructor);
+    ta_free(s);
+    assert_int_equal(destructor_calls, 1);
+
+    // A large allocation is not taken from the arena, but is still a child.
+    int *big = ta_new_array(arena, int, 100000);
+    big[99999] = 1;
+    ta_set_destructor(big, count_destructor);
+
+    ta_free(arena);
+    assert_int_equal(destructor_calls, 1002);
+}
+
+static void test_arena_realloc(void)
+{
+    void *arena = ta_new_arena(NULL);
+
+    // Grow within the arena, and out of it (past the maximum arena size).
+    int *arr = NULL;
+    for (int n = 0; n < 10000; n++) {
+        arr = ta_realloc(arena, arr, int, n + 1);
+        arr[n] = n;
+        if (n == 10) {
+            void *child = ta_new_context(arr);
+            ta_set_destructor(child, count_destructor);
+        }
+    }
+    for (int n = 0; n < 10000; n++)
+        assert_int_equal(arr[n], n);
+
+    // Shrinking keeps the contents.
+    arr = ta_realloc(arena, arr, int, 5);
+    assert_int_equal(ta_get_size(arr), 5 * sizeof(int));
+    assert_int_equal(arr[4], 4);
+
+    destructor_calls = 0;
+    ta_free(arena);
+    assert_int_equal(destructor_calls, 1);
+}
+
+static char *arena_str(void *parent, const char *str)
+{
+    // Not ta_strdup(), to make sure this is allocated from the arena directly.
+    char *s = ta_alloc_size(parent, strlen(str) + 1);
+    strcpy(s, str);
+    return s;
+}
+
+static void test_arena_escape(void)
+{
+    void *arena = ta_new_arena(NULL);
+    void *owner = ta_new_context(NULL);
+
+    char *a = arena_str(arena, "escaped to NULL");
+    char *b = arena_str(arena, "escaped to owner");
+    char *b_child = arena_str(b, "child");
+    char *b_grandchild = arena_str(b_child, "grandchild");
+    char *c = arena_str(arena, "moved back");
+
+    ta_set_parent(a, NULL);
+    ta_set_parent(b, owner);
+    ta_set_parent(c, NULL);
+    ta_set_parent(c, arena);
+
+    destructor_calls = 0;
+    ta_set_destructor(c, count_destructor);
+    ta_free(arena);
+    assert_int_equal(destructor_calls, 1);
+
+    // The arena memory must stay valid for allocations moved out of it.
+    assert_string_equal(a, "escaped to NULL");
+    assert_string_equal(b, "escaped to owner");
+    assert_string_equal(b_child, "child");
+    assert_string_equal(b_grandchild, "grandchild");
+    char *b_child2 = arena_str(b, "new child");
+    assert_string_equal(b_child2, "new child");
+
+    // Freeing the escaped parent first must not free the memory of the
+    // children, which were escaped with it.
+    ta_set_parent(b_child, NULL);
+    ta_free(owner);
+    assert_string_equal(b_child, "child");
+    assert_string_equal(b_grandchild, "grandchild");
+    ta_free(b_child);
+
+    ta_free(a);
+}
+
+static void test_arena_realloc_escape(void)
+{
+    // An escaped block that grows out of the arena memory must keep the
+    // arena alive for its children.
+    void *arena = ta_new_arena(NULL);
+    char *a = ta_alloc_size(arena, 16);
+    ta_set_parent(a, NULL);
+    char *child = arena_str(a, "child");
+    ta_free(arena);
+    a = ta_realloc_size(NULL, a, 8000);
+    assert_string_equal(child, "child");
+    ta_free(a);
+
+    // Same for a block that grew out of the arena memory, and then escaped.
+    arena = ta_new_arena(NULL);
+    a = ta_alloc_size(arena, 16);
+    child = arena_str(a, "child");
+    a = ta_realloc_size(NULL, a, 8000);
+    ta_set_parent(a, NULL);
+    ta_free(arena);
+    assert_string_equal(child, "child");
+    ta_free(a);
+
+    // And for children of a block that left the arena memory without having
+    // any children.
+    arena = ta_new_arena(NULL);
+    a = ta_alloc_size(arena, 16);
+    a = ta_realloc_size(NULL, a, 8000);
+    child = arena_str(a, "child");
+    ta_set_parent(a, NULL);
+    ta_free(arena);
+    assert_string_equal(child, "child");
+    ta_free(a);
+}
+
+#define BENCH_TREES 2000
+#define BENCH_NODES 500
+
+static int64_t bench_tree(bool use_arena)
+{
+    int64_t start = mp_time_ns();
+    for (int t = 0; t < BENCH_TREES; t++) {
+        void *root = use_arena ? ta_new_arena(NULL) : ta_new_context(NULL);
+        void *parent = root;
+        for (int n = 0; n < BENCH_NODES; n++) {
+            void *p = ta_alloc_size(parent, 16 + n % 64);
+            if (n % 16 == 0)
+                parent = p;
+        }
+        ta_free(root);
+    }
+    return mp_time_ns() - start;
+}
+
+static void bench(void)
+{
+    int64_t t_malloc = bench_tree(false);
+    int64_t t_arena = bench_tree(true);
+    int allocs = BENCH_TREES * BENCH_NODES;
+    printf("malloc: %.1f ns/alloc\n", t_malloc / (double)allocs);
+    printf("arena:  %.1f ns/alloc\n", t_arena / (double)allocs);
+}
+
+int main(int argc, char *argv[])
+{
+    mp_time_init();
+
+    if (argc > 1 && strcmp(argv[1], "bench") == 0) {
+        bench();
+        return 0;
+    }
+
+    test_arena_basic();
+    test_arena_realloc();
+    test_arena_escape();
+    test_arena_realloc_escape();
+    return 0;
+}
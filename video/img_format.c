@@ -23,6 +23,7 @@
 #include <libavutil/pixfmt.h>
 #include <libavutil/pixdesc.h>
 
+#include "osdep/threads.h"
 #include "video/img_format.h"
 #include "video/mp_image.h"
 #include "video/fmt-conversion.h"
@@ -559,7 +560,7 @@ int mp_imgfmt_desc_get_num_comps(struct mp_imgfmt_desc *desc)
     return 3 + (flags & MP_IMGFLAG_GRAY ? -2 : 0) + !!(flags & MP_IMGFLAG_ALPHA);
 }
 
-struct mp_imgfmt_desc mp_imgfmt_get_desc(int mpfmt)
+static struct mp_imgfmt_desc compute_desc(int mpfmt)
 {
     struct mp_imgfmt_desc desc;
 
@@ -702,11 +703,11 @@ int mp_find_other_endian(int imgfmt)
     return pixfmt2imgfmt(av_pix_fmt_swap_endianness(imgfmt2pixfmt(imgfmt)));
 }
 
-bool mp_get_regular_imgfmt(struct mp_regular_imgfmt *dst, int imgfmt)
+static bool compute_regular_imgfmt(struct mp_regular_imgfmt *dst,
+                                   struct mp_imgfmt_desc desc)
 {
     struct mp_regular_imgfmt res = {0};
 
-    struct mp_imgfmt_desc desc = mp_imgfmt_get_desc(imgfmt);
     if (!desc.num_planes)
         return false;
     res.num_planes = desc.num_planes;
@@ -766,6 +767,48 @@ bool mp_get_regular_imgfmt(struct mp_regular_imgfmt *dst, int imgfmt)
     return true;
 }
 
+// The descriptors never change at runtime, but are somewhat expensive to
+// compute, and are looked up all the time (e.g. on each mp_image_setfmt()).
+// So compute them for all formats on first use.
+#define NUM_IMGFMTS (IMGFMT_END - IMGFMT_START)
+
+static struct mp_imgfmt_desc imgfmt_descs[NUM_IMGFMTS];
+static struct mp_regular_imgfmt regular_imgfmts[NUM_IMGFMTS];
+static bool regular_imgfmt_valid[NUM_IMGFMTS];
+static mp_once imgfmt_tables_once = MP_STATIC_ONCE_INITIALIZER;
+
+static void init_imgfmt_tables(void)
+{
+    for (int n = 1; n < NUM_IMGFMTS; n++) {
+        imgfmt_descs[n] = compute_desc(IMGFMT_START + n);
+        regular_imgfmt_valid[n] =
+            compute_regular_imgfmt(&regular_imgfmts[n], imgfmt_descs[n]);
+    }
+}
+
+static bool imgfmt_in_range(int imgfmt)
+{
+    if (imgfmt <= IMGFMT_START || imgfmt >= IMGFMT_END)
+        return false;
+    mp_exec_once(&imgfmt_tables_once, init_imgfmt_tables);
+    return true;
+}
+
+struct mp_imgfmt_desc mp_imgfmt_get_desc(int mpfmt)
+{
+    if (!imgfmt_in_range(mpfmt))
+        return (struct mp_imgfmt_desc){0};
+    return imgfmt_descs[mpfmt - IMGFMT_START];
+}
+
+bool mp_get_regular_imgfmt(struct mp_regular_imgfmt *dst, int imgfmt)
+{
+    if (!imgfmt_in_range(imgfmt) || !regular_imgfmt_valid[imgfmt - IMGFMT_START])
+        return false;
+    *dst = regular_imgfmts[imgfmt - IMGFMT_START];
+    return true;
+}
+
 static bool regular_imgfmt_equals(struct mp_regular_imgfmt *a,
                                   struct mp_regular_imgfmt *b)
 {
@@ -794,10 +837,11 @@ static bool regular_imgfmt_equals(struct mp_regular_imgfmt *a,
 // Find a format that matches this one exactly.
 int mp_find_regular_imgfmt(struct mp_regular_imgfmt *src)
 {
-    for (int n = IMGFMT_START + 1; n < IMGFMT_END; n++) {
-        struct mp_regular_imgfmt f;
-        if (mp_get_regular_imgfmt(&f, n) && regular_imgfmt_equals(src, &f))
-            return n;
+    mp_exec_once(&imgfmt_tables_once, init_imgfmt_tables);
+    for (int n = 1; n < NUM_IMGFMTS; n++) {
+        if (regular_imgfmt_valid[n] &&
+            regular_imgfmt_equals(src, &regular_imgfmts[n]))
+            return IMGFMT_START + n;
     }
     return 0;
 }
@@ -808,11 +852,37 @@ int mp_find_regular_imgfmt(struct mp_regular_imgfmt *src)
 // Returns the imgfmt, or 0 on error.
 int mp_imgfmt_select_best(int dst1, int dst2, int src)
 {
+    // Format negotiation asks the same questions over and over, and the
+    // libavcodec function is slow. Remember recent results (the cache is
+    // direct-mapped; a colliding entry simply replaces the old one).
+    static mp_static_mutex cache_lock = MP_STATIC_MUTEX_INITIALIZER;
+    static struct { int dst1, dst2, src, res; } cache[256];
+
+    unsigned hash = ((unsigned)dst1 * 31u + (unsigned)dst2) * 31u + (unsigned)src;
+    hash = (hash ^ (hash >> 8)) % MP_ARRAY_SIZE(cache);
+
+    mp_mutex_lock(&cache_lock);
+    bool hit = cache[hash].res && cache[hash].dst1 == dst1 &&
+               cache[hash].dst2 == dst2 && cache[hash].src == src;
+    int res = hit ? cache[hash].res : 0;
+    mp_mutex_unlock(&cache_lock);
+    if (hit)
+        return res;
+
     enum AVPixelFormat dst1pxf = imgfmt2pixfmt(dst1);
     enum AVPixelFormat dst2pxf = imgfmt2pixfmt(dst2);
     enum AVPixelFormat srcpxf = imgfmt2pixfmt(src);
     enum AVPixelFormat dstlist[] = {dst1pxf, dst2pxf, AV_PIX_FMT_NONE};
-    return pixfmt2imgfmt(avcodec_find_best_pix_fmt_of_list(dstlist, srcpxf, 1, 0));
+    res = pixfmt2imgfmt(avcodec_find_best_pix_fmt_of_list(dstlist, srcpxf, 1, 0));
+
+    mp_mutex_lock(&cache_lock);
+    cache[hash].dst1 = dst1;
+    cache[hash].dst2 = dst2;
+    cache[hash].src = src;
+    cache[hash].res = res;
+    mp_mutex_unlock(&cache_lock);
+
+    return res;
 }
 
 // Same as mp_imgfmt_select_best(), but with a list of dst formats.
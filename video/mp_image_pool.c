@@ -18,6 +18,7 @@
 #include "config.h"
 
 #include <stddef.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <assert.h>
 
@@ -36,21 +37,36 @@
 #include "fmt-conversion.h"
 #include "mp_image_pool.h"
 #include "mp_image.h"
-#include "osdep/threads.h"
 
-static mp_static_mutex pool_mutex = MP_STATIC_MUTEX_INITIALIZER;
-#define pool_lock() mp_mutex_lock(&pool_mutex)
-#define pool_unlock() mp_mutex_unlock(&pool_mutex)
+// Free images of at most this many different formats/sizes are kept, so that
+// switching back and forth between a few sizes doesn't reallocate every time.
+#define MAX_BUCKETS 3
+
+// If all pools together hold more than this, a pool that needs to allocate a
+// new image first frees its unused images.
+#define POOL_BUDGET_BYTES (512 * 1024 * 1024)
+
+// Global statistics (see mp_image_pool_get_stats()).
+static atomic_int_least64_t pool_bytes;
+static atomic_int_least64_t pool_hits;
+static atomic_int_least64_t pool_misses;
+static atomic_int_least64_t pool_trimmed;
 
 // Thread-safety: the pool itself is not thread-safe, but pool-allocated images
 // can be referenced and unreferenced from other threads. (As long as the image
 // destructors are thread-safe.)
 
-struct mp_image_pool {
+// Images with the same format and size.
+struct pool_bucket {
+    int fmt, w, h;
     struct mp_image **images;
     int num_images;
+    unsigned int last_use;      // pool->lru_counter value
+};
 
-    int fmt, w, h;
+struct mp_image_pool {
+    struct pool_bucket *buckets;
+    int num_buckets;
 
     mp_image_allocator allocator;
     void *allocator_ctx;
@@ -59,13 +75,20 @@ struct mp_image_pool {
     unsigned int lru_counter;
 };
 
+enum {
+    IMG_REFERENCED  = 1 << 0,   // outside mp_image reference exists
+    IMG_POOL_ALIVE  = 1 << 1,   // the mp_image_pool references this
+};
+
 // Used to gracefully handle the case when the pool is freed while image
 // references allocated from the image pool are still held by someone.
 struct image_flags {
-    // If both of these are false, the image must be freed.
-    bool referenced;            // outside mp_image reference exists
-    bool pool_alive;            // the mp_image_pool references this
+    // IMG_* flags. If none is set, the image must be freed. Only the pool
+    // sets flags, but anyone can clear IMG_REFERENCED, so this is atomic
+    // instead of locked.
+    atomic_int state;
     unsigned int order;         // for LRU allocation (basically a timestamp)
+    int64_t size;               // for pool_bytes
 };
 
 static void image_pool_destructor(void *ptr)
@@ -83,21 +106,66 @@ struct mp_image_pool *mp_image_pool_new(void *tparent)
     return pool;
 }
 
+static void free_image(struct mp_image *img)
+{
+    struct image_flags *it = img->priv;
+    atomic_fetch_add(&pool_bytes, -it->size);
+    talloc_free(img);
+}
+
+// Drop the pool's reference to the image.
+static void release_image(struct mp_image *img)
+{
+    struct image_flags *it = img->priv;
+    int state = atomic_fetch_and(&it->state, ~IMG_POOL_ALIVE);
+    assert(state & IMG_POOL_ALIVE);
+    if (!(state & IMG_REFERENCED))
+        free_image(img);
+}
+
+static void remove_bucket(struct mp_image_pool *pool, int index)
+{
+    struct pool_bucket *b = &pool->buckets[index];
+    for (int n = 0; n < b->num_images; n++)
+        release_image(b->images[n]);
+    talloc_free(b->images);
+    MP_TARRAY_REMOVE_AT(pool->buckets, pool->num_buckets, index);
+}
+
 void mp_image_pool_clear(struct mp_image_pool *pool)
 {
-    for (int n = 0; n < pool->num_images; n++) {
-        struct mp_image *img = pool->images[n];
-        struct image_flags *it = img->priv;
-        bool referenced;
-        pool_lock();
-        assert(it->pool_alive);
-        it->pool_alive = false;
-        referenced = it->referenced;
-        pool_unlock();
-        if (!referenced)
-            talloc_free(img);
+    while (pool->num_buckets)
+        remove_bucket(pool, pool->num_buckets - 1);
+}
+
+// Free all images not in use (because the budget is exceeded).
+static void trim_pool(struct mp_image_pool *pool)
+{
+    for (int i = pool->num_buckets - 1; i >= 0; i--) {
+        struct pool_bucket *b = &pool->buckets[i];
+        for (int n = b->num_images - 1; n >= 0; n--) {
+            struct mp_image *img = b->images[n];
+            struct image_flags *it = img->priv;
+            if (atomic_load(&it->state) & IMG_REFERENCED)
+                continue;
+            MP_TARRAY_REMOVE_AT(b->images, b->num_images, n);
+            release_image(img);
+            atomic_fetch_add(&pool_trimmed, 1);
+        }
+        if (!b->num_images)
+            remove_bucket(pool, i);
     }
-    pool->num_images = 0;
+}
+
+static struct pool_bucket *find_bucket(struct mp_image_pool *pool, int fmt,
+                                       int w, int h)
+{
+    for (int n = 0; n < pool->num_buckets; n++) {
+        struct pool_bucket *b = &pool->buckets[n];
+        if (b->fmt == fmt && b->w == w && b->h == h)
+            return b;
+    }
+    return NULL;
 }
 
 // This is the only function that is allowed to run in a different thread.
@@ -106,41 +174,36 @@ static void unref_image(void *opaque, uint8_t *data)
 {
     struct mp_image *img = opaque;
     struct image_flags *it = img->priv;
-    bool alive;
-    pool_lock();
-    assert(it->referenced);
-    it->referenced = false;
-    alive = it->pool_alive;
-    pool_unlock();
-    if (!alive)
-        talloc_free(img);
+    int state = atomic_fetch_and(&it->state, ~IMG_REFERENCED);
+    assert(state & IMG_REFERENCED);
+    if (!(state & IMG_POOL_ALIVE))
+        free_image(img);
 }
 
-// Return a new image of given format/size. Unlike mp_image_pool_get(), this
-// returns NULL if there is no free image of this format/size.
-struct mp_image *mp_image_pool_get_no_alloc(struct mp_image_pool *pool, int fmt,
-                                            int w, int h)
+static struct mp_image *take_image(struct mp_image_pool *pool, int fmt,
+                                   int w, int h)
 {
+    struct pool_bucket *b = find_bucket(pool, fmt, w, h);
+    if (!b)
+        return NULL;
+
     struct mp_image *new = NULL;
-    pool_lock();
-    for (int n = 0; n < pool->num_images; n++) {
-        struct mp_image *img = pool->images[n];
+    for (int n = 0; n < b->num_images; n++) {
+        struct mp_image *img = b->images[n];
         struct image_flags *img_it = img->priv;
-        assert(img_it->pool_alive);
-        if (!img_it->referenced) {
-            if (img->imgfmt == fmt && img->w == w && img->h == h) {
-                if (pool->use_lru) {
-                    struct image_flags *new_it = new ? new->priv : NULL;
-                    if (!new_it || new_it->order > img_it->order)
-                        new = img;
-                } else {
+        int state = atomic_load(&img_it->state);
+        assert(state & IMG_POOL_ALIVE);
+        if (!(state & IMG_REFERENCED)) {
+            if (pool->use_lru) {
+                struct image_flags *new_it = new ? new->priv : NULL;
+                if (!new_it || new_it->order > img_it->order)
                     new = img;
-                    break;
-                }
+            } else {
+                new = img;
+                break;
             }
         }
     }
-    pool_unlock();
     if (!new)
         return NULL;
 
@@ -164,18 +227,54 @@ struct mp_image *mp_image_pool_get_no_alloc(struct mp_image_pool *pool, int fmt,
     }
 
     struct image_flags *it = new->priv;
-    assert(!it->referenced && it->pool_alive);
-    it->referenced = true;
+    atomic_fetch_or(&it->state, IMG_REFERENCED);
     it->order = ++pool->lru_counter;
+    b->last_use = it->order;
     return ref;
 }
 
+// Return a new image of given format/size. Unlike mp_image_pool_get(), this
+// returns NULL if there is no free image of this format/size.
+struct mp_image *mp_image_pool_get_no_alloc(struct mp_image_pool *pool, int fmt,
+                                            int w, int h)
+{
+    struct mp_image *new = take_image(pool, fmt, w, h);
+    if (new)
+        atomic_fetch_add(&pool_hits, 1);
+    return new;
+}
+
 void mp_image_pool_add(struct mp_image_pool *pool, struct mp_image *new)
 {
+    struct pool_bucket *b = find_bucket(pool, new->imgfmt, new->w, new->h);
+    if (!b) {
+        // Make room by dropping the least recently used size.
+        if (pool->num_buckets >= MAX_BUCKETS) {
+            int lru = 0;
+            for (int n = 1; n < pool->num_buckets; n++) {
+                if (pool->buckets[n].last_use < pool->buckets[lru].last_use)
+                    lru = n;
+            }
+            remove_bucket(pool, lru);
+        }
+        MP_TARRAY_APPEND(pool, pool->buckets, pool->num_buckets,
+            (struct pool_bucket){
+                .fmt = new->imgfmt,
+                .w = new->w,
+                .h = new->h,
+                .last_use = pool->lru_counter,
+            });
+        b = &pool->buckets[pool->num_buckets - 1];
+    }
+
     struct image_flags *it = talloc_ptrtype(new, it);
-    *it = (struct image_flags) { .pool_alive = true };
+    *it = (struct image_flags) {0};
+    atomic_init(&it->state, IMG_POOL_ALIVE);
+    for (int p = 0; p < MP_MAX_PLANES; p++)
+        it->size += new->bufs[p] ? new->bufs[p]->size : 0;
+    atomic_fetch_add(&pool_bytes, it->size);
     new->priv = it;
-    MP_TARRAY_APPEND(pool, pool->images, pool->num_images, new);
+    MP_TARRAY_APPEND(pool, b->images, b->num_images, new);
 }
 
 // Return a new image of given format/size. The only difference to
@@ -191,11 +290,9 @@ struct mp_image *mp_image_pool_get(struct mp_image_pool *pool, int fmt,
         return mp_image_alloc(fmt, w, h);
     struct mp_image *new = mp_image_pool_get_no_alloc(pool, fmt, w, h);
     if (!new) {
-        if (fmt != pool->fmt || w != pool->w || h != pool->h)
-            mp_image_pool_clear(pool);
-        pool->fmt = fmt;
-        pool->w = w;
-        pool->h = h;
+        atomic_fetch_add(&pool_misses, 1);
+        if (atomic_load(&pool_bytes) > POOL_BUDGET_BYTES)
+            trim_pool(pool);
         if (pool->allocator) {
             new = pool->allocator(pool->allocator_ctx, fmt, w, h);
         } else {
@@ -204,11 +301,21 @@ struct mp_image *mp_image_pool_get(struct mp_image_pool *pool, int fmt,
         if (!new)
             return NULL;
         mp_image_pool_add(pool, new);
-        new = mp_image_pool_get_no_alloc(pool, fmt, w, h);
+        new = take_image(pool, fmt, w, h);
     }
     return new;
 }
 
+void mp_image_pool_get_stats(struct mp_image_pool_stats *st)
+{
+    *st = (struct mp_image_pool_stats){
+        .bytes = atomic_load(&pool_bytes),
+        .hits = atomic_load(&pool_hits),
+        .misses = atomic_load(&pool_misses),
+        .trimmed = atomic_load(&pool_trimmed),
+    };
+}
+
 // Like mp_image_new_copy(), but allocate the image out of the pool.
 // If pool==NULL, a plain copy is made (for convenience).
 // Returns NULL on OOM.
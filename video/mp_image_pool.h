@@ -2,6 +2,7 @@
 #define MPV_MP_IMAGE_POOL_H
 
 #include <stdbool.h>
+#include <stdint.h>
 
 struct mp_image_pool;
 
@@ -26,6 +27,16 @@ struct mp_image *mp_image_pool_new_copy(struct mp_image_pool *pool,
 bool mp_image_pool_make_writeable(struct mp_image_pool *pool,
                                   struct mp_image *img);
 
+// Totals of all pools in the process.
+struct mp_image_pool_stats {
+    int64_t bytes;      // memory of all pool images (free or in use)
+    int64_t hits;       // number of images reused
+    int64_t misses;     // number of images allocated
+    int64_t trimmed;    // number of unused images freed to stay in budget
+};
+
+void mp_image_pool_get_stats(struct mp_image_pool_stats *st);
+
 struct mp_image *mp_image_hw_download(struct mp_image *img,
                                       struct mp_image_pool *swpool);
 